@@ -0,0 +1,256 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"time"
+	"unsafe"
+)
+
+// ErrQueueFull is returned by PostWrite and PostRead when the send queue already
+// holds as many outstanding requests as the connection's queue depth. Reap some
+// completions and retry.
+var ErrQueueFull = errors.New("rdmahandler: send queue is full")
+
+// WrIDReserved is the first work request identifier reserved for the library's
+// own requests (messaging, in-band completions, rings and channels). Their
+// completions are consumed internally, so a request posted with a wrID of
+// WrIDReserved or above would never be reported; the Post functions, PostBatch
+// and SubmissionQueue reject such identifiers with ErrReservedWrID.
+const WrIDReserved uint64 = C.WRID_MSG_RECV
+
+// ErrReservedWrID is returned for a work request identifier of WrIDReserved or above.
+var ErrReservedWrID = errors.New("rdmahandler: work request identifier is reserved")
+
+// checkWrID rejects identifiers that the completion routing would take for internal ones.
+func checkWrID(wrID uint64) error {
+	if wrID >= WrIDReserved {
+		return fmt.Errorf("wr_id 0x%x: %w", wrID, ErrReservedWrID)
+	}
+	return nil
+}
+
+// Completion describes one finished asynchronous work request.
+type Completion struct {
+	// WrID is the identifier the request was posted with, below WrIDReserved.
+	WrID uint64
+	// Status is the raw ibv_wc_status of the completion; 0 means success.
+	Status int
+	// Bytes is the number of bytes transferred, as reported by the HCA.
+	Bytes int
+}
+
+// Err returns nil for a successful completion and an error naming the
+// ibv_wc_status otherwise.
+func (c Completion) Err() error {
+	if c.Status == C.IBV_WC_SUCCESS {
+		return nil
+	}
+	return fmt.Errorf("wr_id %d completed with status %s (0x%x)",
+		c.WrID, C.GoString(C.ibv_wc_status_str(C.enum_ibv_wc_status(c.Status))), c.Status)
+}
+
+// PostWrite copies data into the local buffer at `offset` and posts an RDMA write of
+// that range to the same offset of the remote buffer, tagged with `wrID`. It does not
+// wait; the completion is returned later by Reap.
+//
+// Up to the connection's queue depth (see WithQueueDepth) requests may be in flight.
+// When the send queue is full, ErrQueueFull is returned and nothing is posted.
+// The range must not be reused until its completion has been reaped.
+//
+// Example:
+//
+//	for i := 0; i < n; i++ {
+//	    if err := h.PostWrite(res, chunks[i], i*chunkSize, uint64(i)); err != nil {
+//	        return err
+//	    }
+//	}
+//	done, err := h.Reap(res, n, time.Second)
+func (h *RDMAHandler) PostWrite(res *RDMAResources, data []byte, offset int, wrID uint64) error {
+	if err := checkWrID(wrID); err != nil {
+		return err
+	}
+	if err := res.checkRange(offset, len(data)); err != nil {
+		return err
+	}
+	if res.queueFull() {
+		return ErrQueueFull
+	}
+	copy(res.region()[offset:], data)
+	if C.post_send_async(&res.res, C.IBV_WR_RDMA_WRITE, C.uint64_t(wrID),
+		C.size_t(offset), C.size_t(offset), C.uint32_t(len(data))) != 0 {
+		return fmt.Errorf("failed to post RDMA write wr_id %d", wrID)
+	}
+	return nil
+}
+
+// PostWriteInline posts an inline RDMA write of `data` to `remoteOffset` of the remote
+// buffer, tagged with `wrID`. The payload is copied into the work request itself, so
+// `data` may be any Go memory, need not be registered, and can be reused as soon as
+// the call returns; the local buffer is not touched. len(data) must not exceed
+// MaxInline.
+//
+// When the send queue is full, ErrQueueFull is returned and nothing is posted.
+func (h *RDMAHandler) PostWriteInline(res *RDMAResources, data []byte, remoteOffset int, wrID uint64) error {
+	if err := checkWrID(wrID); err != nil {
+		return err
+	}
+	if len(data) == 0 || len(data) > res.MaxInline() {
+		return fmt.Errorf("%d bytes do not fit in the %d byte inline limit", len(data), res.MaxInline())
+	}
+	if remoteOffset < 0 || remoteOffset+len(data) > res.RemoteBufferSize() {
+		return fmt.Errorf("range [%d, +%d) is out of the %d byte remote buffer", remoteOffset, len(data), res.RemoteBufferSize())
+	}
+	if res.queueFull() {
+		return ErrQueueFull
+	}
+	if C.post_inline_async(&res.res, C.uint64_t(wrID), unsafe.Pointer(&data[0]), C.uint32_t(len(data)),
+		C.size_t(remoteOffset)) != 0 {
+		return fmt.Errorf("failed to post inline RDMA write wr_id %d", wrID)
+	}
+	return nil
+}
+
+// PostRead posts an RDMA read of `length` bytes from `offset` of the remote buffer into
+// the same offset of the local buffer, tagged with `wrID`. It does not wait; once Reap
+// has returned the completion, the data can be fetched with LocalBytes.
+//
+// When the send queue is full, ErrQueueFull is returned and nothing is posted.
+func (h *RDMAHandler) PostRead(res *RDMAResources, offset int, length int, wrID uint64) error {
+	if err := checkWrID(wrID); err != nil {
+		return err
+	}
+	if err := res.checkRange(offset, length); err != nil {
+		return err
+	}
+	if res.queueFull() {
+		return ErrQueueFull
+	}
+	if C.post_send_async(&res.res, C.IBV_WR_RDMA_READ, C.uint64_t(wrID),
+		C.size_t(offset), C.size_t(offset), C.uint32_t(length)) != 0 {
+		return fmt.Errorf("failed to post RDMA read wr_id %d", wrID)
+	}
+	return nil
+}
+
+// Reap collects up to `max` completions of requests posted with PostWrite or PostRead.
+//
+// It waits up to `timeout` for the first completion (a negative timeout waits
+// forever, zero only checks once) and then returns everything else that is already
+// queued without waiting further. An empty result with nil error means the timeout
+// expired. Failed work requests are reported through Completion.Err, not through
+// the returned error, which is reserved for failures of the CQ itself.
+func (h *RDMAHandler) Reap(res *RDMAResources, max int, timeout time.Duration) ([]Completion, error) {
+	if max <= 0 {
+		return nil, nil
+	}
+	out := make([]Completion, max)
+	n, err := h.ReapInto(res, out, timeout)
+	if err != nil {
+		return nil, err
+	}
+	return out[:n], nil
+}
+
+// ReapInto is the allocation-free form of Reap: it fills `out` with up to len(out)
+// completions and returns how many were stored. The C side drains the CQ in
+// batches of POLL_BATCH entries per ibv_poll_cq call, so one call can complete a
+// whole window of outstanding requests. With WithEventCompletion the wait parks the
+// goroutine once the spin budget is used up.
+//
+// Example:
+//
+//	done := make([]rdmahandler.Completion, res.QueueDepth())
+//	for res.Outstanding() > 0 {
+//	    n, err := h.ReapInto(res, done, time.Second)
+//	    if err != nil {
+//	        return err
+//	    }
+//	    for _, c := range done[:n] {
+//	        if err := c.Err(); err != nil {
+//	            return err
+//	        }
+//	    }
+//	}
+func (h *RDMAHandler) ReapInto(res *RDMAResources, out []Completion, timeout time.Duration) (int, error) {
+	if len(out) == 0 {
+		return 0, nil
+	}
+	if cap(res.scratch) < len(out) {
+		res.scratch = make([]C.struct_completion_t, len(out))
+	}
+	wcs := res.scratch[:len(out)]
+	var n C.int
+	_, err := res.await(timeout, func(timeoutUsec C.long) (bool, error) {
+		n = C.reap_completions(&res.res, &wcs[0], C.int(len(out)), timeoutUsec)
+		if n < 0 {
+			return false, fmt.Errorf("failed to reap completions")
+		}
+		return n > 0, nil
+	})
+	if err != nil {
+		return 0, err
+	}
+	for i := 0; i < int(n); i++ {
+		out[i] = Completion{
+			WrID:   uint64(wcs[i].wr_id),
+			Status: int(wcs[i].status),
+			Bytes:  int(wcs[i].byte_len),
+		}
+	}
+	return int(n), nil
+}
+
+// LocalBytes returns a copy of [offset, offset+length) of the local registered buffer,
+// e.g. the destination of a completed PostRead.
+func (r *RDMAResources) LocalBytes(offset, length int) ([]byte, error) {
+	if offset < 0 || length < 0 || offset+length > r.BufferSize() {
+		return nil, fmt.Errorf("range [%d, +%d) is out of the %d byte buffer", offset, length, r.BufferSize())
+	}
+	out := make([]byte, length)
+	copy(out, r.region()[offset:offset+length])
+	return out, nil
+}
+
+// Outstanding returns the number of send queue slots held by asynchronously posted
+// requests whose completions have not been reaped yet. An unsignaled request of a
+// PostBatch holds its slot until the signaled request after it is reaped.
+func (r *RDMAResources) Outstanding() int {
+	return int(r.res.sq_outstanding)
+}
+
+// MaxInline returns the largest payload the connection sends inline. Writes up to
+// this size use IBV_SEND_INLINE automatically; PostWriteInline accepts no more.
+func (r *RDMAResources) MaxInline() int {
+	return int(r.res.inline_size)
+}
+
+// QueueDepth returns the send queue depth the connection was created with.
+func (r *RDMAResources) QueueDepth() int {
+	return int(r.res.qp_depth)
+}
+
+// queueFull reports whether another asynchronous request would overflow the send queue.
+func (r *RDMAResources) queueFull() bool {
+	return r.res.sq_outstanding >= r.res.qp_depth
+}
+
+// checkIdle fails when asynchronous requests are still outstanding; the synchronous
+// operations poll the shared CQ and would otherwise swallow their completions.
+func (r *RDMAResources) checkIdle(character string) error {
+	if r.res.sq_outstanding != 0 {
+		return fmt.Errorf("%s: %d asynchronous requests are still outstanding", character, r.res.sq_outstanding)
+	}
+	// 条带化传输会轮询每个附属 QP 的 CQ
+	for i, lane := range r.lanes {
+		if lane.res.sq_outstanding != 0 {
+			return fmt.Errorf("%s: %d asynchronous requests are still outstanding on QP %d", character,
+				lane.res.sq_outstanding, i+1)
+		}
+	}
+	return nil
+}
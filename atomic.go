@@ -0,0 +1,67 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import "fmt"
+
+// FetchAdd atomically adds `add` to the 64-bit word at `remoteOffset` of the remote
+// buffer and returns the word's previous value. It is a single RDMA atomic verb:
+// there is no TCP sync and no read-modify-write window, so any number of peers can
+// update the same counter concurrently.
+//
+// `remoteOffset` must be 8-byte aligned. The peer's buffer must have been
+// registered on a device that supports atomics (see AtomicCapable on the peer's
+// side); otherwise the completion fails with a remote access error.
+//
+// Example:
+//
+//	ticket, err := h.FetchAdd(res, counterOffset, 1, "client")
+func (h *RDMAHandler) FetchAdd(res *RDMAResources, remoteOffset int, add uint64, character string) (uint64, error) {
+	return res.atomic(C.IBV_WR_ATOMIC_FETCH_AND_ADD, remoteOffset, add, 0, character)
+}
+
+// CompareSwap atomically replaces the 64-bit word at `remoteOffset` of the remote
+// buffer with `swap` if it equals `compare`, and returns the word's previous value.
+// The swap took place exactly when the returned value equals `compare`, which makes
+// it the building block for remote lock words.
+//
+// Example:
+//
+//	// take the lock at lockOffset
+//	for {
+//	    old, err := h.CompareSwap(res, lockOffset, 0, myID, "client")
+//	    if err != nil {
+//	        return err
+//	    }
+//	    if old == 0 {
+//	        break
+//	    }
+//	}
+func (h *RDMAHandler) CompareSwap(res *RDMAResources, remoteOffset int, compare, swap uint64, character string) (uint64, error) {
+	return res.atomic(C.IBV_WR_ATOMIC_CMP_AND_SWP, remoteOffset, compare, swap, character)
+}
+
+// atomic posts one atomic verb and returns the old value once its own
+// completion has arrived.
+func (r *RDMAResources) atomic(opcode C.int, remoteOffset int, compareAdd, swap uint64, character string) (uint64, error) {
+	if err := r.checkIdle(character); err != nil {
+		return 0, err
+	}
+	if remoteOffset < 0 || remoteOffset%8 != 0 || remoteOffset+8 > r.RemoteBufferSize() {
+		return 0, fmt.Errorf("%s: remote offset %d is not an aligned word of the %d byte remote buffer",
+			character, remoteOffset, r.RemoteBufferSize())
+	}
+	var old C.uint64_t
+	if C.atomic_fetch(&r.res, opcode, C.size_t(remoteOffset), C.uint64_t(compareAdd), C.uint64_t(swap), &old) != 0 {
+		return 0, fmt.Errorf("%s: atomic operation failed", character)
+	}
+	return uint64(old), nil
+}
+
+// AtomicCapable reports whether the connection's device supports RDMA atomics, i.e.
+// whether the local buffer accepts the peer's FetchAdd and CompareSwap.
+func (r *RDMAResources) AtomicCapable() bool {
+	return r.res.dev != nil && r.res.dev.device_attr.atomic_cap != C.IBV_ATOMIC_NONE
+}
@@ -0,0 +1,86 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import "fmt"
+
+// BatchOp is one work request of a doorbell batch posted with PostBatch. Both offsets
+// refer to the registered buffers; fill the local range through Slice or Buffer
+// before posting a write.
+type BatchOp struct {
+	// Read selects an RDMA read instead of an RDMA write.
+	Read bool
+	// LocalOffset and RemoteOffset locate the range in the local and remote buffer.
+	LocalOffset  int
+	RemoteOffset int
+	// Length is the number of bytes to transfer.
+	Length int
+	// WrID is reported by Reap if this request is one that is signaled. It must be
+	// below WrIDReserved.
+	WrID uint64
+}
+
+// PostBatch links all `ops` into one chain and rings the doorbell once, so thousands of
+// small writes cost one MMIO write instead of one each. Only every `signalEvery`th
+// request, and always the last one, asks for a completion; Reap therefore returns one
+// Completion per signaled request, and it stands for the unsignaled requests posted
+// before it. A non-positive signalEvery signals every request.
+//
+// The whole batch must fit in the free part of the send queue (see QueueDepth and
+// Outstanding); otherwise ErrQueueFull is returned and nothing is posted. If the
+// device rejects a request part way through, the requests before it stay posted and
+// count in Outstanding; unsignaled ones after their last signaled request hold their
+// slots until the next signaled request is reaped.
+//
+// Example:
+//
+//	ops := make([]rdmahandler.BatchOp, n)
+//	for i := range ops {
+//	    dst, err := res.Slice(i*64, 64)
+//	    if err != nil {
+//	        return err
+//	    }
+//	    copy(dst, records[i])
+//	    ops[i] = rdmahandler.BatchOp{LocalOffset: i * 64, RemoteOffset: i * 64, Length: 64, WrID: uint64(i)}
+//	}
+//	if err := h.PostBatch(res, ops, 32); err != nil {
+//	    return err
+//	}
+func (h *RDMAHandler) PostBatch(res *RDMAResources, ops []BatchOp, signalEvery int) error {
+	if len(ops) == 0 {
+		return nil
+	}
+	if res.Outstanding()+len(ops) > res.QueueDepth() {
+		return ErrQueueFull
+	}
+	if cap(res.batch) < len(ops) {
+		res.batch = make([]C.struct_batch_op_t, len(ops))
+	}
+	batch := res.batch[:len(ops)]
+	for i, op := range ops {
+		if err := checkWrID(op.WrID); err != nil {
+			return fmt.Errorf("batch request %d: %w", i, err)
+		}
+		if op.LocalOffset < 0 || op.Length < 0 || op.LocalOffset+op.Length > res.BufferSize() ||
+			op.RemoteOffset < 0 || op.RemoteOffset+op.Length > res.RemoteBufferSize() {
+			return fmt.Errorf("batch request %d [%d -> %d, +%d) is out of the %d/%d byte buffers",
+				i, op.LocalOffset, op.RemoteOffset, op.Length, res.BufferSize(), res.RemoteBufferSize())
+		}
+		batch[i] = C.struct_batch_op_t{
+			wr_id:         C.uint64_t(op.WrID),
+			local_offset:  C.uint64_t(op.LocalOffset),
+			remote_offset: C.uint64_t(op.RemoteOffset),
+			length:        C.uint32_t(op.Length),
+			opcode:        C.IBV_WR_RDMA_WRITE,
+		}
+		if op.Read {
+			batch[i].opcode = C.IBV_WR_RDMA_READ
+		}
+	}
+	if C.post_send_batch(&res.res, &batch[0], C.int(len(batch)), C.int(signalEvery), nil) != 0 {
+		return fmt.Errorf("failed to post a batch of %d requests", len(ops))
+	}
+	return nil
+}
@@ -0,0 +1,191 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+// ChannelConfig configures a Channel.
+type ChannelConfig struct {
+	// SendOffset and RecvOffset locate the two windows of Size bytes in both
+	// peers' buffers; the peer swaps them. Both must be 64-byte aligned.
+	SendOffset int
+	RecvOffset int
+	Size       int
+	// RendezvousThreshold is the message size from which the receiver RDMA READs
+	// the payload out of the sender's memory instead of it being copied through
+	// the windows. Zero uses XFER_DEFAULT_RENDEZVOUS; it is capped at half the
+	// window's data area less a 64-byte record header.
+	RendezvousThreshold int
+	// FixedModeration keeps the CQ's moderation as it is. By default an
+	// event-mode connection (WithEventCompletion) moderates the CQ while it
+	// completes many requests and turns moderation off again when it calms down.
+	FixedModeration bool
+}
+
+// ChannelStats counts a channel's messages by the path they took.
+type ChannelStats struct {
+	// Inline messages went as one inline SEND, Eager ones as a SEND staged in the
+	// window, Written ones as an RDMA WRITE into the peer's window plus a SEND of
+	// the header, Rendezvous ones were RDMA READ by the receiver.
+	SentInline, SentEager, SentWritten, SentRendezvous                 uint64
+	ReceivedInline, ReceivedEager, ReceivedWritten, ReceivedRendezvous uint64
+	// SignalEvery is the current interval between signaled requests.
+	SignalEvery int
+	// CQCount and CQPeriod are the CQ moderation currently applied, zero when
+	// the CQ is not moderated.
+	CQCount  int
+	CQPeriod time.Duration
+}
+
+// Channel exchanges messages of any size with the peer and picks the transport
+// by size: an inline SEND for tiny messages, a SEND staged in a registered
+// window for those that fit the peer's receive slots, an RDMA WRITE into the
+// peer's window followed by a SEND of the header for medium ones, and a
+// rendezvous for large ones, where the receiver RDMA READs the payload straight
+// from the sender's memory into its own. Messages arrive in the order they were
+// sent whatever their path. Both ends may send at the same time, also large
+// messages: a Send waiting for its rendezvous reads the peer's pending
+// rendezvous payloads into temporary buffers, which the next Recv returns.
+//
+// Only every so many requests are signaled: back-to-back sends widen the
+// interval, a send after a pause is signaled at once. The connection needs
+// messaging (WithMessaging or WithSharedReceiveQueue) on both sides. Like a
+// ring, a channel owns the connection's send queue and CQ while it is in use;
+// call Close before using the connection for anything else.
+type Channel struct {
+	res *RDMAResources
+	x   C.struct_rdma_xfer
+}
+
+// NewChannel creates this end of a channel. The peer must create its end with the
+// windows swapped before the first message is sent.
+//
+// Example:
+//
+//	// client
+//	ch, err := h.NewChannel(res, rdmahandler.ChannelConfig{SendOffset: 0, RecvOffset: 1 << 20, Size: 1 << 20})
+//	// server
+//	ch, err := h.NewChannel(res, rdmahandler.ChannelConfig{SendOffset: 1 << 20, RecvOffset: 0, Size: 1 << 20})
+func (h *RDMAHandler) NewChannel(res *RDMAResources, cfg ChannelConfig) (*Channel, error) {
+	if cfg.SendOffset < 0 || cfg.RecvOffset < 0 || cfg.Size <= 0 || cfg.RendezvousThreshold < 0 {
+		return nil, fmt.Errorf("invalid channel windows at %d and %d of %d bytes", cfg.SendOffset, cfg.RecvOffset, cfg.Size)
+	}
+	if err := res.checkIdle("channel"); err != nil {
+		return nil, err
+	}
+	adaptive := C.int(1)
+	if cfg.FixedModeration {
+		adaptive = 0
+	}
+	ch := &Channel{res: res}
+	if C.xfer_init(&ch.x, &res.res, C.size_t(cfg.SendOffset), C.size_t(cfg.RecvOffset), C.uint64_t(cfg.Size),
+		C.uint64_t(cfg.RendezvousThreshold), adaptive) != 0 {
+		return nil, fmt.Errorf("failed to set up channel windows at %d and %d", cfg.SendOffset, cfg.RecvOffset)
+	}
+	return ch, nil
+}
+
+// Send sends `data` as one message, waiting up to `timeout` for window space or,
+// for a rendezvous, for the peer to fetch the payload (a negative timeout waits
+// forever). ErrTimeout reports that the wait gave up; a rendezvous the peer has
+// not fetched by then fails on the peer's side. `data` may be reused as soon as
+// Send returns.
+func (c *Channel) Send(data []byte, timeout time.Duration) error {
+	var p unsafe.Pointer
+	if len(data) > 0 {
+		p = unsafe.Pointer(&data[0])
+	}
+	switch C.xfer_send(&c.x, &c.res.res, p, C.uint64_t(len(data)), timeoutMicros(timeout)) {
+	case 0:
+		return nil
+	case C.POLL_TIMED_OUT:
+		return ErrTimeout
+	default:
+		return fmt.Errorf("failed to send %d byte channel message", len(data))
+	}
+}
+
+// Recv returns the next message, waiting up to `timeout` for one (a negative
+// timeout waits forever). ErrTimeout reports that nothing arrived in time. With
+// WithEventCompletion the goroutine parks while the connection is idle.
+func (c *Channel) Recv(timeout time.Duration) ([]byte, error) {
+	var msg C.struct_xfer_hdr
+	var payload unsafe.Pointer
+	done, err := c.res.await(timeout, func(timeoutUsec C.long) (bool, error) {
+		switch C.xfer_recv(&c.x, &c.res.res, &msg, &payload, timeoutUsec) {
+		case 0:
+			return true, nil
+		case C.POLL_TIMED_OUT:
+			return false, nil
+		default:
+			return false, fmt.Errorf("receiving channel message failed")
+		}
+	})
+	if err != nil {
+		return nil, err
+	}
+	if !done {
+		return nil, ErrTimeout
+	}
+	out := make([]byte, int(msg.length))
+	if msg.kind == C.XFER_RTS {
+		if len(out) > 0 && C.xfer_fetch(&c.x, &c.res.res, unsafe.Pointer(&out[0])) != 0 {
+			C.xfer_consume(&c.x, &c.res.res)
+			return nil, fmt.Errorf("failed to fetch %d byte rendezvous message", len(out))
+		}
+	} else if len(out) > 0 {
+		copy(out, unsafe.Slice((*byte)(payload), len(out)))
+	}
+	if C.xfer_consume(&c.x, &c.res.res) != 0 {
+		return nil, fmt.Errorf("failed to release channel message")
+	}
+	return out, nil
+}
+
+// Stats returns the channel's path counters and its current signalling and CQ
+// moderation.
+func (c *Channel) Stats() ChannelStats {
+	return ChannelStats{
+		SentInline:         uint64(c.x.sent[C.XFER_INLINE]),
+		SentEager:          uint64(c.x.sent[C.XFER_EAGER]),
+		SentWritten:        uint64(c.x.sent[C.XFER_WRITTEN]),
+		SentRendezvous:     uint64(c.x.sent[C.XFER_RTS]),
+		ReceivedInline:     uint64(c.x.received[C.XFER_INLINE]),
+		ReceivedEager:      uint64(c.x.received[C.XFER_EAGER]),
+		ReceivedWritten:    uint64(c.x.received[C.XFER_WRITTEN]),
+		ReceivedRendezvous: uint64(c.x.received[C.XFER_RTS]),
+		SignalEvery:        int(c.x.signal_every),
+		CQCount:            int(c.x.cq_count),
+		CQPeriod:           time.Duration(c.x.cq_period) * time.Microsecond,
+	}
+}
+
+// Close waits until every request of the channel has completed. The connection
+// can be used for other operations afterwards.
+func (c *Channel) Close() error {
+	if C.xfer_drain(&c.x, &c.res.res, C.long(C.MAX_POLL_CQ_TIMEOUT*1000)) != 0 {
+		return fmt.Errorf("failed to drain channel requests")
+	}
+	return nil
+}
+
+// SetCQModeration makes the CQ raise a completion event only once `count`
+// completions have gathered or `period` has passed since the first one; zero for
+// both turns moderation off. It only affects event-mode waiters
+// (WithEventCompletion): the completions themselves are polled as before.
+func (r *RDMAResources) SetCQModeration(count int, period time.Duration) error {
+	if count < 0 || count > 0xffff || period < 0 || period > 0xffff*time.Microsecond {
+		return fmt.Errorf("invalid CQ moderation of %d completions / %v", count, period)
+	}
+	if rc := C.cq_moderate(&r.res, C.int(count), C.int(period/time.Microsecond)); rc != 0 {
+		return fmt.Errorf("failed to set CQ moderation: %w", syscall.Errno(rc))
+	}
+	return nil
+}
@@ -0,0 +1,133 @@
+package main
+
+import (
+	"fmt"
+	"os"
+	"strconv"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/breayhing/rdmahandler"
+)
+
+// The benchmarks run against an `rdmabench -server` started with its default
+// flags on the peer host, e.g.
+//
+//	server$ rdmabench -server
+//	client$ RDMABENCH_CONNECT=192.168.1.10 go test -bench . ./cmd/rdmabench
+//
+// RDMABENCH_PORT, RDMABENCH_DEVICE and RDMABENCH_GID correspond to -port,
+// -device and -gid. Without RDMABENCH_CONNECT every benchmark is skipped.
+
+var (
+	benchOnce sync.Once
+	benchRes  *rdmahandler.RDMAResources
+	benchErr  error
+	benchH    = &rdmahandler.RDMAHandler{}
+)
+
+// benchSizes are the message sizes of the write, read and send benchmarks.
+var benchSizes = []int{64, 4 << 10, 64 << 10, 1 << 20}
+
+// benchDepth is the number of writes or reads kept in flight.
+const benchDepth = 16
+
+// benchConn connects to the server once for all benchmarks, with the options
+// the server derives from its default flags.
+func benchConn(b *testing.B) *rdmahandler.RDMAResources {
+	addr := os.Getenv("RDMABENCH_CONNECT")
+	if addr == "" {
+		b.Skip("RDMABENCH_CONNECT is not set")
+	}
+	benchOnce.Do(func() {
+		port := 18515
+		if s := os.Getenv("RDMABENCH_PORT"); s != "" {
+			if port, benchErr = strconv.Atoi(s); benchErr != nil {
+				return
+			}
+		}
+		opts := []rdmahandler.Option{
+			rdmahandler.WithBufferSize(8 << 20),
+			rdmahandler.WithQueueDepth(128),
+			rdmahandler.WithMessaging(129, 64<<10),
+		}
+		if dev := os.Getenv("RDMABENCH_DEVICE"); dev != "" {
+			opts = append(opts, rdmahandler.WithDeviceName(dev))
+		}
+		if s := os.Getenv("RDMABENCH_GID"); s != "" {
+			gid, err := strconv.Atoi(s)
+			if err != nil {
+				benchErr = err
+				return
+			}
+			opts = append(opts, rdmahandler.WithGIDIndex(gid))
+		}
+		rdmahandler.SetLogLevel(rdmahandler.LogError)
+		benchRes, benchErr = benchH.InitClient(addr, port, opts...)
+	})
+	if benchErr != nil {
+		b.Fatalf("connecting to %s: %v", addr, benchErr)
+	}
+	return benchRes
+}
+
+// TestMain says goodbye to the server, which then exits, once all benchmarks ran.
+func TestMain(m *testing.M) {
+	code := m.Run()
+	if benchRes != nil {
+		benchH.Send(benchRes, nil, "client")
+		benchH.Destroy(benchRes)
+	}
+	os.Exit(code)
+}
+
+// benchTransfer reports the bandwidth of b.N writes or reads of `size` bytes with
+// benchDepth in flight, plus their p50 and p99 post-to-completion latency.
+func benchTransfer(b *testing.B, read bool) {
+	res := benchConn(b)
+	for _, size := range benchSizes {
+		if size > res.BufferSize() {
+			continue
+		}
+		b.Run(fmt.Sprintf("size=%d", size), func(b *testing.B) {
+			if _, err := window(benchH, res, read, size, benchDepth, 100); err != nil {
+				b.Fatal(err)
+			}
+			b.SetBytes(int64(size))
+			b.ResetTimer()
+			start := time.Now()
+			lat, err := window(benchH, res, read, size, benchDepth, b.N)
+			if err != nil {
+				b.Fatal(err)
+			}
+			r := summarize(lat, time.Since(start), size)
+			b.ReportMetric(float64(r.P50Ns), "p50-ns")
+			b.ReportMetric(float64(r.P99Ns), "p99-ns")
+		})
+	}
+}
+
+func BenchmarkWrite(b *testing.B) { benchTransfer(b, false) }
+
+func BenchmarkRead(b *testing.B) { benchTransfer(b, true) }
+
+// BenchmarkSend reports the one-way latency of Send/Recv ping-pongs echoed by the
+// server.
+func BenchmarkSend(b *testing.B) {
+	res := benchConn(b)
+	for _, size := range benchSizes {
+		if size > res.PeerMessageSize() {
+			continue
+		}
+		b.Run(fmt.Sprintf("size=%d", size), func(b *testing.B) {
+			b.SetBytes(int64(size))
+			r, err := pingPong(benchH, res, size, b.N, 100)
+			if err != nil {
+				b.Fatal(err)
+			}
+			b.ReportMetric(float64(r.P50Ns), "p50-ns")
+			b.ReportMetric(float64(r.P99Ns), "p99-ns")
+		})
+	}
+}
@@ -0,0 +1,431 @@
+// Command rdmabench measures the latency and bandwidth of the rdmahandler API in
+// the style of perftest: the same binary runs on both hosts with the same flags,
+// one side with -server.
+//
+//	server$ rdmabench -server
+//	client$ rdmabench -connect 192.168.1.10 -tests write,read,send -json
+//
+// RDMA writes and reads are posted through PostBatch and reaped with ReapInto,
+// keeping up to -depths requests in flight per QP; a multi-QP run (-qps) drives
+// one lane of a striped connection per goroutine. Send latency is a ping-pong of
+// Send and Recv against the server, which echoes every message. Every run
+// reports the p50/p99/p999 post-to-completion latency and the bandwidth, as a
+// table or, with -json, as one JSON object per line for regression tracking.
+package main
+
+import (
+	"encoding/json"
+	"flag"
+	"fmt"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/breayhing/rdmahandler"
+)
+
+// result is one line of the benchmark output.
+type result struct {
+	Test   string  `json:"test"`
+	Size   int     `json:"size"`
+	Depth  int     `json:"depth"`
+	QPs    int     `json:"qps"`
+	Iters  int     `json:"iters"`
+	AvgNs  int64   `json:"avg_ns"`
+	P50Ns  int64   `json:"p50_ns"`
+	P99Ns  int64   `json:"p99_ns"`
+	P999Ns int64   `json:"p999_ns"`
+	MBps   float64 `json:"mb_per_s"`
+	Mops   float64 `json:"mops"`
+}
+
+type benchConfig struct {
+	tests  []string
+	sizes  []int
+	depths []int
+	qps    []int
+	iters  int
+	volume int64
+	warmup int
+}
+
+func main() {
+	server := flag.Bool("server", false, "run the passive side and wait for a client")
+	connect := flag.String("connect", "", "address of the server to benchmark against")
+	port := flag.Int("port", 18515, "TCP port of the handshake")
+	tests := flag.String("tests", "write,read,send", "comma-separated tests: write, read, send")
+	sizes := flag.String("sizes", "8-8M", "message sizes: a min-max range of powers of two or a comma-separated list")
+	depths := flag.String("depths", "1,2,4,8,16,32,64,128", "comma-separated queue depths")
+	qps := flag.String("qps", "1", "comma-separated QP counts; counts above 1 stripe the connection")
+	iters := flag.Int("iters", 10000, "operations per run")
+	volume := flag.String("volume", "1G", "cap on the bytes moved per run; large sizes use fewer iterations")
+	warmup := flag.Int("warmup", 100, "untimed operations before each run")
+	msgSize := flag.Int("msg-size", 64<<10, "receive slot size; send runs above it are skipped")
+	device := flag.String("device", "", "RDMA device name")
+	gid := flag.Int("gid", -1, "GID index, -1 for none")
+	mtu := flag.Int("mtu", 0, "path MTU in bytes, 0 for the port's active MTU")
+	asJSON := flag.Bool("json", false, "print one JSON object per run")
+	logLevel := flag.Int("log", int(rdmahandler.LogError), "log level: 0 silent, 1 error, 2 info, 3 debug")
+	flag.Parse()
+
+	rdmahandler.SetLogLevel(rdmahandler.LogLevel(*logLevel))
+	cfg := benchConfig{tests: split(*tests), iters: *iters, warmup: *warmup}
+	var err error
+	if cfg.sizes, err = parseSizes(*sizes); err == nil {
+		if cfg.depths, err = parseInts(*depths); err == nil {
+			if cfg.qps, err = parseInts(*qps); err == nil {
+				cfg.volume, err = parseSize(*volume)
+			}
+		}
+	}
+	if err != nil {
+		fatalf("%v", err)
+	}
+	if !*server && *connect == "" {
+		fatalf("either -server or -connect is required")
+	}
+
+	// 两端使用相同的参数，缓冲区、队列深度和条带数在握手时取两端的较小值
+	opts := []rdmahandler.Option{
+		rdmahandler.WithBufferSize(maxOf(cfg.sizes)),
+		rdmahandler.WithQueueDepth(maxOf(cfg.depths)),
+		rdmahandler.WithStripes(maxOf(cfg.qps)),
+		rdmahandler.WithMessaging(maxOf(cfg.depths)+1, *msgSize),
+		rdmahandler.WithPathMTU(*mtu),
+	}
+	if *device != "" {
+		opts = append(opts, rdmahandler.WithDeviceName(*device))
+	}
+	if *gid >= 0 {
+		opts = append(opts, rdmahandler.WithGIDIndex(*gid))
+	}
+
+	h := &rdmahandler.RDMAHandler{}
+	if *server {
+		res, err := h.InitServer(*port, opts...)
+		if err != nil {
+			fatalf("%v", err)
+		}
+		defer h.Destroy(res)
+		if err := serve(h, res); err != nil {
+			fatalf("%v", err)
+		}
+		return
+	}
+	res, err := h.InitClient(*connect, *port, opts...)
+	if err != nil {
+		fatalf("%v", err)
+	}
+	defer h.Destroy(res)
+	if err := run(h, res, cfg, *asJSON); err != nil {
+		fatalf("%v", err)
+	}
+}
+
+// serve echoes the client's messages until it says goodbye with an empty message.
+// Writes and reads need nothing from the server.
+func serve(h *rdmahandler.RDMAHandler, res *rdmahandler.RDMAResources) error {
+	for {
+		msg, err := h.Recv(res, time.Second, "server")
+		if err == rdmahandler.ErrTimeout {
+			if !res.Healthy() {
+				return fmt.Errorf("client went away")
+			}
+			continue
+		}
+		if err != nil {
+			return err
+		}
+		if len(msg) == 0 {
+			return nil
+		}
+		if err := h.Send(res, msg, "server"); err != nil {
+			return err
+		}
+	}
+}
+
+// run goes through every combination of the configuration and prints the results.
+func run(h *rdmahandler.RDMAHandler, res *rdmahandler.RDMAResources, cfg benchConfig, asJSON bool) error {
+	if !asJSON {
+		fmt.Printf("%-6s %9s %6s %4s %8s %10s %10s %10s %10s %11s %8s\n",
+			"test", "size", "depth", "qps", "iters", "avg_us", "p50_us", "p99_us", "p999_us", "MB/s", "Mops")
+	}
+	emit := func(r result) {
+		if asJSON {
+			line, _ := json.Marshal(r)
+			fmt.Println(string(line))
+			return
+		}
+		us := func(ns int64) float64 { return float64(ns) / 1e3 }
+		fmt.Printf("%-6s %9d %6d %4d %8d %10.2f %10.2f %10.2f %10.2f %11.1f %8.3f\n",
+			r.Test, r.Size, r.Depth, r.QPs, r.Iters, us(r.AvgNs), us(r.P50Ns), us(r.P99Ns), us(r.P999Ns), r.MBps, r.Mops)
+	}
+	defer h.Send(res, nil, "client")
+
+	for _, test := range cfg.tests {
+		for _, size := range cfg.sizes {
+			iters := cfg.iters
+			if cfg.volume > 0 && int64(iters)*int64(size) > cfg.volume {
+				iters = int(cfg.volume / int64(size))
+				if iters < 16 {
+					iters = 16
+				}
+			}
+			if test == "send" {
+				// 收发是一问一答，只测深度 1；超过槽位大小的消息无法发送
+				if size > res.PeerMessageSize() {
+					continue
+				}
+				r, err := pingPong(h, res, size, iters, cfg.warmup)
+				if err != nil {
+					return err
+				}
+				emit(r)
+				continue
+			}
+			for _, qps := range cfg.qps {
+				if qps > res.Stripes() {
+					continue
+				}
+				for _, depth := range cfg.depths {
+					if depth > res.QueueDepth() {
+						continue
+					}
+					r, err := transfer(h, res, test == "read", size, depth, qps, iters, cfg.warmup)
+					if err != nil {
+						return err
+					}
+					r.Test = test
+					emit(r)
+				}
+			}
+		}
+	}
+	return nil
+}
+
+// transfer runs `iters` RDMA writes or reads of `size` bytes on each of `qps` QPs,
+// keeping `depth` of them in flight per QP.
+func transfer(h *rdmahandler.RDMAHandler, res *rdmahandler.RDMAResources, read bool, size, depth, qps, iters, warmup int) (result, error) {
+	lat := make([][]int64, qps)
+	errs := make([]error, qps)
+	var wg sync.WaitGroup
+	var ready, begin sync.WaitGroup
+	ready.Add(qps)
+	begin.Add(1)
+	var start time.Time
+	for q := 0; q < qps; q++ {
+		wg.Add(1)
+		go func(q int) {
+			defer wg.Done()
+			lane := res.Lane(q)
+			if _, errs[q] = window(h, lane, read, size, depth, warmup); errs[q] != nil {
+				ready.Done()
+				return
+			}
+			// 所有 QP 预热完毕后同时开始计时
+			ready.Done()
+			begin.Wait()
+			lat[q], errs[q] = window(h, lane, read, size, depth, iters)
+		}(q)
+	}
+	ready.Wait()
+	start = time.Now()
+	begin.Done()
+	wg.Wait()
+	elapsed := time.Since(start)
+	var all []int64
+	for q := 0; q < qps; q++ {
+		if errs[q] != nil {
+			return result{}, fmt.Errorf("QP %d: %w", q, errs[q])
+		}
+		all = append(all, lat[q]...)
+	}
+	r := summarize(all, elapsed, size)
+	r.Depth, r.QPs, r.Iters = depth, qps, iters
+	return r, nil
+}
+
+// window posts `iters` requests on one QP with at most `depth` outstanding and
+// returns the post-to-completion latency of each.
+func window(h *rdmahandler.RDMAHandler, res *rdmahandler.RDMAResources, read bool, size, depth, iters int) ([]int64, error) {
+	posted := make([]int64, iters)
+	lat := make([]int64, 0, iters)
+	done := make([]rdmahandler.Completion, depth)
+	op := []rdmahandler.BatchOp{{Read: read, Length: size}}
+	epoch := time.Now()
+	next, inflight := 0, 0
+	for next < iters || inflight > 0 {
+		for next < iters && inflight < depth {
+			op[0].WrID = uint64(next)
+			posted[next] = int64(time.Since(epoch))
+			if err := h.PostBatch(res, op, 1); err != nil {
+				return nil, err
+			}
+			next++
+			inflight++
+		}
+		n, err := h.ReapInto(res, done, time.Second)
+		if err != nil {
+			return nil, err
+		}
+		if n == 0 {
+			return nil, fmt.Errorf("no completion within a second, %d requests outstanding", inflight)
+		}
+		now := int64(time.Since(epoch))
+		for _, c := range done[:n] {
+			if err := c.Err(); err != nil {
+				return nil, err
+			}
+			lat = append(lat, now-posted[c.WrID])
+		}
+		inflight -= n
+	}
+	return lat, nil
+}
+
+// pingPong measures the round trip of a `size` byte message echoed by the server
+// and reports half of it as the one-way latency, like perftest.
+func pingPong(h *rdmahandler.RDMAHandler, res *rdmahandler.RDMAResources, size, iters, warmup int) (result, error) {
+	msg := make([]byte, size)
+	lat := make([]int64, 0, iters)
+	var start time.Time
+	for i := -warmup; i < iters; i++ {
+		if i == 0 {
+			start = time.Now()
+		}
+		t := time.Now()
+		if err := h.Send(res, msg, "client"); err != nil {
+			return result{}, err
+		}
+		if _, err := h.Recv(res, time.Second, "client"); err != nil {
+			return result{}, err
+		}
+		if i >= 0 {
+			lat = append(lat, int64(time.Since(t))/2)
+		}
+	}
+	r := summarize(lat, time.Since(start), size)
+	r.Test, r.Size, r.Depth, r.QPs, r.Iters = "send", size, 1, 1, iters
+	return r, nil
+}
+
+// summarize computes the percentiles of `lat` and the throughput of moving
+// `bytesPerOp` for each of them in `elapsed`.
+func summarize(lat []int64, elapsed time.Duration, bytesPerOp int) result {
+	r := result{Size: bytesPerOp}
+	if len(lat) == 0 {
+		return r
+	}
+	sort.Slice(lat, func(i, j int) bool { return lat[i] < lat[j] })
+	var sum int64
+	for _, v := range lat {
+		sum += v
+	}
+	pct := func(p float64) int64 { return lat[int(p*float64(len(lat)-1))] }
+	r.AvgNs = sum / int64(len(lat))
+	r.P50Ns, r.P99Ns, r.P999Ns = pct(0.50), pct(0.99), pct(0.999)
+	secs := elapsed.Seconds()
+	r.MBps = float64(bytesPerOp) * float64(len(lat)) / secs / 1e6
+	r.Mops = float64(len(lat)) / secs / 1e6
+	return r
+}
+
+func split(s string) []string {
+	var out []string
+	for _, f := range strings.Split(s, ",") {
+		if f = strings.TrimSpace(f); f != "" {
+			out = append(out, f)
+		}
+	}
+	return out
+}
+
+func parseInts(s string) ([]int, error) {
+	var out []int
+	for _, f := range split(s) {
+		v, err := strconv.Atoi(f)
+		if err != nil || v <= 0 {
+			return nil, fmt.Errorf("invalid count %q", f)
+		}
+		out = append(out, v)
+	}
+	if len(out) == 0 {
+		return nil, fmt.Errorf("empty list %q", s)
+	}
+	return out, nil
+}
+
+// parseSize parses a byte count with an optional K, M or G suffix.
+func parseSize(s string) (int64, error) {
+	mult := int64(1)
+	switch {
+	case strings.HasSuffix(s, "K"):
+		mult = 1 << 10
+	case strings.HasSuffix(s, "M"):
+		mult = 1 << 20
+	case strings.HasSuffix(s, "G"):
+		mult = 1 << 30
+	}
+	if mult > 1 {
+		s = s[:len(s)-1]
+	}
+	v, err := strconv.ParseInt(s, 10, 64)
+	if err != nil || v < 0 {
+		return 0, fmt.Errorf("invalid size %q", s)
+	}
+	return v * mult, nil
+}
+
+// parseSizes parses "min-max" as every power of two in the range, or a list.
+func parseSizes(s string) ([]int, error) {
+	if lo, hi, ok := strings.Cut(s, "-"); ok {
+		min, err := parseSize(lo)
+		if err != nil {
+			return nil, err
+		}
+		max, err := parseSize(hi)
+		if err != nil {
+			return nil, err
+		}
+		if min <= 0 || max < min {
+			return nil, fmt.Errorf("invalid size range %q", s)
+		}
+		var out []int
+		for v := min; v <= max; v *= 2 {
+			out = append(out, int(v))
+		}
+		return out, nil
+	}
+	var out []int
+	for _, f := range split(s) {
+		v, err := parseSize(f)
+		if err != nil || v <= 0 {
+			return nil, fmt.Errorf("invalid size %q", f)
+		}
+		out = append(out, int(v))
+	}
+	if len(out) == 0 {
+		return nil, fmt.Errorf("empty size list %q", s)
+	}
+	return out, nil
+}
+
+func maxOf(v []int) int {
+	m := v[0]
+	for _, x := range v[1:] {
+		if x > m {
+			m = x
+		}
+	}
+	return m
+}
+
+func fatalf(format string, args ...interface{}) {
+	fmt.Fprintf(os.Stderr, "rdmabench: "+format+"\n", args...)
+	os.Exit(1)
+}
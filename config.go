@@ -0,0 +1,110 @@
+package rdmahandler
+
+/*
+#include <stdlib.h>
+#include "rdma_operations.h"
+*/
+import "C"
+import "unsafe"
+
+// WithDeviceName selects the RDMA device by name (e.g. "mlx5_0") instead of the
+// first one found. An empty name keeps the default.
+func WithDeviceName(name string) Option {
+	return func(o *connOptions) {
+		o.devName = name
+	}
+}
+
+// WithIBPort selects the port of the device the connection uses. A non-positive
+// port keeps the default (1).
+func WithIBPort(port int) Option {
+	return func(o *connOptions) {
+		if port > 0 {
+			o.ibPort = port
+		}
+	}
+}
+
+// WithGIDIndex selects the GID table index used for global routing, which RoCE
+// requires. A negative index disables GRH and addresses the peer by LID only, as
+// on an InfiniBand subnet. Without the option the default (-1) applies.
+func WithGIDIndex(index int) Option {
+	return func(o *connOptions) {
+		o.gidIdx = &index
+	}
+}
+
+// WithPathMTU caps the path MTU of the connection at `bytes`, which must be one of
+// 256, 512, 1024, 2048 or 4096. By default both peers announce the active MTU of
+// their port during the handshake and the smaller one is used; the cap only ever
+// lowers that value. Other sizes are ignored.
+func WithPathMTU(bytes int) Option {
+	return func(o *connOptions) {
+		if mtu := mtuEnum(bytes); mtu != 0 {
+			o.mtu = mtu
+		}
+	}
+}
+
+// mtuEnum maps an MTU in bytes to its enum ibv_mtu value, 0 if there is none.
+func mtuEnum(bytes int) int {
+	switch bytes {
+	case 256:
+		return C.IBV_MTU_256
+	case 512:
+		return C.IBV_MTU_512
+	case 1024:
+		return C.IBV_MTU_1024
+	case 2048:
+		return C.IBV_MTU_2048
+	case 4096:
+		return C.IBV_MTU_4096
+	}
+	return 0
+}
+
+// connConfig is the per-connection C configuration and the C strings it points to.
+type connConfig struct {
+	cfg     C.struct_config_t
+	strings []*C.char
+}
+
+// newConnConfig starts from the process-wide C defaults and applies the options.
+// Nothing writes to the global C config, so connections can be set up from many
+// goroutines at once. An empty `ip` configures the server side.
+func newConnConfig(o *connOptions, ip string, port int) *connConfig {
+	c := &connConfig{cfg: C.config}
+	if ip != "" {
+		c.cfg.server_name = c.cString(ip)
+	} else {
+		c.cfg.server_name = nil
+	}
+	if port > 0 {
+		c.cfg.tcp_port = C.uint32_t(port)
+	}
+	if o.devName != "" {
+		c.cfg.dev_name = c.cString(o.devName)
+	}
+	if o.ibPort > 0 {
+		c.cfg.ib_port = C.int(o.ibPort)
+	}
+	if o.gidIdx != nil {
+		c.cfg.gid_idx = C.int(*o.gidIdx)
+	}
+	return c
+}
+
+// cString allocates a C string that lives until free.
+func (c *connConfig) cString(s string) *C.char {
+	p := C.CString(s)
+	c.strings = append(c.strings, p)
+	return p
+}
+
+// free releases the C strings. The configuration must not be used afterwards.
+func (c *connConfig) free() {
+	for _, p := range c.strings {
+		C.free(unsafe.Pointer(p))
+	}
+	c.strings = nil
+}
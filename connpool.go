@@ -0,0 +1,252 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"net"
+	"strconv"
+	"sync"
+	"time"
+)
+
+// Reconnect brings a broken connection back, e.g. after a failed poll_completion
+// with IBV_WC_RETRY_EXC_ERR left its QP in the error state. Only the QPs are
+// reset and walked through INIT, RTR and RTS again; the device, PD, CQ and the
+// registered buffer are kept, so recovery costs one handshake instead of a full
+// Destroy and InitClient.
+//
+// The peer must call Reconnect on its end of the connection at the same time. The
+// TCP connection is reused while it is alive, otherwise a client dials again and
+// an InitServer peer accepts again on its port. A peer returned by Server.Accept
+// can only be reconnected over its existing TCP connection. WithHandshakeTimeout
+// bounds the handshake.
+//
+// Asynchronous requests that were outstanding are dropped together with their
+// completions, and messages not yet returned by Recv are lost.
+func (h *RDMAHandler) Reconnect(res *RDMAResources) error {
+	return res.reconnect(false)
+}
+
+// Redial reconnects a client like Reconnect, but always drops its TCP connection
+// and dials the server again. A multi-client Server takes the new TCP connection
+// for a new client and returns the peer from Accept, so the server's application
+// need not take part; the peer it had before sees its connection fail (Healthy
+// reports false) and should destroy it. An InitServer peer has to call Reconnect
+// at the same time.
+func (h *RDMAHandler) Redial(res *RDMAResources) error {
+	return res.reconnect(true)
+}
+
+// reconnect runs resources_reconnect and connects the lanes again, both within the
+// connection's handshake timeout.
+func (r *RDMAResources) reconnect(redial bool) error {
+	// 附属 QP 借用本连接的套接字，按新的协商结果重新建立
+	laneErr := r.destroyLanes()
+	dial := C.int(0)
+	if redial {
+		dial = 1
+	}
+	if C.resources_reconnect(&r.res, dial, C.long(r.handshakeTimeout/time.Microsecond)) != 0 {
+		return fmt.Errorf("failed to reconnect QPs")
+	}
+	if err := r.connectLanes(); err != nil {
+		r.destroyLanes()
+		return err
+	}
+	if err := r.liftHandshakeTimeout(); err != nil {
+		return err
+	}
+	return laneErr
+}
+
+// Healthy reports whether every QP of the connection is ready to send and the
+// TCP connection to the peer is still up. TCP keepalive probes an idle
+// connection after 10 seconds, so a peer that vanished silently is noticed
+// within about 25 seconds (KEEPALIVE_IDLE_SEC, KEEPALIVE_INTERVAL_SEC and
+// KEEPALIVE_COUNT); until then Healthy may still report true.
+func (r *RDMAResources) Healthy() bool {
+	if C.qp_state(&r.res) != C.IBV_QPS_RTS {
+		return false
+	}
+	for _, lane := range r.lanes {
+		if C.qp_state(&lane.res) != C.IBV_QPS_RTS {
+			return false
+		}
+	}
+	return C.sock_alive(r.res.sock) != 0
+}
+
+// poolHandshakeTimeout bounds the handshakes of a ConnPool without WithHandshakeTimeout.
+const poolHandshakeTimeout = 10 * time.Second
+
+// ConnPool keeps idle client connections keyed by (host, port) for reuse. All
+// connections share one device and PD: the Device or MemoryPool passed through
+// the options, or a device the pool opens for itself.
+//
+// A connection is checked when it is taken out of the pool rather than by a
+// background prober. A connection whose QP failed is reset and redialed with
+// Redial, keeping its buffer; only when that fails is it destroyed and dialed
+// from scratch. A multi-client Server serves the redial like any new client;
+// an InitServer peer must handle it as described for Redial. Unless the options
+// say otherwise, every handshake of the pool is bounded by poolHandshakeTimeout.
+type ConnPool struct {
+	h    RDMAHandler
+	opts []Option
+	// dev is the device the pool opened itself because no option provided one.
+	dev *Device
+
+	mu     sync.Mutex
+	idle   map[string][]*RDMAResources
+	leased map[*RDMAResources]string
+	closed bool
+}
+
+// NewConnPool creates an empty pool; `opts` configure every connection it dials
+// as in InitClient.
+//
+// Example:
+//
+//	pool, err := rdmahandler.NewConnPool(rdmahandler.WithBufferSize(1 << 20))
+//	if err != nil {
+//	    return err
+//	}
+//	defer pool.Close()
+//	res, err := pool.Get("10.0.0.2", 8080)
+//	if err != nil {
+//	    return err
+//	}
+//	err = h.WriteAt(res, data, 0, "client")
+//	if err != nil {
+//	    pool.Discard(res)
+//	    return err
+//	}
+//	pool.Put(res)
+func NewConnPool(opts ...Option) (*ConnPool, error) {
+	o := defaultConnOptions()
+	for _, opt := range opts {
+		opt(&o)
+	}
+	p := &ConnPool{
+		idle:   make(map[string][]*RDMAResources),
+		leased: make(map[*RDMAResources]string),
+	}
+	// 未指定设备时连接池打开一个设备，所有连接共享它和它的 PD
+	if o.device == nil && o.pool == nil && o.srq == nil {
+		dev, err := OpenDevice(opts...)
+		if err != nil {
+			return nil, err
+		}
+		p.dev = dev
+		opts = append(append([]Option(nil), opts...), WithDevice(dev))
+	}
+	// 连接池的握手不能无限期地阻塞 Get
+	if o.handshakeTimeout == 0 {
+		opts = append(append([]Option(nil), opts...), WithHandshakeTimeout(poolHandshakeTimeout))
+	}
+	p.opts = opts
+	return p, nil
+}
+
+// Get returns a connection to `host:port` for exclusive use until it is handed
+// back with Put or Discard. An idle connection is reused, after it has been
+// reconnected if its QP broke while it was idle or in its previous use; without
+// one a new connection is dialed.
+func (p *ConnPool) Get(host string, port int) (*RDMAResources, error) {
+	key := net.JoinHostPort(host, strconv.Itoa(port))
+	p.mu.Lock()
+	if p.closed {
+		p.mu.Unlock()
+		return nil, fmt.Errorf("connection pool is closed")
+	}
+	var res *RDMAResources
+	if conns := p.idle[key]; len(conns) > 0 {
+		res = conns[len(conns)-1]
+		p.idle[key] = conns[:len(conns)-1]
+	}
+	p.mu.Unlock()
+
+	if res != nil && !res.Healthy() {
+		logf(LogInfo, "ConnPool", "connection to %s is broken, reconnecting", key)
+		if err := p.h.Redial(res); err != nil {
+			logf(LogError, "ConnPool", "reconnect to %s failed: %v", key, err)
+			p.h.Destroy(res)
+			res = nil
+		}
+	}
+	if res == nil {
+		var err error
+		if res, err = p.h.InitClient(host, port, p.opts...); err != nil {
+			return nil, err
+		}
+	}
+	p.mu.Lock()
+	p.leased[res] = key
+	p.mu.Unlock()
+	return res, nil
+}
+
+// Put hands a connection obtained from Get back to the pool. A connection whose
+// last operation failed may be put back as well; it is reconnected by the next
+// Get for its address.
+func (p *ConnPool) Put(res *RDMAResources) error {
+	p.mu.Lock()
+	key, ok := p.leased[res]
+	if !ok {
+		p.mu.Unlock()
+		return fmt.Errorf("connection does not belong to the pool")
+	}
+	delete(p.leased, res)
+	if !p.closed {
+		p.idle[key] = append(p.idle[key], res)
+		p.mu.Unlock()
+		return nil
+	}
+	p.mu.Unlock()
+	return p.h.Destroy(res)
+}
+
+// Discard destroys a connection obtained from Get instead of returning it to the
+// pool.
+func (p *ConnPool) Discard(res *RDMAResources) error {
+	p.mu.Lock()
+	_, ok := p.leased[res]
+	delete(p.leased, res)
+	p.mu.Unlock()
+	if !ok {
+		return fmt.Errorf("connection does not belong to the pool")
+	}
+	return p.h.Destroy(res)
+}
+
+// Close destroys the idle connections. Connections still out are destroyed when
+// they are put back. The pool's own device reference is dropped; the device lives
+// on until its last connection is destroyed.
+func (p *ConnPool) Close() error {
+	p.mu.Lock()
+	if p.closed {
+		p.mu.Unlock()
+		return nil
+	}
+	p.closed = true
+	idle := p.idle
+	p.idle = nil
+	p.mu.Unlock()
+
+	var err error
+	for _, conns := range idle {
+		for _, res := range conns {
+			if derr := p.h.Destroy(res); derr != nil && err == nil {
+				err = derr
+			}
+		}
+	}
+	if p.dev != nil {
+		if derr := p.dev.Close(); derr != nil && err == nil {
+			err = derr
+		}
+	}
+	return err
+}
@@ -0,0 +1,71 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import "fmt"
+
+// Device is an opened RDMA device together with its protection domain. Opening a
+// device, querying it and allocating a PD are done once per Device; every
+// connection created with WithDevice, and every MemoryPool created on it, shares
+// them. Memory registered in the PD can therefore be used on all those
+// connections, and hundreds of peers cost one context instead of hundreds.
+//
+// Connections created without WithDevice or WithPool still open a private device
+// of their own. A Device is safe for concurrent use.
+type Device struct {
+	dev *C.struct_rdma_device
+}
+
+// OpenDevice opens the RDMA device and allocates its PD. Of the options only
+// WithDeviceName and WithIBPort apply; without them the defaults are used.
+//
+// Example:
+//
+//	dev, err := rdmahandler.OpenDevice()
+//	if err != nil {
+//	    return err
+//	}
+//	defer dev.Close()
+//	for _, peer := range peers {
+//	    res, err := h.InitClient(peer, 8080, rdmahandler.WithDevice(dev))
+//	    ...
+//	}
+func OpenDevice(opts ...Option) (*Device, error) {
+	o := defaultConnOptions()
+	for _, opt := range opts {
+		opt(&o)
+	}
+	cfg := newConnConfig(&o, "", 0)
+	defer cfg.free()
+	dev := C.rdma_device_open(&cfg.cfg)
+	if dev == nil {
+		return nil, fmt.Errorf("failed to open RDMA device")
+	}
+	return &Device{dev: dev}, nil
+}
+
+// Close drops the caller's reference on the device. Connections and pools created
+// on it keep their own references, so the context and PD are released only once
+// the last of them has been destroyed.
+func (d *Device) Close() error {
+	if d.dev == nil {
+		return nil
+	}
+	dev := d.dev
+	d.dev = nil
+	if C.rdma_device_put(dev) != 0 {
+		return fmt.Errorf("failed to close RDMA device")
+	}
+	return nil
+}
+
+// WithDevice creates the connection's QP and CQ on a shared Device instead of
+// opening the device again. When combined with WithPool, the pool must have been
+// created on the same device.
+func WithDevice(d *Device) Option {
+	return func(o *connOptions) {
+		o.device = d
+	}
+}
@@ -0,0 +1,147 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"os"
+	"syscall"
+	"time"
+)
+
+// WithEventCompletion creates the connection's CQ with a completion channel so that
+// waiting goroutines park in Go's netpoller instead of burning a core.
+//
+// A waiter first busy-polls the CQ for up to `spin`; only when nothing completed in
+// that window does it arm the CQ and sleep on the channel fd. A spin of a few
+// microseconds keeps the latency of a busy connection close to pure polling, while an
+// idle connection costs no CPU. A zero spin always sleeps immediately.
+//
+// The option affects Reap/ReapInto and the waits of the in-band mode
+// (WithInbandCompletion); the synchronous Write/Read only wait for their own
+// completion and keep busy-polling.
+func WithEventCompletion(spin time.Duration) Option {
+	return func(o *connOptions) {
+		o.eventMode = true
+		if spin > 0 {
+			o.spin = spin
+		}
+	}
+}
+
+// openEventFile wraps the completion channel fd in an *os.File registered with the
+// netpoller. The fd is duplicated so that closing the file does not close the
+// channel, which ibv_destroy_comp_channel owns.
+func (r *RDMAResources) openEventFile() error {
+	fd := int(C.cq_event_fd(&r.res))
+	if fd < 0 {
+		return nil
+	}
+	dup, err := syscall.Dup(fd)
+	if err != nil {
+		return fmt.Errorf("failed to dup completion channel fd: %w", err)
+	}
+	if err := syscall.SetNonblock(dup, true); err != nil {
+		syscall.Close(dup)
+		return fmt.Errorf("failed to make completion channel fd non-blocking: %w", err)
+	}
+	r.cqFile = os.NewFile(uintptr(dup), "rdma-cq")
+	return nil
+}
+
+// closeEventFile releases the duplicated channel fd, if any.
+func (r *RDMAResources) closeEventFile() {
+	if r.cqFile != nil {
+		r.cqFile.Close()
+		r.cqFile = nil
+	}
+}
+
+// await drives a C-side wait function according to the connection's completion mode.
+//
+// `try` must poll for the awaited condition for at most the given number of
+// microseconds (negative meaning forever) and report whether it was met.
+// In busy-poll mode `try` simply gets the whole timeout. In event mode it gets the
+// spin budget, and in between the CQ is armed and the goroutine parks on the
+// channel fd until the next completion event or the deadline.
+//
+// It returns false with a nil error when the timeout expired.
+func (r *RDMAResources) await(timeout time.Duration, try func(timeoutUsec C.long) (bool, error)) (bool, error) {
+	if r.cqFile == nil {
+		return try(timeoutMicros(timeout))
+	}
+	var deadline time.Time
+	if timeout >= 0 {
+		deadline = time.Now().Add(timeout)
+	}
+	for {
+		spin := r.spin
+		if timeout >= 0 {
+			if remaining := time.Until(deadline); remaining < spin {
+				spin = remaining
+			}
+			if spin < 0 {
+				spin = 0
+			}
+		}
+		if done, err := try(timeoutMicros(spin)); done || err != nil {
+			return done, err
+		}
+		if C.cq_arm(&r.res) != 0 {
+			return false, fmt.Errorf("failed to arm CQ notification")
+		}
+		// a completion may have arrived between the last poll and the arm
+		if done, err := try(0); done || err != nil {
+			return done, err
+		}
+		if timeout >= 0 && !time.Now().Before(deadline) {
+			return false, nil
+		}
+		if err := r.waitEvent(deadline); err != nil {
+			if errors.Is(err, os.ErrDeadlineExceeded) {
+				return false, nil
+			}
+			return false, err
+		}
+	}
+}
+
+// waitEvent parks the goroutine until the completion channel delivers an event,
+// then consumes and acknowledges it. A zero deadline waits forever.
+func (r *RDMAResources) waitEvent(deadline time.Time) error {
+	if err := r.cqFile.SetReadDeadline(deadline); err != nil {
+		return err
+	}
+	conn, err := r.cqFile.SyscallConn()
+	if err != nil {
+		return err
+	}
+	var eventErr error
+	err = conn.Read(func(uintptr) bool {
+		switch C.cq_consume_event(&r.res) {
+		case 0:
+			return true
+		case C.POLL_TIMED_OUT:
+			return false
+		default:
+			eventErr = fmt.Errorf("failed to get CQ event")
+			return true
+		}
+	})
+	if err != nil {
+		return err
+	}
+	return eventErr
+}
+
+// timeoutMicros converts a Go timeout to the microsecond convention of the C side,
+// where a negative value waits forever.
+func timeoutMicros(timeout time.Duration) C.long {
+	if timeout < 0 {
+		return -1
+	}
+	return C.long(timeout / time.Microsecond)
+}
@@ -0,0 +1,84 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"unsafe"
+)
+
+// SendFile transfers the file at `path` to the peer, which must call ReceiveFile
+// at the same time, and returns its size. The file is mapped and registered as a
+// whole and RDMA WRITTEN straight into the peer's mapped destination in
+// FILE_CHUNK_SIZE requests, as many in flight as the send queue holds, so its
+// contents never pass through Go memory or the connection's buffer.
+//
+// When the device supports on-demand paging (ODPCapable) the mapping is
+// registered with IBV_ACCESS_ON_DEMAND and registration costs the same for any
+// file size; otherwise the mapping is pinned for the duration of the transfer.
+//
+// Example:
+//
+//	n, err := h.SendFile(res, "/data/snapshot.bin", "client")
+func (h *RDMAHandler) SendFile(res *RDMAResources, path string, character string) (int64, error) {
+	return res.fileTransfer(path, character, "send", func(p *C.char, n *C.uint64_t) C.int {
+		return C.file_push(&res.res, p, n)
+	})
+}
+
+// ReceiveFile stores the file the peer sends with SendFile at `path`, creating or
+// truncating it, and returns its size. The data lands in the page cache of the
+// mapped destination; it is written back to disk by the kernel as usual.
+func (h *RDMAHandler) ReceiveFile(res *RDMAResources, path string, character string) (int64, error) {
+	return res.fileTransfer(path, character, "receive", func(p *C.char, n *C.uint64_t) C.int {
+		return C.file_accept(&res.res, p, n)
+	})
+}
+
+// FetchFile RDMA READs the file the peer offers with ServeFile into `path`,
+// creating or truncating it, and returns its size. It is the pull counterpart of
+// SendFile: the peer's CPU only maps and registers the file.
+//
+// Example:
+//
+//	// server
+//	_, err := h.ServeFile(res, "/data/snapshot.bin", "server")
+//	// client
+//	n, err := h.FetchFile(res, "/tmp/snapshot.bin", "client")
+func (h *RDMAHandler) FetchFile(res *RDMAResources, path string, character string) (int64, error) {
+	return res.fileTransfer(path, character, "fetch", func(p *C.char, n *C.uint64_t) C.int {
+		return C.file_pull(&res.res, p, n)
+	})
+}
+
+// ServeFile offers the file at `path` to the peer's FetchFile and returns once the
+// peer has read it.
+func (h *RDMAHandler) ServeFile(res *RDMAResources, path string, character string) (int64, error) {
+	return res.fileTransfer(path, character, "serve", func(p *C.char, n *C.uint64_t) C.int {
+		return C.file_serve(&res.res, p, n)
+	})
+}
+
+// fileTransfer runs one side of a file transfer on the connection's primary QP.
+func (r *RDMAResources) fileTransfer(path, character, what string, run func(*C.char, *C.uint64_t) C.int) (int64, error) {
+	if err := r.checkIdle(character); err != nil {
+		return 0, err
+	}
+	p := C.CString(path)
+	defer C.free(unsafe.Pointer(p))
+	var n C.uint64_t
+	if run(p, &n) != 0 {
+		return 0, fmt.Errorf("%s: failed to %s file %s", character, what, path)
+	}
+	return int64(n), nil
+}
+
+// ODPCapable reports whether the connection's device supports on-demand paging
+// for the RDMA WRITEs and READs of a file transfer, i.e. whether SendFile and
+// FetchFile register files without pinning them.
+func (r *RDMAResources) ODPCapable() bool {
+	need := C.int(C.IBV_ODP_SUPPORT_WRITE | C.IBV_ODP_SUPPORT_READ)
+	return r.res.dev != nil && r.res.dev.odp_caps&need == need
+}
@@ -8,15 +8,53 @@ package rdmahandler
 */
 import "C"
 import (
+	"bytes"
 	"fmt"
+	"os"
+	"syscall"
+	"time"
 	"unsafe"
 )
 
 type RDMACommunicator interface {
-	InitServer(port int) (*RDMAResources, error)
-	InitClient(ip string, port int) (*RDMAResources, error)
+	InitServer(port int, opts ...Option) (*RDMAResources, error)
+	InitClient(ip string, port int, opts ...Option) (*RDMAResources, error)
+	InitClients(peers []string, port int, parallel int, opts ...Option) ([]*RDMAResources, error)
+	Listen(port int, cfg ServerConfig, opts ...Option) (*Server, error)
 	Write(res *RDMAResources, contents string, character string) error
 	Read(res *RDMAResources, character string) (string, error)
+	ReadN(res *RDMAResources, max int, character string) (string, error)
+	WriteAt(res *RDMAResources, data []byte, offset int, character string) error
+	ReadAt(res *RDMAResources, offset int, length int, character string) ([]byte, error)
+	WriteRegion(res *RDMAResources, offset int, length int, character string) error
+	ReadRegion(res *RDMAResources, offset int, length int, character string) ([]byte, error)
+	Release(res *RDMAResources, character string) error
+	Send(res *RDMAResources, data []byte, character string) error
+	Recv(res *RDMAResources, timeout time.Duration, character string) ([]byte, error)
+	WriteV(res *RDMAResources, segs []Segment, remoteOffset int, character string) error
+	ReadV(res *RDMAResources, segs []Segment, remoteOffset int, character string) error
+	FetchAdd(res *RDMAResources, remoteOffset int, add uint64, character string) (uint64, error)
+	CompareSwap(res *RDMAResources, remoteOffset int, compare, swap uint64, character string) (uint64, error)
+	PostWrite(res *RDMAResources, data []byte, offset int, wrID uint64) error
+	PostWriteInline(res *RDMAResources, data []byte, remoteOffset int, wrID uint64) error
+	PostRead(res *RDMAResources, offset int, length int, wrID uint64) error
+	PostWriteBlock(res *RDMAResources, b *Block, blockOffset, remoteOffset, length int, wrID uint64) error
+	PostReadBlock(res *RDMAResources, b *Block, blockOffset, remoteOffset, length int, wrID uint64) error
+	PostBatch(res *RDMAResources, ops []BatchOp, signalEvery int) error
+	NewSubmissionQueue(res *RDMAResources, entries int, signalEvery int) (*SubmissionQueue, error)
+	NewRingProducer(res *RDMAResources, offset, size int) (*RingProducer, error)
+	NewRingConsumer(res *RDMAResources, offset, size int) (*RingConsumer, error)
+	NewKVServer(res *RDMAResources, offset, size, slotSize int) (*KVServer, error)
+	NewKVClient(res *RDMAResources, offset int) (*KVClient, error)
+	NewChannel(res *RDMAResources, cfg ChannelConfig) (*Channel, error)
+	Reap(res *RDMAResources, max int, timeout time.Duration) ([]Completion, error)
+	ReapInto(res *RDMAResources, out []Completion, timeout time.Duration) (int, error)
+	SendFile(res *RDMAResources, path string, character string) (int64, error)
+	ReceiveFile(res *RDMAResources, path string, character string) (int64, error)
+	FetchFile(res *RDMAResources, path string, character string) (int64, error)
+	ServeFile(res *RDMAResources, path string, character string) (int64, error)
+	Reconnect(res *RDMAResources) error
+	Redial(res *RDMAResources) error
 	Destroy(res *RDMAResources) error
 }
 
@@ -45,6 +83,8 @@ type RDMAHandler struct{}
 // `port` is the port number on which the RDMA server will listen. It should be a valid
 // port number where the server has permissions to bind.
 //
+// `opts` configures the connection, e.g. WithBufferSize to register a larger region.
+//
 // On success, it returns a pointer to the initialized RDMAResources and nil error.
 // On failure, it returns nil and the error encountered.
 //
@@ -56,8 +96,8 @@ type RDMAHandler struct{}
 //	}
 //	// Use res (RDMAResources) as needed
 //	...
-func (h *RDMAHandler) InitServer(port int) (*RDMAResources, error) {
-	return initRDMAConnection("", port)
+func (h *RDMAHandler) InitServer(port int, opts ...Option) (*RDMAResources, error) {
+	return initRDMAConnection("", port, opts...)
 }
 
 // InitClient establishes a connection to an RDMA server at the specified IP address and port.
@@ -67,6 +107,7 @@ func (h *RDMAHandler) InitServer(port int) (*RDMAResources, error) {
 // `ip` is the IP address of the RDMA server to connect to. It should be a valid IPv4 or IPv6 address.
 // `port` is the port number on which the RDMA server is listening. It should be a valid port number
 // where the server is expecting connections.
+// `opts` configures the connection, e.g. WithBufferSize to register a larger region.
 //
 // On success, it returns a pointer to the initialized RDMAResources and nil error. On failure, it
 // returns nil and the error encountered.
@@ -79,8 +120,8 @@ func (h *RDMAHandler) InitServer(port int) (*RDMAResources, error) {
 //	}
 //	// Use clientRes (RDMAResources) for client-side operations
 //	...
-func (h *RDMAHandler) InitClient(ip string, port int) (*RDMAResources, error) {
-	return initRDMAConnection(ip, port)
+func (h *RDMAHandler) InitClient(ip string, port int, opts ...Option) (*RDMAResources, error) {
+	return initRDMAConnection(ip, port, opts...)
 }
 
 //	Write sends the given contents to a remote RDMA peer using the specified RDMAResources.
@@ -97,6 +138,11 @@ func (h *RDMAHandler) InitClient(ip string, port int) (*RDMAResources, error) {
 //
 // This function first synchronizes the data, then performs the RDMA write operation, and
 // finally checks for completion. Any error encountered during these steps is returned.
+// With WithInbandCompletion the TCP synchronizations are replaced by an RDMA WRITE_WITH_IMM
+// that the peer's Read consumes.
+//
+// The string and its terminating NUL are copied straight into the registered buffer;
+// use WriteRegion to avoid even that copy.
 //
 // On success, it returns nil. On failure, it returns an error detailing the issue encountered.
 //
@@ -107,24 +153,16 @@ func (h *RDMAHandler) InitClient(ip string, port int) (*RDMAResources, error) {
 //	    log.Fatalf("RDMA write failed: %v", err)
 //	}
 func (h *RDMAHandler) Write(res *RDMAResources, contents string, character string) error {
-	if err := syncData(res); err != nil {
+	if err := res.checkIdle(character); err != nil {
 		return err
 	}
-	cContents := C.CString(contents)
-	defer C.free(unsafe.Pointer(cContents))
-
-	C.strcpy(res.res.buf, cContents)
-
-	if C.post_send(&res.res, C.IBV_WR_RDMA_WRITE) != 0 {
-		return fmt.Errorf("%s: failed to post SR", character)
-	}
-	if C.poll_completion(&res.res) != 0 {
-		return fmt.Errorf("%s: poll completion failed", character)
+	if len(contents)+1 > res.BufferSize() {
+		return fmt.Errorf("%s: contents of %d bytes do not fit in a %d byte buffer", character, len(contents), res.BufferSize())
 	}
-	if err := syncData(res); err != nil {
-		return err
-	}
-	return nil
+	buf := res.region()
+	copy(buf, contents)
+	buf[len(contents)] = 0
+	return h.WriteRegion(res, 0, len(contents)+1, character)
 }
 
 // Read performs an RDMA read operation using the given RDMAResources and retrieves data from a remote RDMA peer.
@@ -137,6 +175,12 @@ func (h *RDMAHandler) Write(res *RDMAResources, contents string, character strin
 //
 // This function synchronizes the data before and after the RDMA read operation. If any error
 // occurs during these steps, the function returns an empty string along with the error.
+// With WithInbandCompletion it instead waits for the peer's next Write to land in the local
+// buffer and acknowledges it in-band.
+//
+// Since the reader does not know how long the peer's string is, Read transfers the whole
+// buffer, the smaller of BufferSize and RemoteBufferSize, on every call. With large
+// buffers use ReadN with a bound on the string's length, or ReadAt for a known range.
 //
 // On successful completion of the read operation, it returns the read data as a string and nil error.
 // On failure, it returns an empty string and the error encountered.
@@ -149,19 +193,227 @@ func (h *RDMAHandler) Write(res *RDMAResources, contents string, character strin
 //	}
 //	fmt.Println("Received data:", data)
 func (h *RDMAHandler) Read(res *RDMAResources, character string) (string, error) {
+	return h.ReadN(res, res.BufferSize(), character)
+}
+
+// ReadN works like Read but RDMA-reads at most `max` bytes from the start of the remote
+// buffer, so a short string costs a short transfer however large the buffers are. A
+// string longer than `max` is cut at `max` bytes. With WithInbandCompletion the length
+// is known from the peer's Write and `max` only bounds the result.
+//
+// Example:
+//
+//	data, err := h.ReadN(serverRes, 256, "server")
+func (h *RDMAHandler) ReadN(res *RDMAResources, max int, character string) (string, error) {
+	if err := res.checkIdle(character); err != nil {
+		return "", err
+	}
+	if max <= 0 {
+		return "", fmt.Errorf("%s: invalid read length %d", character, max)
+	}
+	if max > res.BufferSize() {
+		max = res.BufferSize()
+	}
+	if res.inband() {
+		if _, err := res.waitInband(character); err != nil {
+			return "", err
+		}
+		data := cString(res.region()[:max])
+		if err := res.releaseInband(character); err != nil {
+			return "", err
+		}
+		return data, nil
+	}
 	if err := syncData(res); err != nil {
 		return "", err
 	}
-	if C.post_send(&res.res, C.IBV_WR_RDMA_READ) != 0 {
-		return "", fmt.Errorf("%s: failed to post SR", character)
+	length := max
+	if remote := res.RemoteBufferSize(); remote < length {
+		length = remote
 	}
-	if C.poll_completion(&res.res) != 0 {
-		return "", fmt.Errorf("%s: poll completion after post_send failed", character)
+	if err := res.transfer(C.IBV_WR_RDMA_READ, 0, length, character); err != nil {
+		return "", err
 	}
 	if err := syncData(res); err != nil {
 		return "", err
 	}
-	return C.GoString(res.res.buf), nil
+	return cString(res.region()[:length]), nil
+}
+
+// WriteAt copies data into the local registered buffer at `offset` and RDMA-writes
+// exactly len(data) bytes to the same offset of the remote buffer.
+//
+// `res` is a pointer to RDMAResources which should be previously initialized and represent
+// an established RDMA connection.
+//
+// `data` is the payload to transfer. It may contain arbitrary bytes, including NUL.
+//
+// `offset` is the byte offset in both the local and the remote buffer. The range
+// [offset, offset+len(data)) must fit in both buffers.
+//
+// `character` is used in error messages to identify the operation or the role of the peer.
+//
+// Like Write, the operation is bracketed by two data synchronizations, or signalled in-band
+// when the connection uses WithInbandCompletion.
+//
+// On success, it returns nil. On failure, it returns an error detailing the issue encountered.
+//
+// Example:
+//
+//	err := h.WriteAt(clientRes, payload, 4096, "client")
+//	if err != nil {
+//	    log.Fatalf("RDMA write failed: %v", err)
+//	}
+func (h *RDMAHandler) WriteAt(res *RDMAResources, data []byte, offset int, character string) error {
+	if err := res.checkIdle(character); err != nil {
+		return err
+	}
+	if err := res.checkRange(offset, len(data)); err != nil {
+		return fmt.Errorf("%s: %w", character, err)
+	}
+	copy(res.region()[offset:], data)
+	return h.WriteRegion(res, offset, len(data), character)
+}
+
+// ReadAt RDMA-reads exactly `length` bytes from `offset` of the remote buffer into the
+// same offset of the local buffer and returns a copy of them.
+//
+// `res` is a pointer to RDMAResources that must be previously initialized and represent
+// an established RDMA connection.
+//
+// `offset` and `length` select the range; it must fit in both buffers.
+//
+// `character` is a string used to identify the operation or the role of the peer in error messages.
+//
+// Like Read, the operation is bracketed by two data synchronizations. Unlike Read, the
+// result is returned as raw bytes, so binary payloads are preserved. With
+// WithInbandCompletion it returns the range once the peer's next WriteAt has landed.
+//
+// On success, it returns the bytes read and nil error. On failure, it returns nil and the error.
+//
+// Example:
+//
+//	data, err := h.ReadAt(serverRes, 4096, 65536, "server")
+//	if err != nil {
+//	    log.Fatalf("RDMA read failed: %v", err)
+//	}
+func (h *RDMAHandler) ReadAt(res *RDMAResources, offset int, length int, character string) ([]byte, error) {
+	view, err := h.ReadRegion(res, offset, length, character)
+	if err != nil {
+		return nil, err
+	}
+	out := make([]byte, length)
+	copy(out, view)
+	if err := h.Release(res, character); err != nil {
+		return nil, err
+	}
+	return out, nil
+}
+
+// WriteRegion RDMA-writes [offset, offset+length) of the local registered buffer to the
+// same range of the remote buffer without copying anything: the caller serializes the
+// payload straight into the slice returned by Slice or Buffer beforehand.
+//
+// `res` is a pointer to RDMAResources which should be previously initialized and represent
+// an established RDMA connection.
+//
+// `offset` and `length` select the range; it must fit in both buffers.
+//
+// `character` is used in error messages to identify the operation or the role of the peer.
+//
+// Like Write, the operation is bracketed by two data synchronizations, or signalled in-band
+// when the connection uses WithInbandCompletion.
+//
+// On success, it returns nil. On failure, it returns an error detailing the issue encountered.
+//
+// Example:
+//
+//	buf, _ := clientRes.Slice(0, len(header)+len(body))
+//	n := copy(buf, header)
+//	copy(buf[n:], body)
+//	if err := h.WriteRegion(clientRes, 0, len(buf), "client"); err != nil {
+//	    log.Fatalf("RDMA write failed: %v", err)
+//	}
+func (h *RDMAHandler) WriteRegion(res *RDMAResources, offset int, length int, character string) error {
+	if err := res.checkIdle(character); err != nil {
+		return err
+	}
+	if err := res.checkRange(offset, length); err != nil {
+		return fmt.Errorf("%s: %w", character, err)
+	}
+	if res.inband() {
+		return res.writeInband(offset, length, character)
+	}
+	if err := syncData(res); err != nil {
+		return err
+	}
+	if err := res.transfer(C.IBV_WR_RDMA_WRITE, offset, length, character); err != nil {
+		return err
+	}
+	if err := syncData(res); err != nil {
+		return err
+	}
+	return nil
+}
+
+// ReadRegion RDMA-reads [offset, offset+length) of the remote buffer into the same range of
+// the local buffer and returns a slice aliasing that range of registered memory, so the
+// result can be parsed in place. Nothing is copied and binary payloads are preserved.
+//
+// `res` is a pointer to RDMAResources that must be previously initialized and represent
+// an established RDMA connection.
+//
+// `offset` and `length` select the range; it must fit in both buffers.
+//
+// `character` is a string used to identify the operation or the role of the peer in error messages.
+//
+// The returned slice is only valid until the next operation touching the range and never
+// after Destroy. Call Release once done with it: with WithInbandCompletion the slice is the
+// data the peer's next WriteRegion/WriteAt placed in the local buffer, and Release hands the
+// write credit back to the peer. Without the in-band mode Release is a no-op.
+//
+// On success, it returns the aliased range and nil error. On failure, it returns nil and the error.
+//
+// Example:
+//
+//	view, err := h.ReadRegion(serverRes, 0, 4096, "server")
+//	if err != nil {
+//	    log.Fatalf("RDMA read failed: %v", err)
+//	}
+//	parse(view)
+//	h.Release(serverRes, "server")
+func (h *RDMAHandler) ReadRegion(res *RDMAResources, offset int, length int, character string) ([]byte, error) {
+	if err := res.checkIdle(character); err != nil {
+		return nil, err
+	}
+	if err := res.checkRange(offset, length); err != nil {
+		return nil, fmt.Errorf("%s: %w", character, err)
+	}
+	if res.inband() {
+		if _, err := res.waitInband(character); err != nil {
+			return nil, err
+		}
+		return res.region()[offset : offset+length : offset+length], nil
+	}
+	if err := syncData(res); err != nil {
+		return nil, err
+	}
+	if err := res.transfer(C.IBV_WR_RDMA_READ, offset, length, character); err != nil {
+		return nil, err
+	}
+	if err := syncData(res); err != nil {
+		return nil, err
+	}
+	return res.region()[offset : offset+length : offset+length], nil
+}
+
+// Release finishes a ReadRegion. In the in-band mode it acknowledges the data to the peer,
+// which may then write again; otherwise it does nothing.
+func (h *RDMAHandler) Release(res *RDMAResources, character string) error {
+	if !res.inband() || res.res.inband_rx_pending == 0 {
+		return nil
+	}
+	return res.releaseInband(character)
 }
 
 // Destroy releases the resources allocated for an RDMA connection.
@@ -184,11 +436,15 @@ func (h *RDMAHandler) Read(res *RDMAResources, character string) (string, error)
 //	    log.Fatalf("Failed to destroy RDMA resources: %v", err)
 //	}
 func (h *RDMAHandler) Destroy(res *RDMAResources) error {
+	res.closeEventFile()
+	defer res.config.free()
+	// 附属 QP 借用本连接的套接字和缓冲区，先销毁它们
+	laneErr := res.destroyLanes()
 	if C.resources_destroy(&res.res) != 0 {
 
 		return fmt.Errorf("failed to destroy resources")
 	}
-	return nil
+	return laneErr
 }
 
 // RDMAResources encapsulates the resources required for establishing and managing
@@ -210,6 +466,139 @@ func (h *RDMAHandler) Destroy(res *RDMAResources) error {
 //	...
 type RDMAResources struct {
 	res C.struct_resources
+
+	// scratch receives completions from the C side in Reap/ReapInto and is reused
+	// across calls to keep reaping allocation-free.
+	scratch []C.struct_completion_t
+	// batch holds the C descriptors of PostBatch and is reused across calls.
+	batch []C.struct_batch_op_t
+
+	// cqFile is the completion channel fd registered with the netpoller in event
+	// mode (WithEventCompletion), nil when the connection busy-polls.
+	cqFile *os.File
+	// spin is how long a waiter busy-polls before sleeping in event mode.
+	spin time.Duration
+	// handshakeTimeout bounds the socket operations of the handshake (WithHandshakeTimeout).
+	handshakeTimeout time.Duration
+
+	// config owns the C strings referenced by res.config until Destroy.
+	config *connConfig
+	// lanes are the additional QPs of a striped connection (WithStripes).
+	lanes []*RDMAResources
+	// laneSetup is how long creating and connecting the lanes took.
+	laneSetup time.Duration
+}
+
+// BufferSize returns the size in bytes of the local registered buffer.
+func (r *RDMAResources) BufferSize() int {
+	return int(r.res.buf_size)
+}
+
+// RemoteBufferSize returns the size in bytes of the peer's registered buffer as
+// announced during the connection handshake.
+func (r *RDMAResources) RemoteBufferSize() int {
+	return int(C.remote_buffer_size(&r.res))
+}
+
+// PathMTU returns the path MTU in bytes negotiated with the peer: the smaller of
+// both ports' active MTUs, capped by WithPathMTU.
+func (r *RDMAResources) PathMTU() int {
+	return 128 << uint(r.res.path_mtu)
+}
+
+// ReadDepth returns how many RDMA reads this side may have in flight on the QP, as
+// negotiated with the peer.
+func (r *RDMAResources) ReadDepth() int {
+	return int(r.res.max_rd_atomic)
+}
+
+// region returns the local registered buffer as a byte slice aliasing C memory.
+func (r *RDMAResources) region() []byte {
+	return unsafe.Slice((*byte)(unsafe.Pointer(r.res.buf)), r.BufferSize())
+}
+
+// Buffer returns the whole local registered buffer as a slice aliasing the memory
+// region, so callers can serialize into it or parse it in place without copies.
+//
+// The slice must not be used after Destroy, and ranges handed to an in-flight
+// RDMA operation must not be touched until the operation has completed.
+func (r *RDMAResources) Buffer() []byte {
+	return r.region()
+}
+
+// Slice returns [offset, offset+length) of the local registered buffer as a slice
+// aliasing the memory region. The same lifetime rules as for Buffer apply.
+func (r *RDMAResources) Slice(offset, length int) ([]byte, error) {
+	if offset < 0 || length < 0 || offset+length > r.BufferSize() {
+		return nil, fmt.Errorf("range [%d, +%d) is out of the %d byte buffer", offset, length, r.BufferSize())
+	}
+	return r.region()[offset : offset+length : offset+length], nil
+}
+
+// cString returns the bytes of b up to the first NUL (or all of b) as a string.
+func cString(b []byte) string {
+	if i := bytes.IndexByte(b, 0); i >= 0 {
+		b = b[:i]
+	}
+	return string(b)
+}
+
+// inband reports whether the connection signals completion in-band.
+func (r *RDMAResources) inband() bool {
+	return r.res.inband != 0
+}
+
+// writeInband posts an in-band write of [offset, offset+length), first waiting for the
+// peer's credit in the connection's completion mode.
+func (r *RDMAResources) writeInband(offset, length int, character string) error {
+	_, err := r.await(-1, func(timeoutUsec C.long) (bool, error) {
+		switch C.inband_write(&r.res, C.size_t(offset), C.uint32_t(length), timeoutUsec) {
+		case 0:
+			return true, nil
+		case C.POLL_TIMED_OUT:
+			return false, nil
+		default:
+			return false, fmt.Errorf("%s: in-band write failed", character)
+		}
+	})
+	return err
+}
+
+// waitInband blocks until the peer's next in-band write has landed and returns its length.
+func (r *RDMAResources) waitInband(character string) (int, error) {
+	var length C.uint32_t
+	_, err := r.await(-1, func(timeoutUsec C.long) (bool, error) {
+		switch C.inband_wait_data(&r.res, &length, timeoutUsec) {
+		case 0:
+			return true, nil
+		case C.POLL_TIMED_OUT:
+			return false, nil
+		default:
+			return false, fmt.Errorf("%s: waiting for in-band data failed", character)
+		}
+	})
+	if err != nil {
+		return 0, err
+	}
+	return int(length), nil
+}
+
+// releaseInband returns the write credit to the peer after the data has been consumed.
+func (r *RDMAResources) releaseInband(character string) error {
+	if C.inband_release(&r.res) != 0 {
+		return fmt.Errorf("%s: in-band ack failed", character)
+	}
+	return nil
+}
+
+// checkRange reports whether [offset, offset+length) fits in both the local and the
+// remote buffer.
+func (r *RDMAResources) checkRange(offset, length int) error {
+	if offset < 0 || length < 0 || offset+length > r.BufferSize() || offset+length > r.RemoteBufferSize() {
+		return fmt.Errorf("range [%d, +%d) is out of bounds (local %d, remote %d bytes)",
+			offset, length, r.BufferSize(), r.RemoteBufferSize())
+	}
+	return nil
 }
 
 // initRDMAConnection initializes the RDMA resources and establishes a connection
@@ -220,6 +609,8 @@ type RDMAResources struct {
 //
 // `port` is the port number used for the RDMA connection.
 //
+// `opts` are applied to the per-connection settings before the resources are created.
+//
 // This function configures the RDMA connection parameters, creates the necessary
 // resources, and connects the queue pairs (QPs). If any step in this process fails,
 // it cleans up any partially created resources and returns an error.
@@ -233,31 +624,142 @@ type RDMAResources struct {
 //	if err != nil {
 //	    log.Fatalf("RDMA connection initialization failed: %v", err)
 //	}
-func initRDMAConnection(ip string, port int) (*RDMAResources, error) {
+func initRDMAConnection(ip string, port int, opts ...Option) (*RDMAResources, error) {
+	return newConnection(ip, port, -1, opts)
+}
+
+// newConnection builds and connects the resources of one peer. A non-negative `sock`
+// is a TCP connection that a Server has already accepted; otherwise the socket is
+// created from `ip` and `port` as usual.
+func newConnection(ip string, port int, sock int, opts []Option) (*RDMAResources, error) {
 	var resources RDMAResources
+	// resources_create 接管套接字之前出错时由这里关闭
+	owned := sock >= 0
+	defer func() {
+		if owned {
+			syscall.Close(sock)
+		}
+	}()
+
+	o := defaultConnOptions()
+	for _, opt := range opts {
+		opt(&o)
+	}
+	resources.res.buf_size = C.size_t(o.bufSize)
+	if o.inband {
+		resources.res.inband = 1
+	}
+	resources.res.qp_depth = C.int(o.qpDepth)
+	resources.res.cq_depth = C.int(o.cqDepth)
+	resources.res.mtu = C.int(o.mtu)
+	resources.res.rd_atomic = C.int(o.rdDepth)
+	resources.res.max_inline = C.int(o.inline)
+	resources.res.stripes = C.int(o.stripes)
+	resources.res.lat_sample = C.int(o.latSample)
+	if o.numaBind {
+		resources.res.numa_bind = 1
+		resources.res.numa_node = C.int(o.numaNode)
+	}
+	resources.res.comp_vector = -1
+	if o.compVector != nil {
+		resources.res.comp_vector = C.int(*o.compVector)
+	}
+	if o.eventMode {
+		resources.res.event_mode = 1
+		resources.spin = o.spin
+	}
+	if o.device != nil {
+		if o.device.dev == nil {
+			return nil, fmt.Errorf("device is closed")
+		}
+		resources.res.dev = o.device.dev
+	}
+	resources.res.msg_slots = C.int(o.msgSlots)
+	resources.res.msg_slot_size = C.uint32_t(o.msgSlotSize)
+	if o.srq != nil {
+		if o.srq.ring == nil {
+			return nil, fmt.Errorf("shared receive queue is closed")
+		}
+		resources.res.msg_ring = o.srq.ring
+		if resources.res.dev == nil {
+			resources.res.dev = o.srq.ring.dev
+		}
+	}
+	if o.pool != nil {
+		if o.pool.pool == nil {
+			return nil, fmt.Errorf("memory pool is closed")
+		}
+		resources.res.pool = o.pool.pool
+	}
 
-	serverAddr := C.CString(ip)
-	defer C.free(unsafe.Pointer(serverAddr))
+	if owned {
+		resources.res.sock = C.int(sock)
+		resources.res.sock_accepted = 1
+		owned = false
+	}
 
+	// 每个连接使用自己的配置副本，多个 goroutine 可以并发建立连接
+	resources.config = newConnConfig(&o, ip, port)
+	resources.res.config = resources.config.cfg
 	if ip != "" {
-		fmt.Println("client now setting up")
-		C.config.server_name = serverAddr
+		logf(LogInfo, "initRDMAConnection", "client now setting up")
 	} else {
-		fmt.Println("server now setting up")
-		C.config.server_name = nil
+		logf(LogInfo, "initRDMAConnection", "server now setting up")
 	}
-	C.config.tcp_port = C.uint32_t(port)
 
 	if C.resources_create(&resources.res) != 0 {
+		resources.config.free()
 		return nil, fmt.Errorf("failed to create resources")
 	}
+	// Server 接受的套接字已由它限时；其余连接按 WithHandshakeTimeout 限时，建立后解除
+	if resources.res.sock_accepted == 0 {
+		resources.handshakeTimeout = o.handshakeTimeout
+	}
+	if resources.handshakeTimeout > 0 &&
+		C.sock_set_timeout(resources.res.sock, C.long(resources.handshakeTimeout/time.Microsecond)) != 0 {
+		C.resources_destroy(&resources.res)
+		resources.config.free()
+		return nil, fmt.Errorf("failed to set the handshake timeout")
+	}
 	if C.connect_qp(&resources.res) != 0 {
 		C.resources_destroy(&resources.res)
+		resources.config.free()
 		return nil, fmt.Errorf("failed to connect QPs")
 	}
+	if err := resources.openEventFile(); err != nil {
+		C.resources_destroy(&resources.res)
+		resources.config.free()
+		return nil, err
+	}
+	if err := resources.connectLanes(); err != nil {
+		resources.destroyLanes()
+		resources.closeEventFile()
+		C.resources_destroy(&resources.res)
+		resources.config.free()
+		return nil, err
+	}
+	if err := resources.liftHandshakeTimeout(); err != nil {
+		resources.destroyLanes()
+		resources.closeEventFile()
+		C.resources_destroy(&resources.res)
+		resources.config.free()
+		return nil, err
+	}
 	return &resources, nil
 }
 
+// liftHandshakeTimeout removes the limit WithHandshakeTimeout put on the socket:
+// later synchronous operations may wait for the peer's application for long.
+func (r *RDMAResources) liftHandshakeTimeout() error {
+	if r.handshakeTimeout <= 0 {
+		return nil
+	}
+	if C.sock_set_timeout(r.res.sock, 0) != 0 {
+		return fmt.Errorf("failed to lift the handshake timeout")
+	}
+	return nil
+}
+
 // syncData synchronizes data over the socket associated with the provided RDMA resources.
 //
 // `res` is a pointer to RDMAResources which should be previously initialized and represent
@@ -265,7 +767,8 @@ func initRDMAConnection(ip string, port int) (*RDMAResources, error) {
 //
 // This function attempts to synchronize data across the connection by sending a single
 // character ('R') and expecting to receive a character back. This ensures both sides of
-// the RDMA connection are ready to proceed with further operations.
+// the RDMA connection are ready to proceed with further operations. The token is a
+// static C byte, so a sync makes one cgo call and allocates nothing.
 //
 // If the synchronization fails, the function returns an error detailing the issue.
 //
@@ -279,8 +782,7 @@ func initRDMAConnection(ip string, port int) (*RDMAResources, error) {
 //	    log.Fatalf("Data synchronization failed: %v", err)
 //	}
 func syncData(res *RDMAResources) error {
-	var tempChar C.char
-	if C.sock_sync_data(res.res.sock, 1, C.CString("R"), &tempChar) != 0 {
+	if C.sock_sync_ready(res.res.sock) != 0 {
 		return fmt.Errorf("sync error")
 	}
 	return nil
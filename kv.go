@@ -0,0 +1,190 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"unsafe"
+)
+
+// ErrTableFull is returned by Put when both buckets the key may live in are full.
+var ErrTableFull = errors.New("rdmahandler: key-value table buckets are full")
+
+// ErrSlotBusy is returned when a slot stayed in the middle of a write for
+// KV_MAX_RETRIES attempts, e.g. because its writer failed while holding it.
+var ErrSlotBusy = errors.New("rdmahandler: key-value slot is busy")
+
+// KVServer owns a hash table in a window of the connection's registered buffer.
+// Its peer looks keys up with a KVClient by RDMA READ alone: the server's CPU
+// is not involved in remote Gets and Puts. The table is an open hash table of
+// cache-line aligned slots; every key has two candidate buckets of
+// KV_BUCKET_SLOTS slots.
+//
+// Get, Put and Delete on the server work on local memory and are safe against
+// concurrent remote readers. Local writes only exclude remote writes when the
+// device's atomics are coherent with the CPU (IBV_ATOMIC_GLOB); otherwise fill
+// the table before clients start to write, or leave the writing to clients.
+type KVServer struct {
+	res *RDMAResources
+	kv  C.struct_rdma_kv
+}
+
+// KVClient accesses the table of the peer's KVServer with one-sided verbs: Get
+// takes one or two RDMA READs, Put and Delete read the buckets, take the slot
+// with an RDMA compare-and-swap and write it back with one doorbell. It uses
+// the same window of the local buffer as scratch space, and the connection's
+// send queue and CQ like the other synchronous operations.
+type KVClient struct {
+	res *RDMAResources
+	kv  C.struct_rdma_kv
+}
+
+// NewKVServer creates a table in [offset, offset+size) of the local buffer and
+// clears it. `offset` must be 64-byte aligned and `slotSize` a multiple of 64,
+// or 0 for KV_DEFAULT_SLOT_SIZE; a slot holds a key and value of up to
+// slotSize-24 bytes together. The peer attaches with NewKVClient once the table
+// exists.
+func (h *RDMAHandler) NewKVServer(res *RDMAResources, offset, size, slotSize int) (*KVServer, error) {
+	if offset < 0 || size <= 0 || slotSize < 0 {
+		return nil, fmt.Errorf("invalid table window [%d, +%d) with %d byte slots", offset, size, slotSize)
+	}
+	s := &KVServer{res: res}
+	if C.kv_init(&s.kv, &res.res, C.size_t(offset), C.uint64_t(size), C.uint32_t(slotSize)) != 0 {
+		return nil, fmt.Errorf("failed to set up key-value table in [%d, +%d)", offset, size)
+	}
+	return s, nil
+}
+
+// NewKVClient attaches to the table the peer created with NewKVServer at `offset`
+// of its buffer; one RDMA READ fetches the table's geometry. The local buffer
+// must hold two buckets and a slot of scratch space at the same offset.
+func (h *RDMAHandler) NewKVClient(res *RDMAResources, offset int) (*KVClient, error) {
+	if offset < 0 {
+		return nil, fmt.Errorf("invalid table offset %d", offset)
+	}
+	if err := res.checkIdle("kv"); err != nil {
+		return nil, err
+	}
+	c := &KVClient{res: res}
+	if C.kv_attach(&c.kv, &res.res, C.size_t(offset)) != 0 {
+		return nil, fmt.Errorf("failed to attach to key-value table at %d", offset)
+	}
+	return c, nil
+}
+
+// MaxEntrySize returns how many bytes of key and value a slot holds together.
+func (s *KVServer) MaxEntrySize() int {
+	return int(s.kv.slot_size) - C.KV_SLOT_META
+}
+
+// Capacity returns the number of slots of the table.
+func (s *KVServer) Capacity() int {
+	return int(s.kv.buckets) * int(s.kv.bucket_slots)
+}
+
+// Get returns a copy of the value stored under `key`, and whether there is one.
+func (s *KVServer) Get(key []byte) ([]byte, bool, error) {
+	if len(key) == 0 {
+		return nil, false, nil
+	}
+	copyBuf := make([]byte, int(s.kv.slot_size))
+	var off, n C.uint32_t
+	rc := C.kv_local_get(&s.kv, &s.res.res, unsafe.Pointer(&key[0]), C.uint32_t(len(key)),
+		unsafe.Pointer(&copyBuf[0]), &off, &n)
+	if err := kvError(rc, "get"); err != nil || rc == C.KV_NOT_FOUND {
+		return nil, false, err
+	}
+	return copyBuf[int(off) : int(off)+int(n) : int(off)+int(n)], true, nil
+}
+
+// Put stores `value` under `key`, replacing any previous value. ErrTableFull
+// reports that the key's buckets have no free slot.
+func (s *KVServer) Put(key, value []byte) error {
+	k, klen, v, vlen := kvArgs(key, value)
+	return kvError(C.kv_local_put(&s.kv, &s.res.res, k, klen, v, vlen), "put")
+}
+
+// Delete removes `key` and reports whether it was in the table.
+func (s *KVServer) Delete(key []byte) (bool, error) {
+	k, klen, _, _ := kvArgs(key, nil)
+	rc := C.kv_local_delete(&s.kv, &s.res.res, k, klen)
+	return rc == 0, kvError(rc, "delete")
+}
+
+// MaxEntrySize returns how many bytes of key and value a slot holds together.
+func (c *KVClient) MaxEntrySize() int {
+	return int(c.kv.slot_size) - C.KV_SLOT_META
+}
+
+// Get returns a copy of the value stored under `key` in the peer's table, and
+// whether there is one.
+//
+// Example:
+//
+//	v, ok, err := kc.Get([]byte("user:42"))
+func (c *KVClient) Get(key []byte) ([]byte, bool, error) {
+	if len(key) == 0 {
+		return nil, false, nil
+	}
+	if err := c.res.checkIdle("kv"); err != nil {
+		return nil, false, err
+	}
+	var off C.uint64_t
+	var n C.uint32_t
+	rc := C.kv_get(&c.kv, &c.res.res, unsafe.Pointer(&key[0]), C.uint32_t(len(key)), &off, &n)
+	if err := kvError(rc, "get"); err != nil || rc == C.KV_NOT_FOUND {
+		return nil, false, err
+	}
+	out := make([]byte, int(n))
+	copy(out, c.res.region()[int(off):int(off)+int(n)])
+	return out, true, nil
+}
+
+// Put stores `value` under `key` in the peer's table. ErrTableFull reports that
+// the key's buckets have no free slot.
+func (c *KVClient) Put(key, value []byte) error {
+	if err := c.res.checkIdle("kv"); err != nil {
+		return err
+	}
+	k, klen, v, vlen := kvArgs(key, value)
+	return kvError(C.kv_put(&c.kv, &c.res.res, k, klen, v, vlen), "put")
+}
+
+// Delete removes `key` from the peer's table and reports whether it was there.
+func (c *KVClient) Delete(key []byte) (bool, error) {
+	if err := c.res.checkIdle("kv"); err != nil {
+		return false, err
+	}
+	k, klen, _, _ := kvArgs(key, nil)
+	rc := C.kv_delete(&c.kv, &c.res.res, k, klen)
+	return rc == 0, kvError(rc, "delete")
+}
+
+// kvArgs converts a key and value for the C side.
+func kvArgs(key, value []byte) (unsafe.Pointer, C.uint32_t, unsafe.Pointer, C.uint32_t) {
+	var k, v unsafe.Pointer
+	if len(key) > 0 {
+		k = unsafe.Pointer(&key[0])
+	}
+	if len(value) > 0 {
+		v = unsafe.Pointer(&value[0])
+	}
+	return k, C.uint32_t(len(key)), v, C.uint32_t(len(value))
+}
+
+// kvError maps the result of a table operation; KV_NOT_FOUND is not an error.
+func kvError(rc C.int, what string) error {
+	switch rc {
+	case 0, C.KV_NOT_FOUND:
+		return nil
+	case C.KV_FULL:
+		return ErrTableFull
+	case C.KV_BUSY:
+		return ErrSlotBusy
+	default:
+		return fmt.Errorf("key-value %s failed", what)
+	}
+}
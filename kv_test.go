@@ -0,0 +1,114 @@
+package rdmahandler
+
+import (
+	"encoding/binary"
+	"testing"
+)
+
+// kvMix and kvHash are a reference implementation of kv_mix and kv_hash, which
+// load the words in host byte order; the tests assume a little-endian host.
+func kvMix(x uint64) uint64 {
+	x ^= x >> 33
+	x *= 0xff51afd7ed558ccd
+	x ^= x >> 33
+	x *= 0xc4ceb9fe1a85ec53
+	x ^= x >> 33
+	return x
+}
+
+func kvHash(data []byte, seed uint64) uint64 {
+	h := seed ^ uint64(len(data))*0x9e3779b97f4a7c15
+	for ; len(data) >= 8; data = data[8:] {
+		h = kvMix(h ^ binary.LittleEndian.Uint64(data))
+	}
+	if len(data) > 0 {
+		var w [8]byte
+		copy(w[:], data)
+		h = kvMix(h ^ binary.LittleEndian.Uint64(w[:]))
+	}
+	return kvMix(h)
+}
+
+func TestKVHash(t *testing.T) {
+	data := []byte("the quick brown fox jumps over the lazy dog")
+	for n := 0; n <= len(data); n++ {
+		for _, seed := range []uint64{0, 1, 0xdeadbeef} {
+			if got, want := cKVHash(data[:n], seed), kvHash(data[:n], seed); got != want {
+				t.Errorf("kv_hash(%q, %d) = %#x, want %#x", data[:n], seed, got, want)
+			}
+		}
+	}
+	// 尾部不满一个字的字节和长度都参与哈希
+	for _, tc := range []struct{ a, b string }{
+		{"abcdefgh1", "abcdefgh2"},
+		{"a", "a\x00"},
+		{"", "\x00"},
+	} {
+		if cKVHash([]byte(tc.a), 0) == cKVHash([]byte(tc.b), 0) {
+			t.Errorf("kv_hash(%q) == kv_hash(%q)", tc.a, tc.b)
+		}
+	}
+}
+
+func TestKVBuckets(t *testing.T) {
+	for _, buckets := range []uint64{1, 2, 3, 64, 1000} {
+		for i := 0; i < 200; i++ {
+			key := []byte{byte(i), byte(i >> 8), 'k'}
+			b := cKVBuckets(buckets, key)
+			want := 2
+			if buckets == 1 {
+				want = 1
+			}
+			if len(b) != want {
+				t.Fatalf("%d buckets: key %q has %d candidates, want %d", buckets, key, len(b), want)
+			}
+			for _, x := range b {
+				if x >= buckets {
+					t.Fatalf("%d buckets: key %q maps to bucket %d", buckets, key, x)
+				}
+			}
+			if len(b) == 2 && b[0] == b[1] {
+				t.Fatalf("%d buckets: both candidates of key %q are bucket %d", buckets, key, b[0])
+			}
+			if b[0] != kvHash(key, 0)%buckets {
+				t.Fatalf("%d buckets: preferred bucket of key %q is %d, want %d", buckets, key, b[0], kvHash(key, 0)%buckets)
+			}
+		}
+	}
+}
+
+func TestKVChecksum(t *testing.T) {
+	const length = 20
+	slot := make([]byte, kvSlotMeta+length+8)
+	binary.LittleEndian.PutUint32(slot[kvChecksumOffset+8:], 5)
+	binary.LittleEndian.PutUint32(slot[kvChecksumOffset+12:], length-5)
+	for i := kvSlotMeta; i < kvSlotMeta+length; i++ {
+		slot[i] = byte(i)
+	}
+	sum := cKVChecksum(slot, 2, length)
+	if want := kvHash(slot[kvChecksumOffset+8:kvSlotMeta+length], 2); sum != want {
+		t.Fatalf("kv_checksum = %#x, want %#x", sum, want)
+	}
+	if cKVChecksum(slot, 4, length) == sum {
+		t.Error("checksum does not depend on the version")
+	}
+	for _, tc := range []struct {
+		offset  int
+		changes bool
+	}{
+		// 版本号和校验和本身不参与，键长、值长、键和值都参与，之后的字节不参与
+		{0, false},
+		{kvChecksumOffset, false},
+		{kvChecksumOffset + 8, true},
+		{kvChecksumOffset + 12, true},
+		{kvSlotMeta, true},
+		{kvSlotMeta + length - 1, true},
+		{kvSlotMeta + length, false},
+	} {
+		c := append([]byte(nil), slot...)
+		c[tc.offset] ^= 0xff
+		if changed := cKVChecksum(c, 2, length) != sum; changed != tc.changes {
+			t.Errorf("flipping byte %d changes the checksum: %v, want %v", tc.offset, changed, tc.changes)
+		}
+	}
+}
@@ -0,0 +1,108 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+
+void rdmaGoLogHook(int level, char *func, char *msg);
+*/
+import "C"
+import (
+	"fmt"
+	"os"
+	"strings"
+	"sync/atomic"
+)
+
+// LogLevel selects how much the package logs. Errors are always cheap to keep on;
+// LogDebug reports every posted work request and completion and is meant for
+// diagnostics only.
+type LogLevel int
+
+const (
+	// LogSilent disables all output.
+	LogSilent LogLevel = C.RDMA_LOG_SILENT
+	// LogError reports failures only.
+	LogError LogLevel = C.RDMA_LOG_ERROR
+	// LogInfo additionally reports connection setup. This is the default.
+	LogInfo LogLevel = C.RDMA_LOG_INFO
+	// LogDebug additionally reports every operation on the data path.
+	LogDebug LogLevel = C.RDMA_LOG_DEBUG
+)
+
+// String returns the lower-case name of the level.
+func (l LogLevel) String() string {
+	switch l {
+	case LogSilent:
+		return "silent"
+	case LogError:
+		return "error"
+	case LogInfo:
+		return "info"
+	case LogDebug:
+		return "debug"
+	}
+	return fmt.Sprintf("LogLevel(%d)", int(l))
+}
+
+// LogHook receives log records instead of stdout/stderr once installed with SetLogHook.
+// `origin` is the name of the C function (or Go function) that logged the record and
+// `msg` is the formatted message without a trailing newline.
+type LogHook func(level LogLevel, origin string, msg string)
+
+// logHook holds the installed LogHook, if any.
+var logHook atomic.Pointer[LogHook]
+
+// SetLogLevel sets the process-wide log level of both the Go and the C side.
+//
+// The data path only logs at LogDebug, so any lower level keeps it silent. Builds
+// that must not even pay for the level check can compile the debug records out with
+// CGO_CFLAGS=-DRDMA_LOG_MAX_LEVEL=2.
+func SetLogLevel(level LogLevel) {
+	C.rdma_set_log_level(C.int(level))
+}
+
+// GetLogLevel returns the current process-wide log level.
+func GetLogLevel() LogLevel {
+	return LogLevel(C.rdma_get_log_level())
+}
+
+// SetLogHook routes all log records of the package to `hook`. Passing nil restores
+// the default output to stdout/stderr. The hook may be called from any goroutine and
+// from inside C calls, so it must not call back into the package.
+func SetLogHook(hook LogHook) {
+	if hook == nil {
+		C.rdma_set_log_hook(nil)
+		logHook.Store(nil)
+		return
+	}
+	logHook.Store(&hook)
+	C.rdma_set_log_hook((*[0]byte)(C.rdmaGoLogHook))
+}
+
+// logf logs a record from the Go side with the same level filtering and routing as
+// the C side.
+func logf(level LogLevel, origin string, format string, args ...interface{}) {
+	if level > GetLogLevel() {
+		return
+	}
+	msg := fmt.Sprintf(format, args...)
+	if hook := logHook.Load(); hook != nil {
+		(*hook)(level, origin, msg)
+		return
+	}
+	// 与 C 侧一致：错误写到 stderr，其余写到 stdout
+	out := os.Stdout
+	if level == LogError {
+		out = os.Stderr
+	}
+	fmt.Fprintln(out, msg)
+}
+
+//export rdmaGoLogHook
+func rdmaGoLogHook(level C.int, function *C.char, msg *C.char) {
+	hook := logHook.Load()
+	if hook == nil {
+		return
+	}
+	(*hook)(LogLevel(level), C.GoString(function), strings.TrimRight(C.GoString(msg), "\n"))
+}
@@ -0,0 +1,146 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"time"
+	"unsafe"
+)
+
+// ErrTimeout is returned by Recv when no message arrived within the timeout.
+var ErrTimeout = errors.New("rdmahandler: timed out")
+
+// WithMessaging enables two-sided SEND/RECV messaging on the connection with a private
+// ring of `slots` receive buffers of `slotSize` bytes each. All slots stay posted as
+// receive requests; consumed slots are re-posted in batches. A message may be as
+// large as the peer's slot size. Both peers need messaging enabled (privately or
+// through WithSharedReceiveQueue) to exchange messages.
+//
+// Messaging uses the receive queue and therefore cannot be combined with
+// WithInbandCompletion.
+func WithMessaging(slots, slotSize int) Option {
+	return func(o *connOptions) {
+		if slots > 0 && slotSize > 0 {
+			o.msgSlots = slots
+			o.msgSlotSize = slotSize
+		}
+	}
+}
+
+// SharedReceiveQueue is a ring of receive buffers behind an SRQ that any number of
+// connections on the same Device can share. A server that gives every connection
+// to one core's queue needs receive memory per core, not per peer.
+type SharedReceiveQueue struct {
+	ring *C.struct_msg_ring
+}
+
+// NewSharedReceiveQueue creates a shared ring of `slots` receive buffers of
+// `slotSize` bytes on `dev`, or on a newly opened device when dev is nil.
+// Connections use it through WithSharedReceiveQueue.
+func NewSharedReceiveQueue(dev *Device, slots, slotSize int) (*SharedReceiveQueue, error) {
+	if slots <= 0 || slotSize <= 0 {
+		return nil, fmt.Errorf("invalid shared receive queue of %d slots of %d bytes", slots, slotSize)
+	}
+	if dev == nil {
+		var err error
+		if dev, err = OpenDevice(); err != nil {
+			return nil, err
+		}
+		// the ring takes its own device reference
+		defer dev.Close()
+	} else if dev.dev == nil {
+		return nil, fmt.Errorf("device is closed")
+	}
+	ring := C.msg_ring_create(dev.dev, C.int(slots), C.uint32_t(slotSize), 1)
+	if ring == nil {
+		return nil, fmt.Errorf("failed to create shared receive queue")
+	}
+	return &SharedReceiveQueue{ring: ring}, nil
+}
+
+// Close destroys the SRQ and its buffers. Every connection using it must have been
+// destroyed before.
+func (q *SharedReceiveQueue) Close() error {
+	if q.ring == nil {
+		return nil
+	}
+	if C.msg_ring_destroy(q.ring) != 0 {
+		return fmt.Errorf("failed to destroy shared receive queue")
+	}
+	q.ring = nil
+	return nil
+}
+
+// WithSharedReceiveQueue enables messaging on the connection and receives its
+// messages through `q`. The connection is created on the queue's device.
+func WithSharedReceiveQueue(q *SharedReceiveQueue) Option {
+	return func(o *connOptions) {
+		o.srq = q
+	}
+}
+
+// Send sends `data` as one message to the peer and waits until the HCA has delivered
+// it. Payloads up to MaxInline bytes go out inline straight from `data`; larger ones
+// are staged in a registered send buffer. The message must fit in the peer's slot
+// size (see PeerMessageSize).
+//
+// Like the other synchronous operations, Send requires that no asynchronous requests
+// are outstanding on the connection.
+func (h *RDMAHandler) Send(res *RDMAResources, data []byte, character string) error {
+	if err := res.checkIdle(character); err != nil {
+		return err
+	}
+	if len(data) > res.PeerMessageSize() {
+		return fmt.Errorf("%s: message of %d bytes exceeds the peer's %d byte slots", character, len(data), res.PeerMessageSize())
+	}
+	var p unsafe.Pointer
+	if len(data) > 0 {
+		p = unsafe.Pointer(&data[0])
+	}
+	if C.msg_send(&res.res, p, C.uint32_t(len(data))) != 0 {
+		return fmt.Errorf("%s: failed to send message", character)
+	}
+	return nil
+}
+
+// Recv returns the next message from the peer, waiting up to `timeout` for one to
+// arrive (a negative timeout waits forever). The message is copied out of its
+// receive slot, which goes straight back to the ring. ErrTimeout reports that
+// nothing arrived in time.
+func (h *RDMAHandler) Recv(res *RDMAResources, timeout time.Duration, character string) ([]byte, error) {
+	if err := res.checkIdle(character); err != nil {
+		return nil, err
+	}
+	var slot, length C.uint32_t
+	done, err := res.await(timeout, func(timeoutUsec C.long) (bool, error) {
+		switch C.msg_recv(&res.res, &slot, &length, timeoutUsec) {
+		case 0:
+			return true, nil
+		case C.POLL_TIMED_OUT:
+			return false, nil
+		default:
+			return false, fmt.Errorf("%s: receiving message failed", character)
+		}
+	})
+	if err != nil {
+		return nil, err
+	}
+	if !done {
+		return nil, ErrTimeout
+	}
+	msg := C.GoBytes(C.msg_slot(&res.res, slot), C.int(length))
+	if C.msg_release(&res.res, slot) != 0 {
+		return nil, fmt.Errorf("%s: failed to re-post receive slot", character)
+	}
+	return msg, nil
+}
+
+// PeerMessageSize returns the largest message the peer accepts, 0 if the peer has
+// messaging disabled.
+func (r *RDMAResources) PeerMessageSize() int {
+	return int(C.remote_msg_size(&r.res))
+}
@@ -0,0 +1,129 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"runtime"
+)
+
+// NUMADevice selects the NUMA node the RDMA device is attached to.
+const NUMADevice = C.NUMA_NODE_DEVICE
+
+// WithNUMANode allocates the connection's registered buffer on NUMA node `node`,
+// or on the device's own node (as reported by sysfs) when node is NUMADevice, so
+// that the HCA's DMA does not cross sockets. The node is preferred, not required:
+// pages go elsewhere when it is full. Without the option, or when the device's
+// node is unknown, the buffer is allocated as before.
+//
+// Slabs of a MemoryPool always prefer the node of the pool's device.
+func WithNUMANode(node int) Option {
+	return func(o *connOptions) {
+		o.numaBind = true
+		o.numaNode = node
+	}
+}
+
+// WithCompletionVector creates the connection's CQ on completion vector `vector`
+// (taken modulo the device's vector count). In event mode (WithEventCompletion)
+// the vector decides which core handles the CQ's interrupts. By default the
+// connections of a device take its vectors in turn; the extra QPs of a striped
+// connection always do.
+func WithCompletionVector(vector int) Option {
+	return func(o *connOptions) {
+		if vector >= 0 {
+			o.compVector = &vector
+		}
+	}
+}
+
+// NUMANode returns the NUMA node the device is attached to, -1 if unknown.
+func (d *Device) NUMANode() int {
+	if d.dev == nil {
+		return -1
+	}
+	return int(d.dev.numa_node)
+}
+
+// LocalCPUs returns the CPUs on the device's NUMA node as listed in sysfs, nil if
+// unknown. They are the natural choice for the goroutines polling its CQs.
+func (d *Device) LocalCPUs() []int {
+	if d.dev == nil {
+		return nil
+	}
+	return localCPUs(d.dev)
+}
+
+// NUMANode returns the NUMA node of the connection's device, -1 if unknown.
+func (r *RDMAResources) NUMANode() int {
+	return int(r.res.dev.numa_node)
+}
+
+// LocalCPUs returns the CPUs on the NUMA node of the connection's device, nil if
+// unknown.
+func (r *RDMAResources) LocalCPUs() []int {
+	return localCPUs(r.res.dev)
+}
+
+// CompletionVector returns the completion vector of the connection's CQ.
+func (r *RDMAResources) CompletionVector() int {
+	return int(r.res.comp_vector)
+}
+
+// localCPUs reads the local CPU list of `dev` from sysfs.
+func localCPUs(dev *C.struct_rdma_device) []int {
+	cpus := make([]C.int, C.THREAD_MAX_CPUS)
+	n := int(C.device_local_cpus(dev.ib_ctx, &cpus[0], C.int(len(cpus))))
+	if n == 0 {
+		return nil
+	}
+	out := make([]int, n)
+	for i := range out {
+		out[i] = int(cpus[i])
+	}
+	return out
+}
+
+// PinThread locks the calling goroutine to its OS thread and restricts that thread
+// to `cpus`, so that a goroutine busy-polling a CQ stays on cores close to the
+// device instead of migrating across sockets. The returned function restores the
+// thread's previous affinity and unlocks the goroutine; it must be called from the
+// same goroutine. A goroutine that exits while pinned takes its thread with it.
+//
+// Example:
+//
+//	restore, err := rdmahandler.PinThread(res.LocalCPUs())
+//	if err != nil {
+//	    return err
+//	}
+//	defer restore()
+//	for {
+//	    n, err := h.ReapInto(res, done, -1)
+//	    ...
+//	}
+func PinThread(cpus []int) (func() error, error) {
+	if len(cpus) == 0 {
+		return nil, fmt.Errorf("no CPUs to pin to")
+	}
+	set := make([]C.int, len(cpus))
+	for i, cpu := range cpus {
+		set[i] = C.int(cpu)
+	}
+	saved := C.malloc(C.THREAD_MASK_SIZE)
+	runtime.LockOSThread()
+	if C.thread_pin(&set[0], C.int(len(set)), saved) != 0 {
+		runtime.UnlockOSThread()
+		C.free(saved)
+		return nil, fmt.Errorf("failed to pin thread to CPUs %v", cpus)
+	}
+	return func() error {
+		defer C.free(saved)
+		defer runtime.UnlockOSThread()
+		if C.thread_restore(saved) != 0 {
+			return fmt.Errorf("failed to restore thread affinity")
+		}
+		return nil
+	}, nil
+}
@@ -0,0 +1,30 @@
+package rdmahandler
+
+import (
+	"reflect"
+	"testing"
+)
+
+func TestCPUListParse(t *testing.T) {
+	for _, tc := range []struct {
+		list string
+		max  int
+		want []int
+	}{
+		{"", 16, []int{}},
+		{"5", 16, []int{5}},
+		{"0-3", 16, []int{0, 1, 2, 3}},
+		{"0-11,24-35", 32, []int{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35}},
+		{"0,2,4-5,9", 16, []int{0, 2, 4, 5, 9}},
+		// CPU 数组满了就停下
+		{"0-7", 3, []int{0, 1, 2}},
+		{"1,3-9", 4, []int{1, 3, 4, 5}},
+		// 格式错误的条目之后不再解析
+		{"0-1,x,4", 16, []int{0, 1}},
+		{"3-1", 16, []int{}},
+	} {
+		if got := cCPUListParse(tc.list, tc.max); !reflect.DeepEqual(got, tc.want) {
+			t.Errorf("cpulist_parse(%q, %d) = %v, want %v", tc.list, tc.max, got, tc.want)
+		}
+	}
+}
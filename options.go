@@ -0,0 +1,151 @@
+package rdmahandler
+
+import "time"
+
+// Option configures a single RDMA connection created by InitServer or InitClient.
+//
+// Options are applied in order, so a later option overrides an earlier one that
+// sets the same field.
+//
+// Example:
+//
+//	res, err := h.InitClient("192.168.1.10", 8080, rdmahandler.WithBufferSize(4<<20))
+type Option func(*connOptions)
+
+// connOptions holds the per-connection settings collected from Option values.
+type connOptions struct {
+	bufSize int
+	inband  bool
+	qpDepth int
+	cqDepth int
+	mtu     int
+	rdDepth int
+	inline  int
+	stripes int
+
+	latSample int
+
+	numaBind   bool
+	numaNode   int
+	compVector *int
+
+	eventMode bool
+	spin      time.Duration
+
+	handshakeTimeout time.Duration
+
+	device *Device
+	pool   *MemoryPool
+
+	msgSlots    int
+	msgSlotSize int
+	srq         *SharedReceiveQueue
+
+	devName string
+	ibPort  int
+	gidIdx  *int
+}
+
+// defaultConnOptions returns the settings used when no Option is given.
+// A zero buffer size keeps the historical MSG_SIZE region.
+func defaultConnOptions() connOptions {
+	return connOptions{}
+}
+
+// WithBufferSize sets the size in bytes of the memory region registered for the
+// connection. Both peers should use sizes large enough for the transfers they
+// intend to issue; every RDMA range is checked against the remote size
+// exchanged during the handshake.
+//
+// A non-positive size keeps the default (MSG_SIZE).
+func WithBufferSize(size int) Option {
+	return func(o *connOptions) {
+		if size > 0 {
+			o.bufSize = size
+		}
+	}
+}
+
+// WithInbandCompletion makes Write, Read, WriteAt and ReadAt signal completion
+// in-band instead of bracketing every operation with two TCP synchronizations.
+//
+// A write is posted as RDMA WRITE_WITH_IMM carrying the payload length; the
+// peer's Read/ReadAt waits for the matching receive completion, returns the data
+// that landed in its buffer and acknowledges it with a zero-length
+// WRITE_WITH_IMM. The TCP socket is then only used for setup and teardown.
+//
+// Both peers must enable the option, and in this mode every Write is consumed
+// by exactly one Read on the other side.
+func WithInbandCompletion() Option {
+	return func(o *connOptions) {
+		o.inband = true
+	}
+}
+
+// WithQueueDepth sets how many work requests the send and receive queues hold, and
+// therefore how many asynchronous PostWrite/PostRead requests may be in flight at
+// once. The value is clamped to the device limit.
+//
+// A non-positive depth keeps the default (DEFAULT_QP_DEPTH).
+func WithQueueDepth(depth int) Option {
+	return func(o *connOptions) {
+		if depth > 0 {
+			o.qpDepth = depth
+		}
+	}
+}
+
+// WithCQDepth sets the number of entries of the completion queue. It must cover every
+// send and receive request that can complete before Reap runs; the default of twice the
+// queue depth does. The value is clamped to the device limit.
+//
+// A non-positive depth keeps the default.
+func WithCQDepth(depth int) Option {
+	return func(o *connOptions) {
+		if depth > 0 {
+			o.cqDepth = depth
+		}
+	}
+}
+
+// WithReadDepth caps how many RDMA reads (and atomics) the connection keeps in flight
+// on its QP. By default both peers announce their device limits during the handshake
+// and each side may issue as many reads as the other can serve, so pipelined PostRead
+// requests overlap instead of paying one round trip each.
+//
+// A non-positive depth keeps the default.
+func WithReadDepth(depth int) Option {
+	return func(o *connOptions) {
+		if depth > 0 {
+			o.rdDepth = depth
+		}
+	}
+}
+
+// WithMaxInline sets how many bytes of payload the QP should accept inline in a
+// work request. Writes and in-band messages up to the granted size are copied into
+// the request by the CPU (IBV_SEND_INLINE) instead of being DMA-read through the MR,
+// which saves a PCIe round trip per small message. Devices that refuse the size get
+// a QP without inline support; MaxInline reports what was granted.
+//
+// Zero keeps the default (DEFAULT_MAX_INLINE); a negative size disables inline sends.
+func WithMaxInline(size int) Option {
+	return func(o *connOptions) {
+		o.inline = size
+	}
+}
+
+// WithHandshakeTimeout bounds every socket read and write of the connection's
+// handshake, in InitClient and InitServer as well as in Reconnect and Redial, so
+// that a peer that stopped answering fails the handshake instead of blocking it
+// forever. The limit is lifted once the connection is established.
+//
+// A non-positive timeout keeps the default of no limit. Peers accepted by a
+// Server are bounded by ServerConfig.HandshakeTimeout instead.
+func WithHandshakeTimeout(timeout time.Duration) Option {
+	return func(o *connOptions) {
+		if timeout > 0 {
+			o.handshakeTimeout = timeout
+		}
+	}
+}
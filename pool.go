@@ -0,0 +1,202 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"unsafe"
+)
+
+// PoolConfig configures a MemoryPool.
+type PoolConfig struct {
+	// SlabSize is the size in bytes of the slabs that small size classes are carved
+	// from. Zero keeps the default of one 2 MiB huge page.
+	SlabSize int
+	// Prealloc is the number of slabs registered up front for every size class that
+	// fits in a slab, so that the first Alloc calls do not register memory.
+	Prealloc int
+	// Device is the device whose PD the slabs are registered in. Nil opens a
+	// device for the pool alone.
+	Device *Device
+}
+
+// MemoryPool hands out blocks of memory that were registered with the RDMA device
+// ahead of time. Registration pins pages and costs far more than the transfers
+// themselves, so a pool registers slabs once and serves every later allocation
+// from them. Blocks come in power-of-two size classes from 64 B to 64 MiB.
+//
+// The pool holds a reference on a Device; connections created with WithPool share
+// that device and lease their buffer from the pool.
+// A MemoryPool is safe for concurrent use.
+type MemoryPool struct {
+	pool *C.struct_mem_pool
+}
+
+// Block is a leased, registered chunk of a MemoryPool. Its memory stays valid
+// until the block is returned with MemoryPool.Free.
+type Block struct {
+	blk  C.struct_mem_block
+	size int
+}
+
+// NewMemoryPool creates a pool on cfg.Device, or on a newly opened device when it is nil.
+//
+// Example:
+//
+//	pool, err := rdmahandler.NewMemoryPool(rdmahandler.PoolConfig{Prealloc: 1})
+//	if err != nil {
+//	    return err
+//	}
+//	defer pool.Close()
+//	res, err := h.InitClient("192.168.1.10", 8080, rdmahandler.WithPool(pool))
+func NewMemoryPool(cfg PoolConfig) (*MemoryPool, error) {
+	if cfg.SlabSize < 0 || cfg.Prealloc < 0 {
+		return nil, fmt.Errorf("invalid pool configuration %+v", cfg)
+	}
+	var dev *C.struct_rdma_device
+	if cfg.Device != nil {
+		if cfg.Device.dev == nil {
+			return nil, fmt.Errorf("device is closed")
+		}
+		dev = cfg.Device.dev
+	}
+	p := C.mem_pool_create(dev, C.size_t(cfg.SlabSize), C.int(cfg.Prealloc))
+	if p == nil {
+		return nil, fmt.Errorf("failed to create memory pool")
+	}
+	return &MemoryPool{pool: p}, nil
+}
+
+// Close deregisters all slabs and drops the pool's device reference. It fails while blocks,
+// including the buffers of connections created with the pool, are still leased.
+func (p *MemoryPool) Close() error {
+	if p.pool == nil {
+		return nil
+	}
+	if C.mem_pool_destroy(p.pool) != 0 {
+		return fmt.Errorf("failed to destroy memory pool")
+	}
+	p.pool = nil
+	return nil
+}
+
+// Alloc leases a block of at least `size` bytes. Only when every slab of the
+// matching size class is in use is a new slab registered.
+func (p *MemoryPool) Alloc(size int) (*Block, error) {
+	if size <= 0 {
+		return nil, fmt.Errorf("invalid block size %d", size)
+	}
+	b := &Block{size: size}
+	if C.mem_pool_alloc(p.pool, C.size_t(size), &b.blk) != 0 {
+		return nil, fmt.Errorf("failed to allocate %d bytes from the memory pool", size)
+	}
+	return b, nil
+}
+
+// Free returns a block to the pool. The block must not be used afterwards, nor
+// freed while a request posted from it is outstanding.
+func (p *MemoryPool) Free(b *Block) error {
+	if b == nil || b.size == 0 {
+		return fmt.Errorf("block is not leased")
+	}
+	if C.mem_pool_free(p.pool, &b.blk) != 0 {
+		return fmt.Errorf("failed to return block to the memory pool")
+	}
+	b.size = 0
+	return nil
+}
+
+// Bytes returns a slice aliasing the block's memory, of the size requested in Alloc.
+func (b *Block) Bytes() []byte {
+	// addr holds a C pointer as an integer; reinterpret it without the uintptr round trip
+	return unsafe.Slice(*(**byte)(unsafe.Pointer(&b.blk.addr)), b.size)
+}
+
+// Size returns the size requested in Alloc.
+func (b *Block) Size() int {
+	return b.size
+}
+
+// Capacity returns the size of the block's size class, which may exceed Size.
+func (b *Block) Capacity() int {
+	return int(b.blk.size)
+}
+
+// Addr returns the virtual address of the block, as used in work requests.
+func (b *Block) Addr() uint64 {
+	return uint64(b.blk.addr)
+}
+
+// Lkey returns the local key of the MR covering the block.
+func (b *Block) Lkey() uint32 {
+	return uint32(b.blk.lkey)
+}
+
+// Rkey returns the remote key of the MR covering the block. That MR is the whole
+// slab's, so a peer given the key can access every block of the slab, also
+// those leased to other connections: only hand it to trusted peers.
+func (b *Block) Rkey() uint32 {
+	return uint32(b.blk.rkey)
+}
+
+// WithPool creates the connection on the pool's Device and leases its buffer from
+// the pool instead of allocating a new one. The leased range gets an MR of its own,
+// whose rkey is what the peer learns, so a peer cannot reach the blocks of other
+// connections in the same slab; since the slab already pins the pages, this
+// registration is much cheaper than registering fresh memory. Only connections
+// created with a pool can post from pool blocks with PostWriteBlock and
+// PostReadBlock. The pool must outlive the connection.
+func WithPool(p *MemoryPool) Option {
+	return func(o *connOptions) {
+		o.pool = p
+	}
+}
+
+// PostWriteBlock posts an RDMA write of [blockOffset, blockOffset+length) of `b` to
+// `remoteOffset` of the remote buffer, tagged with `wrID`. Unlike PostWrite it does not
+// copy: the HCA reads straight from the block. The block must come from the pool
+// the connection was created with and must not be changed or freed before the
+// completion has been reaped.
+//
+// When the send queue is full, ErrQueueFull is returned and nothing is posted.
+func (h *RDMAHandler) PostWriteBlock(res *RDMAResources, b *Block, blockOffset, remoteOffset, length int, wrID uint64) error {
+	return res.postBlock(C.IBV_WR_RDMA_WRITE, b, blockOffset, remoteOffset, length, wrID)
+}
+
+// PostReadBlock posts an RDMA read of `length` bytes from `remoteOffset` of the remote
+// buffer into `b` at `blockOffset`, tagged with `wrID`. The data is available through
+// b.Bytes() once Reap has returned the completion.
+//
+// When the send queue is full, ErrQueueFull is returned and nothing is posted.
+func (h *RDMAHandler) PostReadBlock(res *RDMAResources, b *Block, blockOffset, remoteOffset, length int, wrID uint64) error {
+	return res.postBlock(C.IBV_WR_RDMA_READ, b, blockOffset, remoteOffset, length, wrID)
+}
+
+// postBlock checks the ranges and posts a work request from a pool block.
+func (r *RDMAResources) postBlock(opcode C.int, b *Block, blockOffset, remoteOffset, length int, wrID uint64) error {
+	if err := checkWrID(wrID); err != nil {
+		return err
+	}
+	if r.res.pool == nil {
+		return fmt.Errorf("connection was not created with a memory pool")
+	}
+	if b == nil || b.size == 0 {
+		return fmt.Errorf("block is not leased")
+	}
+	if blockOffset < 0 || length < 0 || blockOffset+length > b.Capacity() {
+		return fmt.Errorf("range [%d, +%d) is out of the %d byte block", blockOffset, length, b.Capacity())
+	}
+	if remoteOffset < 0 || remoteOffset+length > r.RemoteBufferSize() {
+		return fmt.Errorf("range [%d, +%d) is out of the %d byte remote buffer", remoteOffset, length, r.RemoteBufferSize())
+	}
+	if r.queueFull() {
+		return ErrQueueFull
+	}
+	if C.post_block_async(&r.res, opcode, C.uint64_t(wrID), &b.blk, C.size_t(blockOffset),
+		C.size_t(remoteOffset), C.uint32_t(length)) != 0 {
+		return fmt.Errorf("failed to post work request wr_id %d from pool block", wrID)
+	}
+	return nil
+}
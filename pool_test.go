@@ -0,0 +1,28 @@
+package rdmahandler
+
+import "testing"
+
+func TestPoolSizeClass(t *testing.T) {
+	const min = 1 << poolMinShift
+	const max = 1 << (poolMinShift + poolNumClasses - 1)
+	for _, tc := range []struct {
+		size int
+		want int
+	}{
+		{0, 0},
+		{1, 0},
+		{min, 0},
+		{min + 1, 1},
+		{2 * min, 1},
+		{2*min + 1, 2},
+		{4096, 12 - poolMinShift},
+		{4097, 13 - poolMinShift},
+		{max - 1, poolNumClasses - 1},
+		{max, poolNumClasses - 1},
+		{max + 1, -1},
+	} {
+		if got := cPoolSizeClass(tc.size); got != tc.want {
+			t.Errorf("pool_size_class(%d) = %d, want %d", tc.size, got, tc.want)
+		}
+	}
+}
@@ -0,0 +1,507 @@
+#include <rdma_operations.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+/******************************************************************************
+Memory-mapped file transfer
+A file is mapped with mmap and the mapping is registered as a whole, so the
+HCA moves the page cache straight onto the wire and into the peer's mapped
+destination without a copy through a staging buffer. Devices with on-demand
+paging get an ODP MR: registration does not pin or read the file, the HCA
+faults pages in as the transfer reaches them. Otherwise the mapping is
+registered normally, which pins it for the duration of the transfer.
+
+Both peers run one of two pairs in lockstep over the connection's TCP socket:
+file_push/file_accept, where the owner of the file RDMA WRITEs it into the
+receiver's mapping, and file_pull/file_serve, where the receiver RDMA READs it
+from the owner's mapping. The transfer itself is pipelined in FILE_CHUNK_SIZE
+requests, as many in flight as the send queue holds. A final exchange of
+status words tells both sides whether the data arrived.
+******************************************************************************/
+/******************************************************************************
+ * Function: device_odp_caps
+ *
+ * Input
+ * ctx opened device context
+ *
+ * Returns
+ * the device's RC on-demand paging capabilities (IBV_ODP_SUPPORT_*), 0 if
+ * it has none
+ ******************************************************************************/
+int device_odp_caps(struct ibv_context *ctx)
+{
+	struct ibv_device_attr_ex attr;
+	memset(&attr, 0, sizeof(attr));
+	if (ibv_query_device_ex(ctx, NULL, &attr))
+		return 0;
+	if (!(attr.odp_caps.general_caps & IBV_ODP_SUPPORT))
+		return 0;
+	return attr.odp_caps.per_transport_caps.rc_odp_caps;
+}
+/******************************************************************************
+ * Function: reg_mr_odp
+ *
+ * Input
+ * dev device to register with
+ * addr start of the memory
+ * length number of bytes
+ * access access flags
+ * odp_need IBV_ODP_SUPPORT_* capabilities an ODP MR would rely on
+ *
+ * Output
+ * odp whether the MR was registered with IBV_ACCESS_ON_DEMAND
+ *
+ * Returns
+ * the MR, NULL on failure
+ *
+ * Description
+ * Register on demand when the device supports it for the intended
+ * operations: the pages are neither pinned nor touched up front and the HCA
+ * faults them in as it reaches them. Otherwise fall back to a regular,
+ * pinning registration.
+ ******************************************************************************/
+struct ibv_mr *reg_mr_odp(struct rdma_device *dev, void *addr, size_t length, int access, int odp_need, int *odp)
+{
+	struct ibv_mr *mr = NULL;
+	*odp = 0;
+	if ((dev->odp_caps & odp_need) == odp_need)
+	{
+		mr = ibv_reg_mr(dev->pd, addr, length, access | IBV_ACCESS_ON_DEMAND);
+		*odp = mr != NULL;
+	}
+	if (!mr)
+		mr = ibv_reg_mr(dev->pd, addr, length, access);
+	return mr;
+}
+/******************************************************************************
+ * Function: file_region_open
+ *
+ * Input
+ * res connection whose device the mapping is registered with
+ * path file to map
+ * size 0 to map an existing file read-only, otherwise the size of the file
+ *      to create (or truncate) and map writable
+ * access remote access flags the peer needs on the mapping
+ * odp_need IBV_ODP_SUPPORT_* capabilities an ODP MR would rely on
+ *
+ * Output
+ * fr the mapped and registered file
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ ******************************************************************************/
+static int file_region_open(struct resources *res, const char *path, uint64_t size, int access, int odp_need,
+							struct file_region *fr)
+{
+	struct stat st;
+	int writable = size != 0;
+	memset(fr, 0, sizeof(*fr));
+	fr->fd = open(path, writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+	if (fr->fd < 0)
+	{
+		log_err("failed to open %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	if (writable)
+	{
+		if (ftruncate(fr->fd, (off_t)size))
+		{
+			log_err("failed to size %s to %" PRIu64 " bytes: %s\n", path, size, strerror(errno));
+			goto file_region_open_error;
+		}
+	}
+	else
+	{
+		if (fstat(fr->fd, &st))
+		{
+			log_err("failed to stat %s: %s\n", path, strerror(errno));
+			goto file_region_open_error;
+		}
+		size = (uint64_t)st.st_size;
+	}
+	fr->size = size;
+	if (!size)
+		return 0;
+	fr->addr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fr->fd, 0);
+	if (fr->addr == MAP_FAILED)
+	{
+		fr->addr = NULL;
+		log_err("failed to map %" PRIu64 " bytes of %s: %s\n", size, path, strerror(errno));
+		goto file_region_open_error;
+	}
+	if (writable)
+		access |= IBV_ACCESS_LOCAL_WRITE;
+	// 顺序访问时让内核提前读入页面，不能按需分页时注册锁定页面会快一些
+	madvise(fr->addr, size, MADV_SEQUENTIAL);
+	fr->mr = reg_mr_odp(res->dev, fr->addr, size, access, odp_need, &fr->odp);
+	if (!fr->mr)
+	{
+		log_err("failed to register %" PRIu64 " bytes of %s\n", size, path);
+		goto file_region_open_error;
+	}
+	log_info("mapped %s: %" PRIu64 " bytes, odp=%d, lkey=0x%x, rkey=0x%x\n", path, size, fr->odp, fr->mr->lkey,
+			 fr->mr->rkey);
+	return 0;
+
+file_region_open_error:
+	if (fr->addr)
+		munmap(fr->addr, size);
+	close(fr->fd);
+	fr->addr = NULL;
+	fr->fd = -1;
+	return 1;
+}
+/******************************************************************************
+ * Function: file_region_close
+ *
+ * Input
+ * fr file opened with file_region_open
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ ******************************************************************************/
+static int file_region_close(struct file_region *fr)
+{
+	int rc = 0;
+	if (fr->mr && ibv_dereg_mr(fr->mr))
+	{
+		log_err("failed to deregister file MR\n");
+		rc = 1;
+	}
+	if (fr->addr)
+		munmap(fr->addr, fr->size);
+	if (fr->fd >= 0)
+		close(fr->fd);
+	memset(fr, 0, sizeof(*fr));
+	fr->fd = -1;
+	return rc;
+}
+/******************************************************************************
+ * Function: file_exchange
+ *
+ * Input
+ * res connection whose socket carries the exchange
+ * fr local file, NULL if there is none yet
+ * size size to announce when fr is NULL
+ *
+ * Output
+ * remote the peer's descriptor in host byte order
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ ******************************************************************************/
+static int file_exchange(struct resources *res, const struct file_region *fr, uint64_t size, struct file_desc *remote)
+{
+	struct file_desc local;
+	struct file_desc tmp;
+	memset(&local, 0, sizeof(local));
+	if (fr)
+	{
+		local.addr = htonll((uintptr_t)fr->addr);
+		local.size = htonll(fr->size);
+		local.rkey = htonl(fr->mr ? fr->mr->rkey : 0);
+	}
+	else
+		local.size = htonll(size);
+	if (sock_sync_data(res->sock, sizeof(local), (char *)&local, (char *)&tmp) < 0)
+	{
+		log_err("failed to exchange file descriptors\n");
+		return 1;
+	}
+	remote->addr = ntohll(tmp.addr);
+	remote->size = ntohll(tmp.size);
+	remote->rkey = ntohl(tmp.rkey);
+	remote->flags = ntohl(tmp.flags);
+	return 0;
+}
+/******************************************************************************
+ * Function: file_finish
+ *
+ * Input
+ * res connection whose socket carries the exchange
+ * rc outcome on this side, 0 for success
+ *
+ * Returns
+ * 0 if both sides succeeded, 1 otherwise
+ *
+ * Description
+ * Swap the outcome with the peer. The receiver of a push only learns here that
+ * the data has landed; either side learns whether the other one failed.
+ ******************************************************************************/
+static int file_finish(struct resources *res, int rc)
+{
+	uint32_t local = htonl(rc ? 1 : 0);
+	uint32_t remote;
+	if (sock_sync_data(res->sock, sizeof(local), (char *)&local, (char *)&remote) < 0)
+	{
+		log_err("failed to exchange file transfer status\n");
+		return 1;
+	}
+	if (!rc && remote)
+		log_err("peer failed the file transfer\n");
+	return rc || remote ? 1 : 0;
+}
+/******************************************************************************
+ * Function: region_stream
+ *
+ * Input
+ * res connection to transfer on
+ * opcode IBV_WR_RDMA_WRITE to push the local memory to the peer,
+ *        IBV_WR_RDMA_READ to pull the peer's memory into it
+ * addr local memory
+ * size number of bytes
+ * lkey local key of the MR covering the memory
+ * remote the peer's memory, in host byte order
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Move the whole range in FILE_CHUNK_SIZE requests, keeping as many of them
+ * in flight as the send queue has room for. Completions of the library's
+ * internal requests that share the CQ are accounted as usual. File
+ * transfers and the rendezvous path of rdma_xfer both stream through here.
+ ******************************************************************************/
+int region_stream(struct resources *res, int opcode, void *addr, uint64_t size, uint32_t lkey,
+				  const struct file_desc *remote)
+{
+	struct ibv_send_wr sr;
+	struct ibv_send_wr *bad_wr = NULL;
+	struct ibv_sge sge;
+	struct ibv_wc wc[POLL_BATCH];
+	uint64_t offset = 0;
+	int window = res->qp_depth - res->sq_outstanding;
+	int inflight = 0;
+	int n;
+	int i;
+	if (opcode == IBV_WR_RDMA_READ && res->max_rd_atomic > 0 && window > res->max_rd_atomic)
+		window = res->max_rd_atomic;
+	if (window < 1)
+	{
+		log_err("send queue is full (%d requests outstanding)\n", res->sq_outstanding);
+		return 1;
+	}
+	while (offset < size || inflight)
+	{
+		while (offset < size && inflight < window)
+		{
+			memset(&sge, 0, sizeof(sge));
+			sge.addr = (uintptr_t)addr + offset;
+			sge.length = size - offset < FILE_CHUNK_SIZE ? (uint32_t)(size - offset) : FILE_CHUNK_SIZE;
+			sge.lkey = lkey;
+			memset(&sr, 0, sizeof(sr));
+			sr.wr_id = offset;
+			sr.sg_list = &sge;
+			sr.num_sge = 1;
+			sr.opcode = opcode;
+			sr.send_flags = IBV_SEND_SIGNALED;
+			sr.wr.rdma.remote_addr = remote->addr + offset;
+			sr.wr.rdma.rkey = remote->rkey;
+			if (ibv_post_send(res->qp, &sr, &bad_wr))
+			{
+				log_err("failed to post chunk at offset %" PRIu64 "\n", offset);
+				goto region_stream_drain;
+			}
+			stats_posted(res, opcode, sge.length);
+			offset += sge.length;
+			inflight++;
+		}
+		n = poll_cq_batch(res, wc, POLL_BATCH, MAX_POLL_CQ_TIMEOUT * 1000L);
+		if (n <= 0)
+		{
+			log_err("chunk did not complete after timeout\n");
+			return 1;
+		}
+		for (i = 0; i < n; i++)
+		{
+			if (wc[i].wr_id >= WRID_MSG_RECV)
+			{
+				if (account_internal(res, &wc[i]))
+					return 1;
+				continue;
+			}
+			inflight--;
+			if (wc[i].status != IBV_WC_SUCCESS)
+			{
+				log_err("chunk at offset %" PRIu64 " failed with status: 0x%x, vendor syndrome: 0x%x\n",
+						wc[i].wr_id, wc[i].status, wc[i].vendor_err);
+				goto region_stream_drain;
+			}
+		}
+	}
+	return 0;
+
+region_stream_drain:
+	// 失败之后仍要取走在途请求的完成事件，连接才能继续使用（QP 出错时它们都会被冲刷）
+	while (inflight > 0)
+	{
+		n = poll_cq_batch(res, wc, POLL_BATCH, MAX_POLL_CQ_TIMEOUT * 1000L);
+		if (n <= 0)
+			break;
+		for (i = 0; i < n; i++)
+			if (wc[i].wr_id < WRID_MSG_RECV)
+				inflight--;
+			else
+				account_internal(res, &wc[i]);
+	}
+	return 1;
+}
+/******************************************************************************
+ * Function: file_push
+ *
+ * Input
+ * res connected resources; the peer runs file_accept
+ * path file to send
+ *
+ * Output
+ * bytes size of the file
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Map `path`, learn where the peer mapped its destination and RDMA WRITE the
+ * file into it.
+ ******************************************************************************/
+int file_push(struct resources *res, const char *path, uint64_t *bytes)
+{
+	struct file_region fr;
+	struct file_desc remote;
+	int rc;
+	// 打开失败也要完成两次交换，对端才不会一直等待
+	rc = file_region_open(res, path, 0, 0, IBV_ODP_SUPPORT_WRITE, &fr);
+	if (file_exchange(res, rc ? NULL : &fr, 0, &remote))
+		rc = 1;
+	if (file_exchange(res, rc ? NULL : &fr, 0, &remote))
+		rc = 1;
+	if (!rc && fr.size && remote.size != fr.size)
+	{
+		log_err("peer mapped %" PRIu64 " bytes for a %" PRIu64 " byte file\n", remote.size, fr.size);
+		rc = 1;
+	}
+	if (!rc && fr.size)
+		rc = region_stream(res, IBV_WR_RDMA_WRITE, fr.addr, fr.size, fr.mr->lkey, &remote);
+	if (!rc)
+		*bytes = fr.size;
+	rc = file_finish(res, rc);
+	if (fr.fd >= 0 && file_region_close(&fr))
+		rc = 1;
+	return rc;
+}
+/******************************************************************************
+ * Function: file_accept
+ *
+ * Input
+ * res connected resources; the peer runs file_push
+ * path destination file, created or truncated
+ *
+ * Output
+ * bytes size of the received file
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ ******************************************************************************/
+int file_accept(struct resources *res, const char *path, uint64_t *bytes)
+{
+	struct file_region fr;
+	struct file_desc remote;
+	int rc = 0;
+	memset(&fr, 0, sizeof(fr));
+	fr.fd = -1;
+	// 第一次交换得到文件大小，第二次交换告诉对端目标映射的位置
+	if (file_exchange(res, NULL, 0, &remote))
+		rc = 1;
+	if (!rc && remote.size)
+		rc = file_region_open(res, path, remote.size, IBV_ACCESS_REMOTE_WRITE, IBV_ODP_SUPPORT_WRITE, &fr);
+	else if (!rc)
+	{
+		// 空文件只需创建
+		fr.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fr.fd < 0)
+		{
+			log_err("failed to create %s: %s\n", path, strerror(errno));
+			rc = 1;
+		}
+	}
+	if (file_exchange(res, rc ? NULL : &fr, 0, &remote))
+		rc = 1;
+	if (!rc)
+		*bytes = fr.size;
+	rc = file_finish(res, rc);
+	if (fr.fd >= 0 && file_region_close(&fr))
+		rc = 1;
+	return rc;
+}
+/******************************************************************************
+ * Function: file_pull
+ *
+ * Input
+ * res connected resources; the peer runs file_serve
+ * path destination file, created or truncated
+ *
+ * Output
+ * bytes size of the received file
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Learn the size and location of the peer's mapped file, map a destination of
+ * that size and RDMA READ the file into it.
+ ******************************************************************************/
+int file_pull(struct resources *res, const char *path, uint64_t *bytes)
+{
+	struct file_region fr;
+	struct file_desc remote;
+	int rc = 0;
+	memset(&fr, 0, sizeof(fr));
+	fr.fd = -1;
+	if (file_exchange(res, NULL, 0, &remote))
+		rc = 1;
+	if (!rc && remote.size)
+		rc = file_region_open(res, path, remote.size, 0, IBV_ODP_SUPPORT_READ, &fr);
+	else if (!rc)
+	{
+		fr.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fr.fd < 0)
+		{
+			log_err("failed to create %s: %s\n", path, strerror(errno));
+			rc = 1;
+		}
+	}
+	if (!rc && fr.size)
+		rc = region_stream(res, IBV_WR_RDMA_READ, fr.addr, fr.size, fr.mr->lkey, &remote);
+	if (!rc)
+		*bytes = fr.size;
+	rc = file_finish(res, rc);
+	if (fr.fd >= 0 && file_region_close(&fr))
+		rc = 1;
+	return rc;
+}
+/******************************************************************************
+ * Function: file_serve
+ *
+ * Input
+ * res connected resources; the peer runs file_pull
+ * path file to serve
+ *
+ * Output
+ * bytes size of the file
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ ******************************************************************************/
+int file_serve(struct resources *res, const char *path, uint64_t *bytes)
+{
+	struct file_region fr;
+	struct file_desc remote;
+	int rc;
+	rc = file_region_open(res, path, 0, IBV_ACCESS_REMOTE_READ, IBV_ODP_SUPPORT_READ, &fr);
+	if (file_exchange(res, rc ? NULL : &fr, 0, &remote))
+		rc = 1;
+	if (!rc)
+		*bytes = fr.size;
+	rc = file_finish(res, rc);
+	if (fr.fd >= 0 && file_region_close(&fr))
+		rc = 1;
+	return rc;
+}
@@ -0,0 +1,42 @@
+#ifndef RDMA_FILE_H
+#define RDMA_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+/* 文件传输中每个 RDMA 请求搬运的字节数 */
+#define FILE_CHUNK_SIZE (1UL << 20)
+
+/* a file mapped into memory and registered with the device */
+struct file_region
+{
+    void *addr;          /* mmap 得到的地址，空文件为 NULL */
+    uint64_t size;       /* 文件大小 */
+    struct ibv_mr *mr;   /* 覆盖整个映射的 MR */
+    int fd;
+    int odp;             /* MR 是否以 IBV_ACCESS_ON_DEMAND 注册 */
+};
+
+/* what one peer tells the other about its file during a transfer, in network byte order */
+struct file_desc
+{
+    uint64_t addr;  /* 映射的虚拟地址 */
+    uint64_t size;  /* 文件大小 */
+    uint32_t rkey;  /* MR 的远程密钥 */
+    uint32_t flags; /* 保留 */
+};
+
+struct resources;
+struct rdma_device;
+
+int device_odp_caps(struct ibv_context *ctx);
+struct ibv_mr *reg_mr_odp(struct rdma_device *dev, void *addr, size_t length, int access, int odp_need, int *odp);
+int region_stream(struct resources *res, int opcode, void *addr, uint64_t size, uint32_t lkey,
+                  const struct file_desc *remote);
+int file_push(struct resources *res, const char *path, uint64_t *bytes);
+int file_accept(struct resources *res, const char *path, uint64_t *bytes);
+int file_pull(struct resources *res, const char *path, uint64_t *bytes);
+int file_serve(struct resources *res, const char *path, uint64_t *bytes);
+
+#endif
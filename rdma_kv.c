@@ -0,0 +1,913 @@
+#include <rdma_operations.h>
+/******************************************************************************
+Remote key-value table over one-sided verbs
+The server keeps an open hash table in a window [base, base + size) of its
+registered buffer. The window starts with a header that tells a client the
+geometry, followed by the buckets. A bucket is KV_BUCKET_SLOTS consecutive,
+cache-line aligned slots, and every key may live in one of two buckets, so
+a lookup is one RDMA READ of a bucket, or two when the key is not in the
+first. The server's CPU takes no part in it.
+
+Each slot starts with a version word. An odd version marks a write in
+progress; a writer takes the slot by an atomic compare-and-swap from the
+even version it read to the next odd one, writes key and value, and then
+writes the following even version. The slot also carries a checksum over
+its contents, seeded with the version, so a reader that catches a slot in
+the middle of a write, or reads it while the HCA places a write out of
+order, sees a mismatch and reads the bucket again.
+
+A client stages everything in the same window of its own buffer: the two
+buckets it read and the slot it writes. The table stores keys and values
+raw and the version word is updated by RDMA atomics, so both peers must
+share byte order.
+******************************************************************************/
+/* kv_slot_state 的结果 */
+#define KV_SLOT_EMPTY 0
+#define KV_SLOT_MATCH 1
+#define KV_SLOT_OTHER 2
+#define KV_SLOT_TORN 3
+/******************************************************************************
+ * Function: kv_mix
+ *
+ * Input
+ * x 64-bit value
+ *
+ * Returns
+ * the value with its bits avalanched (the murmur3 finalizer)
+ ******************************************************************************/
+static uint64_t kv_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+/******************************************************************************
+ * Function: kv_hash
+ *
+ * Input
+ * data bytes to hash
+ * len number of bytes
+ * seed initial value
+ *
+ * Returns
+ * 64-bit hash of the bytes, computed a word at a time
+ ******************************************************************************/
+uint64_t kv_hash(const void *data, size_t len, uint64_t seed)
+{
+	const char *p = data;
+	uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+	uint64_t w;
+	for (; len >= 8; p += 8, len -= 8)
+	{
+		memcpy(&w, p, 8);
+		h = kv_mix(h ^ w);
+	}
+	if (len)
+	{
+		w = 0;
+		memcpy(&w, p, len);
+		h = kv_mix(h ^ w);
+	}
+	return kv_mix(h);
+}
+/******************************************************************************
+ * Function: kv_bucket_bytes
+ *
+ * Input
+ * kv pointer to the table
+ *
+ * Returns
+ * size of one bucket
+ ******************************************************************************/
+static size_t kv_bucket_bytes(const struct rdma_kv *kv)
+{
+	return (size_t)kv->slot_size * kv->bucket_slots;
+}
+/******************************************************************************
+ * Function: kv_bucket_offset
+ *
+ * Input
+ * kv pointer to the table
+ * bucket bucket index
+ *
+ * Returns
+ * offset of the bucket in the server's buffer
+ ******************************************************************************/
+static size_t kv_bucket_offset(const struct rdma_kv *kv, uint64_t bucket)
+{
+	return kv->base + KV_HEADER_SIZE + bucket * kv_bucket_bytes(kv);
+}
+/******************************************************************************
+ * Function: kv_buckets
+ *
+ * Input
+ * kv pointer to the table
+ * key key bytes
+ * key_len key length
+ *
+ * Output
+ * b the key's candidate buckets, the preferred one first
+ *
+ * Returns
+ * number of candidate buckets, 1 for a single-bucket table and 2 otherwise
+ ******************************************************************************/
+int kv_buckets(const struct rdma_kv *kv, const void *key, uint32_t key_len, uint64_t b[2])
+{
+	uint64_t h = kv_hash(key, key_len, 0);
+	b[0] = h % kv->buckets;
+	if (kv->buckets == 1)
+		return 1;
+	b[1] = kv_mix(h ^ 0x5bd1e9955bd1e995ULL) % kv->buckets;
+	if (b[1] == b[0])
+		b[1] = (b[0] + 1) % kv->buckets;
+	return 2;
+}
+/******************************************************************************
+ * Function: kv_checksum
+ *
+ * Input
+ * slot slot contents
+ * version version the contents belong to
+ * length bytes of key and value
+ *
+ * Returns
+ * checksum over the lengths, key and value, seeded with the version
+ ******************************************************************************/
+uint64_t kv_checksum(const char *slot, uint64_t version, uint32_t length)
+{
+	return kv_hash(slot + KV_CHECKSUM_OFFSET + 8, KV_SLOT_META - KV_CHECKSUM_OFFSET - 8 + length, version);
+}
+/******************************************************************************
+ * Function: kv_slot_state
+ *
+ * Input
+ * kv pointer to the table
+ * slot copy of a slot, or the slot itself
+ * key key bytes
+ * key_len key length
+ *
+ * Returns
+ * KV_SLOT_EMPTY, KV_SLOT_MATCH if the slot holds the key, KV_SLOT_OTHER if it
+ * holds another key, KV_SLOT_TORN if it is being written or was read in the
+ * middle of a write
+ ******************************************************************************/
+static int kv_slot_state(const struct rdma_kv *kv, const char *slot, const void *key, uint32_t key_len)
+{
+	uint64_t version;
+	uint64_t checksum;
+	uint32_t klen;
+	uint32_t vlen;
+	memcpy(&version, slot + KV_VERSION_OFFSET, 8);
+	memcpy(&checksum, slot + KV_CHECKSUM_OFFSET, 8);
+	memcpy(&klen, slot + KV_CHECKSUM_OFFSET + 8, 4);
+	memcpy(&vlen, slot + KV_CHECKSUM_OFFSET + 12, 4);
+	if (version & 1)
+		return KV_SLOT_TORN;
+	if (klen == 0)
+		return KV_SLOT_EMPTY;
+	if (klen > kv->slot_size - KV_SLOT_META || vlen > kv->slot_size - KV_SLOT_META - klen ||
+		kv_checksum(slot, version, klen + vlen) != checksum)
+		return KV_SLOT_TORN;
+	if (klen == key_len && !memcmp(slot + KV_SLOT_META, key, key_len))
+		return KV_SLOT_MATCH;
+	return KV_SLOT_OTHER;
+}
+/******************************************************************************
+ * Function: kv_scan
+ *
+ * Input
+ * kv pointer to the table
+ * bucket copy of a bucket
+ * key key bytes
+ * key_len key length
+ *
+ * Output
+ * match index of the slot holding the key, -1 if none
+ * empty index of the first empty slot, -1 if none
+ *
+ * Returns
+ * number of torn slots
+ ******************************************************************************/
+static int kv_scan(const struct rdma_kv *kv, const char *bucket, const void *key, uint32_t key_len, int *match,
+				   int *empty)
+{
+	int torn = 0;
+	uint32_t i;
+	*match = -1;
+	*empty = -1;
+	for (i = 0; i < kv->bucket_slots; i++)
+	{
+		switch (kv_slot_state(kv, bucket + (size_t)i * kv->slot_size, key, key_len))
+		{
+		case KV_SLOT_MATCH:
+			*match = (int)i;
+			return torn;
+		case KV_SLOT_EMPTY:
+			if (*empty < 0)
+				*empty = (int)i;
+			break;
+		case KV_SLOT_TORN:
+			torn++;
+			break;
+		}
+	}
+	return torn;
+}
+/******************************************************************************
+ * Function: kv_fill
+ *
+ * Input
+ * slot slot to fill; the version word is left alone
+ * version version the new contents will be published with
+ * key key bytes, NULL with key_len 0 to empty the slot
+ * key_len key length
+ * value value bytes
+ * value_len value length
+ *
+ * Returns
+ * number of bytes of the slot that make up the new contents
+ ******************************************************************************/
+static uint32_t kv_fill(char *slot, uint64_t version, const void *key, uint32_t key_len, const void *value,
+						uint32_t value_len)
+{
+	uint64_t checksum;
+	memcpy(slot + KV_CHECKSUM_OFFSET + 8, &key_len, 4);
+	memcpy(slot + KV_CHECKSUM_OFFSET + 12, &value_len, 4);
+	if (key_len)
+		memcpy(slot + KV_SLOT_META, key, key_len);
+	if (value_len)
+		memcpy(slot + KV_SLOT_META + key_len, value, value_len);
+	checksum = kv_checksum(slot, version, key_len + value_len);
+	memcpy(slot + KV_CHECKSUM_OFFSET, &checksum, 8);
+	return KV_SLOT_META + key_len + value_len;
+}
+/******************************************************************************
+ * Function: kv_init
+ *
+ * Input
+ * kv table to initialize
+ * res connection whose buffer holds the table
+ * base offset of the window, a multiple of KV_SLOT_ALIGN
+ * size size of the window
+ * slot_size bytes per slot, a multiple of KV_SLOT_ALIGN; 0 for
+ *           KV_DEFAULT_SLOT_SIZE
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Clear the window and write the header a client reads in kv_attach.
+ ******************************************************************************/
+int kv_init(struct rdma_kv *kv, struct resources *res, size_t base, uint64_t size, uint32_t slot_size)
+{
+	struct kv_header hdr;
+	if (!slot_size)
+		slot_size = KV_DEFAULT_SLOT_SIZE;
+	if (base % KV_SLOT_ALIGN || slot_size % KV_SLOT_ALIGN || slot_size <= KV_SLOT_META)
+	{
+		log_err("table window at %zu with %u byte slots is not aligned to %d bytes\n", base, slot_size,
+				KV_SLOT_ALIGN);
+		return 1;
+	}
+	if (base > res->buf_size || size > res->buf_size - base)
+	{
+		log_err("table window [%zu, +%" PRIu64 ") is out of buffer of %zu bytes\n", base, size, res->buf_size);
+		return 1;
+	}
+	memset(kv, 0, sizeof(*kv));
+	kv->base = base;
+	kv->slot_size = slot_size;
+	kv->bucket_slots = KV_BUCKET_SLOTS;
+	kv->server = 1;
+	// 客户端用一次 READ 取整个桶，桶不能超过一个请求的长度
+	if (kv_bucket_bytes(kv) > UINT32_MAX)
+	{
+		log_err("buckets of %zu bytes do not fit in one request\n", kv_bucket_bytes(kv));
+		return 1;
+	}
+	kv->buckets = size > KV_HEADER_SIZE ? (size - KV_HEADER_SIZE) / kv_bucket_bytes(kv) : 0;
+	if (!kv->buckets)
+	{
+		log_err("table window of %" PRIu64 " bytes cannot hold a bucket of %zu bytes\n", size, kv_bucket_bytes(kv));
+		return 1;
+	}
+	if (res->dev && res->dev->device_attr.atomic_cap != IBV_ATOMIC_GLOB)
+		log_info("device atomics are not coherent with the CPU; local writes race with remote ones\n");
+	memset(res->buf + base, 0, KV_HEADER_SIZE + kv->buckets * kv_bucket_bytes(kv));
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.buckets = kv->buckets;
+	hdr.slot_size = kv->slot_size;
+	hdr.bucket_slots = kv->bucket_slots;
+	memcpy(res->buf + base, &hdr, sizeof(hdr));
+	// 魔数最后写入，客户端看到魔数时表头的其余部分已经就绪
+	__atomic_store_n((uint64_t *)(res->buf + base), KV_MAGIC, __ATOMIC_RELEASE);
+	log_info("key-value table at %zu: %" PRIu64 " buckets of %u slots of %u bytes\n", base, kv->buckets,
+			 kv->bucket_slots, kv->slot_size);
+	return 0;
+}
+/******************************************************************************
+ * Function: kv_attach
+ *
+ * Input
+ * kv table to initialize
+ * res connection to the server
+ * base offset of the window the server passed to kv_init
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Read the table header with one RDMA READ. The same window of the local
+ * buffer must hold two buckets and one slot of scratch space.
+ ******************************************************************************/
+int kv_attach(struct rdma_kv *kv, struct resources *res, size_t base)
+{
+	struct kv_header hdr;
+	size_t scratch;
+	if (base % KV_SLOT_ALIGN || base > res->buf_size || KV_HEADER_SIZE > res->buf_size - base)
+	{
+		log_err("table window at %zu is not aligned or out of buffer of %zu bytes\n", base, res->buf_size);
+		return 1;
+	}
+	if (post_send_range(res, IBV_WR_RDMA_READ, base, base, KV_HEADER_SIZE) || poll_completion(res))
+	{
+		log_err("failed to read the table header\n");
+		return 1;
+	}
+	memcpy(&hdr, res->buf + base, sizeof(hdr));
+	if (hdr.magic != KV_MAGIC || !hdr.buckets || !hdr.bucket_slots || hdr.slot_size % KV_SLOT_ALIGN ||
+		hdr.slot_size <= KV_SLOT_META)
+	{
+		log_err("no key-value table at offset %zu of the peer's buffer\n", base);
+		return 1;
+	}
+	memset(kv, 0, sizeof(*kv));
+	kv->base = base;
+	kv->buckets = hdr.buckets;
+	kv->slot_size = hdr.slot_size;
+	kv->bucket_slots = hdr.bucket_slots;
+	// 表头来自对端，按对端缓冲区的大小检查，避免越界的 READ 使 QP 进入错误状态
+	if (kv_bucket_bytes(kv) > UINT32_MAX || base > res->remote_props.size ||
+		KV_HEADER_SIZE > res->remote_props.size - base ||
+		kv->buckets > (res->remote_props.size - base - KV_HEADER_SIZE) / kv_bucket_bytes(kv))
+	{
+		log_err("table header at %zu describes %" PRIu64 " buckets of %zu bytes beyond the peer's %" PRIu64
+				" byte buffer\n",
+				base, kv->buckets, kv_bucket_bytes(kv), res->remote_props.size);
+		return 1;
+	}
+	scratch = 2 * kv_bucket_bytes(kv) + kv->slot_size;
+	if (scratch > res->buf_size - base)
+	{
+		log_err("local window at %zu cannot hold the %zu bytes of table scratch space\n", base, scratch);
+		return 1;
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: kv_read_bucket
+ *
+ * Input
+ * kv pointer to the table
+ * res connection to the server
+ * bucket bucket index
+ * which 0 or 1, the scratch area to read into
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ ******************************************************************************/
+static int kv_read_bucket(struct rdma_kv *kv, struct resources *res, uint64_t bucket, int which)
+{
+	size_t local = kv->base + which * kv_bucket_bytes(kv);
+	if (post_send_range(res, IBV_WR_RDMA_READ, local, kv_bucket_offset(kv, bucket), (uint32_t)kv_bucket_bytes(kv)) ||
+		poll_completion(res))
+	{
+		log_err("failed to read bucket %" PRIu64 "\n", bucket);
+		return 1;
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: kv_get
+ *
+ * Input
+ * kv table attached with kv_attach
+ * res connection to the server
+ * key key bytes
+ * key_len key length
+ *
+ * Output
+ * offset where the value lies in the local buffer, valid until the next call
+ * length length of the value
+ *
+ * Returns
+ * 0 on success, 1 on failure, KV_NOT_FOUND if the key is not in the table,
+ * KV_BUSY if its slot stayed in the middle of a write
+ ******************************************************************************/
+int kv_get(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, uint64_t *offset,
+		   uint32_t *length)
+{
+	uint64_t b[2];
+	int n = kv_buckets(kv, key, key_len, b);
+	int match;
+	int empty;
+	int torn;
+	int retry;
+	int i;
+	char *slot;
+	for (i = 0; i < n; i++)
+	{
+		for (retry = 0;; retry++)
+		{
+			if (retry == KV_MAX_RETRIES)
+				return KV_BUSY;
+			if (kv_read_bucket(kv, res, b[i], 0))
+				return 1;
+			torn = kv_scan(kv, res->buf + kv->base, key, key_len, &match, &empty);
+			if (match >= 0)
+			{
+				slot = res->buf + kv->base + (size_t)match * kv->slot_size;
+				memcpy(length, slot + KV_CHECKSUM_OFFSET + 12, 4);
+				*offset = (uint64_t)(slot + KV_SLOT_META + key_len - res->buf);
+				return 0;
+			}
+			if (!torn)
+				break;
+		}
+	}
+	return KV_NOT_FOUND;
+}
+/******************************************************************************
+ * Function: kv_locate
+ *
+ * Input
+ * kv table attached with kv_attach
+ * res connection to the server
+ * key key bytes
+ * key_len key length
+ * insert whether an empty slot will do when the key is not in the table
+ *
+ * Output
+ * remote offset of the chosen slot in the server's buffer
+ * version the slot's version when it was read
+ *
+ * Returns
+ * 0 on success, 1 on failure, KV_NOT_FOUND or KV_FULL if there is no slot,
+ * KV_BUSY if the buckets stayed in the middle of writes
+ *
+ * Description
+ * Find the slot holding the key, or else the first empty slot of the
+ * candidate buckets. The second bucket is only read when the key is not in
+ * the first; absence is only concluded from a view without torn slots.
+ ******************************************************************************/
+static int kv_locate(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, int insert,
+					 size_t *remote, uint64_t *version)
+{
+	uint64_t b[2];
+	int n = kv_buckets(kv, key, key_len, b);
+	int match;
+	int empty[2];
+	int torn;
+	int retry;
+	int i;
+	char *bucket;
+	for (retry = 0; retry < KV_MAX_RETRIES; retry++)
+	{
+		torn = 0;
+		for (i = 0; i < n; i++)
+		{
+			if (kv_read_bucket(kv, res, b[i], i))
+				return 1;
+			bucket = res->buf + kv->base + i * kv_bucket_bytes(kv);
+			torn += kv_scan(kv, bucket, key, key_len, &match, &empty[i]);
+			if (match >= 0)
+			{
+				*remote = kv_bucket_offset(kv, b[i]) + (size_t)match * kv->slot_size;
+				memcpy(version, bucket + (size_t)match * kv->slot_size + KV_VERSION_OFFSET, 8);
+				return 0;
+			}
+		}
+		if (torn)
+			continue;
+		if (!insert)
+			return KV_NOT_FOUND;
+		for (i = 0; i < n; i++)
+		{
+			if (empty[i] < 0)
+				continue;
+			bucket = res->buf + kv->base + i * kv_bucket_bytes(kv);
+			*remote = kv_bucket_offset(kv, b[i]) + (size_t)empty[i] * kv->slot_size;
+			memcpy(version, bucket + (size_t)empty[i] * kv->slot_size + KV_VERSION_OFFSET, 8);
+			return 0;
+		}
+		return KV_FULL;
+	}
+	return KV_BUSY;
+}
+/******************************************************************************
+ * Function: kv_lock
+ *
+ * Input
+ * res connection to the server
+ * remote offset of the slot in the server's buffer
+ * version even version the slot had when it was read
+ *
+ * Returns
+ * 0 if the slot is now held, 1 on failure, KV_BUSY if it changed since it
+ * was read
+ ******************************************************************************/
+static int kv_lock(struct resources *res, size_t remote, uint64_t version)
+{
+	uint64_t old;
+	if (atomic_fetch(res, IBV_WR_ATOMIC_CMP_AND_SWP, remote + KV_VERSION_OFFSET, version, version + 1, &old))
+	{
+		log_err("failed to lock slot at %zu\n", remote);
+		return 1;
+	}
+	return old == version ? 0 : KV_BUSY;
+}
+/******************************************************************************
+ * Function: kv_publish
+ *
+ * Input
+ * kv table attached with kv_attach
+ * res connection to the server
+ * remote offset of the held slot in the server's buffer
+ * length bytes of the staged slot that make up the new contents
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Write the staged contents and then the staged version word, which
+ * releases the slot, as one chain with one doorbell. RC executes the writes
+ * of a QP in order, so the new version lands after the contents.
+ ******************************************************************************/
+static int kv_publish(struct rdma_kv *kv, struct resources *res, size_t remote, uint32_t length)
+{
+	struct ibv_send_wr wrs[2];
+	struct ibv_sge sges[2];
+	struct ibv_send_wr *bad_wr = NULL;
+	size_t staging = kv->base + 2 * kv_bucket_bytes(kv);
+	size_t offsets[2] = {KV_CHECKSUM_OFFSET, KV_VERSION_OFFSET};
+	uint32_t lengths[2] = {length - KV_CHECKSUM_OFFSET, 8};
+	int i;
+	memset(wrs, 0, sizeof(wrs));
+	for (i = 0; i < 2; i++)
+	{
+		sges[i].addr = (uintptr_t)(res->buf + staging + offsets[i]);
+		sges[i].length = lengths[i];
+		sges[i].lkey = res->mr->lkey;
+		wrs[i].sg_list = &sges[i];
+		wrs[i].num_sge = 1;
+		wrs[i].opcode = IBV_WR_RDMA_WRITE;
+		wrs[i].send_flags = inline_flag(res, IBV_WR_RDMA_WRITE, lengths[i]);
+		wrs[i].wr.rdma.remote_addr = res->remote_props.addr + remote + offsets[i];
+		wrs[i].wr.rdma.rkey = res->remote_props.rkey;
+	}
+	wrs[0].next = &wrs[1];
+	wrs[1].send_flags |= IBV_SEND_SIGNALED;
+	if (ibv_post_send(res->qp, wrs, &bad_wr))
+	{
+		log_err("failed to post slot write at %zu\n", remote);
+		return 1;
+	}
+	for (i = 0; i < 2; i++)
+		stats_posted(res, IBV_WR_RDMA_WRITE, lengths[i]);
+	res->sync_post_ns = stats_sample(res);
+	return poll_completion(res);
+}
+/******************************************************************************
+ * Function: kv_store
+ *
+ * Input
+ * kv table attached with kv_attach
+ * res connection to the server
+ * key key bytes
+ * key_len key length
+ * value value bytes, NULL to delete the key
+ * value_len value length
+ *
+ * Returns
+ * 0 on success, 1 on failure, KV_NOT_FOUND when deleting a missing key,
+ * KV_FULL, KV_BUSY
+ *
+ * Description
+ * Locate the slot, take it with a compare-and-swap on its version and
+ * publish the new contents. Losing the slot to another writer starts over.
+ ******************************************************************************/
+static int kv_store(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, const void *value,
+					uint32_t value_len)
+{
+	char *staging = res->buf + kv->base + 2 * kv_bucket_bytes(kv);
+	size_t remote;
+	uint64_t version;
+	uint32_t length;
+	int retry;
+	int rc;
+	for (retry = 0; retry < KV_MAX_RETRIES; retry++)
+	{
+		rc = kv_locate(kv, res, key, key_len, value != NULL, &remote, &version);
+		if (rc)
+			return rc;
+		rc = kv_lock(res, remote, version);
+		if (rc == KV_BUSY)
+			continue;
+		if (rc)
+			return rc;
+		version += 2;
+		memcpy(staging + KV_VERSION_OFFSET, &version, 8);
+		if (value)
+			length = kv_fill(staging, version, key, key_len, value, value_len);
+		else
+			length = kv_fill(staging, version, NULL, 0, NULL, 0);
+		if (kv_publish(kv, res, remote, length))
+		{
+			// 槽位停留在奇数版本，之后的读写都会把它当作正在写入
+			log_err("slot at %zu stays locked after a failed write\n", remote);
+			return 1;
+		}
+		return 0;
+	}
+	return KV_BUSY;
+}
+/******************************************************************************
+ * Function: kv_put
+ *
+ * Input
+ * kv table attached with kv_attach
+ * res connection to the server
+ * key key bytes, at least one
+ * key_len key length
+ * value value bytes
+ * value_len value length; key and value must fit in a slot after its
+ *           KV_SLOT_META bytes of metadata
+ *
+ * Returns
+ * 0 on success, 1 on failure, KV_FULL if both candidate buckets are full,
+ * KV_BUSY if the slot kept changing under the writer
+ ******************************************************************************/
+int kv_put(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, const void *value,
+		   uint32_t value_len)
+{
+	static const char none;
+	if (!key_len || key_len > kv->slot_size - KV_SLOT_META || value_len > kv->slot_size - KV_SLOT_META - key_len)
+	{
+		log_err("entry of %u + %u bytes does not fit in a %u byte slot\n", key_len, value_len, kv->slot_size);
+		return 1;
+	}
+	return kv_store(kv, res, key, key_len, value_len ? value : &none, value_len);
+}
+/******************************************************************************
+ * Function: kv_delete
+ *
+ * Input
+ * kv table attached with kv_attach
+ * res connection to the server
+ * key key bytes
+ * key_len key length
+ *
+ * Returns
+ * 0 on success, 1 on failure, KV_NOT_FOUND if the key is not in the table,
+ * KV_BUSY
+ ******************************************************************************/
+int kv_delete(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len)
+{
+	if (!key_len || key_len > kv->slot_size - KV_SLOT_META)
+		return KV_NOT_FOUND;
+	return kv_store(kv, res, key, key_len, NULL, 0);
+}
+/******************************************************************************
+ * Function: kv_local_slot
+ *
+ * Input
+ * kv table created with kv_init
+ * res connection whose buffer holds the table
+ * bucket bucket index
+ * index slot index within the bucket
+ *
+ * Returns
+ * the slot in the local buffer
+ ******************************************************************************/
+static char *kv_local_slot(struct rdma_kv *kv, struct resources *res, uint64_t bucket, int index)
+{
+	return res->buf + kv_bucket_offset(kv, bucket) + (size_t)index * kv->slot_size;
+}
+/******************************************************************************
+ * Function: kv_local_state
+ *
+ * Input
+ * kv table created with kv_init
+ * slot slot in the local buffer
+ * key key bytes
+ * key_len key length
+ *
+ * Output
+ * version the version the state belongs to
+ *
+ * Returns
+ * the slot's state as for kv_slot_state; KV_SLOT_TORN also when a remote
+ * writer changed the slot while it was examined
+ ******************************************************************************/
+static int kv_local_state(struct rdma_kv *kv, char *slot, const void *key, uint32_t key_len, uint64_t *version)
+{
+	uint64_t *word = (uint64_t *)(slot + KV_VERSION_OFFSET);
+	int state;
+	*version = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+	state = kv_slot_state(kv, slot, key, key_len);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(word, __ATOMIC_RELAXED) != *version)
+		return KV_SLOT_TORN;
+	return state;
+}
+/******************************************************************************
+ * Function: kv_local_get
+ *
+ * Input
+ * kv table created with kv_init
+ * res connection whose buffer holds the table
+ * key key bytes
+ * key_len key length
+ *
+ * Output
+ * copy consistent copy of the slot holding the key, slot_size bytes
+ * value_offset where the value starts in the copy
+ * length length of the value
+ *
+ * Returns
+ * 0 on success, KV_NOT_FOUND, KV_BUSY
+ *
+ * Description
+ * Look the key up in local memory. Remote writers may change a slot at any
+ * time, so the slot is copied out and the copy checked before it is used.
+ ******************************************************************************/
+int kv_local_get(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, void *copy,
+				 uint32_t *value_offset, uint32_t *length)
+{
+	uint64_t b[2];
+	int n = kv_buckets(kv, key, key_len, b);
+	uint64_t *word;
+	uint64_t version;
+	char *slot;
+	int torn;
+	int retry;
+	int state;
+	int i;
+	uint32_t j;
+	for (i = 0; i < n; i++)
+	{
+		for (retry = 0;; retry++)
+		{
+			if (retry == KV_MAX_RETRIES)
+				return KV_BUSY;
+			torn = 0;
+			for (j = 0; j < kv->bucket_slots; j++)
+			{
+				slot = kv_local_slot(kv, res, b[i], (int)j);
+				word = (uint64_t *)(slot + KV_VERSION_OFFSET);
+				version = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+				memcpy(copy, slot, kv->slot_size);
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				state = __atomic_load_n(word, __ATOMIC_RELAXED) == version
+							? kv_slot_state(kv, copy, key, key_len)
+							: KV_SLOT_TORN;
+				if (state == KV_SLOT_MATCH)
+				{
+					*value_offset = KV_SLOT_META + key_len;
+					memcpy(length, (char *)copy + KV_CHECKSUM_OFFSET + 12, 4);
+					return 0;
+				}
+				if (state == KV_SLOT_TORN)
+					torn++;
+			}
+			if (!torn)
+				break;
+		}
+	}
+	return KV_NOT_FOUND;
+}
+/******************************************************************************
+ * Function: kv_local_store
+ *
+ * Input
+ * kv table created with kv_init
+ * res connection whose buffer holds the table
+ * key key bytes
+ * key_len key length
+ * value value bytes, NULL to delete the key
+ * value_len value length
+ *
+ * Returns
+ * 0 on success, KV_NOT_FOUND when deleting a missing key, KV_FULL, KV_BUSY
+ *
+ * Description
+ * The local counterpart of kv_store: the slot is taken with a CPU
+ * compare-and-swap on its version and released with a store of the next
+ * version.
+ ******************************************************************************/
+static int kv_local_store(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len,
+						  const void *value, uint32_t value_len)
+{
+	uint64_t b[2];
+	int n = kv_buckets(kv, key, key_len, b);
+	char *target;
+	char *slot;
+	uint64_t target_version = 0;
+	uint64_t version;
+	int found;
+	int retry;
+	int torn;
+	int state;
+	int i;
+	uint32_t j;
+	for (retry = 0; retry < KV_MAX_RETRIES; retry++)
+	{
+		target = NULL;
+		found = 0;
+		torn = 0;
+		for (i = 0; i < n && !found; i++)
+		{
+			for (j = 0; j < kv->bucket_slots; j++)
+			{
+				slot = kv_local_slot(kv, res, b[i], (int)j);
+				state = kv_local_state(kv, slot, key, key_len, &version);
+				if (state == KV_SLOT_MATCH)
+				{
+					target = slot;
+					target_version = version;
+					found = 1;
+					break;
+				}
+				if (state == KV_SLOT_TORN)
+					torn++;
+				else if (state == KV_SLOT_EMPTY && value && !target)
+				{
+					target = slot;
+					target_version = version;
+				}
+			}
+		}
+		// 只有在没有读到写了一半的槽位时才能断定键不存在
+		if (!found && torn)
+			continue;
+		if (!target)
+			return value ? KV_FULL : KV_NOT_FOUND;
+		if (!__atomic_compare_exchange_n((uint64_t *)(target + KV_VERSION_OFFSET), &target_version,
+										 target_version + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+		target_version += 2;
+		if (value)
+			kv_fill(target, target_version, key, key_len, value, value_len);
+		else
+			kv_fill(target, target_version, NULL, 0, NULL, 0);
+		__atomic_store_n((uint64_t *)(target + KV_VERSION_OFFSET), target_version, __ATOMIC_RELEASE);
+		return 0;
+	}
+	return KV_BUSY;
+}
+/******************************************************************************
+ * Function: kv_local_put
+ *
+ * Input
+ * kv table created with kv_init
+ * res connection whose buffer holds the table
+ * key key bytes, at least one
+ * key_len key length
+ * value value bytes
+ * value_len value length
+ *
+ * Returns
+ * 0 on success, 1 if the entry does not fit in a slot, KV_FULL, KV_BUSY
+ ******************************************************************************/
+int kv_local_put(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, const void *value,
+				 uint32_t value_len)
+{
+	static const char none;
+	if (!key_len || key_len > kv->slot_size - KV_SLOT_META || value_len > kv->slot_size - KV_SLOT_META - key_len)
+	{
+		log_err("entry of %u + %u bytes does not fit in a %u byte slot\n", key_len, value_len, kv->slot_size);
+		return 1;
+	}
+	return kv_local_store(kv, res, key, key_len, value_len ? value : &none, value_len);
+}
+/******************************************************************************
+ * Function: kv_local_delete
+ *
+ * Input
+ * kv table created with kv_init
+ * res connection whose buffer holds the table
+ * key key bytes
+ * key_len key length
+ *
+ * Returns
+ * 0 on success, KV_NOT_FOUND if the key is not in the table, KV_BUSY
+ ******************************************************************************/
+int kv_local_delete(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len)
+{
+	if (!key_len || key_len > kv->slot_size - KV_SLOT_META)
+		return KV_NOT_FOUND;
+	return kv_local_store(kv, res, key, key_len, NULL, 0);
+}
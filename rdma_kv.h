@@ -0,0 +1,66 @@
+#ifndef RDMA_KV_H
+#define RDMA_KV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 窗口开头的表头：魔数、桶数、槽位大小、每桶槽位数 */
+#define KV_HEADER_SIZE 64
+#define KV_MAGIC 0x3130564b414d4452ULL /* "RDMAKV01" */
+/* 槽位按缓存行对齐，大小为其整数倍 */
+#define KV_SLOT_ALIGN 64
+#define KV_DEFAULT_SLOT_SIZE 128
+/* 一个桶的槽位连续存放，一次 RDMA READ 读入 */
+#define KV_BUCKET_SLOTS 4
+/* 槽位内的布局：版本号（奇数表示正在写入）、校验和、键长、值长，之后是键和值 */
+#define KV_VERSION_OFFSET 0
+#define KV_CHECKSUM_OFFSET 8
+#define KV_SLOT_META 24
+/* 读到正在写入或写了一半的槽位时重试的次数 */
+#define KV_MAX_RETRIES 64
+
+/* 查找不到键、两个候选桶都已满、槽位一直处于写入状态 */
+#define KV_NOT_FOUND 3
+#define KV_FULL 4
+#define KV_BUSY 5
+
+struct resources;
+
+/* the table header at the start of the window, in the server's byte order */
+struct kv_header
+{
+    uint64_t magic;
+    uint64_t buckets;
+    uint32_t slot_size;
+    uint32_t bucket_slots;
+};
+
+/* one end of a hash table in a window of the server's registered buffer; every
+   call takes the connection carrying it, so that the struct holds no pointers
+   and can live in Go memory */
+struct rdma_kv
+{
+    size_t base;           /* 窗口在双方缓冲区中的偏移（两端相同） */
+    uint64_t buckets;      /* 桶数 */
+    uint32_t slot_size;    /* 每个槽位的字节数 */
+    uint32_t bucket_slots; /* 每个桶的槽位数 */
+    int server;            /* 1 为持有表的一端，0 为通过 RDMA 访问的一端 */
+};
+
+int kv_init(struct rdma_kv *kv, struct resources *res, size_t base, uint64_t size, uint32_t slot_size);
+int kv_attach(struct rdma_kv *kv, struct resources *res, size_t base);
+int kv_get(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, uint64_t *offset,
+           uint32_t *length);
+int kv_put(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, const void *value,
+           uint32_t value_len);
+int kv_delete(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len);
+int kv_local_get(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, void *copy,
+                 uint32_t *value_offset, uint32_t *length);
+int kv_local_put(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len, const void *value,
+                 uint32_t value_len);
+int kv_local_delete(struct rdma_kv *kv, struct resources *res, const void *key, uint32_t key_len);
+uint64_t kv_hash(const void *data, size_t len, uint64_t seed);
+int kv_buckets(const struct rdma_kv *kv, const void *key, uint32_t key_len, uint64_t b[2]);
+uint64_t kv_checksum(const char *slot, uint64_t version, uint32_t length);
+
+#endif
@@ -0,0 +1,498 @@
+#include <rdma_operations.h>
+/******************************************************************************
+Two-sided message engine
+Each connection with messaging enabled receives SENDs into a ring of
+registered slots. All slots are kept posted as receive requests; a consumed
+slot goes back to the ring and is re-posted together with others in one
+ibv_post_recv call once MSG_REPLENISH_BATCH of them have accumulated. A ring
+created with `shared` sits behind an SRQ and serves every connection
+attached to it, so receive memory no longer grows with the number of peers.
+******************************************************************************/
+/******************************************************************************
+ * Function: msg_ring_post
+ *
+ * Input
+ * ring pointer to the ring, lock held
+ * qp QP to post to (ignored for a shared ring)
+ * slots slot indices to post
+ * n number of slots
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Post one receive request per slot, chained into a single call.
+ ******************************************************************************/
+static int msg_ring_post(struct msg_ring *ring, struct ibv_qp *qp, int *slots, int n)
+{
+	struct ibv_recv_wr *bad_wr = NULL;
+	int rc;
+	int i;
+	if (n <= 0)
+		return 0;
+	for (i = 0; i < n; i++)
+	{
+		ring->sges[i].addr = (uintptr_t)(ring->buf + (size_t)slots[i] * ring->slot_size);
+		ring->sges[i].length = ring->slot_size;
+		ring->sges[i].lkey = ring->mr->lkey;
+		memset(&ring->wrs[i], 0, sizeof(ring->wrs[i]));
+		ring->wrs[i].wr_id = WRID_MSG_RECV | (uint32_t)slots[i];
+		ring->wrs[i].sg_list = &ring->sges[i];
+		ring->wrs[i].num_sge = 1;
+		ring->wrs[i].next = i + 1 < n ? &ring->wrs[i + 1] : NULL;
+	}
+	if (ring->srq)
+		rc = ibv_post_srq_recv(ring->srq, ring->wrs, &bad_wr);
+	else
+		rc = ibv_post_recv(qp, ring->wrs, &bad_wr);
+	if (rc)
+		log_err("failed to post %d message RRs\n", n);
+	else
+		log_debug("posted %d message RRs\n", n);
+	return rc;
+}
+/******************************************************************************
+ * Function: msg_ring_create
+ *
+ * Input
+ * dev device to register the slots in
+ * slots number of receive slots
+ * slot_size largest message in bytes
+ * shared create an SRQ for the ring and post all slots to it
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * the ring, NULL on failure
+ *
+ * Description
+ * A private ring is posted to its QP by msg_ring_fill once the QP is in INIT.
+ ******************************************************************************/
+struct msg_ring *msg_ring_create(struct rdma_device *dev, int slots, uint32_t slot_size, int shared)
+{
+	struct ibv_srq_init_attr srq_attr;
+	struct msg_ring *ring;
+	size_t size;
+	int max_wr;
+	int i;
+	if (slots <= 0 || !slot_size)
+	{
+		log_err("invalid message ring of %d slots of %u bytes\n", slots, slot_size);
+		return NULL;
+	}
+	max_wr = shared ? dev->device_attr.max_srq_wr : dev->device_attr.max_qp_wr;
+	if (slots > max_wr)
+		slots = max_wr;
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+	{
+		log_err("failed to allocate message ring\n");
+		return NULL;
+	}
+	pthread_mutex_init(&ring->lock, NULL);
+	rdma_device_get(dev);
+	ring->dev = dev;
+	ring->slots = slots;
+	ring->slot_size = slot_size;
+	ring->batch = slots / 4 < MSG_REPLENISH_BATCH ? slots / 4 : MSG_REPLENISH_BATCH;
+	if (ring->batch < 1)
+		ring->batch = 1;
+
+	size = (size_t)slots * slot_size;
+	if (posix_memalign((void **)&ring->buf, 4096, size))
+	{
+		ring->buf = NULL;
+		log_err("failed to allocate %zu bytes of message slots\n", size);
+		goto msg_ring_create_error;
+	}
+	memset(ring->buf, 0, size);
+	ring->mr = ibv_reg_mr(dev->pd, ring->buf, size, IBV_ACCESS_LOCAL_WRITE);
+	if (!ring->mr)
+	{
+		log_err("ibv_reg_mr failed for %zu bytes of message slots\n", size);
+		goto msg_ring_create_error;
+	}
+	ring->pending = malloc(slots * sizeof(*ring->pending));
+	ring->wrs = calloc(slots, sizeof(*ring->wrs));
+	ring->sges = calloc(slots, sizeof(*ring->sges));
+	if (!ring->pending || !ring->wrs || !ring->sges)
+	{
+		log_err("failed to allocate message ring bookkeeping\n");
+		goto msg_ring_create_error;
+	}
+	// 所有槽位一开始都等待投递
+	for (i = 0; i < slots; i++)
+		ring->pending[i] = i;
+	ring->num_pending = slots;
+
+	if (shared)
+	{
+		memset(&srq_attr, 0, sizeof(srq_attr));
+		srq_attr.attr.max_wr = slots;
+		srq_attr.attr.max_sge = 1;
+		ring->srq = ibv_create_srq(dev->pd, &srq_attr);
+		if (!ring->srq)
+		{
+			log_err("failed to create SRQ with %d entries\n", slots);
+			goto msg_ring_create_error;
+		}
+		if (msg_ring_post(ring, NULL, ring->pending, ring->num_pending))
+			goto msg_ring_create_error;
+		ring->num_pending = 0;
+	}
+	log_info("message ring created: %d slots of %u bytes%s\n", slots, slot_size, shared ? ", shared" : "");
+	return ring;
+
+msg_ring_create_error:
+	msg_ring_destroy(ring);
+	return NULL;
+}
+/******************************************************************************
+ * Function: msg_ring_destroy
+ *
+ * Input
+ * ring pointer to the ring
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * The QPs using the ring must be destroyed first; ibv_destroy_srq fails
+ * while any is still attached.
+ ******************************************************************************/
+int msg_ring_destroy(struct msg_ring *ring)
+{
+	int rc = 0;
+	if (!ring)
+		return 0;
+	if (ring->srq && ibv_destroy_srq(ring->srq))
+	{
+		log_err("failed to destroy SRQ\n");
+		return 1;
+	}
+	if (ring->mr && ibv_dereg_mr(ring->mr))
+	{
+		log_err("failed to deregister message ring MR\n");
+		rc = 1;
+	}
+	free(ring->buf);
+	free(ring->pending);
+	free(ring->wrs);
+	free(ring->sges);
+	if (ring->dev && rdma_device_put(ring->dev))
+		rc = 1;
+	pthread_mutex_destroy(&ring->lock);
+	free(ring);
+	return rc;
+}
+/******************************************************************************
+ * Function: msg_ring_fill
+ *
+ * Input
+ * ring pointer to a private ring
+ * qp QP in INIT or later
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Post every slot that is not posted yet.
+ ******************************************************************************/
+int msg_ring_fill(struct msg_ring *ring, struct ibv_qp *qp)
+{
+	int rc;
+	pthread_mutex_lock(&ring->lock);
+	rc = msg_ring_post(ring, qp, ring->pending, ring->num_pending);
+	if (!rc)
+		ring->num_pending = 0;
+	pthread_mutex_unlock(&ring->lock);
+	return rc;
+}
+/******************************************************************************
+ * Function: msg_account
+ *
+ * Input
+ * res pointer to resources structure
+ * wc completion with a message wr_id
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Queue an arrived message for msg_recv, or note that the outstanding
+ * message send has completed.
+ ******************************************************************************/
+int msg_account(struct resources *res, struct ibv_wc *wc)
+{
+	int tail;
+	if (wc->status != IBV_WC_SUCCESS)
+	{
+		log_err("got bad message completion with status: 0x%x, vendor syndrome: 0x%x\n", wc->status,
+				wc->vendor_err);
+		return 1;
+	}
+	if (wc->wr_id == WRID_MSG_SEND)
+	{
+		res->msg_send_done = 1;
+		return 0;
+	}
+	if (res->msg_ready_count == res->msg_ring->slots)
+	{
+		log_err("message ready queue overflow\n");
+		return 1;
+	}
+	tail = (res->msg_ready_head + res->msg_ready_count) % res->msg_ring->slots;
+	res->msg_ready[tail] = (uint64_t)(uint32_t)wc->wr_id << 32 | wc->byte_len;
+	res->msg_ready_count++;
+	return 0;
+}
+/******************************************************************************
+ * Function: msg_poll
+ *
+ * Input
+ * res pointer to resources structure
+ * timeout_usec how long to wait for the first completion
+ *
+ * Returns
+ * 0 if completions were handled, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Drain the CQ and account message completions. Apart from the requests of
+ * a message channel, nothing else may be in flight on the CQ while messaging.
+ ******************************************************************************/
+static int msg_poll(struct resources *res, long timeout_usec)
+{
+	struct ibv_wc wc[POLL_BATCH];
+	int n;
+	int i;
+	n = poll_cq_batch(res, wc, POLL_BATCH, timeout_usec);
+	if (n < 0)
+		return 1;
+	if (n == 0)
+		return POLL_TIMED_OUT;
+	for (i = 0; i < n; i++)
+	{
+		// 消息通道与消息引擎共用 CQ
+		if (wc[i].wr_id == WRID_XFER)
+		{
+			if (account_internal(res, &wc[i]))
+				return 1;
+			continue;
+		}
+		if ((wc[i].wr_id & WRID_MSG_MASK) != WRID_MSG_RECV && wc[i].wr_id != WRID_MSG_SEND)
+		{
+			log_err("unexpected completion wr_id %" PRIu64 " while messaging\n", wc[i].wr_id);
+			return 1;
+		}
+		if (msg_account(res, &wc[i]))
+			return 1;
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: msg_send
+ *
+ * Input
+ * res pointer to resources structure with messaging enabled
+ * data payload, in any memory
+ * length number of bytes, at most the peer's slot size
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Send one message and wait for its completion. Payloads up to the inline
+ * size go straight from `data`; larger ones are staged in the connection's
+ * registered send buffer. Messages arriving meanwhile are queued.
+ ******************************************************************************/
+int msg_send(struct resources *res, const void *data, uint32_t length)
+{
+	struct ibv_send_wr sr;
+	struct ibv_sge sge;
+	struct ibv_send_wr *bad_wr = NULL;
+	int rc;
+	if (!res->msg_ring)
+	{
+		log_err("messaging is not enabled on this connection\n");
+		return -1;
+	}
+	if (!res->remote_props.msg_size)
+	{
+		log_err("the peer has no message ring\n");
+		return -1;
+	}
+	if (length > res->remote_props.msg_size)
+	{
+		log_err("message of %u bytes exceeds the peer's slot size of %u\n", length, res->remote_props.msg_size);
+		return -1;
+	}
+	memset(&sge, 0, sizeof(sge));
+	memset(&sr, 0, sizeof(sr));
+	sr.send_flags = IBV_SEND_SIGNALED | inline_flag(res, IBV_WR_SEND, length);
+	if (sr.send_flags & IBV_SEND_INLINE)
+		sge.addr = (uintptr_t)data;
+	else
+	{
+		memcpy(res->msg_tx, data, length);
+		sge.addr = (uintptr_t)res->msg_tx;
+		sge.lkey = res->msg_tx_mr->lkey;
+	}
+	sge.length = length;
+	sr.wr_id = WRID_MSG_SEND;
+	sr.sg_list = length ? &sge : NULL;
+	sr.num_sge = length ? 1 : 0;
+	sr.opcode = IBV_WR_SEND;
+	res->msg_send_done = 0;
+	if (ibv_post_send(res->qp, &sr, &bad_wr))
+	{
+		log_err("failed to post message SR\n");
+		return -1;
+	}
+	log_debug("message of %u bytes posted\n", length);
+	stats_posted(res, IBV_WR_SEND, length);
+	while (!res->msg_send_done)
+	{
+		rc = msg_poll(res, MAX_POLL_CQ_TIMEOUT * 1000L);
+		if (rc == POLL_TIMED_OUT)
+			log_err("message send did not complete after timeout\n");
+		if (rc)
+			return -1;
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: msg_recv
+ *
+ * Input
+ * res pointer to resources structure with messaging enabled
+ * timeout_usec how long to wait, 0 for a single check, negative forever
+ *
+ * Output
+ * slot slot holding the message, to be passed to msg_release
+ * length length of the message
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ ******************************************************************************/
+int msg_recv(struct resources *res, uint32_t *slot, uint32_t *length, long timeout_usec)
+{
+	uint64_t entry;
+	int rc;
+	if (!res->msg_ring)
+	{
+		log_err("messaging is not enabled on this connection\n");
+		return 1;
+	}
+	if (!res->msg_ready_count)
+	{
+		rc = msg_poll(res, timeout_usec);
+		if (rc)
+			return rc;
+		if (!res->msg_ready_count)
+			return POLL_TIMED_OUT;
+	}
+	entry = res->msg_ready[res->msg_ready_head];
+	res->msg_ready_head = (res->msg_ready_head + 1) % res->msg_ring->slots;
+	res->msg_ready_count--;
+	*slot = (uint32_t)(entry >> 32);
+	*length = (uint32_t)entry;
+	return 0;
+}
+/******************************************************************************
+ * Function: msg_slot
+ *
+ * Input
+ * res pointer to resources structure with messaging enabled
+ * slot slot returned by msg_recv
+ *
+ * Returns
+ * the address of the slot's memory
+ ******************************************************************************/
+void *msg_slot(struct resources *res, uint32_t slot)
+{
+	return res->msg_ring->buf + (size_t)slot * res->msg_ring->slot_size;
+}
+/******************************************************************************
+ * Function: msg_release
+ *
+ * Input
+ * res pointer to resources structure with messaging enabled
+ * slot slot returned by msg_recv, no longer in use
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Hand the slot back to the ring. Slots are re-posted in batches.
+ ******************************************************************************/
+int msg_release(struct resources *res, uint32_t slot)
+{
+	struct msg_ring *ring = res->msg_ring;
+	int rc = 0;
+	if (slot >= (uint32_t)ring->slots)
+		return -1;
+	pthread_mutex_lock(&ring->lock);
+	ring->pending[ring->num_pending++] = slot;
+	if (ring->num_pending >= ring->batch)
+	{
+		rc = msg_ring_post(ring, res->qp, ring->pending, ring->num_pending);
+		if (!rc)
+			ring->num_pending = 0;
+	}
+	pthread_mutex_unlock(&ring->lock);
+	return rc;
+}
+/******************************************************************************
+ * Function: msg_reset
+ *
+ * Input
+ * res pointer to resources structure whose QP has been reset
+ *
+ * Returns
+ * none
+ *
+ * Description
+ * Forget the message state of a connection before it reconnects. A reset QP
+ * has dropped all receive requests of a private ring, so every slot goes back
+ * to the pending list for the next msg_ring_fill. A shared ring's requests
+ * stay posted on the SRQ; only slots of messages that were queued but never
+ * taken by msg_recv are returned.
+ ******************************************************************************/
+void msg_reset(struct resources *res)
+{
+	struct msg_ring *ring = res->msg_ring;
+	int i;
+	if (!ring)
+		return;
+	pthread_mutex_lock(&ring->lock);
+	if (ring->srq)
+	{
+		for (i = 0; i < res->msg_ready_count; i++)
+			ring->pending[ring->num_pending++] =
+				(int)(res->msg_ready[(res->msg_ready_head + i) % ring->slots] >> 32);
+	}
+	else
+	{
+		for (i = 0; i < ring->slots; i++)
+			ring->pending[i] = i;
+		ring->num_pending = ring->slots;
+	}
+	pthread_mutex_unlock(&ring->lock);
+	res->msg_ready_head = 0;
+	res->msg_ready_count = 0;
+	res->msg_send_done = 0;
+}
+/******************************************************************************
+ * Function: remote_msg_size
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Returns
+ * the peer's message slot size announced in connect_qp, 0 without messaging
+ ******************************************************************************/
+uint32_t remote_msg_size(struct resources *res)
+{
+	return res->remote_props.msg_size;
+}
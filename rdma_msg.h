@@ -0,0 +1,47 @@
+#ifndef RDMA_MSG_H
+#define RDMA_MSG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <infiniband/verbs.h>
+
+/* 接收请求的 wr_id：高 32 位为 WRID_MSG_RECV 的高位，低 32 位为槽位下标 */
+#define WRID_MSG_RECV 0xfffffffe00000000ULL
+#define WRID_MSG_MASK 0xffffffff00000000ULL
+#define WRID_MSG_SEND 0xfffffffffffffff3ULL
+/* 归还的槽位攒够这么多个才一次性重新投递（槽位很少时取槽位数的四分之一） */
+#define MSG_REPLENISH_BATCH 16
+
+struct rdma_device;
+struct resources;
+
+/* a ring of registered receive slots, private to one QP or behind an SRQ */
+struct msg_ring
+{
+    struct rdma_device *dev;   /* 接收环持有引用的设备 */
+    struct ibv_srq *srq;       /* 共享接收队列，私有接收环为 NULL */
+    char *buf;                 /* 所有槽位组成的连续内存 */
+    struct ibv_mr *mr;         /* 覆盖 buf 的 MR */
+    int slots;                 /* 槽位数 */
+    uint32_t slot_size;        /* 每个槽位（即每条消息）的最大字节数 */
+    int *pending;              /* 已被消费、等待重新投递的槽位 */
+    int num_pending;
+    int batch;                 /* 重新投递的批大小 */
+    struct ibv_recv_wr *wrs;   /* 批量投递用的请求数组，slots 项 */
+    struct ibv_sge *sges;
+    pthread_mutex_t lock;
+};
+
+struct msg_ring *msg_ring_create(struct rdma_device *dev, int slots, uint32_t slot_size, int shared);
+int msg_ring_destroy(struct msg_ring *ring);
+int msg_ring_fill(struct msg_ring *ring, struct ibv_qp *qp);
+int msg_account(struct resources *res, struct ibv_wc *wc);
+int msg_send(struct resources *res, const void *data, uint32_t length);
+int msg_recv(struct resources *res, uint32_t *slot, uint32_t *length, long timeout_usec);
+void *msg_slot(struct resources *res, uint32_t slot);
+int msg_release(struct resources *res, uint32_t slot);
+void msg_reset(struct resources *res);
+uint32_t remote_msg_size(struct resources *res);
+
+#endif
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <rdma_operations.h>
+/******************************************************************************
+NUMA and core placement
+On multi-socket hosts the HCA sits on one socket. Buffers it DMAs into and
+the threads polling its CQs should live on that socket, otherwise every
+transfer and completion crosses the inter-socket link. The kernel reports
+the device's node and its local CPUs in sysfs; memory is steered to a node
+with mbind so that no libnuma dependency is needed.
+******************************************************************************/
+/* mbind 的策略值，与 <numaif.h> 一致 */
+#define NUMA_MPOL_PREFERRED 1
+
+_Static_assert(sizeof(cpu_set_t) <= THREAD_MASK_SIZE, "THREAD_MASK_SIZE cannot hold a cpu_set_t");
+/******************************************************************************
+ * Function: device_sysfs_read
+ *
+ * Input
+ * ctx opened device context
+ * attr file below the device's PCI directory in sysfs
+ * len size of buf
+ *
+ * Output
+ * buf contents of the file, without the trailing newline
+ *
+ * Returns
+ * 0 on success, -1 if the file cannot be read
+ ******************************************************************************/
+static int device_sysfs_read(struct ibv_context *ctx, const char *attr, char *buf, size_t len)
+{
+	char path[IBV_SYSFS_PATH_MAX + 64];
+	FILE *f;
+	snprintf(path, sizeof(path), "%s/device/%s", ctx->device->ibdev_path, attr);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(buf, len, f))
+	{
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	buf[strcspn(buf, "\n")] = 0;
+	return 0;
+}
+/******************************************************************************
+ * Function: device_numa_node
+ *
+ * Input
+ * ctx opened device context
+ *
+ * Returns
+ * the NUMA node the device is attached to, -1 if the system does not say
+ * (single-node systems report -1 as well)
+ ******************************************************************************/
+int device_numa_node(struct ibv_context *ctx)
+{
+	char buf[32];
+	if (device_sysfs_read(ctx, "numa_node", buf, sizeof(buf)))
+		return -1;
+	return atoi(buf);
+}
+/******************************************************************************
+ * Function: cpulist_parse
+ *
+ * Input
+ * list CPU list in the kernel's format, e.g. "0-11,24-35"
+ * max capacity of cpus
+ *
+ * Output
+ * cpus the listed CPUs, in the order of the list
+ *
+ * Returns
+ * number of CPUs stored; parsing stops at the first malformed entry or when
+ * `cpus` is full
+ ******************************************************************************/
+int cpulist_parse(const char *list, int *cpus, int max)
+{
+	const char *p;
+	char *end;
+	long lo;
+	long hi;
+	int n = 0;
+	for (p = list; *p && n < max;)
+	{
+		lo = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		hi = lo;
+		if (*end == '-')
+		{
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+		}
+		for (; lo <= hi && n < max; lo++)
+			cpus[n++] = (int)lo;
+		p = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+/******************************************************************************
+ * Function: device_local_cpus
+ *
+ * Input
+ * ctx opened device context
+ * max capacity of cpus
+ *
+ * Output
+ * cpus the CPUs on the device's node, in ascending order
+ *
+ * Returns
+ * number of CPUs stored, 0 if the system does not say
+ *
+ * Description
+ * Parse the device's local_cpulist with cpulist_parse.
+ ******************************************************************************/
+int device_local_cpus(struct ibv_context *ctx, int *cpus, int max)
+{
+	char buf[4096];
+	if (device_sysfs_read(ctx, "local_cpulist", buf, sizeof(buf)))
+		return 0;
+	return cpulist_parse(buf, cpus, max);
+}
+/******************************************************************************
+ * Function: numa_prefer
+ *
+ * Input
+ * p page-aligned mapping that has not been touched yet
+ * size length of the mapping
+ * node NUMA node to place the pages on
+ *
+ * Returns
+ * 0 on success, -1 on failure
+ *
+ * Description
+ * Give the mapping a preferred-node policy. Pages are placed on `node` when
+ * they are first touched, e.g. when ibv_reg_mr pins them, and fall back to
+ * other nodes instead of failing when the node is full.
+ ******************************************************************************/
+int numa_prefer(void *p, size_t size, int node)
+{
+	unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	if (node < 0 || node >= NUMA_MAX_NODES)
+		return -1;
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_mbind, p, size, NUMA_MPOL_PREFERRED, mask, NUMA_MAX_NODES, 0))
+	{
+		log_debug("mbind to node %d failed: %s\n", node, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: numa_alloc
+ *
+ * Input
+ * size number of bytes
+ * node NUMA node to place the memory on
+ *
+ * Returns
+ * zeroed, page-aligned memory to be released with numa_free, NULL on failure
+ *
+ * Description
+ * Map anonymous memory and prefer `node` for it. A failed mbind is not an
+ * error: the memory is still usable, it just may land elsewhere.
+ ******************************************************************************/
+void *numa_alloc(size_t size, int node)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	if (numa_prefer(p, size, node))
+		log_info("could not place %zu bytes on NUMA node %d\n", size, node);
+	return p;
+}
+/******************************************************************************
+ * Function: numa_free
+ *
+ * Input
+ * p memory returned by numa_alloc
+ * size size passed to numa_alloc
+ ******************************************************************************/
+void numa_free(void *p, size_t size)
+{
+	if (p)
+		munmap(p, size);
+}
+/******************************************************************************
+ * Function: thread_pin
+ *
+ * Input
+ * cpus CPUs the calling thread may run on
+ * n number of CPUs
+ *
+ * Output
+ * saved the thread's previous affinity, THREAD_MASK_SIZE bytes, for
+ *       thread_restore; may be NULL
+ *
+ * Returns
+ * 0 on success, -1 on failure
+ ******************************************************************************/
+int thread_pin(const int *cpus, int n, void *saved)
+{
+	cpu_set_t set;
+	int i;
+	if (saved && sched_getaffinity(0, sizeof(cpu_set_t), (cpu_set_t *)saved))
+	{
+		log_err("sched_getaffinity failed: %s\n", strerror(errno));
+		return -1;
+	}
+	CPU_ZERO(&set);
+	for (i = 0; i < n; i++)
+		if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+			CPU_SET(cpus[i], &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+	{
+		log_err("sched_setaffinity to %d CPUs failed: %s\n", n, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: thread_restore
+ *
+ * Input
+ * saved affinity saved by thread_pin
+ *
+ * Returns
+ * 0 on success, -1 on failure
+ ******************************************************************************/
+int thread_restore(const void *saved)
+{
+	if (sched_setaffinity(0, sizeof(cpu_set_t), (const cpu_set_t *)saved))
+	{
+		log_err("sched_setaffinity failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef RDMA_NUMA_H
+#define RDMA_NUMA_H
+
+#include <stddef.h>
+#include <infiniband/verbs.h>
+
+/* 一个 NUMA 节点掩码或 CPU 集合最多覆盖的位数 */
+#define NUMA_MAX_NODES 1024
+#define THREAD_MAX_CPUS 1024
+/* thread_pin 保存原有亲和性所需的字节数 */
+#define THREAD_MASK_SIZE (THREAD_MAX_CPUS / 8)
+/* resources.numa_node 取此值时使用设备所在的节点 */
+#define NUMA_NODE_DEVICE -1
+
+int device_numa_node(struct ibv_context *ctx);
+int cpulist_parse(const char *list, int *cpus, int max);
+int device_local_cpus(struct ibv_context *ctx, int *cpus, int max);
+void *numa_alloc(size_t size, int node);
+void numa_free(void *p, size_t size);
+int numa_prefer(void *p, size_t size, int node);
+int thread_pin(const int *cpus, int n, void *saved);
+int thread_restore(const void *saved);
+
+#endif
@@ -5,6 +5,49 @@ struct config_t config = {
 	19875, /* tcp_port */
 	1,	   /* ib_port */
 	-1 /* gid_idx */};
+int rdma_log_level = RDMA_LOG_INFO;
+void (*rdma_log_hook)(int level, char *func, char *msg) = NULL;
+static int inband_setup(struct resources *res);
+static int inband_account(struct resources *res, struct ibv_wc *wc);
+static void sock_keepalive(int sock);
+static int post_send_wr(struct resources *res, int opcode, uint64_t wr_id, size_t local_offset, size_t remote_offset,
+						uint32_t length);
+static int post_send_sge(struct resources *res, int opcode, uint64_t wr_id, struct ibv_sge *sge, size_t remote_offset);
+/******************************************************************************
+* Function: rdma_log
+*
+* Input
+* level RDMA_LOG_ERROR, RDMA_LOG_INFO or RDMA_LOG_DEBUG
+* func name of the calling function
+* fmt printf-style format
+*
+* Output
+* none
+*
+* Returns
+* none
+*
+* Description
+* Backend of the log_err/log_info/log_debug macros, which have already
+* checked the level. Without a hook, errors go to stderr and everything else
+* to stdout as before; with a hook the formatted message is handed over
+* together with its level and origin.
+******************************************************************************/
+void rdma_log(int level, const char *func, const char *fmt, ...)
+{
+	char msg[512];
+	void (*hook)(int level, char *func, char *msg) = __atomic_load_n(&rdma_log_hook, __ATOMIC_ACQUIRE);
+	va_list ap;
+	va_start(ap, fmt);
+	if (hook)
+	{
+		vsnprintf(msg, sizeof(msg), fmt, ap);
+		hook(level, (char *)func, msg);
+	}
+	else
+		vfprintf(level == RDMA_LOG_ERROR ? stderr : stdout, fmt, ap);
+	va_end(ap);
+}
 /******************************************************************************
 Socket operations
 For simplicity, the example program uses TCP sockets to exchange control
@@ -13,6 +56,94 @@ information. If a TCP/IP stack/connection is not available, connection manager
 this example
 ******************************************************************************/
 /******************************************************************************
+* Function: sock_keepalive
+*
+* Input
+* sock connected socket
+*
+* Output
+* none
+*
+* Returns
+* none
+*
+* Description
+* Enable TCP keepalive so that a peer that vanished without closing the
+* connection is noticed by sock_alive while the connection sits idle. The
+* kernel's default of two hours of idleness before the first probe is cut
+* to KEEPALIVE_IDLE_SEC; after KEEPALIVE_COUNT unanswered probes, sent every
+* KEEPALIVE_INTERVAL_SEC, the connection is reset.
+******************************************************************************/
+static void sock_keepalive(int sock)
+{
+	int on = 1;
+	int idle = KEEPALIVE_IDLE_SEC;
+	int interval = KEEPALIVE_INTERVAL_SEC;
+	int count = KEEPALIVE_COUNT;
+	setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+}
+/******************************************************************************
+* Function: sock_set_timeout
+*
+* Input
+* sock connected socket
+* timeout_usec how long a single read or write may block, 0 for no limit
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, -1 on failure
+*
+* Description
+* Bound the blocking socket calls, e.g. of a handshake with a peer that
+* connected and then went silent. A call that times out fails like any
+* other socket error.
+******************************************************************************/
+int sock_set_timeout(int sock, long timeout_usec)
+{
+	struct timeval tv;
+	tv.tv_sec = timeout_usec / 1000000;
+	tv.tv_usec = timeout_usec % 1000000;
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ||
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+	{
+		log_err("failed to set socket timeout: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+/******************************************************************************
+* Function: sock_alive
+*
+* Input
+* sock connected socket
+*
+* Output
+* none
+*
+* Returns
+* 1 if the peer is still connected, 0 otherwise
+*
+* Description
+* Peek at the socket without blocking: end of file or a socket error such as
+* a keepalive timeout means the peer is gone.
+******************************************************************************/
+int sock_alive(int sock)
+{
+	char c;
+	ssize_t n;
+	if (sock < 0)
+		return 0;
+	n = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (n > 0)
+		return 1;
+	return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+/******************************************************************************
 * Function: sock_connect
 *
 输入:
@@ -57,7 +188,7 @@ int sock_connect(const char *servername, int port)
 	sockfd = getaddrinfo(servername, service, &hints, &resolved_addr);
 	if (sockfd < 0)
 	{
-		fprintf(stderr, "%s for %s:%d\n", gai_strerror(sockfd), servername, port);
+		log_err("%s for %s:%d\n", gai_strerror(sockfd), servername, port);
 		goto sock_connect_exit;
 	}
 
@@ -72,7 +203,7 @@ int sock_connect(const char *servername, int port)
 				/* Client mode. Initiate connection to remote */
 				if ((tmp = connect(sockfd, iterator->ai_addr, iterator->ai_addrlen)))
 				{
-					fprintf(stdout, "failed connect \n");
+					log_err("failed connect \n");
 					close(sockfd);
 					sockfd = -1;
 				}
@@ -91,6 +222,8 @@ int sock_connect(const char *servername, int port)
 	}
 
 sock_connect_exit:
+	if (sockfd >= 0)
+		sock_keepalive(sockfd);
 	if (listenfd)
 		close(listenfd);
 	if (resolved_addr)
@@ -98,16 +231,116 @@ sock_connect_exit:
 	if (sockfd < 0)
 	{
 		if (servername)
-			fprintf(stderr, "Couldn't connect to %s:%d\n", servername, port);
+			log_err("Couldn't connect to %s:%d\n", servername, port);
 		else
 		{
 			perror("server accept");
-			fprintf(stderr, "accept() failed\n");
+			log_err("accept() failed\n");
 		}
 	}
 	return sockfd;
 }
 /******************************************************************************
+* Function: sock_listen
+*
+* Input
+* port port to listen on
+* backlog length of the queue of pending connections
+*
+* Output
+* none
+*
+* Returns
+* listening socket (fd) on success, negative error code on failure
+*
+* Description
+* Unlike the server mode of sock_connect, which accepts one peer and closes
+* the listener, the socket keeps listening so that a multi-client server can
+* accept any number of peers with sock_accept.
+******************************************************************************/
+int sock_listen(int port, int backlog)
+{
+	struct sockaddr_in addr;
+	int listenfd;
+	int on = 1;
+	listenfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenfd < 0)
+	{
+		log_err("failed to create listening socket: %s\n", strerror(errno));
+		return -1;
+	}
+	// 服务重启时端口可能还处于 TIME_WAIT，允许立即重新绑定
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listenfd, backlog))
+	{
+		log_err("failed to listen on port %d: %s\n", port, strerror(errno));
+		close(listenfd);
+		return -1;
+	}
+	log_info("listening on port %d for TCP connections\n", port);
+	return listenfd;
+}
+/******************************************************************************
+* Function: sock_accept
+*
+* Input
+* listenfd socket returned by sock_listen
+*
+* Output
+* none
+*
+* Returns
+* connected socket (fd) on success, -1 on failure, -2 once the listener has
+* been shut down with sock_shutdown
+******************************************************************************/
+int sock_accept(int listenfd)
+{
+	int sockfd;
+	do
+		sockfd = accept(listenfd, NULL, 0);
+	while (sockfd < 0 && (errno == EINTR || errno == ECONNABORTED));
+	if (sockfd < 0)
+	{
+		if (errno == EINVAL || errno == EBADF)
+			return -2;
+		log_err("accept() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	sock_keepalive(sockfd);
+	return sockfd;
+}
+/******************************************************************************
+* Function: sock_shutdown
+*
+* Input
+* listenfd socket returned by sock_listen
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, -1 on failure
+*
+* Description
+* Wake a thread blocked in sock_accept on the socket; every later
+* sock_accept returns -2. The socket is not closed, since closing it while
+* another thread may still call sock_accept would let the descriptor be
+* reused under it: the accepting thread closes it once it has stopped.
+******************************************************************************/
+int sock_shutdown(int listenfd)
+{
+	if (shutdown(listenfd, SHUT_RDWR) && errno != ENOTCONN)
+	{
+		log_err("shutdown() of the listening socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+/******************************************************************************
 * Function: sock_sync_data
 *
 * Input
@@ -141,25 +374,114 @@ int sock_sync_data(int sock, int xfer_size, char *local_data, char *remote_data)
 	int total_read_bytes = 0;
 	rc = write(sock, local_data, xfer_size);
 	if (rc < xfer_size)
-		fprintf(stderr, "Failed writing data during sock_sync_data\n");
+		log_err("Failed writing data during sock_sync_data\n");
 	else
 		rc = 0;
 	// ：使用 while 循环从套接字读取数据，直到读取到的总字节数等于预期的 xfer_size
 	while (!rc && total_read_bytes < xfer_size)
 	{
-		read_bytes = read(sock, remote_data, xfer_size);
+		read_bytes = read(sock, remote_data + total_read_bytes, xfer_size - total_read_bytes);
 		if (read_bytes > 0)
 			total_read_bytes += read_bytes;
 		else
-			rc = read_bytes;
+			rc = read_bytes ? read_bytes : -1; // 对端关闭了连接
 	}
 	return rc;
 }
 /******************************************************************************
+* Function: sock_sync_ready
+*
+* Input
+* sock socket to transfer data on
+*
+* Returns
+* 0 on success, negative error code on failure
+*
+* Description
+* Exchange the one-byte ready token that brackets the synchronous Go
+* operations. The token and the received byte live in static and stack
+* memory, so a sync costs one cgo call and no allocation on either side.
+******************************************************************************/
+int sock_sync_ready(int sock)
+{
+	static char ready = 'R';
+	char remote;
+	return sock_sync_data(sock, 1, &ready, &remote);
+}
+/******************************************************************************
 End of socket operations
 ******************************************************************************/
 /* poll_completion */
 /******************************************************************************
+* Function: monotonic_usec
+*
+* Returns
+* microseconds of CLOCK_MONOTONIC
+*
+* Description
+* Clock used for the poll timeouts; unlike gettimeofday it does not jump when
+* the wall clock is adjusted.
+******************************************************************************/
+unsigned long monotonic_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+/******************************************************************************
+* Function: poll_cq_batch
+*
+* Input
+* res pointer to resources structure whose CQ is polled
+* max capacity of wc
+* timeout_usec how long to spin for the first completion, 0 for a single
+*              check, negative to spin forever
+*
+* Output
+* wc filled with up to max completions
+*
+* Returns
+* number of completions stored in wc (0 on timeout), negative on failure
+*
+* Description
+* Busy-poll the CQ, draining up to `max` entries per ibv_poll_cq call. The
+* clock is only read every POLL_CLOCK_INTERVAL empty polls so that the time
+* check does not dominate the spin. Every CQ access of the library goes
+* through here, so this is where polls and completions are counted.
+******************************************************************************/
+int poll_cq_batch(struct resources *res, struct ibv_wc *wc, int max, long timeout_usec)
+{
+	unsigned long start_time_usec = 0;
+	unsigned int empty = 0;
+	int poll_result;
+	for (;;)
+	{
+		poll_result = ibv_poll_cq(res->cq, max, wc);
+		if (poll_result)
+			break;
+		empty++;
+		if (timeout_usec == 0)
+			break;
+		if (timeout_usec < 0 || empty % POLL_CLOCK_INTERVAL)
+			continue;
+		if (!start_time_usec)
+			start_time_usec = monotonic_usec();
+		else if (monotonic_usec() - start_time_usec >= (unsigned long)timeout_usec)
+		{
+			stats_add(res->stats.timeouts, 1);
+			break;
+		}
+	}
+	// 空轮询在本地累加，退出时只写一次计数器
+	if (empty)
+		stats_add(res->stats.cq_empty_polls, empty);
+	if (poll_result < 0)
+		log_err("poll CQ failed\n");
+	else
+		stats_completed(res, wc, poll_result);
+	return poll_result;
+}
+/******************************************************************************
 * Function: poll_completion
 *
 * Input
@@ -173,48 +495,65 @@ End of socket operations
 * 0 on success, 1 on failure
 *
 * Description
-* Poll the completion queue for a single event. This function will continue to
-* poll the queue until MAX_POLL_CQ_TIMEOUT milliseconds have passed.
+* Poll the completion queue for the completion of the one synchronous request
+* in flight. This function will continue to poll the queue until
+* MAX_POLL_CQ_TIMEOUT milliseconds have passed. Completions of the library's
+* own requests (messages, in-band receives and credits) share the CQ; they are
+* routed to account_internal on the way instead of being taken for the
+* request's completion.
 *
 ******************************************************************************/
 int poll_completion(struct resources *res)
 {
-	// 定义并初始化用于轮询的变量，包括 struct ibv_wc wc（用于存储完成事件的详情）和时间相关的变量（用于控制轮询超时）
+	// struct ibv_wc wc 用于存储完成事件的详情，超时控制由 poll_cq_batch 负责
 	struct ibv_wc wc;
-	unsigned long start_time_msec;
-	unsigned long cur_time_msec;
-	struct timeval cur_time;
+	unsigned long start_usec = monotonic_usec();
+	unsigned long elapsed;
 	int poll_result;
 	int rc = 0;
 	/* poll the completion for a while before giving up of doing it .. */
-	gettimeofday(&cur_time, NULL);
-	start_time_msec = (cur_time.tv_sec * 1000) + (cur_time.tv_usec / 1000);
-	do
+	for (;;)
 	{
-		poll_result = ibv_poll_cq(res->cq, 1, &wc);
-		gettimeofday(&cur_time, NULL);
-		cur_time_msec = (cur_time.tv_sec * 1000) + (cur_time.tv_usec / 1000);
-	} while ((poll_result == 0) && ((cur_time_msec - start_time_msec) < MAX_POLL_CQ_TIMEOUT));
+		elapsed = monotonic_usec() - start_usec;
+		if (elapsed >= MAX_POLL_CQ_TIMEOUT * 1000UL)
+		{
+			poll_result = 0;
+			break;
+		}
+		poll_result = poll_cq_batch(res, &wc, 1, MAX_POLL_CQ_TIMEOUT * 1000L - (long)elapsed);
+		if (poll_result <= 0)
+			break;
+		// 消息、带内模式的接收和额度不是本请求的完成事件，交给各自的引擎记账后继续等待
+		if (wc.wr_id < WRID_MSG_RECV)
+			break;
+		if (account_internal(res, &wc))
+		{
+			res->sync_post_ns = 0;
+			return 1;
+		}
+	}
+	if (poll_result > 0 && wc.status == IBV_WC_SUCCESS)
+		stats_latency(res, res->sync_post_ns);
+	res->sync_post_ns = 0;
 
 	if (poll_result < 0)
 	{
-		// 表示轮询 CQ 失败，打印错误消息，并设置返回代码为 1。
-		fprintf(stderr, "poll CQ failed\n");
+		// 表示轮询 CQ 失败，设置返回代码为 1。
 		rc = 1;
 	}
 	else if (poll_result == 0)
 	{
 		// 表示轮询超时但未找到完成事件，打印超时错误消息，并设置返回代码为 1。
-		fprintf(stderr, "completion wasn't found in the CQ after timeout\n");
+		log_err("completion wasn't found in the CQ after timeout\n");
 		rc = 1;
 	}
 	else
 	{
 		/* CQE found */
-		fprintf(stdout, "completion was found in CQ with status 0x%x\n", wc.status);
+		log_debug("completion was found in CQ with status 0x%x\n", wc.status);
 		if (wc.status != IBV_WC_SUCCESS)
 		{
-			fprintf(stderr, "got bad completion with status: 0x%x, vendor syndrome: 0x%x\n", wc.status,
+			log_err("got bad completion with status: 0x%x, vendor syndrome: 0x%x\n", wc.status,
 					wc.vendor_err);
 			rc = 1;
 		}
@@ -235,87 +574,806 @@ int poll_completion(struct resources *res)
 * 0 on success, error code on failure
 *
 * Description
-* This function will create and post a send work request
+* This function will create and post a send work request covering the whole
+* registered buffer. For RDMA operations the length is clamped to the smaller
+* of the local and the remote buffer.
 ******************************************************************************/
 int post_send(struct resources *res, int opcode)
 {
-	// 在 RDMA 操作中，发送工作请求用于指定如何发送数据（例如，普通发送、RDMA 读或写等）。
-	// sr 的字段包括散布/聚集元素的列表、操作类型（opcode）、发送标志等
+	size_t length = res->buf_size;
+	if (opcode != IBV_WR_SEND && res->remote_props.size < length)
+		length = res->remote_props.size;
+	return post_send_range(res, opcode, 0, 0, (uint32_t)length);
+}
+/******************************************************************************
+* Function: post_send_range
+*
+* Input
+* res pointer to resources structure
+* opcode IBV_WR_SEND, IBV_WR_RDMA_READ or IBV_WR_RDMA_WRITE
+* local_offset offset into res->buf where the data is taken from / placed to
+* remote_offset offset into the remote buffer (ignored for IBV_WR_SEND)
+* length number of bytes to transfer
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Create and post a send work request that moves exactly `length` bytes.
+* Both ranges are checked against the local and remote buffer sizes before
+* the request is posted.
+******************************************************************************/
+int post_send_range(struct resources *res, int opcode, size_t local_offset, size_t remote_offset, uint32_t length)
+{
+	int rc = post_send_wr(res, opcode, 0, local_offset, remote_offset, length);
+	if (!rc)
+		res->sync_post_ns = stats_sample(res);
+	return rc;
+}
+/******************************************************************************
+* Function: post_atomic
+*
+* Input
+* res pointer to resources structure
+* opcode IBV_WR_ATOMIC_FETCH_AND_ADD or IBV_WR_ATOMIC_CMP_AND_SWP
+* remote_offset 8-byte aligned offset into the remote buffer
+* compare_add value to add, or value to compare with
+* swap value to store if the comparison succeeds (ignored for fetch-and-add)
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Post one atomic verb on the remote 64-bit word. The word's previous value
+* lands in res->atomic_buf once the completion has been polled. The
+* responder executes the operation atomically with respect to other atomics
+* on the same device, so concurrent peers need no extra round trips.
+******************************************************************************/
+int post_atomic(struct resources *res, int opcode, size_t remote_offset, uint64_t compare_add, uint64_t swap)
+{
 	struct ibv_send_wr sr;
-
-	// sge 用于指定 RDMA 操作中要使用的数据缓冲区的地址、长度和本地密钥（lkey）。本地密钥是 RDMA 设备用于访问该内存区域的权限令牌。
-	struct ibv_sge sge;
-
-	// 如果 ibv_post_send 返回错误，bad_wr 将被设置为指向问题所在的发送工作请求。初始时设置为 NULL，表示没有错误。
 	struct ibv_send_wr *bad_wr = NULL;
+	struct ibv_sge sge;
 	int rc;
-	memset(&sge, 0, sizeof(sge));	// 使用 memset 初始化散布/聚集条目 sge。
-	sge.addr = (uintptr_t)res->buf; // 设置 sge.addr 为要发送或读写的数据的地址
-	sge.length = MSG_SIZE;			// 设置 sge.length 为要发送或读写的数据的长度。
-	sge.lkey = res->mr->lkey;		// 设置 sge.lkey 为关联内存区域的本地密钥。
-	memset(&sr, 0, sizeof(sr));		// 使用 memset 初始化发送工作请求 sr。
-	sr.next = NULL;
-	sr.wr_id = 0;
-	sr.sg_list = &sge;				   // 设置 sr.sg_list 指向散布/聚集条目
-	sr.num_sge = 1;					   // 设置 sr.num_sge 为 1，表示只有一个散布/聚集条目。
-	sr.opcode = opcode;				   // 设置 sr.opcode 为传入的操作码。
-	sr.send_flags = IBV_SEND_SIGNALED; // 设置 sr.send_flags 为 IBV_SEND_SIGNALED，以触发完成事件。
-
-	if (opcode != IBV_WR_SEND)
+	if (remote_offset % sizeof(uint64_t) || remote_offset > res->remote_props.size ||
+		sizeof(uint64_t) > res->remote_props.size - remote_offset)
 	{
-		sr.wr.rdma.remote_addr = res->remote_props.addr;
-		sr.wr.rdma.rkey = res->remote_props.rkey;
+		log_err("remote offset %zu is not an aligned word of the %" PRIu64 " byte buffer\n", remote_offset,
+				res->remote_props.size);
+		return -1;
 	}
-	/* there is a Receive Request in the responder side, so we won't get any into RNR flow */
-	// 在 post_send 函数中，rc 用于存储 ibv_post_send 函数的返回值，以指示操作是否成功。成功时，rc 通常为 0；失败时，它包含错误代码。
+	if (!res->max_rd_atomic)
+	{
+		log_err("peers negotiated no outstanding atomic operations\n");
+		return -1;
+	}
+	sge.addr = (uintptr_t)res->atomic_buf;
+	sge.length = sizeof(uint64_t);
+	sge.lkey = res->atomic_mr->lkey;
+
+	memset(&sr, 0, sizeof(sr));
+	sr.wr_id = 0;
+	sr.sg_list = &sge;
+	sr.num_sge = 1;
+	sr.opcode = opcode;
+	sr.send_flags = IBV_SEND_SIGNALED;
+	sr.wr.atomic.remote_addr = res->remote_props.addr + remote_offset;
+	sr.wr.atomic.rkey = res->remote_props.rkey;
+	sr.wr.atomic.compare_add = compare_add;
+	sr.wr.atomic.swap = swap;
 	rc = ibv_post_send(res->qp, &sr, &bad_wr);
 	if (rc)
-		fprintf(stderr, "failed to post SR\n");
+		log_err("failed to post atomic SR\n");
 	else
 	{
-		switch (opcode)
-		{
-		case IBV_WR_SEND:
-			fprintf(stdout, "Send Request was posted\n");
-			break;
-		case IBV_WR_RDMA_READ:
-			fprintf(stdout, "RDMA Read Request was posted\n");
-			break;
-		case IBV_WR_RDMA_WRITE:
-			fprintf(stdout, "RDMA Write Request was posted\n");
-			break;
-		default:
-			fprintf(stdout, "Unknown Request was posted\n");
-			break;
-		}
+		log_debug("Atomic Request was posted\n");
+		stats_posted(res, opcode, sizeof(uint64_t));
+		res->sync_post_ns = stats_sample(res);
 	}
 	return rc;
 }
 /******************************************************************************
- * Function: post_receive
- * Input
- * res pointer to resources structure
- *  int post_receive(struct resources *res): 该函数接受一个指向包含 RDMA 资源的 resources 结构体的指针 res
- *
- * Output
- * none
- *
- * Returns
- * 0 on success, error code on failure
- *
- * Description
- *
- ******************************************************************************/
-int post_receive(struct resources *res)
+* Function: atomic_fetch
+*
+* Input
+* res pointer to resources structure
+* opcode IBV_WR_ATOMIC_FETCH_AND_ADD or IBV_WR_ATOMIC_CMP_AND_SWP
+* remote_offset 8-byte aligned offset into the remote buffer
+* compare_add value to add, or value to compare with
+* swap value to store if the comparison succeeds (ignored for fetch-and-add)
+*
+* Output
+* old the word's value before the operation
+*
+* Returns
+* 0 on success, 1 on failure
+*
+* Description
+* Post one atomic verb and wait for its own completion before reading
+* res->atomic_buf; completions of messages or in-band credits that arrive
+* first are accounted by poll_completion and do not end the wait.
+******************************************************************************/
+int atomic_fetch(struct resources *res, int opcode, size_t remote_offset, uint64_t compare_add, uint64_t swap,
+				 uint64_t *old)
 {
-	struct ibv_recv_wr rr;
-	struct ibv_sge sge;
-	struct ibv_recv_wr *bad_wr;
-	int rc;
-	/* prepare the scatter/gather entry */
-	memset(&sge, 0, sizeof(sge));
+	if (post_atomic(res, opcode, remote_offset, compare_add, swap))
+		return 1;
+	if (poll_completion(res))
+		return 1;
+	// 完成事件之后 NIC 已经写回旧值
+	*old = *(volatile uint64_t *)res->atomic_buf;
+	return 0;
+}
+/******************************************************************************
+* Function: post_send_async
+*
+* Input
+* res pointer to resources structure
+* opcode IBV_WR_SEND, IBV_WR_RDMA_READ or IBV_WR_RDMA_WRITE
+* wr_id identifier reported back in the completion
+* local_offset offset into res->buf where the data is taken from / placed to
+* remote_offset offset into the remote buffer (ignored for IBV_WR_SEND)
+* length number of bytes to transfer
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Same as post_send_range, but tags the work request with `wr_id` and does not
+* wait for it. Completions are collected later with reap_completions, so up to
+* res->qp_depth requests may be in flight at the same time.
+******************************************************************************/
+int post_send_async(struct resources *res, int opcode, uint64_t wr_id, size_t local_offset, size_t remote_offset,
+					uint32_t length)
+{
+	int rc;
+	if (res->sq_outstanding >= res->qp_depth)
+	{
+		log_debug("send queue is full (%d outstanding)\n", res->sq_outstanding);
+		return -1;
+	}
+	rc = post_send_wr(res, opcode, wr_id, local_offset, remote_offset, length);
+	if (!rc)
+		sq_track(res, 1);
+	return rc;
+}
+/******************************************************************************
+* Function: post_block_async
+*
+* Input
+* res pointer to resources structure, created with res->pool
+* opcode IBV_WR_SEND, IBV_WR_RDMA_READ or IBV_WR_RDMA_WRITE
+* wr_id identifier reported back in the completion
+* blk block leased from res->pool, used as the local side of the transfer
+* block_offset offset into the block
+* remote_offset offset into the remote buffer (ignored for IBV_WR_SEND)
+* length number of bytes to transfer
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Like post_send_async, but the local data lives in a pool block instead of
+* res->buf. The block's MR must belong to the connection's PD, i.e. the
+* connection has to be created with the same pool.
+******************************************************************************/
+int post_block_async(struct resources *res, int opcode, uint64_t wr_id, struct mem_block *blk, size_t block_offset,
+					 size_t remote_offset, uint32_t length)
+{
+	struct ibv_sge sge;
+	int rc;
+	if (!res->pool)
+	{
+		log_err("connection was not created with a memory pool\n");
+		return -1;
+	}
+	if (block_offset > blk->size || length > blk->size - block_offset)
+	{
+		log_err("block range [%zu, +%u) is out of block of %" PRIu64 " bytes\n", block_offset, length, blk->size);
+		return -1;
+	}
+	if (res->sq_outstanding >= res->qp_depth)
+	{
+		log_debug("send queue is full (%d outstanding)\n", res->sq_outstanding);
+		return -1;
+	}
+	memset(&sge, 0, sizeof(sge));
+	sge.addr = blk->addr + block_offset;
+	sge.length = length;
+	sge.lkey = blk->lkey;
+	rc = post_send_sge(res, opcode, wr_id, &sge, remote_offset);
+	if (!rc)
+		sq_track(res, 1);
+	return rc;
+}
+/******************************************************************************
+* Function: sq_track
+*
+* Input
+* res pointer to resources structure
+* slots send queue slots occupied by a signaled asynchronous request and the
+*       unsignaled requests posted right before it
+*
+* Description
+* RC send completions arrive in posting order, so a FIFO of slot counts
+* tells reap_completions how many slots each completion frees. The FIFO also
+* carries the posting time of sampled requests for the latency histogram.
+* Unsignaled requests left behind by a partial post (res->sq_unsignaled) are
+* already counted as outstanding and are released with this request.
+******************************************************************************/
+void sq_track(struct resources *res, int slots)
+{
+	int pos = (res->sig_head + res->sig_count) % res->qp_depth;
+	res->sig_slots[pos] = slots + res->sq_unsignaled;
+	res->sq_unsignaled = 0;
+	res->sig_post_ns[pos] = stats_sample(res);
+	res->sig_count++;
+	res->sq_outstanding += slots;
+}
+/******************************************************************************
+* Function: sq_untrack
+*
+* Input
+* res pointer to resources structure
+*
+* Description
+* Release the slots of the oldest signaled asynchronous request, whose
+* completion was just reaped.
+******************************************************************************/
+void sq_untrack(struct resources *res)
+{
+	int slots = 1;
+	if (res->sig_count)
+	{
+		slots = res->sig_slots[res->sig_head];
+		stats_latency(res, res->sig_post_ns[res->sig_head]);
+		res->sig_head = (res->sig_head + 1) % res->qp_depth;
+		res->sig_count--;
+	}
+	res->sq_outstanding -= slots;
+	if (res->sq_outstanding < 0)
+		res->sq_outstanding = 0;
+}
+/******************************************************************************
+* Function: inline_flag
+*
+* Input
+* res pointer to resources structure
+* opcode opcode of the work request
+* length total payload of the work request
+*
+* Returns
+* IBV_SEND_INLINE if the payload can be copied into the work request, else 0
+*
+* Description
+* Inline data is written into the WQE by the CPU during ibv_post_send, which
+* saves the HCA a DMA read of the payload. RDMA reads and atomics have no
+* outgoing payload.
+******************************************************************************/
+int inline_flag(struct resources *res, int opcode, uint32_t length)
+{
+	if (opcode == IBV_WR_RDMA_READ || opcode == IBV_WR_ATOMIC_FETCH_AND_ADD || opcode == IBV_WR_ATOMIC_CMP_AND_SWP ||
+		!length || length > (uint32_t)res->inline_size)
+		return 0;
+	return IBV_SEND_INLINE;
+}
+/******************************************************************************
+* Function: post_inline_async
+*
+* Input
+* res pointer to resources structure
+* wr_id identifier reported back in the completion
+* data payload, in any memory; it is consumed before the call returns
+* length number of bytes, at most res->inline_size
+* remote_offset offset into the remote buffer
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Post a signaled inline RDMA write straight from unregistered memory. Since
+* the payload is copied into the WQE, the caller may reuse `data` at once.
+******************************************************************************/
+int post_inline_async(struct resources *res, uint64_t wr_id, const void *data, uint32_t length, size_t remote_offset)
+{
+	struct ibv_sge sge;
+	int rc;
+	if (!length || length > (uint32_t)res->inline_size)
+	{
+		log_err("%u bytes do not fit in the %d byte inline limit\n", length, res->inline_size);
+		return -1;
+	}
+	if (res->sq_outstanding >= res->qp_depth)
+	{
+		log_debug("send queue is full (%d outstanding)\n", res->sq_outstanding);
+		return -1;
+	}
+	memset(&sge, 0, sizeof(sge));
+	sge.addr = (uintptr_t)data;
+	sge.length = length;
+	rc = post_send_sge(res, IBV_WR_RDMA_WRITE, wr_id, &sge, remote_offset);
+	if (!rc)
+		sq_track(res, 1);
+	return rc;
+}
+/******************************************************************************
+* Function: post_send_batch
+*
+* Input
+* res pointer to resources structure
+* ops work requests on the registered buffer, in posting order
+* num_ops number of work requests
+* signal_every request a completion for every Nth work request; the last one
+*              of the batch is always signaled
+*
+* Output
+* posted number of requests the send queue accepted, may be NULL
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Link all requests through `next` and ring the doorbell once with a single
+* ibv_post_send. Unsignaled requests produce no completion; their send queue
+* slots are released together with the next signaled one, so reap_completions
+* reports one completion per signaled request only. When the post fails part
+* way, the requests before the failing one are on the send queue anyway: they
+* are reported in `posted` and accounted, and the unsignaled ones after the
+* last signaled request stay outstanding until the next signaled request.
+******************************************************************************/
+int post_send_batch(struct resources *res, struct batch_op_t *ops, int num_ops, int signal_every, int *posted_out)
+{
+	struct ibv_send_wr *wr;
+	struct ibv_sge *sge;
+	struct ibv_send_wr *bad_wr = NULL;
+	int posted = num_ops;
+	int unsignaled = 0;
+	int rc;
+	int i;
+	if (posted_out)
+		*posted_out = 0;
+	if (num_ops <= 0)
+		return 0;
+	if (signal_every <= 0)
+		signal_every = 1;
+	if (res->sq_outstanding + num_ops > res->qp_depth)
+	{
+		log_debug("send queue cannot take %d more requests (%d outstanding)\n", num_ops, res->sq_outstanding);
+		return -1;
+	}
+	for (i = 0; i < num_ops; i++)
+	{
+		if (ops[i].local_offset > res->buf_size || ops[i].length > res->buf_size - ops[i].local_offset ||
+			ops[i].remote_offset > res->remote_props.size ||
+			ops[i].length > res->remote_props.size - ops[i].remote_offset)
+		{
+			log_err("batch request %d [%" PRIu64 " -> %" PRIu64 ", +%u) is out of the buffers\n", i,
+					ops[i].local_offset, ops[i].remote_offset, ops[i].length);
+			return -1;
+		}
+		wr = &res->batch_wrs[i];
+		sge = &res->batch_sges[i];
+		sge->addr = (uintptr_t)(res->buf + ops[i].local_offset);
+		sge->length = ops[i].length;
+		sge->lkey = res->mr->lkey;
+		memset(wr, 0, sizeof(*wr));
+		wr->wr_id = ops[i].wr_id;
+		wr->sg_list = sge;
+		wr->num_sge = 1;
+		wr->opcode = ops[i].opcode;
+		wr->wr.rdma.remote_addr = res->remote_props.addr + ops[i].remote_offset;
+		wr->wr.rdma.rkey = res->remote_props.rkey;
+		wr->next = i + 1 < num_ops ? &res->batch_wrs[i + 1] : NULL;
+		if ((i + 1) % signal_every == 0 || i + 1 == num_ops)
+			wr->send_flags = IBV_SEND_SIGNALED;
+		wr->send_flags |= inline_flag(res, ops[i].opcode, ops[i].length);
+	}
+	rc = ibv_post_send(res->qp, res->batch_wrs, &bad_wr);
+	if (rc)
+	{
+		log_err("failed to post a batch of %d SRs (failed at wr_id %" PRIu64 ")\n", num_ops,
+				bad_wr ? bad_wr->wr_id : 0);
+		// 失败请求之前的请求已经进入发送队列，仍要记账
+		posted = bad_wr ? (int)(bad_wr - res->batch_wrs) : 0;
+	}
+	for (i = 0; i < posted; i++)
+	{
+		stats_posted(res, ops[i].opcode, ops[i].length);
+		unsignaled++;
+		if (res->batch_wrs[i].send_flags & IBV_SEND_SIGNALED)
+		{
+			sq_track(res, unsignaled);
+			unsignaled = 0;
+		}
+	}
+	// 部分投递时最后一个带完成事件的请求之后还可能有未记账的请求
+	res->sq_outstanding += unsignaled;
+	res->sq_unsignaled += unsignaled;
+	if (posted_out)
+		*posted_out = posted;
+	if (!rc)
+		log_debug("posted a batch of %d requests with one doorbell\n", num_ops);
+	return rc;
+}
+/******************************************************************************
+* Function: post_sge_list
+*
+* Input
+* res pointer to resources structure
+* opcode IBV_WR_RDMA_READ or IBV_WR_RDMA_WRITE
+* sge local scatter/gather entries, each with the lkey of its own MR
+* num_sge number of entries
+* remote_offset offset into the remote buffer where the contiguous range starts
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Gather the local entries into (or scatter them from) one contiguous remote
+* range and wait until the transfer has completed. Entries are packed into
+* work requests of up to res->max_send_sge entries each; up to POLL_BATCH
+* requests are chained into one ibv_post_send call and waited for before
+* the next window is posted, so lists of any length stay within the send
+* queue. Like poll_completion, it must not be mixed with asynchronous
+* requests on the same CQ; completions of messages and in-band credits are
+* accounted on the way. On failure the window's requests are still waited
+* for, so that none is left behind for the next operation.
+******************************************************************************/
+int post_sge_list(struct resources *res, int opcode, struct ibv_sge *sge, int num_sge, size_t remote_offset)
+{
+	struct ibv_send_wr wrs[POLL_BATCH];
+	struct ibv_send_wr *bad_wr = NULL;
+	struct ibv_wc wc[POLL_BATCH];
+	uint64_t total = 0;
+	int per_wr = res->max_send_sge > 0 ? res->max_send_sge : 1;
+	int window = res->qp_depth < POLL_BATCH ? res->qp_depth : POLL_BATCH;
+	int done;
+	int posted;
+	int rc = 0;
+	int n;
+	int i;
+
+	for (i = 0; i < num_sge; i++)
+		total += sge[i].length;
+	if (remote_offset > res->remote_props.size || total > res->remote_props.size - remote_offset)
+	{
+		log_err("remote range [%zu, +%" PRIu64 ") is out of buffer of %" PRIu64 " bytes\n", remote_offset, total,
+				res->remote_props.size);
+		return -1;
+	}
+
+	while (num_sge > 0)
+	{
+		// 把接下来的条目装进最多 window 个请求，串成链表一次投递
+		memset(wrs, 0, sizeof(wrs));
+		for (posted = 0; posted < window && num_sge > 0; posted++)
+		{
+			n = num_sge < per_wr ? num_sge : per_wr;
+			wrs[posted].wr_id = posted;
+			wrs[posted].sg_list = sge;
+			wrs[posted].num_sge = n;
+			wrs[posted].opcode = opcode;
+			wrs[posted].send_flags = IBV_SEND_SIGNALED;
+			wrs[posted].wr.rdma.remote_addr = res->remote_props.addr + remote_offset;
+			wrs[posted].wr.rdma.rkey = res->remote_props.rkey;
+			wrs[posted].next = NULL;
+			if (posted > 0)
+				wrs[posted - 1].next = &wrs[posted];
+			total = 0;
+			for (i = 0; i < n; i++)
+				total += sge[i].length;
+			if (total <= UINT32_MAX)
+				wrs[posted].send_flags |= inline_flag(res, opcode, (uint32_t)total);
+			remote_offset += total;
+			sge += n;
+			num_sge -= n;
+		}
+		if (ibv_post_send(res->qp, wrs, &bad_wr))
+		{
+			log_err("failed to post a chain of %d SRs\n", posted);
+			// 失败请求之前的请求已经进入发送队列，仍要等它们完成
+			posted = bad_wr ? (int)(bad_wr - wrs) : 0;
+			rc = -1;
+		}
+		for (i = 0; i < posted; i++)
+		{
+			total = 0;
+			for (n = 0; n < wrs[i].num_sge; n++)
+				total += wrs[i].sg_list[n].length;
+			stats_posted(res, opcode, total);
+		}
+		if (!rc)
+			log_debug("posted %d chained %s requests\n", posted,
+					  opcode == IBV_WR_RDMA_READ ? "RDMA read" : "RDMA write");
+
+		// 等待本窗口的全部完成事件，再投递下一个窗口；出错时也要取完，免得留给下一个操作
+		for (done = 0; done < posted;)
+		{
+			n = poll_cq_batch(res, wc, POLL_BATCH, MAX_POLL_CQ_TIMEOUT * 1000L);
+			if (n <= 0)
+			{
+				log_err("completion wasn't found in the CQ after timeout\n");
+				return -1;
+			}
+			for (i = 0; i < n; i++)
+			{
+				// 消息和带内模式的完成事件交给各自的引擎记账
+				if (wc[i].wr_id >= WRID_MSG_RECV)
+				{
+					if (account_internal(res, &wc[i]))
+						rc = -1;
+					continue;
+				}
+				done++;
+				if (wc[i].status != IBV_WC_SUCCESS && !rc)
+				{
+					log_err("got bad completion with status: 0x%x, vendor syndrome: 0x%x\n", wc[i].status,
+							wc[i].vendor_err);
+					rc = -1;
+				}
+			}
+		}
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+/******************************************************************************
+* Function: post_send_wr
+*
+* Input
+* res pointer to resources structure
+* opcode IBV_WR_SEND, IBV_WR_RDMA_READ or IBV_WR_RDMA_WRITE
+* wr_id identifier reported back in the completion
+* local_offset offset into res->buf
+* remote_offset offset into the remote buffer (ignored for IBV_WR_SEND)
+* length number of bytes to transfer
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Build and post a single-SGE signaled send work request after checking the
+* local and remote ranges.
+******************************************************************************/
+static int post_send_wr(struct resources *res, int opcode, uint64_t wr_id, size_t local_offset, size_t remote_offset,
+						uint32_t length)
+{
+	// sge 用于指定 RDMA 操作中要使用的数据缓冲区的地址、长度和本地密钥（lkey）。本地密钥是 RDMA 设备用于访问该内存区域的权限令牌。
+	struct ibv_sge sge;
+
+	// 检查本地的访问范围，避免越界。
+	if (local_offset > res->buf_size || length > res->buf_size - local_offset)
+	{
+		log_err("local range [%zu, +%u) is out of buffer of %zu bytes\n", local_offset, length, res->buf_size);
+		return -1;
+	}
+
+	memset(&sge, 0, sizeof(sge));					// 使用 memset 初始化散布/聚集条目 sge。
+	sge.addr = (uintptr_t)(res->buf + local_offset); // 设置 sge.addr 为要发送或读写的数据的地址
+	sge.length = length;							 // 设置 sge.length 为要发送或读写的数据的长度。
+	sge.lkey = res->mr->lkey;						 // 设置 sge.lkey 为关联内存区域的本地密钥。
+	return post_send_sge(res, opcode, wr_id, &sge, remote_offset);
+}
+/******************************************************************************
+* Function: post_send_sge
+*
+* Input
+* res pointer to resources structure
+* opcode IBV_WR_SEND, IBV_WR_RDMA_READ or IBV_WR_RDMA_WRITE
+* wr_id identifier reported back in the completion
+* sge local scatter/gather entry, already validated by the caller
+* remote_offset offset into the remote buffer (ignored for IBV_WR_SEND)
+*
+* Output
+* none
+*
+* Returns
+* 0 on success, error code on failure
+*
+* Description
+* Check the remote range and post a signaled send work request for `sge`.
+******************************************************************************/
+static int post_send_sge(struct resources *res, int opcode, uint64_t wr_id, struct ibv_sge *sge, size_t remote_offset)
+{
+	// 在 RDMA 操作中，发送工作请求用于指定如何发送数据（例如，普通发送、RDMA 读或写等）。
+	// sr 的字段包括散布/聚集元素的列表、操作类型（opcode）、发送标志等
+	struct ibv_send_wr sr;
+
+	// 如果 ibv_post_send 返回错误，bad_wr 将被设置为指向问题所在的发送工作请求。初始时设置为 NULL，表示没有错误。
+	struct ibv_send_wr *bad_wr = NULL;
+	uint32_t length = sge->length;
+	int rc;
+
+	// 检查远端的访问范围，避免越界。
+	if (opcode != IBV_WR_SEND &&
+		(remote_offset > res->remote_props.size || length > res->remote_props.size - remote_offset))
+	{
+		log_err("remote range [%zu, +%u) is out of buffer of %" PRIu64 " bytes\n", remote_offset, length,
+				res->remote_props.size);
+		return -1;
+	}
+
+	memset(&sr, 0, sizeof(sr)); // 使用 memset 初始化发送工作请求 sr。
+	sr.next = NULL;
+	sr.wr_id = wr_id;
+	sr.sg_list = sge;				   // 设置 sr.sg_list 指向散布/聚集条目
+	sr.num_sge = 1;					   // 设置 sr.num_sge 为 1，表示只有一个散布/聚集条目。
+	sr.opcode = opcode;				   // 设置 sr.opcode 为传入的操作码。
+	sr.send_flags = IBV_SEND_SIGNALED; // 设置 sr.send_flags 为 IBV_SEND_SIGNALED，以触发完成事件。
+	sr.send_flags |= inline_flag(res, opcode, length); // 小消息由 CPU 直接写入请求，HCA 不必再通过 MR 读取
+
+	if (opcode != IBV_WR_SEND)
+	{
+		sr.wr.rdma.remote_addr = res->remote_props.addr + remote_offset;
+		sr.wr.rdma.rkey = res->remote_props.rkey;
+	}
+	/* there is a Receive Request in the responder side, so we won't get any into RNR flow */
+	// 在 post_send 函数中，rc 用于存储 ibv_post_send 函数的返回值，以指示操作是否成功。成功时，rc 通常为 0；失败时，它包含错误代码。
+	rc = ibv_post_send(res->qp, &sr, &bad_wr);
+	if (rc)
+		log_err("failed to post SR\n");
+	else
+	{
+		stats_posted(res, opcode, length);
+		switch (opcode)
+		{
+		case IBV_WR_SEND:
+			log_debug("Send Request was posted\n");
+			break;
+		case IBV_WR_RDMA_READ:
+			log_debug("RDMA Read Request was posted\n");
+			break;
+		case IBV_WR_RDMA_WRITE:
+			log_debug("RDMA Write Request was posted\n");
+			break;
+		default:
+			log_debug("Unknown Request was posted\n");
+			break;
+		}
+	}
+	return rc;
+}
+/******************************************************************************
+* Function: account_internal
+*
+* Input
+* res pointer to resources structure
+* wc completion with an internal wr_id (at or above WRID_MSG_RECV)
+*
+* Returns
+* 0 on success, 1 on failure
+*
+* Description
+* Route a completion of the library's own work requests to its owner, so
+* that whoever polls the CQ keeps every engine's bookkeeping current.
+******************************************************************************/
+int account_internal(struct resources *res, struct ibv_wc *wc)
+{
+	if (wc->wr_id == WRID_RING || wc->wr_id == WRID_XFER)
+	{
+		if (wc->status != IBV_WC_SUCCESS)
+		{
+			log_err("got bad ring or channel completion with status: 0x%x, vendor syndrome: 0x%x\n", wc->status,
+					wc->vendor_err);
+			return 1;
+		}
+		sq_untrack(res);
+		return 0;
+	}
+	if (res->msg_ring)
+		return msg_account(res, wc);
+	return inband_account(res, wc);
+}
+/******************************************************************************
+* Function: reap_completions
+*
+* Input
+* res pointer to resources structure
+* out array of at least `max` entries
+* max maximum number of completions to return
+* timeout_usec how long to wait for the first completion, 0 for a single
+*              check, negative to wait forever
+*
+* Output
+* out filled with the reaped completions
+*
+* Returns
+* number of completions stored in out (0 on timeout), -1 on failure
+*
+* Description
+* Collect completions of requests posted with post_send_async. Blocks until at
+* least one completion is available or timeout_usec passes, then drains whatever
+* else is already queued (up to max), POLL_BATCH entries per ibv_poll_cq call. Completions of the in-band mode's own
+* requests are accounted internally and never returned. Completions with an
+* error status are returned like any other and release their send queue slots
+* as well; the caller inspects `status`. Their opcode is undefined.
+******************************************************************************/
+int reap_completions(struct resources *res, struct completion_t *out, int max, long timeout_usec)
+{
+	struct ibv_wc wc[POLL_BATCH];
+	int poll_result;
+	int batch;
+	int i;
+	int n = 0;
+	while (n < max)
+	{
+		batch = max - n < POLL_BATCH ? max - n : POLL_BATCH;
+		// 只有第一次需要等待；之后只取出 CQ 中已经存在的完成事件
+		poll_result = poll_cq_batch(res, wc, batch, n ? 0 : timeout_usec);
+		if (poll_result < 0)
+			return -1;
+		if (poll_result == 0)
+			break;
+		for (i = 0; i < poll_result; i++)
+		{
+			if (wc[i].wr_id >= WRID_MSG_RECV)
+			{
+				if (account_internal(res, &wc[i]))
+					return -1;
+				continue;
+			}
+			// 库只以保留的 wr_id 投递接收请求，其余完成事件都来自发送队列；
+			// 失败的完成事件的 opcode 无定义，所以不论状态一律释放槽位
+			sq_untrack(res);
+			out[n].wr_id = wc[i].wr_id;
+			out[n].status = wc[i].status;
+			out[n].opcode = wc[i].opcode;
+			out[n].byte_len = wc[i].byte_len;
+			n++;
+		}
+		// 本次没有取满，说明 CQ 已经空了
+		if (poll_result < batch)
+			break;
+	}
+	return n;
+}
+/******************************************************************************
+ * Function: post_receive
+ * Input
+ * res pointer to resources structure
+ *  int post_receive(struct resources *res): 该函数接受一个指向包含 RDMA 资源的 resources 结构体的指针 res
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ *
+ ******************************************************************************/
+int post_receive(struct resources *res)
+{
+	struct ibv_recv_wr rr;
+	struct ibv_sge sge;
+	struct ibv_recv_wr *bad_wr;
+	int rc;
+	/* prepare the scatter/gather entry */
+	memset(&sge, 0, sizeof(sge));
 	sge.addr = (uintptr_t)res->buf;
-	sge.length = MSG_SIZE;
+	sge.length = res->buf_size;
 	sge.lkey = res->mr->lkey;
 
 	memset(&rr, 0, sizeof(rr));
@@ -326,9 +1384,9 @@ int post_receive(struct resources *res)
 
 	rc = ibv_post_recv(res->qp, &rr, &bad_wr);
 	if (rc)
-		fprintf(stderr, "failed to post RR\n");
+		log_err("failed to post RR\n");
 	else
-		fprintf(stdout, "Receive Request was posted\n");
+		log_debug("Receive Request was posted\n");
 	return rc;
 }
 /******************************************************************************
@@ -351,6 +1409,223 @@ void resources_init(struct resources *res)
 	memset(res, 0, sizeof *res);
 	// res->sock = -1;: 将 sock 成员（套接字文件描述符）设置为 -1。这是一个常用的技巧，用于表示该套接字尚未被分配或初始化
 	res->sock = -1;
+	// 从全局默认配置复制一份，之后只修改本连接的副本
+	res->config = config;
+}
+/******************************************************************************
+* Function: resources_init_lane
+*
+* Input
+* lane resources of the additional QP to initialize
+* primary connected primary resources of the striped connection
+* index lane index, 1 to primary->stripes - 1
+*
+* Output
+* none
+*
+* Returns
+* none
+*
+* Description
+* Prepare an additional QP of a striped connection. The lane gets its own QP
+* and CQ on the primary's device but borrows the primary's TCP socket,
+* registered buffer and MR, so every lane can reach the whole buffer and the
+* peer's lanes are set up over the same socket, in order. Messaging, the
+* in-band mode and the pool are not copied: they stay on the primary.
+******************************************************************************/
+void resources_init_lane(struct resources *lane, const struct resources *primary, int index)
+{
+	resources_init(lane);
+	lane->config = primary->config;
+	lane->lane = index;
+	lane->sock = primary->sock;
+	lane->dev = primary->dev;
+	lane->buf = primary->buf;
+	lane->buf_size = primary->buf_size;
+	lane->mr = primary->mr;
+	lane->qp_depth = primary->qp_depth;
+	lane->cq_depth = primary->qp_depth * 2;
+	lane->max_inline = primary->max_inline;
+	lane->mtu = primary->mtu;
+	lane->rd_atomic = primary->rd_atomic;
+	lane->event_mode = primary->event_mode;
+	lane->lat_sample = primary->lat_sample;
+	// 附属 QP 的 CQ 分散到其他完成向量上
+	lane->comp_vector = -1;
+}
+/******************************************************************************
+ * Function: open_ib_device
+ *
+ * Input
+ * dev_name name of the IB device, NULL for the first one found
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * the opened device context, NULL on failure
+ *
+ * Description
+ * Find the IB device named by dev_name (or the first one) and open it.
+ ******************************************************************************/
+struct ibv_context *open_ib_device(const char *dev_name)
+{
+	// dev_list 是一个指向 InfiniBand 设备指针数组的指针。这个数组用于存储系统中检测到的所有 IB 设备
+	struct ibv_device **dev_list = NULL;
+	// ib_dev 是一个指向单个 IB 设备的指针。它将用于指向从 dev_list 中选定的设备
+	struct ibv_device *ib_dev = NULL;
+	struct ibv_context *ib_ctx = NULL;
+	int num_devices;
+	int i;
+
+	log_info("searching for IB devices in host\n");
+	// 使用 ibv_get_device_list 函数获取系统中所有 IB（InfiniBand）设备的列表
+	dev_list = ibv_get_device_list(&num_devices);
+	if (!dev_list)
+	{
+		log_err("failed to get IB devices list\n");
+		return NULL;
+	}
+	/* if there isn't any IB device in host */
+	if (!num_devices)
+	{
+		log_err("found %d device(s)\n", num_devices);
+		goto open_ib_device_exit;
+	}
+	log_info("found %d device(s)\n", num_devices);
+
+	// 遍历设备列表，找到与配置中指定名称相匹配的设备。
+	for (i = 0; i < num_devices; i++)
+	{
+		if (!dev_name)
+		{
+			// 未指定设备时自动选择设备列表中的第一个设备。不修改全局配置，多个连接可以并发打开设备。
+			dev_name = ibv_get_device_name(dev_list[i]);
+			log_info("device not specified, using first one found: %s\n", dev_name);
+		}
+
+		// 如果设备名称可以匹配
+		if (!strcmp(ibv_get_device_name(dev_list[i]), dev_name))
+		{
+			ib_dev = dev_list[i];
+			break;
+		}
+	}
+	/* if the device wasn't found in host */
+	if (!ib_dev)
+	{
+		log_err("IB device %s wasn't found\n", dev_name);
+		goto open_ib_device_exit;
+	}
+
+	// 使用 ibv_open_device 函数打开找到的设备，并获取设备上下文。
+	ib_ctx = ibv_open_device(ib_dev);
+	if (!ib_ctx)
+		log_err("failed to open device %s\n", dev_name);
+open_ib_device_exit:
+	ibv_free_device_list(dev_list);
+	return ib_ctx;
+}
+/******************************************************************************
+ * Function: rdma_device_open
+ *
+ * Input
+ * cfg configuration naming the device and port
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * the device with one reference held by the caller, NULL on failure
+ *
+ * Description
+ * Open cfg->dev_name, allocate its PD and query the device and cfg->ib_port
+ * once. Every connection and pool created on the device shares
+ * the context and PD, so memory registered once is usable on all of them.
+ ******************************************************************************/
+struct rdma_device *rdma_device_open(const struct config_t *cfg)
+{
+	struct rdma_device *dev;
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+	{
+		log_err("failed to allocate device\n");
+		return NULL;
+	}
+	dev->refs = 1;
+	dev->ib_ctx = open_ib_device(cfg->dev_name);
+	if (!dev->ib_ctx)
+		goto rdma_device_open_error;
+	if (ibv_query_device(dev->ib_ctx, &dev->device_attr))
+	{
+		log_err("ibv_query_device failed\n");
+		goto rdma_device_open_error;
+	}
+	dev->ib_port = cfg->ib_port;
+	if (ibv_query_port(dev->ib_ctx, dev->ib_port, &dev->port_attr))
+	{
+		log_err("ibv_query_port on port %u failed\n", dev->ib_port);
+		goto rdma_device_open_error;
+	}
+	dev->pd = ibv_alloc_pd(dev->ib_ctx);
+	if (!dev->pd)
+	{
+		log_err("ibv_alloc_pd failed\n");
+		goto rdma_device_open_error;
+	}
+	dev->numa_node = device_numa_node(dev->ib_ctx);
+	if (dev->numa_node >= 0)
+		log_info("device %s is attached to NUMA node %d\n", ibv_get_device_name(dev->ib_ctx->device), dev->numa_node);
+	dev->odp_caps = device_odp_caps(dev->ib_ctx);
+	return dev;
+
+rdma_device_open_error:
+	rdma_device_put(dev);
+	return NULL;
+}
+/******************************************************************************
+ * Function: rdma_device_get
+ *
+ * Input
+ * dev device opened with rdma_device_open
+ *
+ * Description
+ * Take another reference on the device.
+ ******************************************************************************/
+void rdma_device_get(struct rdma_device *dev)
+{
+	__atomic_add_fetch(&dev->refs, 1, __ATOMIC_RELAXED);
+}
+/******************************************************************************
+ * Function: rdma_device_put
+ *
+ * Input
+ * dev device opened with rdma_device_open
+ *
+ * Returns
+ * 0 on success, 1 if closing the device failed
+ *
+ * Description
+ * Drop a reference; the last one deallocates the PD and closes the context.
+ * Every MR and QP created in the PD must be gone by then.
+ ******************************************************************************/
+int rdma_device_put(struct rdma_device *dev)
+{
+	int rc = 0;
+	if (__atomic_sub_fetch(&dev->refs, 1, __ATOMIC_ACQ_REL))
+		return 0;
+	if (dev->pd && ibv_dealloc_pd(dev->pd))
+	{
+		log_err("failed to deallocate PD\n");
+		rc = 1;
+	}
+	if (dev->ib_ctx && ibv_close_device(dev->ib_ctx))
+	{
+		log_err("failed to close device context\n");
+		rc = 1;
+	}
+	free(dev);
+	return rc;
 }
 /******************************************************************************
 * Function: resources_create
@@ -372,191 +1647,299 @@ void resources_init(struct resources *res)
 int resources_create(struct resources *res)
 {
 
-	// dev_list 是一个指向 InfiniBand 设备指针数组的指针。这个数组用于存储系统中检测到的所有 IB 设备
-	// 初始设置为 NULL，这个数组将由 ibv_get_device_list 函数填充。
-	struct ibv_device **dev_list = NULL;
-
 	// qp_init_attr 是一个结构体，用于初始化队列对（Queue Pair, QP）。它包含了创建 QP 所需的所有参数，如 QP 类型、发送/接收完成队列（CQ）的指针、最大发送/接收工作请求等。
 	struct ibv_qp_init_attr qp_init_attr;
 
-	// ib_dev 是一个指向单个 IB 设备的指针。它将用于指向从 dev_list 中选定的设备
-	// 最初设置为 NULL，在设备选择过程中会被赋值。
-	struct ibv_device *ib_dev = NULL;
-
 	// size 用于存储将要分配的内存缓冲区的大小。在这个上下文中，它通常被设置为消息大小。
 	size_t size;
 
-	// i 是一个循环计数器，用于遍历 IB 设备列表
-	int i;
-
 	// mr_flags 用于指定注册内存区域（Memory Region, MR）时的访问权限标志。这些标志包括本地写入、远程读取和远程写入权限。
 	int mr_flags = 0;
 
-	// cq_size 用于指定创建的完成队列（CQ）的大小。在这个示例中，由于每个端只发送一个工作请求，所以一个 CQ 条目足够了。
+	// cq_size 用于指定创建的完成队列（CQ）的大小，需要容纳所有可能同时在途的发送和接收请求。
 	int cq_size = 0;
 
-	// num_devices 用于存储系统中检测到的 IB 设备数量。这个值由 ibv_get_device_list 函数设置。
-	int num_devices;
+	// node 是缓冲区所在的 NUMA 节点
+	int node;
 
 	// rc 是一个返回码变量，用于存储函数的执行结果。成功时为 0，失败时为非零值。
 	int rc = 0;
 
+	// 记录各阶段的耗时，供 SetupStats 报告
+	unsigned long phase_usec = monotonic_usec();
+
 	// 根据配置，函数尝试建立一个 TCP 连接。在客户端模式下，它连接到指定的服务器和端口；在服务器模式下，它监听指定的端口。
+	// 条带化连接的附属 QP 沿用主连接的套接字；多客户端服务器已经 accept 得到了套接字。
+	if (res->sock_accepted)
+		log_info("TCP connection was accepted\n");
+	else if (res->lane)
+		log_debug("QP %d of the striped connection reuses the TCP connection\n", res->lane);
 	/* if client side */
-	if (config.server_name)
+	else if (res->config.server_name)
 	{
-		res->sock = sock_connect(config.server_name, config.tcp_port);
+		res->sock = sock_connect(res->config.server_name, res->config.tcp_port);
 		if (res->sock < 0)
 		{
-			fprintf(stderr, "failed to establish TCP connection to server %s, port %d\n",
-					config.server_name, config.tcp_port);
+			log_err("failed to establish TCP connection to server %s, port %d\n",
+					res->config.server_name, res->config.tcp_port);
 			rc = -1;
 			goto resources_create_exit;
 		}
 	}
 	else
 	{
-		fprintf(stdout, "waiting on port %d for TCP connection\n", config.tcp_port);
-		res->sock = sock_connect(NULL, config.tcp_port);
+		log_info("waiting on port %d for TCP connection\n", res->config.tcp_port);
+		res->sock = sock_connect(NULL, res->config.tcp_port);
 		if (res->sock < 0)
 		{
-			fprintf(stderr, "failed to establish TCP connection with client on port %d\n",
-					config.tcp_port);
-			rc = -1;
+			log_err("failed to establish TCP connection with client on port %d\n",
+					res->config.tcp_port);
+			rc = -1;
+			goto resources_create_exit;
+		}
+	}
+	if (!res->lane && !res->sock_accepted)
+		log_info("TCP connection was established\n");
+	res->setup.tcp_usec = monotonic_usec() - phase_usec;
+	phase_usec = monotonic_usec();
+
+	// 连接共享调用方给定的设备、内存池的设备，或者打开一个新设备；无论哪种情况连接都持有设备的一个引用。
+	if (res->pool && res->dev && res->dev != res->pool->dev)
+	{
+		log_err("memory pool belongs to a different device\n");
+		res->dev = NULL;
+		rc = 1;
+		goto resources_create_exit;
+	}
+	if (!res->dev && res->pool)
+		res->dev = res->pool->dev;
+	if (res->dev)
+		rdma_device_get(res->dev);
+	else
+		res->dev = rdma_device_open(&res->config);
+	if (!res->dev)
+	{
+		rc = 1;
+		goto resources_create_exit;
+	}
+
+	res->setup.device_usec = monotonic_usec() - phase_usec;
+	phase_usec = monotonic_usec();
+
+	// 端口属性在打开设备时已经查询过，只有使用其它端口时才需要重新查询。
+	if (res->config.ib_port == res->dev->ib_port)
+		res->port_attr = res->dev->port_attr;
+	else if (ibv_query_port(res->dev->ib_ctx, res->config.ib_port, &res->port_attr))
+	{
+		log_err("ibv_query_port on port %u failed\n", res->config.ib_port);
+		rc = 1;
+		goto resources_create_exit;
+	}
+
+	// 把队列深度限制在设备支持的范围内。
+	if (!res->qp_depth)
+		res->qp_depth = DEFAULT_QP_DEPTH;
+	if (!res->lat_sample)
+		res->lat_sample = DEFAULT_LAT_SAMPLE;
+	if (res->inband && res->qp_depth < INBAND_RECV_DEPTH)
+		res->qp_depth = INBAND_RECV_DEPTH;
+	if (res->qp_depth > res->dev->device_attr.max_qp_wr)
+		res->qp_depth = res->dev->device_attr.max_qp_wr;
+	if (!res->cq_depth)
+		res->cq_depth = 2 * res->qp_depth;
+	if (res->cq_depth > res->dev->device_attr.max_cqe)
+		res->cq_depth = res->dev->device_attr.max_cqe;
+
+	// 消息引擎：创建私有接收环（或使用调用方传入的共享接收环），接收请求和带内模式都占用接收队列，二者不能同时使用。
+	if (res->msg_slots && !res->msg_ring)
+	{
+		res->msg_ring = msg_ring_create(res->dev, res->msg_slots, res->msg_slot_size, 0);
+		if (!res->msg_ring)
+		{
+			rc = 1;
+			goto resources_create_exit;
+		}
+		res->msg_own_ring = 1;
+	}
+	if (res->msg_ring)
+	{
+		if (res->inband)
+		{
+			log_err("messaging cannot be combined with in-band completion\n");
+			rc = 1;
+			goto resources_create_exit;
+		}
+		if (res->msg_ring->dev != res->dev)
+		{
+			log_err("message ring belongs to a different device\n");
+			rc = 1;
+			goto resources_create_exit;
+		}
+		// 所有槽位的完成事件都可能进入本连接的 CQ
+		res->cq_depth += res->msg_ring->slots;
+		if (res->cq_depth > res->dev->device_attr.max_cqe)
+			res->cq_depth = res->dev->device_attr.max_cqe;
+		res->msg_ready = calloc(res->msg_ring->slots, sizeof(*res->msg_ready));
+		if (!res->msg_ready)
+		{
+			log_err("failed to allocate message queue\n");
+			rc = 1;
 			goto resources_create_exit;
 		}
 	}
-	fprintf(stdout, "TCP connection was established\n");
-	fprintf(stdout, "searching for IB devices in host\n");
 
-	// 使用 ibv_get_device_list 函数获取系统中所有 IB（InfiniBand）设备的列表
-	dev_list = ibv_get_device_list(&num_devices);
-	if (!dev_list)
-	{
-		fprintf(stderr, "failed to get IB devices list\n");
-		rc = 1;
-		goto resources_create_exit;
-	}
-	/* if there isn't any IB device in host */
-	if (!num_devices)
+	// 为批量投递预先分配请求数组，以及记录异步请求占用槽位的环形队列，数据通路上不再分配内存。
+	res->batch_wrs = calloc(res->qp_depth, sizeof(*res->batch_wrs));
+	res->batch_sges = calloc(res->qp_depth, sizeof(*res->batch_sges));
+	res->sig_slots = calloc(res->qp_depth, sizeof(*res->sig_slots));
+	res->sig_post_ns = calloc(res->qp_depth, sizeof(*res->sig_post_ns));
+	if (!res->batch_wrs || !res->batch_sges || !res->sig_slots || !res->sig_post_ns)
 	{
-		fprintf(stderr, "found %d device(s)\n", num_devices);
+		log_err("failed to allocate send queue bookkeeping for depth %d\n", res->qp_depth);
 		rc = 1;
 		goto resources_create_exit;
 	}
-	fprintf(stdout, "found %d device(s)\n", num_devices);
 
-	// 遍历设备列表，找到与配置中指定名称相匹配的设备。
-	for (i = 0; i < num_devices; i++)
+	// 事件模式下创建完成通道，并把它的 fd 设为非阻塞，以便交给 Go 的 netpoller 等待。
+	if (res->event_mode)
 	{
-		if (!config.dev_name)
+		res->channel = ibv_create_comp_channel(res->dev->ib_ctx);
+		if (!res->channel)
 		{
-			// 自动选择设备列表中的第一个设备，并将其名称复制到 config.dev_name。这里使用 strdup 函数来分配新的内存并复制设备名称字符串。
-			config.dev_name = strdup(ibv_get_device_name(dev_list[i]));
-			fprintf(stdout, "device not specified, using first one found: %s\n", config.dev_name);
+			log_err("failed to create completion channel\n");
+			rc = 1;
+			goto resources_create_exit;
 		}
-
-		// 如果设备名称可以匹配
-		if (!strcmp(ibv_get_device_name(dev_list[i]), config.dev_name))
+		if (fcntl(res->channel->fd, F_SETFL, fcntl(res->channel->fd, F_GETFL) | O_NONBLOCK) < 0)
 		{
-			// ib_dev = dev_list[i];：将 ib_dev 指针设置为匹配的设备。
-			ib_dev = dev_list[i];
-			break;
+			log_err("failed to make completion channel non-blocking\n");
+			rc = 1;
+			goto resources_create_exit;
 		}
 	}
-	/* if the device wasn't found in host */
-	if (!ib_dev)
-	{
-		fprintf(stderr, "IB device %s wasn't found\n", config.dev_name);
-		rc = 1;
-		goto resources_create_exit;
-	}
 
-	// 使用 ibv_open_device 函数打开找到的设备，并获取设备上下文。
-	res->ib_ctx = ibv_open_device(ib_dev);
-	if (!res->ib_ctx)
+	// 使用 ibv_create_cq 创建一个完成队列（Completion Queue），发送和接收的完成事件都进入这里。
+	cq_size = res->cq_depth;
+	// 未指定完成向量时在设备的向量间轮流分配，使各连接的完成中断分散到不同的核上
+	if (res->dev->ib_ctx->num_comp_vectors <= 0)
+		res->comp_vector = 0;
+	else if (res->comp_vector < 0)
+		res->comp_vector = __atomic_fetch_add(&res->dev->next_vector, 1, __ATOMIC_RELAXED) %
+						   res->dev->ib_ctx->num_comp_vectors;
+	else
+		res->comp_vector %= res->dev->ib_ctx->num_comp_vectors;
+	res->cq = ibv_create_cq(res->dev->ib_ctx, cq_size, NULL, res->channel, res->comp_vector);
+	if (!res->cq)
 	{
-		fprintf(stderr, "failed to open device %s\n", config.dev_name);
+		log_err("failed to create CQ with %u entries\n", cq_size);
 		rc = 1;
 		goto resources_create_exit;
 	}
-	// 现在初始化完毕，可以释放原来的设备列表了
-	ibv_free_device_list(dev_list);
-	dev_list = NULL;
-	ib_dev = NULL;
-
-	// 使用 ibv_query_port 查询指定 IB 端口的属性
-	// 这个调用查询指定的 InfiniBand 端口属性，存储在 res->port_attr 中。
-	// res->ib_ctx 是打开的 IB 设备的上下文，config.ib_port 是要查询的端口号。
-	if (ibv_query_port(res->ib_ctx, config.ib_port, &res->port_attr))
+	log_debug("CQ of %u entries uses completion vector %d\n", cq_size, res->comp_vector);
+
+	// 分配内存缓冲区，大小由调用方通过 res->buf_size 指定，未指定时使用 MSG_SIZE
+	size = res->buf_size ? res->buf_size : MSG_SIZE;
+	res->buf_size = size;
+	if (res->lane)
+		log_info("QP %d of the striped connection shares the buffer at addr=%p, lkey=0x%x\n", res->lane,
+				 res->buf, res->mr->lkey);
+	else if (res->pool)
 	{
-		fprintf(stderr, "ibv_query_port on port %u failed\n", config.ib_port);
-		rc = 1;
-		goto resources_create_exit;
+		// 从内存池租用缓冲区。slab 的 MR 覆盖其他连接租用的块，它的 rkey 不能交给对端，
+		// 所以只为本连接的范围再注册一个 MR；页面已经被 slab 固定，注册不再需要分配和缺页
+		if (mem_pool_alloc(res->pool, size, &res->pool_block))
+		{
+			log_err("failed to lease %zu bytes from the memory pool\n", size);
+			rc = 1;
+			goto resources_create_exit;
+		}
+		res->buf = (char *)(uintptr_t)res->pool_block.addr;
+		memset(res->buf, 0, size);
+		res->mr = ibv_reg_mr(res->dev->pd, res->buf, size, IBV_ACCESS_LOCAL_WRITE | remote_access_flags(res->dev));
+		if (!res->mr)
+		{
+			log_err("ibv_reg_mr failed for the %zu bytes leased from the memory pool\n", size);
+			rc = 1;
+			goto resources_create_exit;
+		}
+		log_info("buffer leased from pool with addr=%p, lkey=0x%x, rkey=0x%x\n",
+				 res->buf, res->mr->lkey, res->mr->rkey);
 	}
-
-	// 使用 ibv_alloc_pd 分配一个保护域（Protection Domain）。
-	res->pd = ibv_alloc_pd(res->ib_ctx);
-	if (!res->pd)
+	else if (res->numa_bind && (res->numa_node >= 0 || res->dev->numa_node >= 0))
 	{
-		fprintf(stderr, "ibv_alloc_pd failed\n");
-		rc = 1;
-		goto resources_create_exit;
+		// 缓冲区放在指定节点（默认是设备所在的节点）上，HCA 的 DMA 不必跨插槽
+		node = res->numa_node >= 0 ? res->numa_node : res->dev->numa_node;
+		res->buf = numa_alloc(size, node);
+		if (!res->buf)
+		{
+			log_err("failed to map %zu bytes on NUMA node %d\n", size, node);
+			rc = 1;
+			goto resources_create_exit;
+		}
+		res->buf_numa = 1;
+		log_info("buffer of %zu bytes placed on NUMA node %d\n", size, node);
 	}
-
-	// 使用 ibv_create_cq 创建一个完成队列（Completion Queue）。
-	cq_size = 1;
-	res->cq = ibv_create_cq(res->ib_ctx, cq_size, NULL, NULL, 0);
-	if (!res->cq)
+	else
 	{
-		fprintf(stderr, "failed to create CQ with %u entries\n", cq_size);
-		rc = 1;
-		goto resources_create_exit;
+		res->buf = (char *)malloc(size);
+		if (!res->buf)
+		{
+			log_err("failed to malloc %Zu bytes to memory buffer\n", size);
+			rc = 1;
+			goto resources_create_exit;
+		}
+		// // 使用 memset 将缓冲区清零。
+		// memset(res->buf, 0, size);
+		// // 如果是服务器端，将消息内容复制到缓冲区中。
+		// if (!config.server_name)
+		// {
+		// 	printf("Enter your message: ");
+		// 	if (fgets(res->buf, MSG_SIZE, stdin) != NULL) // 假设 BUFFER_SIZE 是 res.buf 的大小
+		// 	{
+		// 		// 除去可能的换行符
+		// 		res->buf[strcspn(res->buf, "\n")] = 0;
+		// 	}
+		// 	else
+		// 	{
+		// 		fprintf(stderr, "Error reading input.\n");
+		// 		// 可以选择如何处理输入错误
+		// 	}
+		// 	fprintf(stdout, "Server: going to send the message: '%s'\n", res->buf);
+		// }
+		// else
+		memset(res->buf, 0, size);
+
+		// 这行代码设定了用于注册内存区域的访问标志。IBV_ACCESS_LOCAL_WRITE 允许本地写入，IBV_ACCESS_REMOTE_READ 和 IBV_ACCESS_REMOTE_WRITE 分别允许远程端读取和写入这块内存。
+		// 这些标志确保了内存区域既能被本地 RDMA 设备用于写操作，也能被远程 RDMA 设备用于读和写操作；设备支持时对端还可以对它执行原子操作。
+		mr_flags = IBV_ACCESS_LOCAL_WRITE | remote_access_flags(res->dev);
+		// 函数注册内存区域。这个调用关联了共享的保护域（res->dev->pd）、内存缓冲区（res->buf）、缓冲区大小（size）以及访问标志（mr_flags）。
+		res->mr = ibv_reg_mr(res->dev->pd, res->buf, size, mr_flags);
+		if (!res->mr)
+		{
+			log_err("ibv_reg_mr failed with mr_flags=0x%x\n", mr_flags);
+			rc = 1;
+			goto resources_create_exit;
+		}
+		log_info("MR was registered with addr=%p, lkey=0x%x, rkey=0x%x, flags=0x%x\n",
+				res->buf, res->mr->lkey, res->mr->rkey, mr_flags);
 	}
 
-	// 分配内存缓冲区
-	size = MSG_SIZE;
-	res->buf = (char *)malloc(size);
-	if (!res->buf)
+	// 原子操作把远端的旧值写回本地内存，为此单独注册一个 8 字节的字，不占用数据缓冲区
+	if (posix_memalign((void **)&res->atomic_buf, 64, sizeof(uint64_t)))
 	{
-		fprintf(stderr, "failed to malloc %Zu bytes to memory buffer\n", size);
+		res->atomic_buf = NULL;
+		log_err("failed to allocate atomic result word\n");
 		rc = 1;
 		goto resources_create_exit;
 	}
-	// // 使用 memset 将缓冲区清零。
-	// memset(res->buf, 0, size);
-	// // 如果是服务器端，将消息内容复制到缓冲区中。
-	// if (!config.server_name)
-	// {
-	// 	printf("Enter your message: ");
-	// 	if (fgets(res->buf, MSG_SIZE, stdin) != NULL) // 假设 BUFFER_SIZE 是 res.buf 的大小
-	// 	{
-	// 		// 除去可能的换行符
-	// 		res->buf[strcspn(res->buf, "\n")] = 0;
-	// 	}
-	// 	else
-	// 	{
-	// 		fprintf(stderr, "Error reading input.\n");
-	// 		// 可以选择如何处理输入错误
-	// 	}
-	// 	fprintf(stdout, "Server: going to send the message: '%s'\n", res->buf);
-	// }
-	// else
-	memset(res->buf, 0, size);
-
-	// 这行代码设定了用于注册内存区域的访问标志。IBV_ACCESS_LOCAL_WRITE 允许本地写入，IBV_ACCESS_REMOTE_READ 和 IBV_ACCESS_REMOTE_WRITE 分别允许远程端读取和写入这块内存。
-	// 这些标志确保了内存区域既能被本地 RDMA 设备用于写操作，也能被远程 RDMA 设备用于读和写操作。
-	mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
-	// 函数注册内存区域。这个调用关联了前面分配的保护域（res->pd）、内存缓冲区（res->buf）、缓冲区大小（size）以及访问标志（mr_flags）。
-	res->mr = ibv_reg_mr(res->pd, res->buf, size, mr_flags);
-	if (!res->mr)
-	{
-		fprintf(stderr, "ibv_reg_mr failed with mr_flags=0x%x\n", mr_flags);
+	*res->atomic_buf = 0;
+	res->atomic_mr = ibv_reg_mr(res->dev->pd, res->atomic_buf, sizeof(uint64_t), IBV_ACCESS_LOCAL_WRITE);
+	if (!res->atomic_mr)
+	{
+		log_err("ibv_reg_mr failed for the atomic result word\n");
 		rc = 1;
 		goto resources_create_exit;
 	}
-	fprintf(stdout, "MR was registered with addr=%p, lkey=0x%x, rkey=0x%x, flags=0x%x\n",
-			res->buf, res->mr->lkey, res->mr->rkey, mr_flags);
 
 	// 这一部分代码涉及使用 InfiniBand Verbs API 创建队列对（Queue Pair, QP），它是 RDMA 通信的核心组件。队列对包含两个队列：发送队列（Send Queue）和接收队列（Receive Queue）
 
@@ -566,32 +1949,59 @@ int resources_create(struct resources *res)
 	// 设置队列对类型为可靠连接（Reliable Connection）。
 	qp_init_attr.qp_type = IBV_QPT_RC;
 
-	// 设置发送队列的所有工作请求在完成时都将产生一个完成事件。
-	qp_init_attr.sq_sig_all = 1;
+	// 只有带 IBV_SEND_SIGNALED 的请求才产生完成事件，批量投递时可以只为每 N 个请求申请一次完成事件。
+	qp_init_attr.sq_sig_all = 0;
 
 	// 指定发送和接收操作都使用同一个完成队列（Completion Queue）
 	qp_init_attr.send_cq = res->cq;
 	qp_init_attr.recv_cq = res->cq;
 
-	// 这个字段指定了发送队列（Send Queue）可以容纳的最大工作请求（Work Request）数。在你的代码中，这个值被设置为 1，意味着发送队列一次只能容纳一个发送工作请求。
-	qp_init_attr.cap.max_send_wr = 10;
+	// 这个字段指定了发送队列（Send Queue）可以容纳的最大工作请求（Work Request）数，即可以同时在途的异步请求数。
+	qp_init_attr.cap.max_send_wr = res->qp_depth;
 
-	// 这个字段指定了接收队列（Receive Queue）可以容纳的最大工作请求数。在你的代码中，这个值也被设置为 1，意味着接收队列一次只能容纳一个接收工作请求。
-	qp_init_attr.cap.max_recv_wr = 10;
+	// 这个字段指定了接收队列（Receive Queue）可以容纳的最大工作请求数。私有接收环的所有槽位都要能同时投递；
+	// 使用共享接收队列时接收请求投递到 SRQ，不占用 QP 的接收队列。
+	qp_init_attr.cap.max_recv_wr = res->qp_depth;
+	if (res->msg_ring && res->msg_own_ring && res->msg_ring->slots > res->qp_depth)
+		qp_init_attr.cap.max_recv_wr = res->msg_ring->slots;
 
 	// : 设置每个工作请求的最大散布/聚集元素（Scatter/Gather Element）数为 1。
-	qp_init_attr.cap.max_send_sge = 10;
-	qp_init_attr.cap.max_recv_sge = 10;
+	qp_init_attr.cap.max_send_sge = MAX_SEND_SGE;
+	if (qp_init_attr.cap.max_send_sge > (uint32_t)res->dev->device_attr.max_sge)
+		qp_init_attr.cap.max_send_sge = res->dev->device_attr.max_sge;
+	qp_init_attr.cap.max_recv_sge = qp_init_attr.cap.max_send_sge;
+	if (res->msg_ring && res->msg_ring->srq)
+	{
+		qp_init_attr.srq = res->msg_ring->srq;
+		qp_init_attr.cap.max_recv_wr = 0;
+		qp_init_attr.cap.max_recv_sge = 0;
+	}
+
+	// 申请内联数据空间；设备不支持这么大时会拒绝创建 QP，此时不带内联重试一次。
+	if (res->max_inline >= 0)
+		qp_init_attr.cap.max_inline_data = res->max_inline ? res->max_inline : DEFAULT_MAX_INLINE;
 
 	// 使用 ibv_create_qp 函数根据提供的属性创建队列对。
-	res->qp = ibv_create_qp(res->pd, &qp_init_attr);
+	res->qp = ibv_create_qp(res->dev->pd, &qp_init_attr);
+	if (!res->qp && qp_init_attr.cap.max_inline_data)
+	{
+		log_info("QP with %u bytes of inline data was refused, retrying without\n",
+				 qp_init_attr.cap.max_inline_data);
+		qp_init_attr.cap.max_inline_data = 0;
+		res->qp = ibv_create_qp(res->dev->pd, &qp_init_attr);
+	}
 	if (!res->qp)
 	{
-		fprintf(stderr, "failed to create QP\n");
+		log_err("failed to create QP\n");
 		rc = 1;
 		goto resources_create_exit;
 	}
-	fprintf(stdout, "QP was created, QP number=0x%x\n", res->qp->qp_num);
+	// ibv_create_qp 把实际的能力写回 qp_init_attr.cap，散布/聚集请求据此切分，内联阈值也以它为准
+	res->max_send_sge = qp_init_attr.cap.max_send_sge;
+	res->inline_size = qp_init_attr.cap.max_inline_data;
+	log_info("QP supports %d bytes of inline data\n", res->inline_size);
+	log_info("QP was created, QP number=0x%x\n", res->qp->qp_num);
+	res->setup.resources_usec = monotonic_usec() - phase_usec;
 resources_create_exit:
 	// 这个资源清理过程确保了在发生错误时，所有已经分配或创建的资源被适当地释放，从而防止资源泄露。
 	if (rc)
@@ -602,6 +2012,23 @@ resources_create_exit:
 			ibv_destroy_qp(res->qp);
 			res->qp = NULL;
 		}
+		// 附属 QP 借用的套接字、缓冲区和 MR 归主连接所有
+		if (res->lane)
+		{
+			res->buf = NULL;
+			res->mr = NULL;
+			res->sock = -1;
+		}
+		if (res->pool)
+		{
+			// 租用的缓冲区归内存池所有，只注销本连接的 MR 并归还
+			if (res->mr)
+				ibv_dereg_mr(res->mr);
+			if (res->buf)
+				mem_pool_free(res->pool, &res->pool_block);
+			res->buf = NULL;
+			res->mr = NULL;
+		}
 		if (res->mr)
 		{
 			ibv_dereg_mr(res->mr);
@@ -609,7 +2036,10 @@ resources_create_exit:
 		}
 		if (res->buf)
 		{
-			free(res->buf);
+			if (res->buf_numa)
+				numa_free(res->buf, res->buf_size);
+			else
+				free(res->buf);
 			res->buf = NULL;
 		}
 		if (res->cq)
@@ -617,35 +2047,81 @@ resources_create_exit:
 			ibv_destroy_cq(res->cq);
 			res->cq = NULL;
 		}
-		if (res->pd)
+		if (res->channel)
 		{
-			ibv_dealloc_pd(res->pd);
-			res->pd = NULL;
+			ibv_destroy_comp_channel(res->channel);
+			res->channel = NULL;
 		}
-		if (res->ib_ctx)
+		if (res->msg_tx_mr)
 		{
-			ibv_close_device(res->ib_ctx);
-			res->ib_ctx = NULL;
+			ibv_dereg_mr(res->msg_tx_mr);
+			res->msg_tx_mr = NULL;
 		}
-		if (dev_list)
+		if (res->atomic_mr)
 		{
-			ibv_free_device_list(dev_list);
-			dev_list = NULL;
+			ibv_dereg_mr(res->atomic_mr);
+			res->atomic_mr = NULL;
+		}
+		free(res->atomic_buf);
+		res->atomic_buf = NULL;
+		free(res->msg_tx);
+		free(res->msg_ready);
+		res->msg_tx = NULL;
+		res->msg_ready = NULL;
+		if (res->msg_own_ring)
+		{
+			msg_ring_destroy(res->msg_ring);
+			res->msg_ring = NULL;
+			res->msg_own_ring = 0;
+		}
+		free(res->batch_wrs);
+		free(res->batch_sges);
+		free(res->sig_slots);
+		free(res->sig_post_ns);
+		res->batch_wrs = NULL;
+		res->batch_sges = NULL;
+		res->sig_slots = NULL;
+		res->sig_post_ns = NULL;
+		if (res->dev)
+		{
+			rdma_device_put(res->dev);
+			res->dev = NULL;
 		}
 		if (res->sock >= 0)
 		{
 			if (close(res->sock))
-				fprintf(stderr, "failed to close socket\n");
+				log_err("failed to close socket\n");
 			res->sock = -1;
 		}
 	}
 	return rc;
 }
+/******************************************************************************
+ * Function: remote_access_flags
+ *
+ * Input
+ * dev device the memory is registered on
+ *
+ * Returns
+ * the remote access flags for buffers and QPs of the device
+ *
+ * Description
+ * Remote atomics are only granted when the device supports them; asking for
+ * IBV_ACCESS_REMOTE_ATOMIC elsewhere makes ibv_reg_mr and ibv_modify_qp fail.
+ ******************************************************************************/
+int remote_access_flags(const struct rdma_device *dev)
+{
+	int flags = IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+	if (dev->device_attr.atomic_cap != IBV_ATOMIC_NONE)
+		flags |= IBV_ACCESS_REMOTE_ATOMIC;
+	return flags;
+}
 /******************************************************************************
  * Function: modify_qp_to_init
  *
  * Input
  * qp QP to transition
+ * cfg configuration of the connection owning the QP
  *
  * Output
  * none
@@ -655,7 +2131,7 @@ resources_create_exit:
  *
  * Description
  ******************************************************************************/
-int modify_qp_to_init(struct ibv_qp *qp)
+int modify_qp_to_init(struct ibv_qp *qp, const struct config_t *cfg, int access_flags)
 {
 	struct ibv_qp_attr attr;
 	int flags;
@@ -666,13 +2142,13 @@ int modify_qp_to_init(struct ibv_qp *qp)
 	attr.qp_state = IBV_QPS_INIT;
 
 	//  设置队列对将要使用的端口号。
-	attr.port_num = config.ib_port;
+	attr.port_num = cfg->ib_port;
 
 	// 置分区键（Partition Key）索引。在大多数情况下，这个值设置为 0。
 	attr.pkey_index = 0;
 
-	//  设置队列对的访问权限，包括本地写入、远程读取和远程写入。
-	attr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+	//  设置队列对的访问权限，包括本地写入、远程读取和远程写入，设备支持时还包括远程原子操作。
+	attr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE | access_flags;
 
 	// 指定将要修改的队列对属性。
 	flags = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS;
@@ -680,7 +2156,7 @@ int modify_qp_to_init(struct ibv_qp *qp)
 	// 函数修改队列对的状态。这个调用需要 qp、属性结构体 attr 和指定的标志 flags
 	rc = ibv_modify_qp(qp, &attr, flags);
 	if (rc)
-		fprintf(stderr, "failed to modify QP state to INIT\n");
+		log_err("failed to modify QP state to INIT\n");
 	return rc;
 }
 /******************************************************************************
@@ -688,9 +2164,12 @@ int modify_qp_to_init(struct ibv_qp *qp)
  *
  * Input
  * qp QP to transition
+ * cfg configuration of the connection owning the QP
  * remote_qpn remote QP number
  * dlid destination LID
  * dgid destination GID (mandatory for RoCEE)
+ * mtu path MTU negotiated with the remote side
+ * max_dest_rd_atomic RDMA reads/atomics the remote side may have in flight
  *
  * Output
  * none
@@ -700,14 +2179,18 @@ int modify_qp_to_init(struct ibv_qp *qp)
  *
  * Description
  ******************************************************************************/
-int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint8_t *dgid)
+int modify_qp_to_rtr(struct ibv_qp *qp, const struct config_t *cfg, uint32_t remote_qpn, uint16_t dlid, uint8_t *dgid,
+					 enum ibv_mtu mtu, uint8_t max_dest_rd_atomic)
 {
 	/*
 	参数部分：
 	qp: 要修改状态的队列对。
+	cfg: 本连接的配置，提供端口号和 GID 索引。
 	remote_qpn: 远程队列对编号。
 	dlid: 目的地局部标识符（Destination Local Identifier）。
 	dgid: 目的地全局标识符（Destination Global Identifier），对 RoCEE（RDMA over Converged Ethernet）是必需的。
+	mtu: 与对端协商得到的路径 MTU。
+	max_dest_rd_atomic: 对端作为发起方可以同时发出的 RDMA 读/原子操作数。
 	*/
 
 	struct ibv_qp_attr attr;
@@ -718,8 +2201,8 @@ int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint
 	// 设置队列对状态为 RTR (IBV_QPS_RTR)。
 	attr.qp_state = IBV_QPS_RTR;
 
-	// 设置路径最大传输单元（attr.path_mtu）
-	attr.path_mtu = IBV_MTU_256;
+	// 设置路径最大传输单元（attr.path_mtu），取双方端口 active_mtu 的最小值
+	attr.path_mtu = mtu;
 
 	// 设置目的队列对编号（attr.dest_qp_num）为 remote_qpn。
 	attr.dest_qp_num = remote_qpn;
@@ -727,8 +2210,8 @@ int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint
 	// 设置请求包序列号（attr.rq_psn）。
 	attr.rq_psn = 0;
 
-	// 设置目标端的最大远程读原子操作数（attr.max_dest_rd_atomic）。
-	attr.max_dest_rd_atomic = 1;
+	// 设置目标端的最大远程读原子操作数（attr.max_dest_rd_atomic），即握手时协商的对端发起深度。
+	attr.max_dest_rd_atomic = max_dest_rd_atomic;
 
 	// 设置最小重试接收不足计时器（attr.min_rnr_timer）。
 	attr.min_rnr_timer = 0x12;
@@ -743,12 +2226,12 @@ int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint
 	// 设置源路径位，通常用于子网内的路径选择。
 	attr.ah_attr.src_path_bits = 0;
 	//  设置使用的 IB 端口号。
-	attr.ah_attr.port_num = config.ib_port;
+	attr.ah_attr.port_num = cfg->ib_port;
 
 	// 如果使用全局标识符（GID），设置 attr.ah_attr.is_global 为 1 并复制 dgid 到 attr.ah_attr.grh.dgid。
-	if (config.gid_idx >= 0)
+	if (cfg->gid_idx >= 0)
 	{
-		// 如果 config.gid_idx 大于等于 0，表示需要使用全局标识符（GID）进行通信，这通常在跨子网通信时使用。
+		// 如果 cfg->gid_idx 大于等于 0，表示需要使用全局标识符（GID）进行通信，这通常在跨子网通信时使用。
 
 		// 设置为使用全局路由。
 		attr.ah_attr.is_global = 1;
@@ -761,7 +2244,7 @@ int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint
 		// 设置跳数限制，对于 RDMA 通常设置为 1。
 		attr.ah_attr.grh.hop_limit = 1;
 		// 设置源 GID 索引
-		attr.ah_attr.grh.sgid_index = config.gid_idx;
+		attr.ah_attr.grh.sgid_index = cfg->gid_idx;
 		// 设置流量类别，通常设置为 0。
 		attr.ah_attr.grh.traffic_class = 0;
 	}
@@ -773,7 +2256,7 @@ int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint
 	// 使用 ibv_modify_qp 函数根据指定的属性和标志修改队列对状态。
 	rc = ibv_modify_qp(qp, &attr, flags);
 	if (rc)
-		fprintf(stderr, "failed to modify QP state to RTR\n");
+		log_err("failed to modify QP state to RTR\n");
 	return rc;
 }
 /******************************************************************************
@@ -781,6 +2264,7 @@ int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint
  *
  * Input
  * qp QP to transition
+ * max_rd_atomic RDMA reads/atomics this side may have in flight
  *
  * Output
  * none
@@ -791,7 +2275,7 @@ int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint
  * Description
 函数的目的是将队列对（Queue Pair, QP）从准备接收（Ready to Receive, RTR）状态转换到准备发送（Ready to Send, RTS）状态。
  ******************************************************************************/
-int modify_qp_to_rts(struct ibv_qp *qp)
+int modify_qp_to_rts(struct ibv_qp *qp, uint8_t max_rd_atomic)
 {
 	struct ibv_qp_attr attr;
 	int flags;
@@ -807,14 +2291,14 @@ int modify_qp_to_rts(struct ibv_qp *qp)
 	// 设置最大重试发送次数。
 	attr.retry_cnt = 6;
 
-	// 设置 RNR（Receiver Not Ready）重试次数。这里设置为 0 表示不进行 RNR 重试。
-	attr.rnr_retry = 0;
+	// 设置 RNR（Receiver Not Ready）重试次数。7 表示无限重试：消息引擎的接收槽位分批补充，发送方超前时等待而不是报错。
+	attr.rnr_retry = 7;
 
 	// 设置发送队列的包序列号。
 	attr.sq_psn = 0;
 
-	//  设置最大远程读原子操作数。
-	attr.max_rd_atomic = 1;
+	//  设置最大远程读原子操作数，即握手时协商的本端发起深度。
+	attr.max_rd_atomic = max_rd_atomic;
 
 	// 这些标志指定了要修改的队列对属性。
 	flags = IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
@@ -823,80 +2307,150 @@ int modify_qp_to_rts(struct ibv_qp *qp)
 	// 使用 ibv_modify_qp 函数根据指定的属性和标志修改队列对状态。
 	rc = ibv_modify_qp(qp, &attr, flags);
 	if (rc)
-		fprintf(stderr, "failed to modify QP state to RTS\n");
+		log_err("failed to modify QP state to RTS\n");
 	return rc;
 }
 /******************************************************************************
- * Function: connect_qp
+ * Function: local_path_mtu
  *
  * Input
- * res pointer to resources structure
+ * res pointer to resources structure, after resources_create
  *
  * Output
  * none
  *
  * Returns
- * 0 on success, error code on failure
+ * the path MTU this side can use (enum ibv_mtu)
  *
  * Description
- * Connect the QP. Transition the server side to RTR, sender side to RTS
+ * The port's active MTU, lowered to res->mtu when the caller asked for less.
+ ******************************************************************************/
+int local_path_mtu(struct resources *res)
+{
+	int mtu = res->port_attr.active_mtu;
+	if (res->mtu && res->mtu < mtu)
+		mtu = res->mtu;
+	return mtu;
+}
+/******************************************************************************
+ * Function: local_rd_atom
  *
- * 连接队列对，将服务端变成待接受状态，客户端变成待发送状态
- * 函数的作用是配置和连接队列对（Queue Pair, QP），以便进行 RDMA 通信。这个过程包括设置队列对的状态，以及交换所需的连接信息。以下是函数的详细解释：
+ * Input
+ * res pointer to resources structure, after resources_create
+ * initiator 1 for the initiator depth, 0 for the responder depth
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * how many RDMA reads/atomics this side supports in flight per QP
+ *
+ * Description
+ * The device limit (max_qp_init_rd_atom or max_qp_rd_atom), lowered to
+ * res->rd_atomic when the caller asked for less. At least one, and the
+ * handshake carries it in a byte.
  ******************************************************************************/
-int connect_qp(struct resources *res)
+static int local_rd_atom(struct resources *res, int initiator)
+{
+	int n = initiator ? res->dev->device_attr.max_qp_init_rd_atom : res->dev->device_attr.max_qp_rd_atom;
+	if (res->rd_atomic && res->rd_atomic < n)
+		n = res->rd_atomic;
+	if (n > UINT8_MAX)
+		n = UINT8_MAX;
+	if (n < 1)
+		n = 1;
+	return n;
+}
+/******************************************************************************
+ * Function: connect_qp_prepare
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Output
+ * local this side's connection data, in network byte order
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * First half of connect_qp: describe the local QP and buffer for the peer.
+ * Callers that connect many QPs prepare all of them, exchange the whole
+ * vector in one message and then finish each QP without further round trips.
+ ******************************************************************************/
+int connect_qp_prepare(struct resources *res, struct cm_con_data_t *local)
 {
-
-	// 这个结构体用于存储本地连接所需的信息，如本地队列对（QP）的编号、内存区域（MR）的键（key）、本地标识符（LID）和全局标识符（GID）。这些信息将被发送到远程端以建立连接。
-	struct cm_con_data_t local_con_data;
-
-	// 类似于 local_con_data，这个结构体用于存储从远程端接收的连接信息。在建立连接时，这些信息是必需的，例如，远程端的队列对编号和内存区域的键。
-	struct cm_con_data_t remote_con_data;
-
-	struct cm_con_data_t tmp_con_data;
-	int rc = 0;
-
-	// 这个字符变量通常用于同步过程中的简单数据交换，确保双方都准备好进行下一步操作
-	char temp_char;
-
 	// 这是一个全局标识符（Global Identifier, GID）的联合体，用于存储本地端的 GID。在使用 RoCE（RDMA over Converged Ethernet）或跨子网的 RDMA 通信时，GID 是必需的。它用于唯一标识 InfiniBand 网络中的设备。
 	union ibv_gid my_gid;
+	int rc;
 
+	memset(local, 0, sizeof(*local));
 	// 表示使用全局标识符（Global Identifier, GID）。函数查询并设置 GID
-	if (config.gid_idx >= 0)
+	if (res->config.gid_idx >= 0)
 	{
-		// 这行代码查询指定 IB 端口的 GID。res->ib_ctx 是设备上下文，config.ib_port 是端口号，config.gid_idx 是 GID 索引。
-		rc = ibv_query_gid(res->ib_ctx, config.ib_port, config.gid_idx, &my_gid);
+		// 这行代码查询指定 IB 端口的 GID。res->dev->ib_ctx 是设备上下文，res->config.ib_port 是端口号，res->config.gid_idx 是 GID 索引。
+		rc = ibv_query_gid(res->dev->ib_ctx, res->config.ib_port, res->config.gid_idx, &my_gid);
 		if (rc)
 		{
-			fprintf(stderr, "could not get gid for port %d, index %d\n", config.ib_port, config.gid_idx);
+			log_err("could not get gid for port %d, index %d\n", res->config.ib_port, res->config.gid_idx);
 			return rc;
 		}
 	}
 	else
-		fprintf(stdout, "using InfiniBand subnet connection\n");
-	// 意味着不需要使用 GID。这种情况下，将 my_gid 清零。这通常用于仅在 InfiniBand 子网内通信的情况。
-	memset(&my_gid, 0, sizeof my_gid);
+	{
+		log_debug("using InfiniBand subnet connection\n");
+		// 意味着不需要使用 GID。这种情况下，将 my_gid 清零。这通常用于仅在 InfiniBand 子网内通信的情况。
+		memset(&my_gid, 0, sizeof my_gid);
+	}
 
 	// 设置本地缓冲区地址。htonll 将地址从主机字节顺序转换为网络字节顺序。
-	local_con_data.addr = htonll((uintptr_t)res->buf);
+	local->addr = htonll((uintptr_t)res->buf);
 	// 设置本地内存区域（MR）的远程键（rkey）。htonl 转换为网络字节顺序。
-	local_con_data.rkey = htonl(res->mr->rkey);
+	local->rkey = htonl(res->mr->rkey);
 	//  设置本地队列对编号。同样使用 htonl 进行字节顺序转换。
-	local_con_data.qp_num = htonl(res->qp->qp_num);
+	local->qp_num = htonl(res->qp->qp_num);
 	// 设置本地标识符（LID）。htons 转换为网络字节顺序。
-	local_con_data.lid = htons(res->port_attr.lid);
+	local->lid = htons(res->port_attr.lid);
+	// 设置本地缓冲区大小，远端据此检查 RDMA 读写范围。
+	local->size = htonll((uint64_t)res->buf_size);
+	// 设置本端可用的路径 MTU，对端据此取双方的最小值。
+	local->mtu = (uint8_t)local_path_mtu(res);
+	// 设置本端的读/原子操作深度：作为响应方的能力和作为发起方的需求。
+	local->rd_atom = (uint8_t)local_rd_atom(res, 0);
+	local->init_rd_atom = (uint8_t)local_rd_atom(res, 1);
+	// 设置本端消息槽位的大小，对端据此限制单条消息的长度。
+	local->msg_size = htonl(res->msg_ring ? res->msg_ring->slot_size : 0);
+	// 主连接发送希望建立的条带数，附属 QP 发送 0。
+	local->stripes = (uint8_t)(res->lane ? 0 : res->stripes);
 	// 复制 GID 到本地连接数据结构。
-	memcpy(local_con_data.gid, &my_gid, 16);
-	fprintf(stdout, "\nLocal LID = 0x%x\n", res->port_attr.lid);
-	// 函数通过已建立的 TCP 套接字交换本地和远程连接数据。
-	// 这里将远端的数据从socket里面读取然后放到临时数据中
-	if (sock_sync_data(res->sock, sizeof(struct cm_con_data_t), (char *)&local_con_data, (char *)&tmp_con_data) < 0)
-	{
-		fprintf(stderr, "failed to exchange connection data between sides\n");
-		rc = 1;
-		goto connect_qp_exit;
-	}
+	memcpy(local->gid, &my_gid, 16);
+	log_debug("Local LID = 0x%x\n", res->port_attr.lid);
+	return 0;
+}
+/******************************************************************************
+ * Function: connect_qp_finish
+ *
+ * Input
+ * res pointer to resources structure
+ * remote_data the peer's connection data, in network byte order
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Second half of connect_qp: negotiate the connection parameters with the
+ * peer's data, post the initial receive requests and move the QP through
+ * INIT, RTR and RTS. No network round trip is involved.
+ ******************************************************************************/
+int connect_qp_finish(struct resources *res, const struct cm_con_data_t *remote_data)
+{
+	struct cm_con_data_t tmp_con_data = *remote_data;
+	struct cm_con_data_t remote_con_data;
+	unsigned long start_usec = monotonic_usec();
+	int rc = 0;
 
 	// 从 tmp_con_data（临时存储远程数据）提取远程端的连接信息，转换回主机字节顺序，并存储在 remote_con_data。
 	remote_con_data.addr = ntohll(tmp_con_data.addr);
@@ -904,66 +2458,321 @@ int connect_qp(struct resources *res)
 	remote_con_data.rkey = ntohl(tmp_con_data.rkey);
 	remote_con_data.qp_num = ntohl(tmp_con_data.qp_num);
 	remote_con_data.lid = ntohs(tmp_con_data.lid);
+	remote_con_data.size = ntohll(tmp_con_data.size);
+	remote_con_data.mtu = tmp_con_data.mtu;
+	remote_con_data.rd_atom = tmp_con_data.rd_atom;
+	remote_con_data.init_rd_atom = tmp_con_data.init_rd_atom;
+	remote_con_data.msg_size = ntohl(tmp_con_data.msg_size);
+	remote_con_data.stripes = tmp_con_data.stripes;
 	// 如果使用 GID，则从 tmp_con_data 复制 GID 到 remote_con_data。
 	memcpy(remote_con_data.gid, tmp_con_data.gid, 16);
 	/* save the remote side attributes, we will need it for the post SR */
 	res->remote_props = remote_con_data;
-	fprintf(stdout, "Remote address = 0x%" PRIx64 "\n", remote_con_data.addr);
-	fprintf(stdout, "Remote rkey = 0x%x\n", remote_con_data.rkey);
-	fprintf(stdout, "Remote QP number = 0x%x\n", remote_con_data.qp_num);
-	fprintf(stdout, "Remote LID = 0x%x\n", remote_con_data.lid);
+	log_debug("Remote address = 0x%" PRIx64 "\n", remote_con_data.addr);
+	log_debug("Remote rkey = 0x%x\n", remote_con_data.rkey);
+	log_debug("Remote QP number = 0x%x\n", remote_con_data.qp_num);
+	log_debug("Remote LID = 0x%x\n", remote_con_data.lid);
+	log_debug("Remote buffer size = %" PRIu64 "\n", remote_con_data.size);
+	// 路径 MTU 取双方的最小值，两端因此得到相同的结果。
+	res->path_mtu = local_path_mtu(res);
+	if (remote_con_data.mtu < res->path_mtu)
+		res->path_mtu = remote_con_data.mtu;
+	log_info("Path MTU = %d bytes (local %d, remote %d)\n", 128 << res->path_mtu, 128 << local_path_mtu(res),
+			 128 << remote_con_data.mtu);
+	// 条带数取双方的最小值，两端因此建立同样多的附属 QP。
+	if (!res->lane)
+	{
+		if (res->stripes < 1)
+			res->stripes = 1;
+		if (res->stripes > MAX_STRIPES)
+			res->stripes = MAX_STRIPES;
+		if (remote_con_data.stripes < res->stripes)
+			res->stripes = remote_con_data.stripes ? remote_con_data.stripes : 1;
+		if (res->stripes > 1)
+			log_info("striping over %d QPs\n", res->stripes);
+	}
+	// 本端发出的读不能多于对端能响应的，本端要响应的正好是对端发出的；两端因此一一对应。
+	res->max_rd_atomic = local_rd_atom(res, 1);
+	if (remote_con_data.rd_atom < res->max_rd_atomic)
+		res->max_rd_atomic = remote_con_data.rd_atom;
+	res->max_dest_rd_atomic = local_rd_atom(res, 0);
+	if (remote_con_data.init_rd_atom < res->max_dest_rd_atomic)
+		res->max_dest_rd_atomic = remote_con_data.init_rd_atom;
+	log_info("outstanding RDMA reads/atomics: initiator %d, responder %d\n", res->max_rd_atomic,
+			 res->max_dest_rd_atomic);
 	// 如果使用 GID，也打印远程 GID
-	if (config.gid_idx >= 0)
+	if (res->config.gid_idx >= 0)
 	{
 		uint8_t *p = remote_con_data.gid;
 		// 打印远程 GID 的每个字节：这个 GID 是一个 128 位的标识符，在这里以 16 个字节的形式打印出来，每个字节表示为两位十六进制数。
-		fprintf(stdout, "Remote GID =%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n ", p[0],
+		log_debug("Remote GID =%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n ", p[0],
 				p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15]);
 	}
 
 	// 将队列对的状态修改为 INIT。
 	// 在这个阶段，队列对从其初始状态（RESET）转换到 INIT 状态。在 INIT 状态下，队列对被配置为具有必要的访问权限和网络参数，但还不能用于发送或接收数据。
 	// 这是队列对生命周期中的第一个激活状态，为后续的数据传输做准备。
-	rc = modify_qp_to_init(res->qp);
+	rc = modify_qp_to_init(res->qp, &res->config, remote_access_flags(res->dev));
 	if (rc)
 	{
-		fprintf(stderr, "change QP state to INIT failed\n");
-		goto connect_qp_exit;
+		log_err("change QP state to INIT failed\n");
+		goto connect_qp_finish_exit;
 	}
 
-	if (config.server_name)
+	if (res->msg_ring)
+	{
+		// 发送缓冲区按对端的槽位大小分配，不能内联的消息先拷贝到这里
+		if (remote_con_data.msg_size)
+		{
+			res->msg_tx = malloc(remote_con_data.msg_size);
+			if (res->msg_tx)
+				res->msg_tx_mr = ibv_reg_mr(res->dev->pd, res->msg_tx, remote_con_data.msg_size, IBV_ACCESS_LOCAL_WRITE);
+			if (!res->msg_tx_mr)
+			{
+				log_err("failed to register a message send buffer of %u bytes\n", remote_con_data.msg_size);
+				rc = 1;
+				goto connect_qp_finish_exit;
+			}
+		}
+		// 消息引擎的接收请求取代单个缓冲区上的接收请求；共享接收环在创建时已经投递
+		if (!res->msg_ring->srq)
+			rc = msg_ring_fill(res->msg_ring, res->qp);
+		if (rc)
+		{
+			log_err("failed to post message RRs\n");
+			goto connect_qp_finish_exit;
+		}
+	}
+	else if (res->inband)
+	{
+		// 带内模式下预先投递接收请求，用于承载对端 WRITE_WITH_IMM 的立即数
+		rc = inband_setup(res);
+		if (rc)
+		{
+			log_err("failed to post in-band RRs\n");
+			goto connect_qp_finish_exit;
+		}
+	}
+	else if (res->config.server_name && !res->lane)
 	{
 		rc = post_receive(res);
 		if (rc)
 		{
-			fprintf(stderr, "failed to post RR\n");
-			goto connect_qp_exit;
+			log_err("failed to post RR\n");
+			goto connect_qp_finish_exit;
 		}
 	}
 
 	// 在此状态下队列对开始准备接收远程端的数据。
-	rc = modify_qp_to_rtr(res->qp, remote_con_data.qp_num, remote_con_data.lid, remote_con_data.gid);
+	rc = modify_qp_to_rtr(res->qp, &res->config, remote_con_data.qp_num, remote_con_data.lid, remote_con_data.gid,
+						  res->path_mtu, res->max_dest_rd_atomic);
+	if (rc)
+	{
+		log_err("failed to modify QP state to RTR\n");
+		goto connect_qp_finish_exit;
+	}
+
+	rc = modify_qp_to_rts(res->qp, res->max_rd_atomic);
 	if (rc)
 	{
-		fprintf(stderr, "failed to modify QP state to RTR\n");
-		goto connect_qp_exit;
+		log_err("failed to modify QP state to RTR\n");
+		goto connect_qp_finish_exit;
 	}
+	log_info("QP state was change to RTS\n");
+	log_info("QP 0x%x connected to remote QP 0x%x (LID 0x%x), remote buffer %" PRIu64 " bytes\n", res->qp->qp_num,
+			 remote_con_data.qp_num, remote_con_data.lid, remote_con_data.size);
+connect_qp_finish_exit:
+	res->setup.transition_usec += monotonic_usec() - start_usec;
+	return rc;
+}
+/******************************************************************************
+ * Function: connect_qp
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Connect the QP. Transition the server side to RTR, sender side to RTS
+ *
+ * 连接队列对，将服务端变成待接受状态，客户端变成待发送状态
+ * 函数的作用是配置和连接队列对（Queue Pair, QP），以便进行 RDMA 通信：准备本端的连接信息，
+ * 通过 TCP 套接字与对端交换，再完成状态转换，最后同步一次，确保双方都已进入 RTS。
+ ******************************************************************************/
+int connect_qp(struct resources *res)
+{
+	struct cm_con_data_t local_con_data;
+	struct cm_con_data_t tmp_con_data;
+	unsigned long start_usec;
+	int rc;
 
-	rc = modify_qp_to_rts(res->qp);
+	rc = connect_qp_prepare(res, &local_con_data);
 	if (rc)
+		return rc;
+
+	// 函数通过已建立的 TCP 套接字交换本地和远程连接数据。
+	// 这里将远端的数据从socket里面读取然后放到临时数据中
+	start_usec = monotonic_usec();
+	if (sock_sync_data(res->sock, sizeof(struct cm_con_data_t), (char *)&local_con_data, (char *)&tmp_con_data) < 0)
 	{
-		fprintf(stderr, "failed to modify QP state to RTR\n");
-		goto connect_qp_exit;
+		log_err("failed to exchange connection data between sides\n");
+		return 1;
 	}
-	fprintf(stdout, "QP state was change to RTS\n");
+	res->setup.exchange_usec += monotonic_usec() - start_usec;
+
+	rc = connect_qp_finish(res, &tmp_con_data);
+	if (rc)
+		return rc;
 
-	if (sock_sync_data(res->sock, 1, "Q", &temp_char)) /* just send a dummy char back and forth */
+	start_usec = monotonic_usec();
+	if (sock_sync_ready(res->sock)) /* just send a dummy char back and forth */
 	{
-		fprintf(stderr, "sync error after QPs are were moved to RTS\n");
-		rc = 1;
+		log_err("sync error after QPs are were moved to RTS\n");
+		return 1;
+	}
+	res->setup.sync_usec += monotonic_usec() - start_usec;
+	return 0;
+}
+/******************************************************************************
+ * Function: qp_state
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Returns
+ * the QP's enum ibv_qp_state, -1 if it cannot be queried
+ ******************************************************************************/
+int qp_state(struct resources *res)
+{
+	struct ibv_qp_attr attr;
+	struct ibv_qp_init_attr init_attr;
+	if (!res->qp || ibv_query_qp(res->qp, &attr, IBV_QP_STATE, &init_attr))
+		return -1;
+	return attr.qp_state;
+}
+/******************************************************************************
+ * Function: resources_reconnect
+ *
+ * Input
+ * res connected resources, typically with a QP in the error state
+ * redial non-zero to drop the TCP connection of a client even while it is
+ *        alive and dial the server again
+ * timeout_usec how long a single socket read or write of the handshake may
+ *              block, 0 for no limit
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Re-establish a broken connection while keeping the device, PD, MR, CQ and
+ * QP. The QP goes back to RESET, whatever the CQ still holds is discarded
+ * along with the send queue accounting, and connect_qp runs its handshake
+ * through INIT, RTR and RTS again; the peer has to reconnect at the same
+ * time. The TCP connection is kept while it is alive unless `redial` is
+ * set. Otherwise a client dials its server again and a server created with
+ * sock_connect accepts on its port again; a connection accepted by a
+ * multi-client server cannot re-establish its socket, its client arrives as
+ * a new peer instead. A redialing client therefore looks like a new client
+ * to a multi-client server, which serves it without its application having
+ * to take part. The socket timeout stays set afterwards so that the caller
+ * can bound further exchanges; sock_set_timeout(res->sock, 0) lifts it.
+ ******************************************************************************/
+int resources_reconnect(struct resources *res, int redial, long timeout_usec)
+{
+	struct ibv_qp_attr attr;
+	struct ibv_wc wc[POLL_BATCH];
+	unsigned long start_usec;
+	int n;
+	int i;
+	if (res->lane)
+	{
+		log_err("striped QPs are reconnected by their primary connection\n");
+		return 1;
+	}
+	memset(&attr, 0, sizeof(attr));
+	attr.qp_state = IBV_QPS_RESET;
+	if (ibv_modify_qp(res->qp, &attr, IBV_QP_STATE))
+	{
+		log_err("failed to modify QP state to RESET\n");
+		return 1;
+	}
+	// RESET 会丢弃 QP 上所有的请求，CQ 中残留的完成事件也一并清掉；
+	// 共享接收环上已到达的消息先入队，再由 msg_reset 归还其槽位
+	while ((n = ibv_poll_cq(res->cq, POLL_BATCH, wc)) > 0)
+		for (i = 0; i < n; i++)
+			if (res->msg_ring && wc[i].status == IBV_WC_SUCCESS &&
+				(wc[i].wr_id & WRID_MSG_MASK) == WRID_MSG_RECV)
+				msg_account(res, &wc[i]);
+	res->sq_outstanding = 0;
+	res->sig_head = 0;
+	res->sig_count = 0;
+	res->sq_unsignaled = 0;
+	msg_reset(res);
+	// 发送缓冲区按对端的槽位大小重新分配
+	if (res->msg_tx_mr)
+		ibv_dereg_mr(res->msg_tx_mr);
+	free(res->msg_tx);
+	res->msg_tx_mr = NULL;
+	res->msg_tx = NULL;
+
+	memset(&res->setup, 0, sizeof(res->setup));
+	if (redial && !res->config.server_name)
+	{
+		log_err("only a client can dial its peer again\n");
+		return 1;
+	}
+	if (!redial && sock_alive(res->sock))
+	{
+		if (sock_set_timeout(res->sock, timeout_usec))
+			return 1;
+		return connect_qp(res);
+	}
+	if (res->sock_accepted)
+	{
+		log_err("TCP connection of an accepted peer is gone, it has to connect again\n");
+		return 1;
+	}
+	start_usec = monotonic_usec();
+	if (res->sock >= 0)
+		close(res->sock);
+	res->sock = sock_connect(res->config.server_name, res->config.tcp_port);
+	if (res->sock < 0)
+	{
+		log_err("failed to re-establish TCP connection on port %d\n", res->config.tcp_port);
+		return 1;
 	}
-connect_qp_exit:
-	return rc;
+	res->setup.tcp_usec = monotonic_usec() - start_usec;
+	if (sock_set_timeout(res->sock, timeout_usec))
+		return 1;
+	return connect_qp(res);
+}
+/******************************************************************************
+ * Function: remote_buffer_size
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * size in bytes of the remote buffer announced in connect_qp
+ *
+ * Description
+ * cm_con_data_t is packed, so its fields are not visible from cgo; this
+ * accessor exposes the one the Go side needs.
+ ******************************************************************************/
+uint64_t remote_buffer_size(struct resources *res)
+{
+	return res->remote_props.size;
 }
 /******************************************************************************
  * Function: resources_destroy
@@ -987,39 +2796,83 @@ int resources_destroy(struct resources *res)
 	if (res->qp)
 		if (ibv_destroy_qp(res->qp))
 		{
-			fprintf(stderr, "failed to destroy QP\n");
+			log_err("failed to destroy QP\n");
+			rc = 1;
+		}
+	// 附属 QP 借用的套接字、缓冲区和 MR 归主连接所有，必须先于主连接销毁
+	if (res->lane)
+	{
+		res->buf = NULL;
+		res->mr = NULL;
+		res->sock = -1;
+	}
+	if (res->pool)
+	{
+		// 先注销只覆盖本连接范围的 MR，再把缓冲区归还给内存池
+		if (res->mr && ibv_dereg_mr(res->mr))
+		{
+			log_err("failed to deregister MR\n");
 			rc = 1;
 		}
+		if (res->buf && mem_pool_free(res->pool, &res->pool_block))
+			rc = 1;
+		res->buf = NULL;
+		res->mr = NULL;
+	}
 	if (res->mr)
 		if (ibv_dereg_mr(res->mr))
 		{
-			fprintf(stderr, "failed to deregister MR\n");
+			log_err("failed to deregister MR\n");
 			rc = 1;
 		}
 	if (res->buf)
-		free(res->buf);
+	{
+		if (res->buf_numa)
+			numa_free(res->buf, res->buf_size);
+		else
+			free(res->buf);
+	}
 	if (res->cq)
 		if (ibv_destroy_cq(res->cq))
 		{
-			fprintf(stderr, "failed to destroy CQ\n");
+			log_err("failed to destroy CQ\n");
+			rc = 1;
+		}
+	if (res->channel)
+		if (ibv_destroy_comp_channel(res->channel))
+		{
+			log_err("failed to destroy completion channel\n");
 			rc = 1;
 		}
-	if (res->pd)
-		if (ibv_dealloc_pd(res->pd))
+	if (res->msg_tx_mr)
+		if (ibv_dereg_mr(res->msg_tx_mr))
 		{
-			fprintf(stderr, "failed to deallocate PD\n");
+			log_err("failed to deregister message send MR\n");
 			rc = 1;
 		}
-	if (res->ib_ctx)
-		if (ibv_close_device(res->ib_ctx))
+	if (res->atomic_mr)
+		if (ibv_dereg_mr(res->atomic_mr))
 		{
-			fprintf(stderr, "failed to close device context\n");
+			log_err("failed to deregister atomic result MR\n");
 			rc = 1;
 		}
+	free(res->atomic_buf);
+	free(res->msg_tx);
+	free(res->msg_ready);
+	if (res->msg_own_ring && msg_ring_destroy(res->msg_ring))
+		rc = 1;
+	free(res->batch_wrs);
+	free(res->batch_sges);
+	free(res->sig_slots);
+	free(res->sig_post_ns);
+	// 释放连接持有的设备引用，最后一个引用会释放 PD 并关闭设备
+	if (res->dev)
+		if (rdma_device_put(res->dev))
+			rc = 1;
 	if (res->sock >= 0)
 		if (close(res->sock))
 		{
-			fprintf(stderr, "failed to close socket\n");
+			log_err("failed to close socket\n");
 			rc = 1;
 		}
 	return rc;
@@ -1101,7 +2954,7 @@ void usage(const char *argv0)
 int receive_message(struct resources *res, const char *entity)
 {
 	printf("%s: Enter your message to send (type 'exit' to end): ", entity);
-	if (fgets(res->buf, MSG_SIZE, stdin) == NULL || strcmp(res->buf, "exit\n") == 0)
+	if (fgets(res->buf, res->buf_size, stdin) == NULL || strcmp(res->buf, "exit\n") == 0)
 	{
 		return 1; // return 1 indicates exit
 	}
@@ -1109,3 +2962,409 @@ int receive_message(struct resources *res, const char *entity)
 	res->buf[strcspn(res->buf, "\n")] = 0;
 	return 0; // return 0 indicates continue
 }
+/******************************************************************************
+In-band completion
+In this mode the data path does not touch the TCP socket. A writer finishes
+its RDMA WRITE with an immediate value carrying the length; the peer learns
+about the data from the receive completion that the immediate consumes and
+answers with a zero-length WRITE_WITH_IMM acknowledgement once it has read the
+buffer. Each side therefore owns one credit: a second write waits for the ack
+of the first instead of overwriting data the peer has not read yet.
+******************************************************************************/
+/******************************************************************************
+ * Function: post_inband_receive
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Post one zero-SGE receive request. WRITE_WITH_IMM only needs the RR for its
+ * immediate value, the payload is placed directly into the registered buffer.
+ ******************************************************************************/
+static int post_inband_receive(struct resources *res)
+{
+	struct ibv_recv_wr rr;
+	struct ibv_recv_wr *bad_wr;
+	int rc;
+	memset(&rr, 0, sizeof(rr));
+	rr.wr_id = WRID_INBAND_RECV;
+	rr.sg_list = NULL;
+	rr.num_sge = 0;
+	rc = ibv_post_recv(res->qp, &rr, &bad_wr);
+	if (rc)
+		log_err("failed to post in-band RR\n");
+	return rc;
+}
+/******************************************************************************
+ * Function: post_inband_write
+ *
+ * Input
+ * res pointer to resources structure
+ * wr_id WRID_INBAND_DATA or WRID_INBAND_ACK
+ * offset offset into both buffers
+ * length number of bytes to write (0 for an ack)
+ * imm immediate value in host byte order
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Post an RDMA WRITE_WITH_IMM work request.
+ ******************************************************************************/
+static int post_inband_write(struct resources *res, uint64_t wr_id, size_t offset, uint32_t length, uint32_t imm)
+{
+	struct ibv_send_wr sr;
+	struct ibv_sge sge;
+	struct ibv_send_wr *bad_wr = NULL;
+	int rc;
+	memset(&sge, 0, sizeof(sge));
+	sge.addr = (uintptr_t)(res->buf + offset);
+	sge.length = length;
+	sge.lkey = res->mr->lkey;
+	memset(&sr, 0, sizeof(sr));
+	sr.wr_id = wr_id;
+	sr.sg_list = length ? &sge : NULL;
+	sr.num_sge = length ? 1 : 0;
+	sr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+	sr.send_flags = IBV_SEND_SIGNALED | inline_flag(res, sr.opcode, length);
+	sr.imm_data = htonl(imm);
+	sr.wr.rdma.remote_addr = res->remote_props.addr + offset;
+	sr.wr.rdma.rkey = res->remote_props.rkey;
+	rc = ibv_post_send(res->qp, &sr, &bad_wr);
+	if (rc)
+		log_err("failed to post in-band SR\n");
+	else
+		stats_posted(res, sr.opcode, length);
+	return rc;
+}
+/******************************************************************************
+ * Function: inband_poll
+ *
+ * Input
+ * res pointer to resources structure
+ * timeout_usec how long to poll before giving up, negative to wait forever
+ *
+ * Output
+ * wr_id wr_id of the completion that was handled
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Reap one completion. Receive completions are accounted in res (a data
+ * arrival or a returned credit) and the receive request is re-posted.
+ ******************************************************************************/
+static int inband_poll(struct resources *res, long timeout_usec, uint64_t *wr_id)
+{
+	struct ibv_wc wc;
+	int poll_result;
+	poll_result = poll_cq_batch(res, &wc, 1, timeout_usec);
+	if (poll_result < 0)
+		return 1;
+	if (poll_result == 0)
+		return POLL_TIMED_OUT;
+	if (wc.status != IBV_WC_SUCCESS)
+	{
+		log_err("got bad completion with status: 0x%x, vendor syndrome: 0x%x\n", wc.status,
+				wc.vendor_err);
+		return 1;
+	}
+	*wr_id = wc.wr_id;
+	return inband_account(res, &wc);
+}
+/******************************************************************************
+ * Function: inband_account
+ *
+ * Input
+ * res pointer to resources structure
+ * wc a successful completion
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Account an in-band receive completion (a data arrival or a returned
+ * credit) and re-post its receive request. Other completions are ignored.
+ ******************************************************************************/
+static int inband_account(struct resources *res, struct ibv_wc *wc)
+{
+	uint32_t imm;
+	if (wc->status != IBV_WC_SUCCESS)
+	{
+		log_err("got bad completion with status: 0x%x, vendor syndrome: 0x%x\n", wc->status,
+				wc->vendor_err);
+		return 1;
+	}
+	if (wc->opcode != IBV_WC_RECV_RDMA_WITH_IMM)
+		return 0;
+	imm = ntohl(wc->imm_data);
+	if (imm & INBAND_IMM_ACK)
+		res->inband_credits++;
+	else
+	{
+		res->inband_rx_pending = 1;
+		res->inband_rx_len = imm;
+	}
+	return post_inband_receive(res) ? 1 : 0;
+}
+/******************************************************************************
+ * Function: inband_wait_send
+ *
+ * Input
+ * res pointer to resources structure
+ * wr_id wr_id of the send request to wait for
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Poll until the given send request completes, accounting any receive
+ * completions that show up meanwhile.
+ ******************************************************************************/
+static int inband_wait_send(struct resources *res, uint64_t wr_id)
+{
+	uint64_t got;
+	int rc;
+	do
+	{
+		rc = inband_poll(res, MAX_POLL_CQ_TIMEOUT * 1000L, &got);
+		if (rc == POLL_TIMED_OUT)
+			log_err("completion wasn't found in the CQ after timeout\n");
+		if (rc)
+			return 1;
+	} while (got != wr_id);
+	return 0;
+}
+/******************************************************************************
+ * Function: inband_setup
+ *
+ * Input
+ * res pointer to resources structure, QP in INIT state
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Pre-post the receive requests used by the in-band mode and hand out the
+ * initial credit. Must run before the QP moves to RTR.
+ ******************************************************************************/
+static int inband_setup(struct resources *res)
+{
+	int i;
+	int rc;
+	for (i = 0; i < INBAND_RECV_DEPTH; i++)
+	{
+		rc = post_inband_receive(res);
+		if (rc)
+			return rc;
+	}
+	res->inband_credits = 1;
+	res->inband_rx_pending = 0;
+	res->inband_rx_len = 0;
+	return 0;
+}
+/******************************************************************************
+ * Function: inband_write
+ *
+ * Input
+ * res pointer to resources structure
+ * offset offset into both the local and the remote buffer
+ * length number of bytes to write
+ * timeout_usec how long to wait for the peer's credit, negative to wait forever
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT if no credit arrived in time
+ * (nothing is posted in that case)
+ *
+ * Description
+ * Write [offset, offset+length) of the local buffer to the same range of the
+ * remote buffer and notify the peer through the immediate value. Waits for the
+ * peer's ack of the previous write first.
+ ******************************************************************************/
+int inband_write(struct resources *res, size_t offset, uint32_t length, long timeout_usec)
+{
+	uint64_t got;
+	int rc;
+	if (offset > res->buf_size || length > res->buf_size - offset ||
+		offset > res->remote_props.size || length > res->remote_props.size - offset)
+	{
+		log_err("in-band range [%zu, +%u) is out of buffer\n", offset, length);
+		return 1;
+	}
+	if (length & INBAND_IMM_ACK)
+	{
+		log_err("in-band write of %u bytes is too large\n", length);
+		return 1;
+	}
+	// 等待对端对上一次写入的确认
+	while (res->inband_credits == 0)
+		if ((rc = inband_poll(res, timeout_usec, &got)))
+			return rc;
+	if (post_inband_write(res, WRID_INBAND_DATA, offset, length, length))
+		return 1;
+	res->inband_credits--;
+	return inband_wait_send(res, WRID_INBAND_DATA);
+}
+/******************************************************************************
+ * Function: inband_wait_data
+ *
+ * Input
+ * res pointer to resources structure
+ * timeout_usec how long to wait, negative to wait forever
+ *
+ * Output
+ * length number of bytes the peer wrote
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT if nothing arrived in time
+ *
+ * Description
+ * Block until the peer's next in-band write has landed in the local buffer.
+ * The caller must call inband_release once it is done with the data.
+ ******************************************************************************/
+int inband_wait_data(struct resources *res, uint32_t *length, long timeout_usec)
+{
+	uint64_t got;
+	int rc;
+	while (!res->inband_rx_pending)
+		if ((rc = inband_poll(res, timeout_usec, &got)))
+			return rc;
+	*length = res->inband_rx_len;
+	return 0;
+}
+/******************************************************************************
+ * Function: inband_release
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Return the credit to the peer so that it may write again.
+ ******************************************************************************/
+int inband_release(struct resources *res)
+{
+	res->inband_rx_pending = 0;
+	if (post_inband_write(res, WRID_INBAND_ACK, 0, 0, INBAND_IMM_ACK))
+		return 1;
+	return inband_wait_send(res, WRID_INBAND_ACK);
+}
+/******************************************************************************
+Completion events
+With res->event_mode the CQ is bound to a completion channel. A waiter that
+has spun for its budget without finding anything arms the CQ with cq_arm,
+checks the CQ once more (a completion may have slipped in before the arm) and
+then sleeps until the channel fd becomes readable. cq_consume_event retrieves
+and acknowledges the event; the waiter then polls the CQ again as usual.
+******************************************************************************/
+/******************************************************************************
+ * Function: cq_event_fd
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Returns
+ * the non-blocking fd of the completion channel, -1 in busy-poll mode
+ ******************************************************************************/
+int cq_event_fd(struct resources *res)
+{
+	return res->channel ? res->channel->fd : -1;
+}
+/******************************************************************************
+ * Function: cq_arm
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Returns
+ * 0 on success, error code on failure
+ *
+ * Description
+ * Request an event for the next completion added to the CQ.
+ ******************************************************************************/
+int cq_arm(struct resources *res)
+{
+	int rc = ibv_req_notify_cq(res->cq, 0);
+	if (rc)
+		log_err("failed to request CQ notification\n");
+	return rc;
+}
+/******************************************************************************
+ * Function: cq_consume_event
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Returns
+ * 0 if an event was consumed, POLL_TIMED_OUT if none is pending, 1 on failure
+ *
+ * Description
+ * Non-blocking ibv_get_cq_event followed by its acknowledgement, so that
+ * resources_destroy never waits for unacknowledged events.
+ ******************************************************************************/
+int cq_consume_event(struct resources *res)
+{
+	struct ibv_cq *ev_cq;
+	void *ev_ctx;
+	if (ibv_get_cq_event(res->channel, &ev_cq, &ev_ctx))
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return POLL_TIMED_OUT;
+		log_err("failed to get CQ event\n");
+		return 1;
+	}
+	ibv_ack_cq_events(ev_cq, 1);
+	return 0;
+}
+/******************************************************************************
+ * Function: cq_moderate
+ *
+ * Input
+ * res pointer to resources structure
+ * count completions to collect before an event is raised, 0 together with a
+ *       zero period for no moderation
+ * period_usec longest time an event is held back
+ *
+ * Returns
+ * 0 on success, error code on failure (e.g. the device cannot moderate)
+ *
+ * Description
+ * Completion moderation only throttles events; the CQ entries themselves are
+ * written as usual, so it matters for event-mode waiters alone.
+ ******************************************************************************/
+int cq_moderate(struct resources *res, int count, int period_usec)
+{
+	struct ibv_modify_cq_attr attr;
+	int rc;
+	memset(&attr, 0, sizeof(attr));
+	attr.attr_mask = IBV_CQ_ATTR_MODERATE;
+	attr.moderate.cq_count = (uint16_t)count;
+	attr.moderate.cq_period = (uint16_t)period_usec;
+	rc = ibv_modify_cq(res->cq, &attr);
+	if (rc)
+		log_info("CQ moderation to %d completions / %d us is not supported: %s\n", count, period_usec,
+				 strerror(rc));
+	else
+		log_debug("CQ moderation set to %d completions / %d us\n", count, period_usec);
+	return rc;
+}
@@ -9,15 +9,80 @@
 #include <byteswap.h>
 #include <getopt.h>
 #include <sys/time.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <infiniband/verbs.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include "rdma_pool.h"
+#include "rdma_msg.h"
+#include "rdma_ring.h"
+#include "rdma_submit.h"
+#include "rdma_stats.h"
+#include "rdma_numa.h"
+#include "rdma_file.h"
+#include "rdma_kv.h"
+#include "rdma_xfer.h"
 
 #define MAX_POLL_CQ_TIMEOUT 2000
+/* 默认的发送/接收队列深度；完成队列默认容纳两者之和 */
+#define DEFAULT_QP_DEPTH 10
+/* 每个发送请求最多使用的散布/聚集条目数（还受设备 max_sge 限制） */
+#define MAX_SEND_SGE 10
+/* 默认向设备申请的内联数据大小（字节）；设备不支持时退回到不使用内联 */
+#define DEFAULT_MAX_INLINE 256
+/* 一个逻辑连接最多使用的 QP 数 */
+#define MAX_STRIPES 16
+/* 每次 ibv_poll_cq 最多取出的完成事件数，以及空轮询多少次才检查一次时钟 */
+#define POLL_BATCH 16
+#define POLL_CLOCK_INTERVAL 256
+/* TCP 保活：空闲多少秒后开始探测、探测间隔（秒）、多少次无应答后断开，约 25 秒发现对端消失 */
+#define KEEPALIVE_IDLE_SEC 10
+#define KEEPALIVE_INTERVAL_SEC 5
+#define KEEPALIVE_COUNT 3
+/* 带超时的等待函数在超时（而非出错）时返回的值 */
+#define POLL_TIMED_OUT 2
 #define MSG "******************************************************************************/"
 #define MSG_SIZE (strlen(MSG) + 6)
+
+/* wr_id 不小于 WRID_MSG_RECV 的请求都是库内部的，其完成事件由 account_internal 消化，
+ * 调用方的 wr_id 必须小于 WRID_MSG_RECV（Go 侧的 WrIDReserved） */
+/* in-band completion mode: receive WRs kept posted for WRITE_WITH_IMM */
+#define INBAND_RECV_DEPTH 4
+#define INBAND_IMM_ACK 0x80000000u
+#define WRID_INBAND_RECV 0xfffffffffffffff0ULL
+#define WRID_INBAND_DATA 0xfffffffffffffff1ULL
+#define WRID_INBAND_ACK 0xfffffffffffffff2ULL
+/* 环形缓冲区的写请求（数据与尾指针、头指针），完成后只释放发送队列槽位 */
+#define WRID_RING 0xfffffffffffffff4ULL
+/* 消息通道（rdma_xfer）的请求，完成后同样只释放发送队列槽位 */
+#define WRID_XFER 0xfffffffffffffff5ULL
+/* 日志级别：SILENT 不输出任何内容，ERROR 只输出错误，INFO 额外输出连接建立过程，DEBUG 额外输出数据通路上的每次操作 */
+#define RDMA_LOG_SILENT 0
+#define RDMA_LOG_ERROR 1
+#define RDMA_LOG_INFO 2
+#define RDMA_LOG_DEBUG 3
+/* 编译期上限，例如 CGO_CFLAGS=-DRDMA_LOG_MAX_LEVEL=2 可以把数据通路的调试日志完全编译掉 */
+#ifndef RDMA_LOG_MAX_LEVEL
+#define RDMA_LOG_MAX_LEVEL RDMA_LOG_DEBUG
+#endif
+#define rdma_log_at(level, ...)                                            \
+    do                                                                     \
+    {                                                                      \
+        if ((level) <= RDMA_LOG_MAX_LEVEL && (level) <= rdma_get_log_level()) \
+            rdma_log((level), __func__, __VA_ARGS__);                      \
+    } while (0)
+#define log_err(...) rdma_log_at(RDMA_LOG_ERROR, __VA_ARGS__)
+#define log_info(...) rdma_log_at(RDMA_LOG_INFO, __VA_ARGS__)
+#define log_debug(...) rdma_log_at(RDMA_LOG_DEBUG, __VA_ARGS__)
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
 static inline uint64_t htonll(uint64_t x) { return bswap_64(x); }
@@ -45,36 +110,192 @@ struct cm_con_data_t
     uint32_t qp_num;       // 队列对的编号。
     uint16_t lid;          // 本地 InfiniBand 端口的本地标识符（Local Identifier）
     uint8_t gid[16];       /* gid */
+    uint64_t size;         // 缓冲区的大小（字节），用于远端做越界检查。
+    uint8_t mtu;           // 本端可用的路径 MTU（enum ibv_mtu），双方取最小值。
+    uint8_t rd_atom;       // 本端作为响应方能同时处理的 RDMA 读/原子操作数。
+    uint8_t init_rd_atom;  // 本端作为发起方想同时发出的 RDMA 读/原子操作数。
+    uint32_t msg_size;     // 本端消息接收槽位的大小，未启用消息引擎时为 0。
+    uint8_t stripes;       // 本端希望建立的 QP 条带数，双方取最小值；附属 QP 发送 0。
 } __attribute__((packed)); 
 
+/* microseconds spent in each phase of connection setup */
+struct setup_stats
+{
+    uint64_t tcp_usec;        /* 建立 TCP 连接，服务器端包括等待客户端 */
+    uint64_t device_usec;     /* 打开或引用设备 */
+    uint64_t resources_usec;  /* 创建 CQ、分配注册缓冲区和创建 QP */
+    uint64_t exchange_usec;   /* 交换连接数据，包括等待对端 */
+    uint64_t transition_usec; /* 协商参数、投递接收请求以及 INIT/RTR/RTS 三次状态转换 */
+    uint64_t sync_usec;       /* 进入 RTS 之后的最后一次同步 */
+};
+
+/* one reaped completion of an asynchronously posted work request */
+struct completion_t
+{
+    uint64_t wr_id;    /* 调用方在投递时指定的 wr_id */
+    uint32_t status;   /* enum ibv_wc_status */
+    uint32_t opcode;   /* enum ibv_wc_opcode */
+    uint32_t byte_len; /* 传输的字节数（仅对接收和 RDMA 读有意义） */
+};
+
+/* device context and PD shared by every connection and pool opened on them */
+struct rdma_device
+{
+    struct ibv_context *ib_ctx;          /* 指向 InfiniBand 设备上下文的指针 */
+    struct ibv_pd *pd;                   /* 保护域（Protection Domain），在其中注册的 MR 可用于所有共享本设备的连接 */
+    struct ibv_device_attr device_attr;  /* 设备属性，打开设备时查询一次 */
+    int ib_port;                         /* 打开设备时查询的端口号 */
+    struct ibv_port_attr port_attr;      /* ib_port 的属性 */
+    int refs;                            /* 引用计数，最后一个引用释放时关闭设备 */
+    int numa_node;                       /* 设备所在的 NUMA 节点（取自 sysfs），未知时为 -1 */
+    int next_vector;                     /* 自动分配完成向量时下一个使用的向量 */
+    int odp_caps;                        /* RC 连接的按需分页能力（IBV_ODP_SUPPORT_*），不支持时为 0 */
+};
+
+/* one work request of a doorbell batch, on the connection's registered buffer */
+struct batch_op_t
+{
+    uint64_t wr_id;         /* 该请求被选为发出完成事件时报告的 wr_id */
+    uint64_t local_offset;  /* 本地缓冲区中的偏移 */
+    uint64_t remote_offset; /* 远端缓冲区中的偏移 */
+    uint32_t length;        /* 字节数 */
+    int opcode;             /* IBV_WR_RDMA_WRITE 或 IBV_WR_RDMA_READ */
+};
+
 struct resources
 {
-    struct ibv_device_attr
-        device_attr;
+    struct config_t config;            /* 本连接的配置，由调用方在 resources_create 之前从全局默认配置复制并修改 */
+    struct rdma_device *dev;           /* 共享的设备上下文和 PD；为 NULL 时 resources_create 使用内存池的设备或打开一个新的 */
     struct ibv_port_attr port_attr;    /* InfiniBand 端口的属性*/
     struct cm_con_data_t remote_props; /*存储用于连接远程端的值。 */
-    struct ibv_context *ib_ctx;        /*指向 InfiniBand 设备上下文的指针 */
-    struct ibv_pd *pd;                 /* 保护域（Protection Domain）的句柄。*/
     struct ibv_cq *cq;                 /* 完成队列（Completion Queue）的句柄 */
+    struct ibv_comp_channel *channel;  /* 事件模式下 CQ 绑定的完成通道，忙轮询模式下为 NULL */
+    int event_mode;                    /* 非 0 时为 CQ 创建完成通道，等待时可以阻塞在通道的 fd 上 */
     struct ibv_qp *qp;                 /* 队列对的句柄。*/
     struct ibv_mr *mr;                 /* 指向用于 RDMA 操作的内存区域（Memory Region）的句柄。 */
     char *buf;                         /* 用于 RDMA 和发送操作的内存缓冲区指针 */
+    size_t buf_size;                   /* 缓冲区大小，为 0 时在 resources_create 中使用 MSG_SIZE */
+    int numa_bind;                     /* 非 0 时缓冲区用 numa_alloc 分配到 numa_node 上 */
+    int numa_node;                     /* 缓冲区所在的 NUMA 节点，NUMA_NODE_DEVICE 表示设备所在的节点 */
+    int buf_numa;                      /* 缓冲区是否由 numa_alloc 分配，决定释放方式 */
+    int comp_vector;                   /* CQ 使用的完成向量，小于 0 时在设备的向量间轮流分配；创建后为实际使用的向量 */
+    int qp_depth;                      /* 发送/接收队列深度，为 0 时使用 DEFAULT_QP_DEPTH */
+    int cq_depth;                      /* 完成队列深度，为 0 时使用 2 * qp_depth */
+    int max_send_sge;                  /* QP 实际支持的每个发送请求的散布/聚集条目数 */
+    int max_inline;                    /* 申请的内联数据大小，为 0 时使用 DEFAULT_MAX_INLINE，小于 0 时不使用内联 */
+    int inline_size;                   /* QP 实际支持的内联数据大小，不超过它的写和发送自动使用 IBV_SEND_INLINE */
+    int sq_outstanding;                /* 已异步投递但尚未被回收的发送请求数（包括不产生完成事件的请求） */
+    int *sig_slots;                    /* 按投递顺序记录每个带完成事件的异步请求释放的发送队列槽位数 */
+    int sig_head;                      /* sig_slots 环形队列中最早的记录 */
+    int sig_count;                     /* sig_slots 中的记录数 */
+    int sq_unsignaled;                 /* 部分投递后留在发送队列中、其后没有带完成事件请求的槽位数，由下一个 sq_track 一并记入 */
+    uint64_t *sig_post_ns;             /* 与 sig_slots 对应的投递时刻（纳秒），未采样的请求为 0 */
+    uint64_t sync_post_ns;             /* 同步请求被采样时的投递时刻，由 poll_completion 记入直方图 */
+    int lat_sample;                    /* 每隔多少个带完成事件的请求采样一次延迟，0 时使用 DEFAULT_LAT_SAMPLE，小于 0 时不采样 */
+    unsigned int lat_tick;             /* 距上次采样的请求数 */
+    struct conn_stats stats;           /* 数据通路计数器和延迟直方图 */
+    struct ibv_send_wr *batch_wrs;     /* post_send_batch 用来串联请求的数组，qp_depth 项 */
+    struct ibv_sge *batch_sges;        /* 与 batch_wrs 一一对应的散布/聚集条目 */
+    int mtu;                           /* 要求的路径 MTU 上限（enum ibv_mtu），为 0 时使用端口的 active_mtu */
+    int path_mtu;                      /* 与对端协商得到的路径 MTU（enum ibv_mtu），在 connect_qp 中设置 */
+    int rd_atomic;                     /* 要求的在途 RDMA 读/原子操作数上限，为 0 时使用设备上限 */
+    int max_rd_atomic;                 /* 协商得到的发起方在途读/原子操作数（QP 的 max_rd_atomic） */
+    int max_dest_rd_atomic;            /* 协商得到的响应方在途读/原子操作数（QP 的 max_dest_rd_atomic） */
     int sock;                          /* TCP 套接字的文件描述符。 */
+    struct mem_pool *pool;             /* 非 NULL 时缓冲区从内存池中租用，连接必须与内存池共享同一个设备 */
+    struct mem_block pool_block;       /* 从内存池租用的缓冲区 */
+    int inband;                        /* 非 0 时数据通路使用 WRITE_WITH_IMM 在带内通知完成，不再经过 TCP 同步 */
+    int inband_credits;                /* 对端还能接收的写次数（对端确认后加一） */
+    int inband_rx_pending;             /* 是否有对端写入但尚未被读取的数据 */
+    uint32_t inband_rx_len;            /* 对端写入数据的长度 */
+    struct msg_ring *msg_ring;         /* 消息接收环；调用方可以传入共享接收环，否则 msg_slots 非 0 时由 resources_create 创建私有接收环 */
+    int msg_own_ring;                  /* msg_ring 是否为本连接私有，由本连接负责销毁 */
+    int msg_slots;                     /* 私有接收环的槽位数，为 0 时不启用消息引擎 */
+    uint32_t msg_slot_size;            /* 私有接收环每个槽位的字节数 */
+    uint64_t *msg_ready;               /* 已到达但尚未被 msg_recv 取走的消息（槽位 << 32 | 长度），环形队列 */
+    int msg_ready_head;
+    int msg_ready_count;
+    char *msg_tx;                      /* 不能内联发送的消息先拷贝到这里，在 connect_qp 中按对端槽位大小分配 */
+    struct ibv_mr *msg_tx_mr;
+    int msg_send_done;                 /* 最近一次消息发送是否已完成 */
+    int sock_accepted;                 /* 非 0 时 sock 已由多客户端服务器 accept 得到，resources_create 不再建立 TCP 连接 */
+    int lane;                          /* 在条带化连接中的下标；非 0 时借用主连接的套接字、缓冲区和 MR */
+    int stripes;                       /* 主连接：请求的条带数，connect_qp 之后为协商结果 */
+    struct setup_stats setup;          /* 建立连接各阶段的耗时 */
+    uint64_t *atomic_buf;              /* 原子操作返回的远端旧值写到这里 */
+    struct ibv_mr *atomic_mr;
 };
+/* 进程范围的默认配置，只读；每个连接使用自己的副本 resources.config */
 extern struct config_t config;
+/* 日志级别和回调可能被任意线程同时读写，只通过下面的原子访问函数使用 */
+extern int rdma_log_level;
+/* 非 NULL 时日志交给该回调处理，而不是写到 stdout/stderr */
+extern void (*rdma_log_hook)(int level, char *func, char *msg);
+
+static inline int rdma_get_log_level(void) { return __atomic_load_n(&rdma_log_level, __ATOMIC_RELAXED); }
+static inline void rdma_set_log_level(int level) { __atomic_store_n(&rdma_log_level, level, __ATOMIC_RELAXED); }
+static inline void rdma_set_log_hook(void (*hook)(int level, char *func, char *msg))
+{
+    __atomic_store_n(&rdma_log_hook, hook, __ATOMIC_RELEASE);
+}
+void rdma_log(int level, const char *func, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
 
 int sock_connect(const char *servername, int port);
+int sock_listen(int port, int backlog);
+int sock_accept(int listenfd);
+int sock_shutdown(int listenfd);
+int sock_alive(int sock);
+int sock_set_timeout(int sock, long timeout_usec);
 int sock_sync_data(int sock, int xfer_size, char *local_data, char *remote_data);
+int sock_sync_ready(int sock);
+unsigned long monotonic_usec(void);
+int poll_cq_batch(struct resources *res, struct ibv_wc *wc, int max, long timeout_usec);
 int poll_completion(struct resources *res);
 int post_send(struct resources *res, int opcode);
+int post_send_range(struct resources *res, int opcode, size_t local_offset, size_t remote_offset, uint32_t length);
+int post_send_async(struct resources *res, int opcode, uint64_t wr_id, size_t local_offset, size_t remote_offset,
+                    uint32_t length);
+int post_block_async(struct resources *res, int opcode, uint64_t wr_id, struct mem_block *blk, size_t block_offset,
+                     size_t remote_offset, uint32_t length);
+int inline_flag(struct resources *res, int opcode, uint32_t length);
+int post_inline_async(struct resources *res, uint64_t wr_id, const void *data, uint32_t length, size_t remote_offset);
+int post_send_batch(struct resources *res, struct batch_op_t *ops, int num_ops, int signal_every, int *posted);
+int post_atomic(struct resources *res, int opcode, size_t remote_offset, uint64_t compare_add, uint64_t swap);
+int atomic_fetch(struct resources *res, int opcode, size_t remote_offset, uint64_t compare_add, uint64_t swap,
+                 uint64_t *old);
+int post_sge_list(struct resources *res, int opcode, struct ibv_sge *sge, int num_sge, size_t remote_offset);
+void sq_track(struct resources *res, int slots);
+void sq_untrack(struct resources *res);
+int account_internal(struct resources *res, struct ibv_wc *wc);
+int reap_completions(struct resources *res, struct completion_t *out, int max, long timeout_usec);
 int post_receive(struct resources *res);
 void resources_init(struct resources *res);
+void resources_init_lane(struct resources *lane, const struct resources *primary, int index);
+struct ibv_context *open_ib_device(const char *dev_name);
+struct rdma_device *rdma_device_open(const struct config_t *cfg);
+void rdma_device_get(struct rdma_device *dev);
+int rdma_device_put(struct rdma_device *dev);
 int resources_create(struct resources *res);
-int modify_qp_to_init(struct ibv_qp *qp);
-int modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, uint16_t dlid, uint8_t *dgid);
-int modify_qp_to_rts(struct ibv_qp *qp);
+int remote_access_flags(const struct rdma_device *dev);
+int modify_qp_to_init(struct ibv_qp *qp, const struct config_t *cfg, int access_flags);
+int modify_qp_to_rtr(struct ibv_qp *qp, const struct config_t *cfg, uint32_t remote_qpn, uint16_t dlid, uint8_t *dgid,
+                     enum ibv_mtu mtu, uint8_t max_dest_rd_atomic);
+int modify_qp_to_rts(struct ibv_qp *qp, uint8_t max_rd_atomic);
+int connect_qp_prepare(struct resources *res, struct cm_con_data_t *local);
+int connect_qp_finish(struct resources *res, const struct cm_con_data_t *remote_data);
 int connect_qp(struct resources *res);
+int qp_state(struct resources *res);
+int resources_reconnect(struct resources *res, int redial, long timeout_usec);
+uint64_t remote_buffer_size(struct resources *res);
+int local_path_mtu(struct resources *res);
 int resources_destroy(struct resources *res);
 void print_config(void);
 void usage(const char *argv0);
 int receive_message(struct resources *res, const char *entity);
+int inband_write(struct resources *res, size_t offset, uint32_t length, long timeout_usec);
+int inband_wait_data(struct resources *res, uint32_t *length, long timeout_usec);
+int inband_release(struct resources *res);
+int cq_event_fd(struct resources *res);
+int cq_arm(struct resources *res);
+int cq_consume_event(struct resources *res);
+int cq_moderate(struct resources *res, int count, int period_usec);
@@ -0,0 +1,359 @@
+#include <rdma_operations.h>
+#include <sys/mman.h>
+/******************************************************************************
+Registered memory pool
+Memory registration pins pages and is far too slow for the connection setup
+or request path. The pool registers memory once, in slabs, and hands out
+fixed-size chunks of power-of-two size classes. A slab of a small class holds
+many chunks; classes larger than the slab size get one chunk per slab. Slabs
+are backed by 2 MiB huge pages when the system has them reserved and fall back
+to transparent huge pages otherwise.
+******************************************************************************/
+/******************************************************************************
+ * Function: pool_size_class
+ *
+ * Input
+ * size requested size in bytes
+ *
+ * Returns
+ * index of the smallest class holding `size`, -1 if it is too large
+ ******************************************************************************/
+int pool_size_class(size_t size)
+{
+	int cls;
+	for (cls = 0; cls < POOL_NUM_CLASSES; cls++)
+		if (size <= ((size_t)1 << (cls + POOL_MIN_SHIFT)))
+			return cls;
+	return -1;
+}
+/******************************************************************************
+ * Function: slab_map
+ *
+ * Input
+ * size number of bytes to map
+ * node NUMA node to prefer for the pages, -1 for none
+ *
+ * Output
+ * hugepage set to 1 if the mapping uses MAP_HUGETLB
+ *
+ * Returns
+ * the mapping, NULL on failure
+ *
+ * Description
+ * Map anonymous memory for a slab, preferring explicit huge pages. The
+ * pages are placed on `node` when ibv_reg_mr faults them in.
+ ******************************************************************************/
+static void *slab_map(size_t size, int node, int *hugepage)
+{
+	void *p = MAP_FAILED;
+	*hugepage = 0;
+#ifdef MAP_HUGETLB
+	if (size % POOL_HUGEPAGE_SIZE == 0)
+	{
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			*hugepage = 1;
+	}
+#endif
+	if (p == MAP_FAILED)
+	{
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+	if (node >= 0)
+		numa_prefer(p, size, node);
+	return p;
+}
+/******************************************************************************
+ * Function: slab_add
+ *
+ * Input
+ * pool pointer to the pool, lock held
+ * cls class to grow
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Map and register one more slab for the class. This is the only place the
+ * pool registers memory.
+ ******************************************************************************/
+static int slab_add(struct mem_pool *pool, int cls)
+{
+	struct mem_class *mc = &pool->classes[cls];
+	struct mem_slab *slab;
+	struct mem_slab *grown;
+	int i;
+	if (mc->num_slabs == mc->cap_slabs)
+	{
+		int cap = mc->cap_slabs ? 2 * mc->cap_slabs : 4;
+		grown = realloc(mc->slabs, cap * sizeof(*grown));
+		if (!grown)
+		{
+			log_err("failed to grow slab table of class %zu\n", mc->chunk_size);
+			return 1;
+		}
+		mc->slabs = grown;
+		mc->cap_slabs = cap;
+	}
+	slab = &mc->slabs[mc->num_slabs];
+	memset(slab, 0, sizeof(*slab));
+	slab->size = mc->chunk_size > pool->slab_size ? mc->chunk_size : pool->slab_size;
+	slab->num_chunks = slab->size / mc->chunk_size;
+	slab->base = slab_map(slab->size, pool->dev->numa_node, &slab->hugepage);
+	if (!slab->base)
+	{
+		log_err("failed to map a slab of %zu bytes\n", slab->size);
+		return 1;
+	}
+	slab->free_chunks = malloc(slab->num_chunks * sizeof(int));
+	if (!slab->free_chunks)
+	{
+		log_err("failed to allocate free list of %d chunks\n", slab->num_chunks);
+		munmap(slab->base, slab->size);
+		return 1;
+	}
+	// 反向压栈，使得块按地址顺序被分配出去
+	for (i = 0; i < slab->num_chunks; i++)
+		slab->free_chunks[i] = slab->num_chunks - 1 - i;
+	slab->num_free = slab->num_chunks;
+	slab->mr = ibv_reg_mr(pool->dev->pd, slab->base, slab->size, pool->mr_flags);
+	if (!slab->mr)
+	{
+		log_err("ibv_reg_mr failed for a slab of %zu bytes with mr_flags=0x%x\n", slab->size, pool->mr_flags);
+		free(slab->free_chunks);
+		munmap(slab->base, slab->size);
+		return 1;
+	}
+	log_info("pool slab registered: class=%zu bytes, chunks=%d, hugepage=%d, lkey=0x%x, rkey=0x%x\n",
+			 mc->chunk_size, slab->num_chunks, slab->hugepage, slab->mr->lkey, slab->mr->rkey);
+	mc->num_slabs++;
+	return 0;
+}
+/******************************************************************************
+ * Function: mem_pool_create
+ *
+ * Input
+ * dev device whose PD the slabs are registered in, NULL to open the
+ *     device of the default configuration
+ * slab_size size of the slabs of the small classes, 0 for the default
+ * prealloc number of slabs to register up front for every class whose
+ *          chunks fit in one default slab
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * the pool, NULL on failure
+ *
+ * Description
+ * The pool holds a reference on the device until mem_pool_destroy.
+ * Connections created with the pool share the same device and PD.
+ ******************************************************************************/
+struct mem_pool *mem_pool_create(struct rdma_device *dev, size_t slab_size, int prealloc)
+{
+	struct mem_pool *pool;
+	int cls;
+	int i;
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+	{
+		log_err("failed to allocate memory pool\n");
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->slab_size = slab_size ? slab_size : POOL_DEFAULT_SLAB_SIZE;
+	for (cls = 0; cls < POOL_NUM_CLASSES; cls++)
+		pool->classes[cls].chunk_size = (size_t)1 << (cls + POOL_MIN_SHIFT);
+
+	if (dev)
+		rdma_device_get(dev);
+	else
+		dev = rdma_device_open(&config);
+	if (!dev)
+		goto mem_pool_create_error;
+	pool->dev = dev;
+	pool->mr_flags = IBV_ACCESS_LOCAL_WRITE | remote_access_flags(dev);
+
+	for (cls = 0; cls < POOL_NUM_CLASSES; cls++)
+	{
+		if (pool->classes[cls].chunk_size > pool->slab_size)
+			break;
+		for (i = 0; i < prealloc; i++)
+			if (slab_add(pool, cls))
+				goto mem_pool_create_error;
+	}
+	return pool;
+
+mem_pool_create_error:
+	mem_pool_destroy(pool);
+	return NULL;
+}
+/******************************************************************************
+ * Function: mem_pool_destroy
+ *
+ * Input
+ * pool pointer to the pool
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, 1 on failure (including chunks that are still leased)
+ *
+ * Description
+ * Deregister and unmap all slabs, then drop the pool's device reference.
+ ******************************************************************************/
+int mem_pool_destroy(struct mem_pool *pool)
+{
+	struct mem_slab *slab;
+	int rc = 0;
+	int cls;
+	int i;
+	if (!pool)
+		return 0;
+	if (pool->leased)
+	{
+		log_err("memory pool still has %ld leased blocks\n", pool->leased);
+		return 1;
+	}
+	for (cls = 0; cls < POOL_NUM_CLASSES; cls++)
+	{
+		for (i = 0; i < pool->classes[cls].num_slabs; i++)
+		{
+			slab = &pool->classes[cls].slabs[i];
+			if (ibv_dereg_mr(slab->mr))
+			{
+				log_err("failed to deregister slab MR\n");
+				rc = 1;
+			}
+			munmap(slab->base, slab->size);
+			free(slab->free_chunks);
+		}
+		free(pool->classes[cls].slabs);
+	}
+	if (pool->dev && rdma_device_put(pool->dev))
+		rc = 1;
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+	return rc;
+}
+/******************************************************************************
+ * Function: mem_pool_alloc
+ *
+ * Input
+ * pool pointer to the pool
+ * size number of bytes needed
+ *
+ * Output
+ * blk descriptor of the leased chunk
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Lease a chunk of the smallest class holding `size`. A new slab is only
+ * registered when every slab of the class is exhausted.
+ ******************************************************************************/
+int mem_pool_alloc(struct mem_pool *pool, size_t size, struct mem_block *blk)
+{
+	struct mem_class *mc;
+	struct mem_slab *slab = NULL;
+	int cls;
+	int i;
+	cls = pool_size_class(size);
+	if (cls < 0)
+	{
+		log_err("no pool size class for %zu bytes\n", size);
+		return 1;
+	}
+	mc = &pool->classes[cls];
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < mc->num_slabs; i++)
+		if (mc->slabs[i].num_free)
+		{
+			slab = &mc->slabs[i];
+			break;
+		}
+	if (!slab)
+	{
+		if (slab_add(pool, cls))
+		{
+			pthread_mutex_unlock(&pool->lock);
+			return 1;
+		}
+		i = mc->num_slabs - 1;
+		slab = &mc->slabs[i];
+	}
+	blk->cls = cls;
+	blk->slab = i;
+	blk->chunk = slab->free_chunks[--slab->num_free];
+	blk->offset = (uint64_t)blk->chunk * mc->chunk_size;
+	blk->addr = (uintptr_t)(slab->base + blk->offset);
+	blk->size = mc->chunk_size;
+	blk->lkey = slab->mr->lkey;
+	blk->rkey = slab->mr->rkey;
+	pool->leased++;
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+/******************************************************************************
+ * Function: mem_pool_free
+ *
+ * Input
+ * pool pointer to the pool
+ * blk descriptor returned by mem_pool_alloc
+ *
+ * Output
+ * none
+ *
+ * Returns
+ * 0 on success, 1 if the descriptor does not belong to the pool
+ ******************************************************************************/
+int mem_pool_free(struct mem_pool *pool, struct mem_block *blk)
+{
+	struct mem_slab *slab;
+	if (blk->cls < 0 || blk->cls >= POOL_NUM_CLASSES)
+		return 1;
+	pthread_mutex_lock(&pool->lock);
+	if (blk->slab < 0 || blk->slab >= pool->classes[blk->cls].num_slabs)
+	{
+		pthread_mutex_unlock(&pool->lock);
+		log_err("block does not belong to the pool\n");
+		return 1;
+	}
+	slab = &pool->classes[blk->cls].slabs[blk->slab];
+	if (blk->chunk < 0 || blk->chunk >= slab->num_chunks || slab->num_free == slab->num_chunks ||
+		blk->addr != (uintptr_t)(slab->base + blk->offset))
+	{
+		pthread_mutex_unlock(&pool->lock);
+		log_err("block does not belong to the pool\n");
+		return 1;
+	}
+	slab->free_chunks[slab->num_free++] = blk->chunk;
+	pool->leased--;
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+/******************************************************************************
+ * Function: mem_pool_block_mr
+ *
+ * Input
+ * pool pointer to the pool
+ * blk descriptor returned by mem_pool_alloc
+ *
+ * Returns
+ * the MR of the slab holding the block
+ ******************************************************************************/
+struct ibv_mr *mem_pool_block_mr(struct mem_pool *pool, struct mem_block *blk)
+{
+	struct ibv_mr *mr;
+	pthread_mutex_lock(&pool->lock);
+	mr = pool->classes[blk->cls].slabs[blk->slab].mr;
+	pthread_mutex_unlock(&pool->lock);
+	return mr;
+}
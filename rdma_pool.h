@@ -0,0 +1,69 @@
+#ifndef RDMA_POOL_H
+#define RDMA_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <infiniband/verbs.h>
+
+/* 尺寸等级：从 2^POOL_MIN_SHIFT 到 2^POOL_MAX_SHIFT 字节，每级翻倍 */
+#define POOL_MIN_SHIFT 6
+#define POOL_MAX_SHIFT 26
+#define POOL_NUM_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+/* 默认的 slab 大小，与 x86_64 的大页大小一致 */
+#define POOL_DEFAULT_SLAB_SIZE (2UL << 20)
+#define POOL_HUGEPAGE_SIZE (2UL << 20)
+
+/* one registered slab, carved into equally sized chunks of its class */
+struct mem_slab
+{
+    char *base;          /* mmap 得到的起始地址 */
+    size_t size;         /* slab 的字节数 */
+    int hugepage;        /* 是否由 MAP_HUGETLB 分配 */
+    struct ibv_mr *mr;   /* 覆盖整个 slab 的 MR */
+    int *free_chunks;    /* 空闲块下标组成的栈 */
+    int num_free;        /* 栈中空闲块数 */
+    int num_chunks;      /* slab 中的块总数 */
+};
+
+struct mem_class
+{
+    size_t chunk_size;       /* 本等级的块大小 */
+    struct mem_slab *slabs;  /* 已注册的 slab 数组 */
+    int num_slabs;
+    int cap_slabs;
+};
+
+struct rdma_device;
+
+struct mem_pool
+{
+    struct rdma_device *dev;     /* 内存池持有引用的设备，slab 注册在它的 PD 中 */
+    size_t slab_size;            /* 小等级的 slab 大小；大于它的等级每个 slab 只放一个块 */
+    int mr_flags;                /* 注册 slab 时使用的访问标志 */
+    struct mem_class classes[POOL_NUM_CLASSES];
+    long leased;                 /* 尚未归还的块数 */
+    pthread_mutex_t lock;
+};
+
+/* descriptor of one leased chunk, handed to Go by value */
+struct mem_block
+{
+    uint64_t addr;   /* 块的虚拟地址 */
+    uint64_t offset; /* 块在其 slab MR 中的偏移 */
+    uint64_t size;   /* 块大小（等级大小，可能大于申请的大小） */
+    uint32_t lkey;   /* slab MR 的本地密钥 */
+    uint32_t rkey;   /* slab MR 的远程密钥 */
+    int cls;         /* 尺寸等级下标 */
+    int slab;        /* slab 下标 */
+    int chunk;       /* 块下标 */
+};
+
+struct mem_pool *mem_pool_create(struct rdma_device *dev, size_t slab_size, int prealloc);
+int mem_pool_destroy(struct mem_pool *pool);
+int pool_size_class(size_t size);
+int mem_pool_alloc(struct mem_pool *pool, size_t size, struct mem_block *blk);
+int mem_pool_free(struct mem_pool *pool, struct mem_block *blk);
+struct ibv_mr *mem_pool_block_mr(struct mem_pool *pool, struct mem_block *blk);
+
+#endif
@@ -0,0 +1,401 @@
+#include <rdma_operations.h>
+/******************************************************************************
+Single-producer/single-consumer ring over RDMA WRITE
+A ring occupies the same window [base, base + size) of both peers' registered
+buffers. The window starts with a control block: the tail word, which the
+producer RDMA-writes into the consumer's buffer after every record, and the
+head word, which the consumer writes back into the producer's buffer to
+return credit. The rest is the data area. Records are a 4-byte length plus
+the payload, padded to 8 bytes; a record never wraps, a RING_WRAP header
+sends the consumer back to the start of the data area instead. A record
+may take at most half the data area, so that it always fits after a wrap.
+
+The producer stages each record in its own copy of the window, so the source
+of the RDMA WRITE is registered memory that is not reused before the consumer
+has returned its credit. The record and the tail update go out as one chain
+with one doorbell; the tail write is inline, so later records cannot change
+the value on its way. The consumer only reads its local memory. Neither side
+makes a syscall or wakes the remote CPU per record. Since RC executes the
+writes of a QP in order, a tail value that has landed implies that the
+records before it have landed too.
+******************************************************************************/
+#define RING_ALIGN(x) (((x) + RING_RECORD_ALIGN - 1) & ~(uint64_t)(RING_RECORD_ALIGN - 1))
+/******************************************************************************
+ * Function: ring_word
+ *
+ * Input
+ * ring pointer to the ring
+ * res connection carrying the ring
+ * offset RING_TAIL_OFFSET or RING_HEAD_OFFSET
+ *
+ * Returns
+ * the control word in the local buffer
+ ******************************************************************************/
+static uint64_t *ring_word(struct rdma_ring *ring, struct resources *res, size_t offset)
+{
+	return (uint64_t *)(res->buf + ring->base + offset);
+}
+/******************************************************************************
+ * Function: ring_data
+ *
+ * Input
+ * ring pointer to the ring
+ * index byte index into the data area
+ *
+ * Returns
+ * offset of the index in both buffers
+ ******************************************************************************/
+static size_t ring_data(struct rdma_ring *ring, uint64_t index)
+{
+	return ring->base + RING_CTRL_SIZE + index;
+}
+/******************************************************************************
+ * Function: ring_reap
+ *
+ * Input
+ * res connection carrying the ring
+ * room send queue slots that must be free
+ * timeout_usec how long to wait
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Reap ring completions until `room` slots of the send queue are free. The
+ * ring's requests are only polled for when the queue fills up, so most
+ * records cost no CQ access at all.
+ ******************************************************************************/
+static int ring_reap(struct resources *res, int room, long timeout_usec)
+{
+	struct ibv_wc wc[POLL_BATCH];
+	int n;
+	int i;
+	while (res->sq_outstanding + room > res->qp_depth)
+	{
+		n = poll_cq_batch(res, wc, POLL_BATCH, timeout_usec);
+		if (n < 0)
+			return 1;
+		if (n == 0)
+			return POLL_TIMED_OUT;
+		for (i = 0; i < n; i++)
+		{
+			if (wc[i].wr_id < WRID_MSG_RECV)
+			{
+				log_err("unexpected completion wr_id %" PRIu64 " on a ring connection\n", wc[i].wr_id);
+				return 1;
+			}
+			if (account_internal(res, &wc[i]))
+				return 1;
+		}
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: ring_post
+ *
+ * Input
+ * res connection carrying the ring
+ * offsets offsets of the ranges, identical in both buffers
+ * lengths lengths of the ranges
+ * n number of ranges; the last one is the control word
+ * timeout_usec how long to wait for send queue room
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Write the ranges to the peer as one chain with one doorbell. Only the
+ * last request is signaled and it frees the slots of the whole chain. If the
+ * control word cannot go inline, wait for the chain to complete before the
+ * word is reused.
+ ******************************************************************************/
+static int ring_post(struct resources *res, size_t *offsets, uint32_t *lengths, int n, long timeout_usec)
+{
+	struct ibv_send_wr wrs[3];
+	struct ibv_sge sges[3];
+	struct ibv_send_wr *bad_wr = NULL;
+	int rc;
+	int i;
+	rc = ring_reap(res, n, timeout_usec);
+	if (rc)
+		return rc;
+	memset(wrs, 0, sizeof(wrs));
+	for (i = 0; i < n; i++)
+	{
+		sges[i].addr = (uintptr_t)(res->buf + offsets[i]);
+		sges[i].length = lengths[i];
+		sges[i].lkey = res->mr->lkey;
+		wrs[i].wr_id = WRID_RING;
+		wrs[i].sg_list = &sges[i];
+		wrs[i].num_sge = 1;
+		wrs[i].opcode = IBV_WR_RDMA_WRITE;
+		wrs[i].send_flags = inline_flag(res, IBV_WR_RDMA_WRITE, lengths[i]);
+		wrs[i].wr.rdma.remote_addr = res->remote_props.addr + offsets[i];
+		wrs[i].wr.rdma.rkey = res->remote_props.rkey;
+		wrs[i].next = i + 1 < n ? &wrs[i + 1] : NULL;
+	}
+	wrs[n - 1].send_flags |= IBV_SEND_SIGNALED;
+	if (ibv_post_send(res->qp, wrs, &bad_wr))
+	{
+		log_err("failed to post %d ring SRs\n", n);
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		stats_posted(res, IBV_WR_RDMA_WRITE, lengths[i]);
+	sq_track(res, n);
+	if (!(wrs[n - 1].send_flags & IBV_SEND_INLINE))
+		return ring_reap(res, res->qp_depth, MAX_POLL_CQ_TIMEOUT * 1000L) ? 1 : 0;
+	return 0;
+}
+/******************************************************************************
+ * Function: ring_init
+ *
+ * Input
+ * ring ring to initialize
+ * res connection carrying the ring
+ * base offset of the ring's window in both buffers, 8-byte aligned
+ * size size of the window; the data area is the largest power of two that
+ *      fits behind the control block
+ * producer 1 for the producer end, 0 for the consumer end
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Both ends must use the same window and create their end before the
+ * producer pushes the first record.
+ ******************************************************************************/
+int ring_init(struct rdma_ring *ring, struct resources *res, size_t base, uint64_t size, int producer)
+{
+	uint64_t capacity = 1;
+	memset(ring, 0, sizeof(*ring));
+	if (base % RING_RECORD_ALIGN || base > res->buf_size || size > res->buf_size - base ||
+		base > res->remote_props.size || size > res->remote_props.size - base)
+	{
+		log_err("ring window [%zu, +%" PRIu64 ") is misaligned or out of the buffers\n", base, size);
+		return 1;
+	}
+	if (size < RING_CTRL_SIZE + 2 * RING_HEADER_SIZE)
+	{
+		log_err("ring window of %" PRIu64 " bytes is too small\n", size);
+		return 1;
+	}
+	// 只在请求链之外留一个槽位还不够用；更浅的发送队列会让环形缓冲区卡住
+	if (res->qp_depth < 4)
+	{
+		log_err("a ring needs a queue depth of at least 4, not %d\n", res->qp_depth);
+		return 1;
+	}
+	while (capacity * 2 <= size - RING_CTRL_SIZE)
+		capacity *= 2;
+	ring->base = base;
+	ring->capacity = capacity;
+	ring->producer = producer;
+	// 每一端只清零由对端写入的那个控制字
+	if (producer)
+		__atomic_store_n(ring_word(ring, res, RING_HEAD_OFFSET), 0, __ATOMIC_RELEASE);
+	else
+		__atomic_store_n(ring_word(ring, res, RING_TAIL_OFFSET), 0, __ATOMIC_RELEASE);
+	log_info("%s ring at offset %zu with %" PRIu64 " bytes of data\n", producer ? "producer" : "consumer", base,
+			 capacity);
+	return 0;
+}
+/******************************************************************************
+ * Function: ring_push
+ *
+ * Input
+ * ring producer end
+ * res connection carrying the ring
+ * data record payload
+ * length payload size
+ * timeout_usec how long to wait for credit and send queue room, negative
+ *              to wait forever
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Append one record of at most half the data area (including its header).
+ * Waiting for credit spins on the local head word that
+ * the consumer writes back; nothing is posted until the record fits.
+ ******************************************************************************/
+int ring_push(struct rdma_ring *ring, struct resources *res, const void *data, uint32_t length, long timeout_usec)
+{
+	uint64_t need = RING_ALIGN(RING_HEADER_SIZE + (uint64_t)length);
+	uint64_t index = ring->pos & (ring->capacity - 1);
+	uint64_t skip = 0;
+	unsigned long start_time_usec = 0;
+	unsigned int spins = 0;
+	size_t offsets[3];
+	uint32_t lengths[3];
+	int n = 0;
+	// 记录最多占数据区的一半：否则在末尾跳过的空间加上记录本身可能超过整个数据区，额度永远不够
+	if (!ring->producer || need > ring->capacity / 2)
+	{
+		log_err("record of %u bytes does not fit in half of the ring\n", length);
+		return 1;
+	}
+	// 记录不能跨越数据区末尾，剩余空间不够时用 RING_WRAP 跳到开头
+	if (need > ring->capacity - index)
+		skip = ring->capacity - index;
+	while (ring->pos + skip + need - ring->credit > ring->capacity)
+	{
+		ring->credit = __atomic_load_n(ring_word(ring, res, RING_HEAD_OFFSET), __ATOMIC_ACQUIRE);
+		if (ring->pos + skip + need - ring->credit <= ring->capacity)
+			break;
+		if (timeout_usec == 0)
+			return POLL_TIMED_OUT;
+		if (timeout_usec < 0 || ++spins % POLL_CLOCK_INTERVAL)
+			continue;
+		if (!start_time_usec)
+			start_time_usec = monotonic_usec();
+		else if (monotonic_usec() - start_time_usec >= (unsigned long)timeout_usec)
+			return POLL_TIMED_OUT;
+	}
+	if (skip)
+	{
+		*(uint32_t *)(res->buf + ring_data(ring, index)) = RING_WRAP;
+		offsets[n] = ring_data(ring, index);
+		lengths[n++] = RING_HEADER_SIZE;
+		index = 0;
+	}
+	*(uint32_t *)(res->buf + ring_data(ring, index)) = length;
+	memcpy(res->buf + ring_data(ring, index) + RING_HEADER_SIZE, data, length);
+	offsets[n] = ring_data(ring, index);
+	lengths[n++] = (uint32_t)need;
+	// 尾指针最后写：它落地时，它之前的记录都已经落地
+	*ring_word(ring, res, RING_TAIL_OFFSET) = ring->pos + skip + need;
+	offsets[n] = ring->base + RING_TAIL_OFFSET;
+	lengths[n++] = sizeof(uint64_t);
+	if (ring_post(res, offsets, lengths, n, timeout_usec < 0 ? -1 : MAX_POLL_CQ_TIMEOUT * 1000L))
+		return 1;
+	ring->pos += skip + need;
+	return 0;
+}
+/******************************************************************************
+ * Function: ring_pop
+ *
+ * Input
+ * ring consumer end
+ * res connection carrying the ring
+ * timeout_usec how long to wait for a record, 0 for a single check,
+ *              negative to wait forever
+ *
+ * Output
+ * offset offset of the record's payload in the local buffer
+ * length payload size
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Return the oldest record without consuming it; ring_consume releases it.
+ * Only local memory is read.
+ ******************************************************************************/
+int ring_pop(struct rdma_ring *ring, struct resources *res, uint64_t *offset, uint32_t *length, long timeout_usec)
+{
+	unsigned long start_time_usec = 0;
+	unsigned int spins = 0;
+	uint64_t tail;
+	uint64_t index;
+	uint32_t len;
+	if (ring->producer)
+		return 1;
+	for (;;)
+	{
+		tail = __atomic_load_n(ring_word(ring, res, RING_TAIL_OFFSET), __ATOMIC_ACQUIRE);
+		if (tail != ring->pos)
+		{
+			index = ring->pos & (ring->capacity - 1);
+			len = *(volatile uint32_t *)(res->buf + ring_data(ring, index));
+			if (len != RING_WRAP)
+				break;
+			ring->pos += ring->capacity - index;
+			continue;
+		}
+		if (timeout_usec == 0)
+			return POLL_TIMED_OUT;
+		if (timeout_usec < 0 || ++spins % POLL_CLOCK_INTERVAL)
+			continue;
+		if (!start_time_usec)
+			start_time_usec = monotonic_usec();
+		else if (monotonic_usec() - start_time_usec >= (unsigned long)timeout_usec)
+			return POLL_TIMED_OUT;
+	}
+	if (RING_ALIGN(RING_HEADER_SIZE + (uint64_t)len) > ring->capacity - index)
+	{
+		log_err("corrupt ring record of %u bytes at index %" PRIu64 "\n", len, index);
+		return 1;
+	}
+	*offset = ring_data(ring, index) + RING_HEADER_SIZE;
+	*length = len;
+	ring->pending = (uint32_t)RING_ALIGN(RING_HEADER_SIZE + (uint64_t)len);
+	return 0;
+}
+/******************************************************************************
+ * Function: ring_consume
+ *
+ * Input
+ * ring consumer end, after a successful ring_pop
+ * res connection carrying the ring
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Release the popped record. Credit goes back to the producer once a quarter
+ * of the ring has been consumed, or as soon as the ring runs empty.
+ ******************************************************************************/
+int ring_consume(struct rdma_ring *ring, struct resources *res)
+{
+	uint64_t tail;
+	ring->pos += ring->pending;
+	ring->pending = 0;
+	tail = __atomic_load_n(ring_word(ring, res, RING_TAIL_OFFSET), __ATOMIC_ACQUIRE);
+	if (ring->pos - ring->published >= ring->capacity / 4 || ring->pos == tail)
+		return ring_publish(ring, res);
+	return 0;
+}
+/******************************************************************************
+ * Function: ring_publish
+ *
+ * Input
+ * ring consumer end
+ * res connection carrying the ring
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Write the head back to the producer now.
+ ******************************************************************************/
+int ring_publish(struct rdma_ring *ring, struct resources *res)
+{
+	size_t offset = ring->base + RING_HEAD_OFFSET;
+	uint32_t length = sizeof(uint64_t);
+	if (ring->producer || ring->pos == ring->published)
+		return 0;
+	*ring_word(ring, res, RING_HEAD_OFFSET) = ring->pos;
+	if (ring_post(res, &offset, &length, 1, MAX_POLL_CQ_TIMEOUT * 1000L))
+		return 1;
+	ring->published = ring->pos;
+	return 0;
+}
+/******************************************************************************
+ * Function: ring_drain
+ *
+ * Input
+ * res connection carrying the ring
+ * timeout_usec how long to wait
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Wait until every request the ring posted has completed, e.g. before the
+ * connection is used for other operations again.
+ ******************************************************************************/
+int ring_drain(struct resources *res, long timeout_usec)
+{
+	return ring_reap(res, res->qp_depth, timeout_usec);
+}
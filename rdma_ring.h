@@ -0,0 +1,40 @@
+#ifndef RDMA_RING_H
+#define RDMA_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 窗口开头的控制区：偏移 0 处为生产者写入的尾指针，偏移 8 处为消费者写回的头指针 */
+#define RING_CTRL_SIZE 64
+#define RING_TAIL_OFFSET 0
+#define RING_HEAD_OFFSET 8
+/* 记录头和记录都按 8 字节对齐 */
+#define RING_RECORD_ALIGN 8
+#define RING_HEADER_SIZE 8
+/* 记录头中的长度为该值时表示跳到数据区开头 */
+#define RING_WRAP 0xffffffffu
+
+struct resources;
+
+/* one end of a single-producer/single-consumer ring over RDMA WRITE; every call
+   takes the connection carrying it, so that the struct holds no pointers and can
+   live in Go memory */
+struct rdma_ring
+{
+    size_t base;            /* 窗口在双方缓冲区中的偏移（两端相同） */
+    uint64_t capacity;      /* 数据区字节数，2 的幂 */
+    int producer;           /* 1 为生产者，0 为消费者 */
+    uint64_t pos;           /* 生产者：已写入的字节位置（尾）；消费者：已读取的字节位置（头） */
+    uint64_t credit;        /* 生产者：最近看到的消费者头指针 */
+    uint64_t published;     /* 消费者：最近写回给生产者的头指针 */
+    uint32_t pending;       /* 消费者：ring_pop 返回但尚未 ring_consume 的记录占用的字节数 */
+};
+
+int ring_init(struct rdma_ring *ring, struct resources *res, size_t base, uint64_t size, int producer);
+int ring_push(struct rdma_ring *ring, struct resources *res, const void *data, uint32_t length, long timeout_usec);
+int ring_pop(struct rdma_ring *ring, struct resources *res, uint64_t *offset, uint32_t *length, long timeout_usec);
+int ring_consume(struct rdma_ring *ring, struct resources *res);
+int ring_publish(struct rdma_ring *ring, struct resources *res);
+int ring_drain(struct resources *res, long timeout_usec);
+
+#endif
@@ -0,0 +1,200 @@
+#include <rdma_operations.h>
+/******************************************************************************
+Data path instrumentation
+Every connection counts the requests it posts and the completions it polls,
+per operation, and keeps an HDR-style histogram of the time from posting a
+signaled request to polling its completion. Latency is sampled every
+res->lat_sample signaled requests so that reading the clock stays off the
+path of most operations.
+******************************************************************************/
+/******************************************************************************
+ * Function: monotonic_nsec
+ *
+ * Returns
+ * CLOCK_MONOTONIC in nanoseconds
+ ******************************************************************************/
+unsigned long monotonic_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+/******************************************************************************
+ * Function: stats_op
+ *
+ * Input
+ * wr_opcode enum ibv_wr_opcode of a send work request
+ *
+ * Returns
+ * the STATS_OP_* counter of the opcode
+ ******************************************************************************/
+int stats_op(int wr_opcode)
+{
+	switch (wr_opcode)
+	{
+	case IBV_WR_RDMA_READ:
+		return STATS_OP_READ;
+	case IBV_WR_SEND:
+	case IBV_WR_SEND_WITH_IMM:
+		return STATS_OP_SEND;
+	case IBV_WR_ATOMIC_CMP_AND_SWP:
+	case IBV_WR_ATOMIC_FETCH_AND_ADD:
+		return STATS_OP_ATOMIC;
+	default:
+		return STATS_OP_WRITE;
+	}
+}
+/******************************************************************************
+ * Function: stats_wc_op
+ *
+ * Input
+ * wc_opcode enum ibv_wc_opcode of a successful completion
+ *
+ * Returns
+ * the STATS_OP_* counter of the completion
+ ******************************************************************************/
+static int stats_wc_op(int wc_opcode)
+{
+	switch (wc_opcode)
+	{
+	case IBV_WC_RDMA_READ:
+		return STATS_OP_READ;
+	case IBV_WC_SEND:
+		return STATS_OP_SEND;
+	case IBV_WC_COMP_SWAP:
+	case IBV_WC_FETCH_ADD:
+		return STATS_OP_ATOMIC;
+	case IBV_WC_RECV:
+	case IBV_WC_RECV_RDMA_WITH_IMM:
+		return STATS_OP_RECV;
+	default:
+		return STATS_OP_WRITE;
+	}
+}
+/******************************************************************************
+ * Function: stats_posted
+ *
+ * Input
+ * res pointer to resources structure
+ * wr_opcode opcode of the posted work request
+ * bytes payload of the work request
+ ******************************************************************************/
+void stats_posted(struct resources *res, int wr_opcode, uint64_t bytes)
+{
+	int op = stats_op(wr_opcode);
+	stats_add(res->stats.posted[op], 1);
+	stats_add(res->stats.bytes[op], bytes);
+}
+/******************************************************************************
+ * Function: stats_completed
+ *
+ * Input
+ * res pointer to resources structure
+ * wc completions returned by one ibv_poll_cq call
+ * n number of completions; nothing is counted for an empty poll
+ *
+ * Description
+ * Count a successful poll and its completions. The opcode of a failed
+ * completion is undefined, so failures are only counted by status.
+ ******************************************************************************/
+void stats_completed(struct resources *res, const struct ibv_wc *wc, int n)
+{
+	int op;
+	int i;
+	if (n <= 0)
+		return;
+	stats_add(res->stats.cq_polls, 1);
+	for (i = 0; i < n; i++)
+	{
+		if (wc[i].status != IBV_WC_SUCCESS)
+		{
+			op = wc[i].status < STATS_NUM_STATUS ? wc[i].status : STATS_NUM_STATUS - 1;
+			stats_add(res->stats.errors[op], 1);
+			continue;
+		}
+		op = stats_wc_op(wc[i].opcode);
+		stats_add(res->stats.completed[op], 1);
+		if (op == STATS_OP_RECV)
+			stats_add(res->stats.bytes[op], wc[i].byte_len);
+	}
+}
+/******************************************************************************
+ * Function: stats_sample
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Returns
+ * the current time in nanoseconds if the signaled request that was just
+ * posted is sampled, 0 otherwise
+ ******************************************************************************/
+uint64_t stats_sample(struct resources *res)
+{
+	if (res->lat_sample <= 0 || ++res->lat_tick < (unsigned int)res->lat_sample)
+		return 0;
+	res->lat_tick = 0;
+	return monotonic_nsec();
+}
+/******************************************************************************
+ * Function: stats_bucket
+ *
+ * Input
+ * ns latency in nanoseconds
+ *
+ * Returns
+ * histogram bucket of the latency: exact below STATS_SUB_BUCKETS, then
+ * STATS_SUB_BUCKETS buckets per power of two
+ ******************************************************************************/
+int stats_bucket(uint64_t ns)
+{
+	int shift;
+	int idx;
+	if (ns < STATS_SUB_BUCKETS)
+		return (int)ns;
+	shift = 63 - __builtin_clzll(ns);
+	idx = (shift - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+		  (int)((ns >> (shift - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+	return idx < STATS_HIST_BUCKETS ? idx : STATS_HIST_BUCKETS - 1;
+}
+/******************************************************************************
+ * Function: stats_latency
+ *
+ * Input
+ * res pointer to resources structure
+ * posted_ns time the request was posted, as returned by stats_sample
+ *
+ * Description
+ * Record the latency of a sampled request whose completion was just polled.
+ * Unsampled requests pass 0 and are ignored.
+ ******************************************************************************/
+void stats_latency(struct resources *res, uint64_t posted_ns)
+{
+	uint64_t ns;
+	if (!posted_ns)
+		return;
+	ns = monotonic_nsec() - posted_ns;
+	stats_add(res->stats.lat_hist[stats_bucket(ns)], 1);
+	stats_add(res->stats.lat_sum_ns, ns);
+}
+/******************************************************************************
+ * Function: stats_snapshot
+ *
+ * Input
+ * res pointer to resources structure
+ *
+ * Output
+ * out copy of the connection's counters
+ *
+ * Description
+ * Safe to call from any thread while the connection is in use. Each counter
+ * is read atomically; the snapshot as a whole is not, so counters that are
+ * updated together can be one operation apart.
+ ******************************************************************************/
+void stats_snapshot(const struct resources *res, struct conn_stats *out)
+{
+	const uint64_t *src = (const uint64_t *)&res->stats;
+	uint64_t *dst = (uint64_t *)out;
+	size_t i;
+	for (i = 0; i < sizeof(*out) / sizeof(uint64_t); i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
@@ -0,0 +1,58 @@
+#ifndef RDMA_STATS_H
+#define RDMA_STATS_H
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+/* 按操作类型分别计数 */
+#define STATS_OP_WRITE 0
+#define STATS_OP_READ 1
+#define STATS_OP_SEND 2
+#define STATS_OP_ATOMIC 3
+#define STATS_OP_RECV 4
+#define STATS_NUM_OPS 5
+/* 按 ibv_wc_status 统计失败的完成事件，更大的状态码计入最后一项 */
+#define STATS_NUM_STATUS 32
+/*
+ * 对数-线性直方图：每个 2 的幂区间分成 2^STATS_SUB_BITS 个桶，相对误差不超过
+ * 1/2^STATS_SUB_BITS；超过 2^STATS_MAX_SHIFT 纳秒的延迟计入最后一个桶
+ */
+#define STATS_SUB_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_SHIFT 36
+#define STATS_HIST_BUCKETS ((STATS_MAX_SHIFT - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS + STATS_SUB_BUCKETS)
+/* 默认每隔多少个带完成事件的请求采样一次延迟 */
+#define DEFAULT_LAT_SAMPLE 16
+
+/*
+ * Per-connection counters of the data path. Only the thread driving the
+ * connection writes them, so an increment is a plain relaxed store instead of
+ * a locked read-modify-write; stats_snapshot reads them from any thread.
+ */
+struct conn_stats
+{
+    uint64_t posted[STATS_NUM_OPS];       /* 投递的请求数 */
+    uint64_t completed[STATS_NUM_OPS];    /* 成功的完成事件数 */
+    uint64_t bytes[STATS_NUM_OPS];        /* 投递的字节数；接收按到达的字节数计 */
+    uint64_t cq_polls;                    /* 取到完成事件的 ibv_poll_cq 调用次数 */
+    uint64_t cq_empty_polls;              /* 没有取到完成事件的 ibv_poll_cq 调用次数 */
+    uint64_t timeouts;                    /* 超时返回的等待次数 */
+    uint64_t errors[STATS_NUM_STATUS];    /* 按状态码统计的失败完成事件数 */
+    uint64_t lat_hist[STATS_HIST_BUCKETS]; /* 采样到的投递到完成延迟（纳秒）的直方图 */
+    uint64_t lat_sum_ns;                  /* 采样延迟之和 */
+};
+
+#define stats_add(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+struct resources;
+
+unsigned long monotonic_nsec(void);
+int stats_op(int wr_opcode);
+int stats_bucket(uint64_t ns);
+void stats_posted(struct resources *res, int wr_opcode, uint64_t bytes);
+void stats_completed(struct resources *res, const struct ibv_wc *wc, int n);
+uint64_t stats_sample(struct resources *res);
+void stats_latency(struct resources *res, uint64_t posted_ns);
+void stats_snapshot(const struct resources *res, struct conn_stats *out);
+
+#endif
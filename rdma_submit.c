@@ -0,0 +1,160 @@
+#include <rdma_operations.h>
+/******************************************************************************
+Batched submission across the Go/C boundary
+Every cgo call costs tens of nanoseconds, which dominates small operations
+when each one crosses the boundary several times. A submit queue keeps its
+request and completion arrays in C memory: Go appends requests and reads
+completions with plain loads and stores, and one call of submit_queue_run
+posts everything queued and reaps the completions that are ready, so a whole
+batch costs a single crossing.
+******************************************************************************/
+/******************************************************************************
+ * Function: submit_queue_create
+ *
+ * Input
+ * sq_size number of requests that can be queued between two runs
+ * cq_size number of completions one run can return
+ * signal_every request a completion for every Nth request of a doorbell batch
+ *
+ * Returns
+ * the queue, NULL on failure
+ ******************************************************************************/
+struct submit_queue *submit_queue_create(int sq_size, int cq_size, int signal_every)
+{
+	struct submit_queue *q;
+	if (sq_size <= 0 || cq_size <= 0)
+	{
+		log_err("invalid submit queue of %d requests and %d completions\n", sq_size, cq_size);
+		return NULL;
+	}
+	q = calloc(1, sizeof(*q));
+	if (!q)
+	{
+		log_err("failed to allocate submit queue\n");
+		return NULL;
+	}
+	q->sqe = calloc(sq_size, sizeof(*q->sqe));
+	q->cqe = calloc(cq_size, sizeof(*q->cqe));
+	if (!q->sqe || !q->cqe)
+	{
+		log_err("failed to allocate submit queue of %d requests and %d completions\n", sq_size, cq_size);
+		submit_queue_destroy(q);
+		return NULL;
+	}
+	q->sq_size = sq_size;
+	q->cq_size = cq_size;
+	q->cq_limit = cq_size;
+	q->signal_every = signal_every > 0 ? signal_every : 1;
+	return q;
+}
+/******************************************************************************
+ * Function: submit_queue_destroy
+ *
+ * Input
+ * q queue returned by submit_queue_create, may be NULL
+ ******************************************************************************/
+void submit_queue_destroy(struct submit_queue *q)
+{
+	if (!q)
+		return;
+	free(q->sqe);
+	free(q->cqe);
+	free(q);
+}
+/******************************************************************************
+ * Function: submit_queue_run
+ *
+ * Input
+ * res pointer to resources structure
+ * q queue holding q->sq_count requests
+ * min_complete number of completions to wait for
+ * timeout_usec how long to wait for them, negative to wait forever
+ *
+ * Output
+ * q->cqe and q->cq_count hold the reaped completions; the requests that were
+ * posted are removed from q->sqe, also when the run fails
+ *
+ * Returns
+ * number of requests posted, -1 on failure
+ *
+ * Description
+ * Post the queued requests in doorbell batches as large as the free part of
+ * the send queue. When the send queue is full, completions are reaped into
+ * q->cqe to make room, so one run can post more requests than the queue
+ * depth. Posting stops early only when the completion array is full; the
+ * remaining requests stay queued for the next run. Afterwards wait until
+ * `min_complete` completions have been collected or the timeout expires, then
+ * pick up whatever else is already in the CQ.
+ ******************************************************************************/
+int submit_queue_run(struct resources *res, struct submit_queue *q, int min_complete, long timeout_usec)
+{
+	int limit = q->cq_limit < q->cq_size ? q->cq_limit : q->cq_size;
+	unsigned long start_time_usec;
+	unsigned long elapsed_usec;
+	long wait_usec;
+	int posted = 0;
+	int rc = 0;
+	int room;
+	int n;
+	if (limit < 0)
+		limit = 0;
+	q->cq_count = 0;
+	while (posted < q->sq_count)
+	{
+		room = res->qp_depth - res->sq_outstanding;
+		if (room <= 0)
+		{
+			if (q->cq_count == limit)
+				break;
+			n = reap_completions(res, q->cqe + q->cq_count, limit - q->cq_count, MAX_POLL_CQ_TIMEOUT * 1000L);
+			if (n <= 0)
+			{
+				if (!n)
+					log_err("send queue stayed full after timeout\n");
+				rc = -1;
+				break;
+			}
+			q->cq_count += n;
+			continue;
+		}
+		if (room > q->sq_count - posted)
+			room = q->sq_count - posted;
+		// 部分投递时被接受的前缀同样要从队列中移除，否则下一次会重复投递
+		rc = post_send_batch(res, q->sqe + posted, room, q->signal_every, &n);
+		posted += n;
+		if (rc)
+		{
+			rc = -1;
+			break;
+		}
+	}
+	// 已投出的请求从队列中移除，剩下的移到开头等待下一次投递
+	if (posted)
+	{
+		memmove(q->sqe, q->sqe + posted, (q->sq_count - posted) * sizeof(*q->sqe));
+		q->sq_count -= posted;
+	}
+	if (rc)
+		return -1;
+	start_time_usec = monotonic_usec();
+	while (q->cq_count < limit)
+	{
+		// 只在还没收够 min_complete 个完成事件时等待，其余情况只取出 CQ 中已有的
+		wait_usec = 0;
+		if (q->cq_count < min_complete && res->sq_outstanding > 0)
+		{
+			elapsed_usec = monotonic_usec() - start_time_usec;
+			if (timeout_usec < 0)
+				wait_usec = -1;
+			else if (elapsed_usec < (unsigned long)timeout_usec)
+				wait_usec = timeout_usec - (long)elapsed_usec;
+		}
+		n = reap_completions(res, q->cqe + q->cq_count, limit - q->cq_count, wait_usec);
+		if (n < 0)
+			return -1;
+		if (!n)
+			break;
+		q->cq_count += n;
+	}
+	return posted;
+}
@@ -0,0 +1,25 @@
+#ifndef RDMA_SUBMIT_H
+#define RDMA_SUBMIT_H
+
+struct resources;
+struct batch_op_t;
+struct completion_t;
+
+/* submission and completion arrays in C memory that Go fills and reads in place */
+struct submit_queue
+{
+    struct batch_op_t *sqe;   /* 待投递的请求，Go 直接写入 */
+    int sq_size;              /* sqe 的容量 */
+    int sq_count;             /* 待投递的请求数；submit_queue_run 返回后只剩未投出的请求 */
+    struct completion_t *cqe; /* submit_queue_run 收割到的完成事件 */
+    int cq_size;              /* cqe 的容量 */
+    int cq_limit;             /* 本次最多收割的完成事件数，不超过 cq_size */
+    int cq_count;             /* 本次收割到的完成事件数 */
+    int signal_every;         /* 每这么多个请求申请一次完成事件 */
+};
+
+struct submit_queue *submit_queue_create(int sq_size, int cq_size, int signal_every);
+void submit_queue_destroy(struct submit_queue *q);
+int submit_queue_run(struct resources *res, struct submit_queue *q, int min_complete, long timeout_usec);
+
+#endif
@@ -0,0 +1,854 @@
+#include <rdma_operations.h>
+/******************************************************************************
+Size-aware message channel
+A channel carries messages of any size over a connection with messaging
+enabled and picks the transport by size:
+
+  tiny        header and payload fit in the inline size: one inline SEND
+              straight from the caller's memory, nothing is staged;
+  small       they fit in the peer's receive slot: one SEND from a record
+              staged in the send window;
+  medium      below the rendezvous threshold: the payload is RDMA WRITTEN
+              from the send window into the same offset of the peer's receive
+              window, followed by a SEND of the header with one doorbell;
+  large       rendezvous: the caller's memory is registered on the spot
+              (on demand where the device allows), a SEND advertises address
+              and rkey, and the receiver RDMA READs the payload straight into
+              its destination. The sender waits until the receiver reports
+              the transfer done.
+
+Every message announces itself with a SEND, so messages are received in the
+order they were sent whatever their path. The windows work like the ring's:
+the sender stages records in its own copy of the send window, the receiver
+writes its consumed position back into it, and a record is not reused
+before the receiver has consumed it. A channel uses two windows, one per
+direction; the peer swaps them.
+
+The channel is full duplex, also for large messages: a sender waiting for
+its rendezvous to be fetched reads the rendezvous payloads the peer has
+queued meanwhile into temporary buffers, so two ends sending large
+messages at the same time do not wait for each other. xfer_recv hands such
+a message out as XFER_FETCHED.
+
+Requests are only signaled every signal_every posts. While messages follow
+each other within XFER_BURST_NS the interval doubles up to a quarter of the
+send queue, the first message after a pause is signaled again, so bursts
+poll few completions while an isolated message frees its slot at once. In
+event mode the CQ's moderation follows the completion rate as well.
+******************************************************************************/
+#define XFER_ROUND(x) (((x) + XFER_ALIGN - 1) & ~(uint64_t)(XFER_ALIGN - 1))
+#define XFER_HDR_SIZE ((uint32_t)sizeof(struct xfer_hdr))
+/******************************************************************************
+ * Function: xfer_word
+ *
+ * Input
+ * res connection carrying the channel
+ * base offset of a window
+ * offset XFER_HEAD_OFFSET or XFER_FIN_OFFSET
+ *
+ * Returns
+ * the control word in the local buffer
+ ******************************************************************************/
+static uint64_t *xfer_word(struct resources *res, size_t base, size_t offset)
+{
+	return (uint64_t *)(res->buf + base + offset);
+}
+/******************************************************************************
+ * Function: xfer_reap
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * room send queue slots that must be free
+ * timeout_usec how long to wait
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Reap completions until `room` slots of the send queue are free, counting
+ * the unsignaled requests that no signaled one covers yet as taken.
+ * Messages arriving meanwhile are queued.
+ ******************************************************************************/
+static int xfer_reap(struct rdma_xfer *x, struct resources *res, int room, long timeout_usec)
+{
+	struct ibv_wc wc[POLL_BATCH];
+	int n;
+	int i;
+	while (res->sq_outstanding + x->unsignaled + room > res->qp_depth)
+	{
+		n = poll_cq_batch(res, wc, POLL_BATCH, timeout_usec);
+		if (n < 0)
+			return 1;
+		if (n == 0)
+			return POLL_TIMED_OUT;
+		for (i = 0; i < n; i++)
+		{
+			if (wc[i].wr_id < WRID_MSG_RECV)
+			{
+				log_err("unexpected completion wr_id %" PRIu64 " on a channel connection\n", wc[i].wr_id);
+				return 1;
+			}
+			if (account_internal(res, &wc[i]))
+				return 1;
+		}
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: xfer_post
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * wrs requests to post as one chain; wr_id, next and IBV_SEND_SIGNALED are
+ *     filled in here
+ * n number of requests
+ * force signal the chain regardless of the interval, e.g. because its
+ *       source is reused as soon as it completes
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Post a chain with one doorbell and signal its last request when the
+ * unsignaled requests reach the channel's interval. Never more than half
+ * the send queue goes unsignaled, so reaping can always free room.
+ ******************************************************************************/
+static int xfer_post(struct rdma_xfer *x, struct resources *res, struct ibv_send_wr *wrs, int n, int force)
+{
+	struct ibv_send_wr *bad_wr = NULL;
+	int pending = x->unsignaled + n;
+	uint32_t bytes;
+	int signal;
+	int i;
+	int j;
+	if (xfer_reap(x, res, n, MAX_POLL_CQ_TIMEOUT * 1000L))
+	{
+		log_err("send queue did not drain for the channel\n");
+		return 1;
+	}
+	signal = force || pending >= x->signal_every || pending >= res->qp_depth / 2;
+	for (i = 0; i < n; i++)
+	{
+		wrs[i].wr_id = WRID_XFER;
+		wrs[i].next = i + 1 < n ? &wrs[i + 1] : NULL;
+	}
+	if (signal)
+		wrs[n - 1].send_flags |= IBV_SEND_SIGNALED;
+	if (ibv_post_send(res->qp, wrs, &bad_wr))
+	{
+		log_err("failed to post %d channel SRs\n", n);
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		bytes = 0;
+		for (j = 0; j < wrs[i].num_sge; j++)
+			bytes += wrs[i].sg_list[j].length;
+		stats_posted(res, wrs[i].opcode, bytes);
+	}
+	if (signal)
+	{
+		sq_track(res, pending);
+		x->unsignaled = 0;
+	}
+	else
+		x->unsignaled = pending;
+	return 0;
+}
+/******************************************************************************
+ * Function: xfer_write_word
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * offset XFER_HEAD_OFFSET or XFER_FIN_OFFSET
+ * value new value of the word in the sender's send window
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Write a control word back to the sender. The word is staged in the local
+ * copy of the receive window; if it cannot go inline, the write is waited
+ * for before the word can change again.
+ ******************************************************************************/
+static int xfer_write_word(struct rdma_xfer *x, struct resources *res, size_t offset, uint64_t value)
+{
+	struct ibv_send_wr wr;
+	struct ibv_sge sge;
+	uint64_t *word = xfer_word(res, x->rx_base, offset);
+	int flags = inline_flag(res, IBV_WR_RDMA_WRITE, sizeof(uint64_t));
+	*word = value;
+	memset(&wr, 0, sizeof(wr));
+	sge.addr = (uintptr_t)word;
+	sge.length = sizeof(uint64_t);
+	sge.lkey = res->mr->lkey;
+	wr.sg_list = &sge;
+	wr.num_sge = 1;
+	wr.opcode = IBV_WR_RDMA_WRITE;
+	wr.send_flags = flags;
+	wr.wr.rdma.remote_addr = res->remote_props.addr + x->rx_base + offset;
+	wr.wr.rdma.rkey = res->remote_props.rkey;
+	if (xfer_post(x, res, &wr, 1, !flags))
+		return 1;
+	if (!flags)
+		return xfer_reap(x, res, res->qp_depth, MAX_POLL_CQ_TIMEOUT * 1000L) ? 1 : 0;
+	return 0;
+}
+/******************************************************************************
+ * Function: xfer_flush
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Cover the unsignaled requests with a signaled zero-length RDMA WRITE, so
+ * that their send queue slots come back.
+ ******************************************************************************/
+static int xfer_flush(struct rdma_xfer *x, struct resources *res)
+{
+	struct ibv_send_wr wr;
+	if (!x->unsignaled)
+		return 0;
+	memset(&wr, 0, sizeof(wr));
+	wr.opcode = IBV_WR_RDMA_WRITE;
+	wr.wr.rdma.remote_addr = res->remote_props.addr + x->rx_base;
+	wr.wr.rdma.rkey = res->remote_props.rkey;
+	return xfer_post(x, res, &wr, 1, 1);
+}
+/******************************************************************************
+ * Function: xfer_adapt
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * now current time in nanoseconds
+ *
+ * Description
+ * Once every XFER_ADAPT_NS, turn CQ moderation on when the connection
+ * completed at least XFER_MODERATE_RATE requests per millisecond since the
+ * last check and off again below. Only event-mode connections are
+ * moderated; a device that cannot moderate is left alone afterwards.
+ ******************************************************************************/
+static void xfer_adapt(struct rdma_xfer *x, struct resources *res, uint64_t now)
+{
+	uint64_t done = 0;
+	uint64_t rate;
+	int busy;
+	int i;
+	if (!x->adaptive_cq || !res->channel || now - x->adapt_ns < XFER_ADAPT_NS)
+		return;
+	for (i = 0; i < STATS_NUM_OPS; i++)
+		done += res->stats.completed[i];
+	rate = (done - x->adapt_done) * 1000000ULL / (now - x->adapt_ns);
+	x->adapt_ns = now;
+	x->adapt_done = done;
+	busy = rate >= XFER_MODERATE_RATE;
+	if (busy == (x->cq_count != 0))
+		return;
+	if (cq_moderate(res, busy ? XFER_CQ_COUNT : 0, busy ? XFER_CQ_PERIOD : 0))
+	{
+		x->adaptive_cq = 0;
+		return;
+	}
+	x->cq_count = busy ? XFER_CQ_COUNT : 0;
+	x->cq_period = busy ? XFER_CQ_PERIOD : 0;
+	log_debug("%" PRIu64 " completions/ms, CQ moderation %s\n", rate, busy ? "on" : "off");
+}
+/******************************************************************************
+ * Function: xfer_init
+ *
+ * Input
+ * x channel to initialize
+ * res connection with messaging enabled on both sides
+ * tx_base offset of the send window in both buffers, XFER_ALIGN aligned
+ * rx_base offset of the receive window in both buffers, XFER_ALIGN aligned
+ * size size of each window; the data area is the largest power of two that
+ *      fits behind the control block
+ * rendezvous messages of at least this many bytes take the rendezvous
+ *            path, 0 for XFER_DEFAULT_RENDEZVOUS; at most half the data area
+ *            less a header, rounded down to XFER_ALIGN
+ * adaptive_cq adjust the CQ's moderation to the completion rate
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * The peer passes the same windows swapped and must have created its end
+ * before the first message is sent.
+ ******************************************************************************/
+int xfer_init(struct rdma_xfer *x, struct resources *res, size_t tx_base, size_t rx_base, uint64_t size,
+			  uint64_t rendezvous, int adaptive_cq)
+{
+	uint64_t capacity = 1;
+	int i;
+	memset(x, 0, sizeof(*x));
+	if (!res->msg_ring || !res->remote_props.msg_size)
+	{
+		log_err("a channel needs messaging enabled on both sides\n");
+		return 1;
+	}
+	if (res->remote_props.msg_size < XFER_HDR_SIZE)
+	{
+		log_err("the peer's message slots of %u bytes cannot hold a channel header\n", res->remote_props.msg_size);
+		return 1;
+	}
+	if (tx_base % XFER_ALIGN || rx_base % XFER_ALIGN || size <= XFER_CTRL_SIZE + XFER_ALIGN ||
+		(tx_base < rx_base + size && rx_base < tx_base + size))
+	{
+		log_err("channel windows at %zu and %zu of %" PRIu64 " bytes are misaligned or overlap\n", tx_base, rx_base,
+				size);
+		return 1;
+	}
+	if (tx_base > res->buf_size || size > res->buf_size - tx_base || rx_base > res->buf_size ||
+		size > res->buf_size - rx_base || tx_base > res->remote_props.size ||
+		size > res->remote_props.size - tx_base || rx_base > res->remote_props.size ||
+		size > res->remote_props.size - rx_base)
+	{
+		log_err("channel windows at %zu and %zu of %" PRIu64 " bytes are out of the buffers\n", tx_base, rx_base,
+				size);
+		return 1;
+	}
+	if (res->qp_depth < 4)
+	{
+		log_err("a channel needs a queue depth of at least 4, not %d\n", res->qp_depth);
+		return 1;
+	}
+	while (capacity * 2 <= size - XFER_CTRL_SIZE)
+		capacity *= 2;
+	if (!rendezvous)
+		rendezvous = XFER_DEFAULT_RENDEZVOUS;
+	// 中等消息整条（连同消息头）不超过窗口的一半，这样在末尾跳过的空间加上记录本身不会超过整个窗口
+	if (rendezvous > ((capacity / 2 - XFER_HDR_SIZE) & ~(uint64_t)(XFER_ALIGN - 1)))
+		rendezvous = (capacity / 2 - XFER_HDR_SIZE) & ~(uint64_t)(XFER_ALIGN - 1);
+	if (!rendezvous)
+	{
+		log_err("channel windows of %" PRIu64 " bytes are too small\n", size);
+		return 1;
+	}
+	x->tx_base = tx_base;
+	x->rx_base = rx_base;
+	x->capacity = capacity;
+	x->rendezvous = rendezvous;
+	x->signal_every = 1;
+	x->adaptive_cq = adaptive_cq;
+	x->pending_slot = XFER_NO_SLOT;
+	x->adapt_ns = monotonic_nsec();
+	for (i = 0; i < STATS_NUM_OPS; i++)
+		x->adapt_done += res->stats.completed[i];
+	// 只清零由对端写入的控制字
+	__atomic_store_n(xfer_word(res, tx_base, XFER_HEAD_OFFSET), 0, __ATOMIC_RELEASE);
+	__atomic_store_n(xfer_word(res, tx_base, XFER_FIN_OFFSET), 0, __ATOMIC_RELEASE);
+	log_info("channel with windows at %zu/%zu of %" PRIu64 " bytes, rendezvous from %" PRIu64 " bytes\n", tx_base,
+			 rx_base, capacity, rendezvous);
+	return 0;
+}
+/******************************************************************************
+ * Function: xfer_reserve
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * need bytes of the record, a multiple of XFER_ALIGN
+ * timeout_usec how long to wait for credit, negative to wait forever
+ *
+ * Output
+ * offset offset of the record in both buffers
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Find room for a record in the send window. A record never wraps; the
+ * rest of the window is skipped instead. Waiting for credit spins on the
+ * local head word that the receiver writes back.
+ ******************************************************************************/
+static int xfer_reserve(struct rdma_xfer *x, struct resources *res, uint64_t need, long timeout_usec,
+						size_t *offset)
+{
+	uint64_t index = x->tx_pos & (x->capacity - 1);
+	uint64_t skip = need > x->capacity - index ? x->capacity - index : 0;
+	unsigned long start_time_usec = 0;
+	unsigned int spins = 0;
+	while (x->tx_pos + skip + need - x->tx_credit > x->capacity)
+	{
+		x->tx_credit = __atomic_load_n(xfer_word(res, x->tx_base, XFER_HEAD_OFFSET), __ATOMIC_ACQUIRE);
+		if (x->tx_pos + skip + need - x->tx_credit <= x->capacity)
+			break;
+		if (timeout_usec == 0)
+			return POLL_TIMED_OUT;
+		if (timeout_usec < 0 || ++spins % POLL_CLOCK_INTERVAL)
+			continue;
+		if (!start_time_usec)
+			start_time_usec = monotonic_usec();
+		else if (monotonic_usec() - start_time_usec >= (unsigned long)timeout_usec)
+			return POLL_TIMED_OUT;
+	}
+	x->tx_pos += skip;
+	*offset = x->tx_base + XFER_CTRL_SIZE + (skip ? 0 : index);
+	x->tx_pos += need;
+	return 0;
+}
+/******************************************************************************
+ * Function: xfer_read
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * rts header of a rendezvous message
+ * dst destination of rts->length bytes, in any memory
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Register the destination, RDMA READ the payload from the sender's memory
+ * and tell the sender it may release it.
+ ******************************************************************************/
+static int xfer_read(struct rdma_xfer *x, struct resources *res, const struct xfer_hdr *rts, void *dst)
+{
+	struct file_desc remote;
+	struct ibv_mr *mr;
+	int odp;
+	int rc;
+	// 读请求直接按 sq_outstanding 计算窗口，先让未发出完成事件的请求回收槽位
+	if (xfer_flush(x, res))
+		return 1;
+	mr = reg_mr_odp(res->dev, dst, rts->length, IBV_ACCESS_LOCAL_WRITE, IBV_ODP_SUPPORT_READ, &odp);
+	if (!mr)
+	{
+		log_err("failed to register %" PRIu64 " bytes for a rendezvous\n", rts->length);
+		return 1;
+	}
+	memset(&remote, 0, sizeof(remote));
+	remote.addr = rts->addr;
+	remote.size = rts->length;
+	remote.rkey = rts->rkey;
+	rc = region_stream(res, IBV_WR_RDMA_READ, dst, rts->length, mr->lkey, &remote);
+	if (ibv_dereg_mr(mr))
+	{
+		log_err("failed to deregister the rendezvous MR\n");
+		rc = 1;
+	}
+	if (rc)
+		return 1;
+	x->rx_fin++;
+	return xfer_write_word(x, res, XFER_FIN_OFFSET, x->rx_fin);
+}
+/******************************************************************************
+ * Function: xfer_serve_early
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Read the payloads of the peer's queued rendezvous messages into temporary
+ * buffers, in arrival order, so that the peer's send can finish while this
+ * end waits for its own. At most XFER_EARLY_DEPTH are read ahead.
+ ******************************************************************************/
+static int xfer_serve_early(struct rdma_xfer *x, struct resources *res)
+{
+	struct xfer_hdr hdr;
+	uint64_t entry;
+	uint32_t slot;
+	void *buf;
+	int seen = 0;
+	int i;
+	int j;
+	for (i = 0; i < res->msg_ready_count && x->early_count < XFER_EARLY_DEPTH; i++)
+	{
+		entry = res->msg_ready[(res->msg_ready_head + i) % res->msg_ring->slots];
+		slot = (uint32_t)(entry >> 32);
+		if ((uint32_t)entry < XFER_HDR_SIZE)
+			continue;
+		memcpy(&hdr, msg_slot(res, slot), XFER_HDR_SIZE);
+		if (hdr.kind != XFER_RTS)
+			continue;
+		// 按到达顺序读取，所以已经读过的就是排在最前面的 early_count 条
+		if (seen++ < x->early_count)
+			continue;
+		buf = malloc(hdr.length ? hdr.length : 1);
+		if (!buf)
+		{
+			log_err("failed to allocate %" PRIu64 " bytes for an early rendezvous\n", hdr.length);
+			return 1;
+		}
+		if (hdr.length && xfer_read(x, res, &hdr, buf))
+		{
+			free(buf);
+			return 1;
+		}
+		j = (x->early_head + x->early_count) % XFER_EARLY_DEPTH;
+		x->early_slot[j] = slot;
+		x->early_buf[j] = (uintptr_t)buf;
+		x->early_count++;
+		log_debug("read the peer's %" PRIu64 " byte rendezvous while waiting for ours\n", hdr.length);
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: xfer_wait_fin
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * timeout_usec how long to wait, negative to wait forever
+ *
+ * Returns
+ * 0 once the receiver has fetched every rendezvous payload sent so far, 1
+ * on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Spin on the local FIN word the receiver writes back, reaping completions
+ * on the way so that the send queue drains and arriving messages are
+ * queued. Rendezvous messages of the peer among them are served at once,
+ * since the peer may be waiting in the same way.
+ ******************************************************************************/
+static int xfer_wait_fin(struct rdma_xfer *x, struct resources *res, long timeout_usec)
+{
+	struct ibv_wc wc[POLL_BATCH];
+	unsigned long start_time_usec = 0;
+	unsigned int spins = 0;
+	int n = 1;
+	int i;
+	while (__atomic_load_n(xfer_word(res, x->tx_base, XFER_FIN_OFFSET), __ATOMIC_ACQUIRE) < x->rts_sent)
+	{
+		// 只有新到了完成事件时队列才可能变化
+		if (n && xfer_serve_early(x, res))
+			return 1;
+		n = poll_cq_batch(res, wc, POLL_BATCH, 0);
+		if (n < 0)
+			return 1;
+		for (i = 0; i < n; i++)
+		{
+			if (wc[i].wr_id < WRID_MSG_RECV)
+			{
+				log_err("unexpected completion wr_id %" PRIu64 " on a channel connection\n", wc[i].wr_id);
+				return 1;
+			}
+			if (account_internal(res, &wc[i]))
+				return 1;
+		}
+		if (timeout_usec < 0 || ++spins % POLL_CLOCK_INTERVAL)
+			continue;
+		if (!start_time_usec)
+			start_time_usec = monotonic_usec();
+		else if (monotonic_usec() - start_time_usec >= (unsigned long)timeout_usec)
+			return POLL_TIMED_OUT;
+	}
+	return 0;
+}
+/******************************************************************************
+ * Function: xfer_send
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * data payload, in any memory
+ * length payload size
+ * timeout_usec how long to wait for window credit or, for a rendezvous, for
+ *              the receiver to fetch the payload; negative to wait forever
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Send one message on the path its size calls for. `data` may be reused as
+ * soon as the call returns.
+ ******************************************************************************/
+int xfer_send(struct rdma_xfer *x, struct resources *res, const void *data, uint64_t length, long timeout_usec)
+{
+	struct xfer_hdr hdr;
+	struct ibv_send_wr wrs[2];
+	struct ibv_sge sges[2];
+	struct ibv_mr *mr = NULL;
+	uint64_t now = monotonic_nsec();
+	int max_every = res->qp_depth / 4 > 0 ? res->qp_depth / 4 : 1;
+	size_t offset;
+	char *record;
+	int odp;
+	int n = 1;
+	int rc;
+	xfer_adapt(x, res, now);
+	if (x->last_post_ns && now - x->last_post_ns < XFER_BURST_NS)
+		x->signal_every = x->signal_every * 2 < max_every ? x->signal_every * 2 : max_every;
+	else
+		x->signal_every = 1;
+	x->last_post_ns = now;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(wrs, 0, sizeof(wrs));
+	memset(sges, 0, sizeof(sges));
+	hdr.length = length;
+	wrs[0].sg_list = sges;
+	wrs[0].num_sge = 1;
+	wrs[0].opcode = IBV_WR_SEND;
+	if (length >= x->rendezvous)
+	{
+		hdr.kind = XFER_RTS;
+		mr = reg_mr_odp(res->dev, (void *)data, length, IBV_ACCESS_REMOTE_READ, IBV_ODP_SUPPORT_READ, &odp);
+		if (!mr)
+		{
+			log_err("failed to register %" PRIu64 " bytes for a rendezvous\n", length);
+			return 1;
+		}
+		hdr.rkey = mr->rkey;
+		hdr.addr = (uintptr_t)data;
+	}
+	else if (XFER_HDR_SIZE + length <= (uint64_t)res->inline_size &&
+			 XFER_HDR_SIZE + length <= res->remote_props.msg_size)
+		hdr.kind = XFER_INLINE;
+	else if (XFER_HDR_SIZE + length <= res->remote_props.msg_size)
+		hdr.kind = XFER_EAGER;
+	else
+		hdr.kind = XFER_WRITTEN;
+
+	if (hdr.kind == XFER_INLINE || (hdr.kind == XFER_RTS && inline_flag(res, IBV_WR_SEND, XFER_HDR_SIZE)))
+	{
+		// 内联发送在投递时就复制了数据，消息头可以留在栈上
+		sges[0].addr = (uintptr_t)&hdr;
+		sges[0].length = XFER_HDR_SIZE;
+		if (length && hdr.kind == XFER_INLINE)
+		{
+			sges[1].addr = (uintptr_t)data;
+			sges[1].length = (uint32_t)length;
+			wrs[0].num_sge = 2;
+		}
+		wrs[0].send_flags = IBV_SEND_INLINE;
+	}
+	else
+	{
+		rc = xfer_reserve(x, res, XFER_ROUND(XFER_HDR_SIZE + (hdr.kind == XFER_RTS ? 0 : length)), timeout_usec,
+						  &offset);
+		if (rc)
+			goto xfer_send_exit;
+		record = res->buf + offset;
+		hdr.pos = x->tx_pos;
+		if (hdr.kind != XFER_RTS)
+			memcpy(record + XFER_HDR_SIZE, data, length);
+		if (hdr.kind == XFER_WRITTEN)
+		{
+			hdr.addr = offset + XFER_HDR_SIZE;
+			sges[0].addr = (uintptr_t)(record + XFER_HDR_SIZE);
+			sges[0].length = (uint32_t)length;
+			sges[0].lkey = res->mr->lkey;
+			wrs[0].opcode = IBV_WR_RDMA_WRITE;
+			wrs[0].send_flags = inline_flag(res, IBV_WR_RDMA_WRITE, (uint32_t)length);
+			wrs[0].wr.rdma.remote_addr = res->remote_props.addr + offset + XFER_HDR_SIZE;
+			wrs[0].wr.rdma.rkey = res->remote_props.rkey;
+			wrs[1].sg_list = &sges[1];
+			wrs[1].num_sge = 1;
+			wrs[1].opcode = IBV_WR_SEND;
+			n = 2;
+		}
+		memcpy(record, &hdr, XFER_HDR_SIZE);
+		sges[n - 1].addr = (uintptr_t)record;
+		sges[n - 1].length = XFER_HDR_SIZE + (hdr.kind == XFER_EAGER ? (uint32_t)length : 0);
+		sges[n - 1].lkey = res->mr->lkey;
+		wrs[n - 1].send_flags = inline_flag(res, IBV_WR_SEND, sges[n - 1].length);
+	}
+	rc = xfer_post(x, res, wrs, n, 0);
+	if (rc)
+		goto xfer_send_exit;
+	x->sent[hdr.kind]++;
+	if (hdr.kind == XFER_RTS)
+	{
+		x->rts_sent++;
+		rc = xfer_wait_fin(x, res, timeout_usec);
+		if (rc == POLL_TIMED_OUT)
+			log_err("the peer did not fetch the %" PRIu64 " byte rendezvous payload in time\n", length);
+	}
+
+xfer_send_exit:
+	// 注销之后对端的读取会失败，所以只在对端取完或放弃等待时注销
+	if (mr && ibv_dereg_mr(mr))
+	{
+		log_err("failed to deregister the rendezvous MR\n");
+		rc = 1;
+	}
+	return rc;
+}
+/******************************************************************************
+ * Function: xfer_recv
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * timeout_usec how long to wait, 0 for a single check, negative forever
+ *
+ * Output
+ * msg header of the next message
+ * payload where its payload lies until xfer_consume, NULL for XFER_RTS,
+ *         whose payload xfer_fetch moves; a rendezvous whose payload was
+ *         read ahead comes back as XFER_FETCHED with its payload here
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ ******************************************************************************/
+int xfer_recv(struct rdma_xfer *x, struct resources *res, struct xfer_hdr *msg, const void **payload,
+			  long timeout_usec)
+{
+	uint32_t slot;
+	uint32_t length;
+	char *p;
+	uint64_t data_start = x->rx_base + XFER_CTRL_SIZE;
+	int rc;
+	if (x->pending_slot != XFER_NO_SLOT)
+	{
+		log_err("the previous channel message has not been consumed\n");
+		return 1;
+	}
+	xfer_adapt(x, res, monotonic_nsec());
+	rc = msg_recv(res, &slot, &length, timeout_usec);
+	if (rc)
+		return rc;
+	p = msg_slot(res, slot);
+	if (length < XFER_HDR_SIZE)
+	{
+		log_err("channel message of %u bytes has no header\n", length);
+		goto xfer_recv_error;
+	}
+	memcpy(msg, p, XFER_HDR_SIZE);
+	*payload = NULL;
+	switch (msg->kind)
+	{
+	case XFER_INLINE:
+	case XFER_EAGER:
+		if (msg->length != length - XFER_HDR_SIZE)
+			goto xfer_recv_corrupt;
+		*payload = p + XFER_HDR_SIZE;
+		break;
+	case XFER_WRITTEN:
+		if (msg->addr < data_start || msg->addr > data_start + x->capacity ||
+			msg->length > data_start + x->capacity - msg->addr)
+			goto xfer_recv_corrupt;
+		*payload = res->buf + msg->addr;
+		break;
+	case XFER_RTS:
+		x->received[XFER_RTS]++;
+		if (x->early_count && x->early_slot[x->early_head] == slot)
+		{
+			x->fetched = x->early_buf[x->early_head];
+			x->early_head = (x->early_head + 1) % XFER_EARLY_DEPTH;
+			x->early_count--;
+			msg->kind = XFER_FETCHED;
+			*payload = (const void *)(uintptr_t)x->fetched;
+		}
+		else
+			x->rts = *msg;
+		break;
+	default:
+		goto xfer_recv_corrupt;
+	}
+	if (msg->kind != XFER_FETCHED && msg->kind != XFER_RTS)
+		x->received[msg->kind]++;
+	x->pending_slot = slot;
+	x->pending_pos = msg->pos;
+	return 0;
+
+xfer_recv_corrupt:
+	log_err("corrupt channel message of kind %u and %" PRIu64 " bytes\n", msg->kind, msg->length);
+xfer_recv_error:
+	msg_release(res, slot);
+	return 1;
+}
+/******************************************************************************
+ * Function: xfer_consume
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Release the message returned by xfer_recv. Credit goes back to the
+ * sender once a quarter of the window has been consumed, or as soon as no
+ * further message is queued.
+ ******************************************************************************/
+int xfer_consume(struct rdma_xfer *x, struct resources *res)
+{
+	int rc;
+	if (x->pending_slot == XFER_NO_SLOT)
+		return 0;
+	rc = msg_release(res, x->pending_slot);
+	x->pending_slot = XFER_NO_SLOT;
+	if (x->fetched)
+	{
+		free((void *)(uintptr_t)x->fetched);
+		x->fetched = 0;
+	}
+	if (x->pending_pos)
+		x->rx_pos = x->pending_pos;
+	if (x->rx_pos != x->rx_published &&
+		(x->rx_pos - x->rx_published >= x->capacity / 4 || !res->msg_ready_count))
+	{
+		if (xfer_write_word(x, res, XFER_HEAD_OFFSET, x->rx_pos))
+			return 1;
+		x->rx_published = x->rx_pos;
+	}
+	return rc ? 1 : 0;
+}
+/******************************************************************************
+ * Function: xfer_fetch
+ *
+ * Input
+ * x pointer to the channel, after xfer_recv returned an XFER_RTS message
+ * res connection carrying the channel
+ * dst destination of msg.length bytes, in any memory
+ *
+ * Returns
+ * 0 on success, 1 on failure
+ *
+ * Description
+ * Register the destination, RDMA READ the payload from the sender's memory
+ * and tell the sender it may release it.
+ ******************************************************************************/
+int xfer_fetch(struct rdma_xfer *x, struct resources *res, void *dst)
+{
+	if (x->pending_slot == XFER_NO_SLOT || x->rts.kind != XFER_RTS)
+	{
+		log_err("no rendezvous message to fetch\n");
+		return 1;
+	}
+	x->rts.kind = 0;
+	return xfer_read(x, res, &x->rts, dst);
+}
+/******************************************************************************
+ * Function: xfer_drain
+ *
+ * Input
+ * x pointer to the channel
+ * res connection carrying the channel
+ * timeout_usec how long to wait
+ *
+ * Returns
+ * 0 on success, 1 on failure, POLL_TIMED_OUT on timeout
+ *
+ * Description
+ * Wait until every request the channel posted has completed, e.g. before
+ * the connection is used for other operations again. Payloads read ahead
+ * for messages that were never received are dropped.
+ ******************************************************************************/
+int xfer_drain(struct rdma_xfer *x, struct resources *res, long timeout_usec)
+{
+	for (; x->early_count; x->early_count--)
+	{
+		free((void *)(uintptr_t)x->early_buf[x->early_head]);
+		x->early_head = (x->early_head + 1) % XFER_EARLY_DEPTH;
+	}
+	if (xfer_flush(x, res))
+		return 1;
+	return xfer_reap(x, res, res->qp_depth, timeout_usec);
+}
@@ -0,0 +1,89 @@
+#ifndef RDMA_XFER_H
+#define RDMA_XFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 窗口开头的控制区：偏移 0 处为接收方写回的已消费位置，偏移 8 处为接收方写回的已完成汇合传输数 */
+#define XFER_CTRL_SIZE 64
+#define XFER_HEAD_OFFSET 0
+#define XFER_FIN_OFFSET 8
+#define XFER_ALIGN 64
+/* 达到该大小的消息默认走汇合（rendezvous）路径，由接收方 RDMA READ */
+#define XFER_DEFAULT_RENDEZVOUS (64 * 1024)
+/* 两次发送间隔小于该值时视为突发，放宽完成事件的请求间隔 */
+#define XFER_BURST_NS 20000
+/* 每隔这么久根据完成速率调整一次 CQ 合并（仅事件模式） */
+#define XFER_ADAPT_NS 1000000
+/* 每毫秒完成数达到该值时启用 CQ 合并，合并参数为下面两项 */
+#define XFER_MODERATE_RATE 64
+#define XFER_CQ_COUNT 16
+#define XFER_CQ_PERIOD 8
+
+/* 消息头中的类型 */
+#define XFER_INLINE 1  /* 内联 SEND，负载紧跟消息头 */
+#define XFER_EAGER 2   /* 从发送窗口发出的 SEND，负载紧跟消息头 */
+#define XFER_WRITTEN 3 /* 负载已 RDMA WRITE 到接收窗口，消息头给出位置 */
+#define XFER_RTS 4     /* 汇合传输：接收方按消息头中的地址和密钥 RDMA READ 负载 */
+#define XFER_FETCHED 5 /* 只由 xfer_recv 返回：发送方等待期间已把对端的汇合传输读进临时缓冲区 */
+/* 发送方等待 FIN 期间最多为这么多条对端的汇合传输提前读取负载 */
+#define XFER_EARLY_DEPTH 8
+/* pending_slot 取此值时没有待消费的消息 */
+#define XFER_NO_SLOT 0xffffffffu
+
+struct resources;
+
+/* the header that starts every message of a channel */
+struct xfer_hdr
+{
+    uint32_t kind;   /* XFER_* */
+    uint32_t rkey;   /* XFER_RTS：发送方内存的远程密钥 */
+    uint64_t length; /* 负载字节数 */
+    uint64_t addr;   /* XFER_WRITTEN：负载在窗口中的偏移；XFER_RTS：发送方内存的地址 */
+    uint64_t pos;    /* 消费该消息后接收方的已消费位置，不占用窗口时为 0 */
+};
+
+/* both directions of a size-aware message channel over a connection with
+   messaging enabled; the struct holds no pointers and can live in Go memory */
+struct rdma_xfer
+{
+    size_t tx_base;         /* 发送窗口的偏移（两端相同，即对端的接收窗口） */
+    size_t rx_base;         /* 接收窗口的偏移 */
+    uint64_t capacity;      /* 每个窗口数据区的字节数，2 的幂 */
+    uint64_t rendezvous;    /* 达到该大小的消息走汇合路径 */
+    uint64_t tx_pos;        /* 发送方：已占用的窗口位置 */
+    uint64_t tx_credit;     /* 发送方：最近看到的对端已消费位置 */
+    uint64_t rts_sent;      /* 发送方：已发出的汇合传输数 */
+    uint64_t rx_pos;        /* 接收方：已消费的窗口位置 */
+    uint64_t rx_published;  /* 接收方：最近写回给发送方的已消费位置 */
+    uint64_t rx_fin;        /* 接收方：已完成的汇合传输数 */
+    uint64_t last_post_ns;  /* 上一次发送的时刻 */
+    uint64_t adapt_ns;      /* 上一次调整 CQ 合并的时刻 */
+    uint64_t adapt_done;    /* 上一次调整时的完成总数 */
+    int signal_every;       /* 当前每隔多少个请求要求一次完成事件 */
+    int unsignaled;         /* 已投递但还没有被带完成事件的请求覆盖的请求数 */
+    int adaptive_cq;        /* 是否根据完成速率调整 CQ 合并 */
+    int cq_count;           /* 当前 CQ 合并的完成数，0 表示未合并 */
+    int cq_period;          /* 当前 CQ 合并的时长（微秒） */
+    uint32_t pending_slot;  /* 接收方：xfer_recv 返回但尚未 xfer_consume 的消息槽位 */
+    uint64_t pending_pos;   /* 接收方：该消息的 pos */
+    struct xfer_hdr rts;    /* 接收方：待 xfer_fetch 的汇合传输 */
+    uint32_t early_slot[XFER_EARLY_DEPTH]; /* 已提前读取负载的汇合传输所在的消息槽位，按到达顺序 */
+    uint64_t early_buf[XFER_EARLY_DEPTH];  /* 对应的临时缓冲区（malloc 得到的地址） */
+    int early_head;
+    int early_count;
+    uint64_t fetched;       /* 接收方：当前消息所在的临时缓冲区，xfer_consume 时释放 */
+    uint64_t sent[5];       /* 按 XFER_* 类型统计的发送消息数 */
+    uint64_t received[5];   /* 按 XFER_* 类型统计的接收消息数 */
+};
+
+int xfer_init(struct rdma_xfer *x, struct resources *res, size_t tx_base, size_t rx_base, uint64_t size,
+              uint64_t rendezvous, int adaptive_cq);
+int xfer_send(struct rdma_xfer *x, struct resources *res, const void *data, uint64_t length, long timeout_usec);
+int xfer_recv(struct rdma_xfer *x, struct resources *res, struct xfer_hdr *msg, const void **payload,
+              long timeout_usec);
+int xfer_consume(struct rdma_xfer *x, struct resources *res);
+int xfer_fetch(struct rdma_xfer *x, struct resources *res, void *dst);
+int xfer_drain(struct rdma_xfer *x, struct resources *res, long timeout_usec);
+
+#endif
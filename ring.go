@@ -0,0 +1,133 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"time"
+	"unsafe"
+)
+
+// RingProducer is the sending end of a single-producer/single-consumer ring in a
+// window of the registered buffers. Each record is one RDMA WRITE of the payload
+// followed by an inline write of the new tail, posted together with one doorbell;
+// the consumer returns credit by writing its head back. Neither side takes a
+// syscall or involves the remote CPU per record.
+//
+// A ring owns the connection's send queue and CQ while it is in use: do not mix
+// it with PostWrite/Reap or the synchronous operations, and call Close before
+// using the connection for anything else. A connection carries one ring
+// direction per window; two windows give a full-duplex channel.
+type RingProducer struct {
+	res  *RDMAResources
+	ring C.struct_rdma_ring
+}
+
+// RingConsumer is the receiving end of a ring created by NewRingConsumer. It only
+// reads local memory; records arrive by RDMA WRITE. Since RDMA WRITE raises no
+// completion on the receiver, Pop always busy-polls, also with
+// WithEventCompletion.
+type RingConsumer struct {
+	res  *RDMAResources
+	ring C.struct_rdma_ring
+}
+
+// NewRingProducer creates the producer end of a ring in [offset, offset+size) of the
+// local and remote buffers. The peer must create the consumer end over the same
+// window before the first Push. `offset` must be 8-byte aligned; the data area is
+// the largest power of two that fits in size-64 bytes.
+func (h *RDMAHandler) NewRingProducer(res *RDMAResources, offset, size int) (*RingProducer, error) {
+	p := &RingProducer{res: res}
+	if err := initRing(res, &p.ring, offset, size, 1); err != nil {
+		return nil, err
+	}
+	return p, nil
+}
+
+// NewRingConsumer creates the consumer end of a ring in [offset, offset+size) of the
+// local and remote buffers, matching the peer's NewRingProducer.
+func (h *RDMAHandler) NewRingConsumer(res *RDMAResources, offset, size int) (*RingConsumer, error) {
+	c := &RingConsumer{res: res}
+	if err := initRing(res, &c.ring, offset, size, 0); err != nil {
+		return nil, err
+	}
+	return c, nil
+}
+
+// initRing validates the window and initializes one end of the ring.
+func initRing(res *RDMAResources, ring *C.struct_rdma_ring, offset, size, producer int) error {
+	if offset < 0 || size <= 0 {
+		return fmt.Errorf("invalid ring window [%d, +%d)", offset, size)
+	}
+	if err := res.checkIdle("ring"); err != nil {
+		return err
+	}
+	if C.ring_init(ring, &res.res, C.size_t(offset), C.uint64_t(size), C.int(producer)) != 0 {
+		return fmt.Errorf("failed to set up ring in [%d, +%d)", offset, size)
+	}
+	return nil
+}
+
+// Push appends one record, waiting up to `timeout` for the consumer to free room
+// (a negative timeout waits forever, zero fails immediately when the ring is
+// full). ErrTimeout reports that the ring stayed full. `data` is copied into the
+// local window before the call returns. A record takes its length plus an 8-byte
+// header rounded up to 8 bytes and may use at most half of the data area.
+func (p *RingProducer) Push(data []byte, timeout time.Duration) error {
+	var ptr unsafe.Pointer
+	if len(data) > 0 {
+		ptr = unsafe.Pointer(&data[0])
+	}
+	switch C.ring_push(&p.ring, &p.res.res, ptr, C.uint32_t(len(data)), timeoutMicros(timeout)) {
+	case 0:
+		return nil
+	case C.POLL_TIMED_OUT:
+		return ErrTimeout
+	default:
+		return fmt.Errorf("failed to push %d byte ring record", len(data))
+	}
+}
+
+// Close waits until every write of the producer has completed. The connection can
+// be used for other operations afterwards.
+func (p *RingProducer) Close() error {
+	if C.ring_drain(&p.res.res, C.long(C.MAX_POLL_CQ_TIMEOUT*1000)) != 0 {
+		return fmt.Errorf("failed to drain ring writes")
+	}
+	return nil
+}
+
+// Pop returns a copy of the oldest record, waiting up to `timeout` for one (a
+// negative timeout waits forever, zero only checks once). ErrTimeout reports
+// that the ring stayed empty.
+func (c *RingConsumer) Pop(timeout time.Duration) ([]byte, error) {
+	var offset C.uint64_t
+	var length C.uint32_t
+	switch C.ring_pop(&c.ring, &c.res.res, &offset, &length, timeoutMicros(timeout)) {
+	case 0:
+	case C.POLL_TIMED_OUT:
+		return nil, ErrTimeout
+	default:
+		return nil, fmt.Errorf("failed to pop ring record")
+	}
+	out := make([]byte, int(length))
+	copy(out, c.res.region()[int(offset):int(offset)+int(length)])
+	if C.ring_consume(&c.ring, &c.res.res) != 0 {
+		return nil, fmt.Errorf("failed to return ring credit")
+	}
+	return out, nil
+}
+
+// Close returns the remaining credit to the producer and waits until the
+// consumer's writes have completed.
+func (c *RingConsumer) Close() error {
+	if C.ring_publish(&c.ring, &c.res.res) != 0 {
+		return fmt.Errorf("failed to return ring credit")
+	}
+	if C.ring_drain(&c.res.res, C.long(C.MAX_POLL_CQ_TIMEOUT*1000)) != 0 {
+		return fmt.Errorf("failed to drain ring writes")
+	}
+	return nil
+}
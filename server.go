@@ -0,0 +1,201 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"errors"
+	"fmt"
+	"runtime"
+	"sync"
+	"syscall"
+	"time"
+)
+
+// ErrServerClosed is returned by Server.Accept once the server has been closed.
+var ErrServerClosed = errors.New("rdmahandler: server closed")
+
+// ServerConfig configures a multi-client Server.
+type ServerConfig struct {
+	// Workers is the number of peers handshaken concurrently. Zero uses one worker
+	// per CPU, so that a burst of reconnecting clients scales with the cores.
+	Workers int
+	// Backlog is the length of the kernel's queue of pending TCP connections. Zero
+	// uses 128.
+	Backlog int
+	// HandshakeTimeout bounds every socket read and write of a peer's handshake,
+	// so that clients that connect and stay silent cannot hold the workers. Zero
+	// uses 10 seconds. The limit is lifted once the connection is established.
+	HandshakeTimeout time.Duration
+}
+
+// Server keeps one TCP port open and turns every client that connects into its own
+// RDMAResources. Each accepted socket is handed to a pool of worker goroutines
+// that run the RDMA handshake (resources_create and connect_qp) in parallel, and
+// the finished connections are returned by Accept in completion order.
+//
+// All connections share one device and PD: the Device or MemoryPool passed through
+// the options, or a device the server opens for itself. Memory registered once,
+// e.g. in the pool, is therefore usable on every peer's connection.
+type Server struct {
+	listenfd C.int
+	conns    chan *RDMAResources
+	sockets  chan int
+	timeout  time.Duration
+	// dev is the device the server opened itself because no option provided one.
+	dev *Device
+
+	closeOnce sync.Once
+	workers   sync.WaitGroup
+}
+
+// Listen starts a multi-client server on `port`. `opts` configure every peer's
+// connection as in InitServer. Clients connect with the usual InitClient.
+//
+// Example:
+//
+//	srv, err := h.Listen(8080, rdmahandler.ServerConfig{}, rdmahandler.WithBufferSize(1<<20))
+//	if err != nil {
+//	    return err
+//	}
+//	defer srv.Close()
+//	for {
+//	    res, err := srv.Accept()
+//	    if err != nil {
+//	        return err
+//	    }
+//	    go serve(res)
+//	}
+func (h *RDMAHandler) Listen(port int, cfg ServerConfig, opts ...Option) (*Server, error) {
+	workers := cfg.Workers
+	if workers <= 0 {
+		workers = runtime.NumCPU()
+	}
+	backlog := cfg.Backlog
+	if backlog <= 0 {
+		backlog = 128
+	}
+	o := defaultConnOptions()
+	for _, opt := range opts {
+		opt(&o)
+	}
+	timeout := cfg.HandshakeTimeout
+	if timeout <= 0 {
+		timeout = 10 * time.Second
+	}
+	s := &Server{
+		conns:   make(chan *RDMAResources, workers),
+		sockets: make(chan int, workers),
+		timeout: timeout,
+	}
+	// 未指定设备时服务器打开一个设备，所有对端的连接共享它和它的 PD
+	if o.device == nil && o.pool == nil && o.srq == nil {
+		dev, err := OpenDevice(opts...)
+		if err != nil {
+			return nil, err
+		}
+		s.dev = dev
+		opts = append(append([]Option(nil), opts...), WithDevice(dev))
+	}
+	s.listenfd = C.sock_listen(C.int(port), C.int(backlog))
+	if s.listenfd < 0 {
+		if s.dev != nil {
+			s.dev.Close()
+		}
+		return nil, fmt.Errorf("failed to listen on port %d", port)
+	}
+	go s.acceptLoop()
+	s.workers.Add(workers)
+	for i := 0; i < workers; i++ {
+		go s.handshakeLoop(opts)
+	}
+	// 所有 worker 退出后不会再有新连接
+	go func() {
+		s.workers.Wait()
+		close(s.conns)
+	}()
+	return s, nil
+}
+
+// acceptLoop accepts TCP connections until the listener is shut down, and then
+// closes it: only here is it certain that no sock_accept uses the descriptor.
+func (s *Server) acceptLoop() {
+	defer close(s.sockets)
+	defer syscall.Close(int(s.listenfd))
+	for {
+		fd := int(C.sock_accept(s.listenfd))
+		if fd == -2 {
+			return
+		}
+		if fd < 0 {
+			// 例如文件描述符耗尽：稍后重试，避免空转
+			time.Sleep(10 * time.Millisecond)
+			continue
+		}
+		if C.sock_set_timeout(C.int(fd), C.long(s.timeout/time.Microsecond)) != 0 {
+			syscall.Close(fd)
+			continue
+		}
+		s.sockets <- fd
+	}
+}
+
+// handshakeLoop turns accepted sockets into connections. A failed handshake only
+// loses that peer.
+func (s *Server) handshakeLoop(opts []Option) {
+	defer s.workers.Done()
+	for fd := range s.sockets {
+		res, err := newConnection("", 0, fd, opts)
+		if err != nil {
+			logf(LogError, "Server", "handshake with a peer failed: %v", err)
+			continue
+		}
+		// 之后的同步操作可能要等对端的应用很久，不再限制
+		if C.sock_set_timeout(res.res.sock, 0) != 0 {
+			logf(LogError, "Server", "failed to lift the handshake timeout")
+			h := RDMAHandler{}
+			h.Destroy(res)
+			continue
+		}
+		s.conns <- res
+	}
+}
+
+// Accept returns the next peer whose handshake has completed. It returns
+// ErrServerClosed after Close.
+func (s *Server) Accept() (*RDMAResources, error) {
+	res, ok := <-s.conns
+	if !ok {
+		return nil, ErrServerClosed
+	}
+	return res, nil
+}
+
+// Close stops accepting, waits for the handshakes in progress (each socket
+// operation of which stalls for at most HandshakeTimeout) and destroys the
+// connections that Accept has not returned yet. Connections already returned
+// stay open and are destroyed by their owners. The server's own device reference
+// is dropped; the device lives on until its last connection is destroyed.
+func (s *Server) Close() error {
+	var err error
+	s.closeOnce.Do(func() {
+		// 只唤醒接受循环，由它在退出时关闭监听套接字
+		if C.sock_shutdown(s.listenfd) != 0 {
+			err = fmt.Errorf("failed to shut down listening socket")
+		}
+		// 接受循环退出后 worker 依次结束，conns 随之关闭
+		h := RDMAHandler{}
+		for res := range s.conns {
+			if derr := h.Destroy(res); derr != nil && err == nil {
+				err = derr
+			}
+		}
+		if s.dev != nil {
+			if derr := s.dev.Close(); derr != nil && err == nil {
+				err = derr
+			}
+		}
+	})
+	return err
+}
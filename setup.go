@@ -0,0 +1,103 @@
+package rdmahandler
+
+import (
+	"fmt"
+	"sync"
+	"time"
+)
+
+// SetupStats breaks down how long establishing a connection took.
+type SetupStats struct {
+	// TCP is the time to establish the TCP connection; for a server it includes
+	// waiting for the client.
+	TCP time.Duration
+	// Device is the time to open the device or take a reference on a shared one.
+	Device time.Duration
+	// Resources is the time to create the CQ, set up the registered buffer and
+	// create the QP.
+	Resources time.Duration
+	// Exchange is the time to swap connection data with the peer, including
+	// waiting for it.
+	Exchange time.Duration
+	// Transition is the time for negotiation, the initial receive requests and
+	// the INIT, RTR and RTS transitions.
+	Transition time.Duration
+	// Sync is the final synchronization after the QP reached RTS.
+	Sync time.Duration
+	// Lanes is the time to create and connect the additional QPs of a striped
+	// connection (WithStripes).
+	Lanes time.Duration
+}
+
+// Total returns the sum of all phases.
+func (s SetupStats) Total() time.Duration {
+	return s.TCP + s.Device + s.Resources + s.Exchange + s.Transition + s.Sync + s.Lanes
+}
+
+// String formats the phases for logs.
+func (s SetupStats) String() string {
+	return fmt.Sprintf("total %v (tcp %v, device %v, resources %v, exchange %v, transition %v, sync %v, lanes %v)",
+		s.Total(), s.TCP, s.Device, s.Resources, s.Exchange, s.Transition, s.Sync, s.Lanes)
+}
+
+// SetupStats returns how long the phases of establishing the connection took.
+func (r *RDMAResources) SetupStats() SetupStats {
+	st := r.res.setup
+	return SetupStats{
+		TCP:        time.Duration(st.tcp_usec) * time.Microsecond,
+		Device:     time.Duration(st.device_usec) * time.Microsecond,
+		Resources:  time.Duration(st.resources_usec) * time.Microsecond,
+		Exchange:   time.Duration(st.exchange_usec) * time.Microsecond,
+		Transition: time.Duration(st.transition_usec) * time.Microsecond,
+		Sync:       time.Duration(st.sync_usec) * time.Microsecond,
+		Lanes:      r.laneSetup,
+	}
+}
+
+// InitClients connects to every address of `peers` on `port`, running up to
+// `parallel` handshakes at once so that their network round trips and QP
+// transitions overlap instead of adding up. A non-positive parallel connects to
+// all peers at once. The result has one entry per peer, in order; on error the
+// connections that were established are destroyed again.
+//
+// For a full mesh, share one Device (WithDevice) across the calls so that the
+// device is opened once per process.
+//
+// Example:
+//
+//	conns, err := h.InitClients(peers, 8080, 64, rdmahandler.WithDevice(dev))
+func (h *RDMAHandler) InitClients(peers []string, port int, parallel int, opts ...Option) ([]*RDMAResources, error) {
+	if parallel <= 0 || parallel > len(peers) {
+		parallel = len(peers)
+	}
+	conns := make([]*RDMAResources, len(peers))
+	errs := make([]error, len(peers))
+	next := make(chan int)
+	var wg sync.WaitGroup
+	wg.Add(parallel)
+	for w := 0; w < parallel; w++ {
+		go func() {
+			defer wg.Done()
+			for i := range next {
+				conns[i], errs[i] = initRDMAConnection(peers[i], port, opts...)
+			}
+		}()
+	}
+	for i := range peers {
+		next <- i
+	}
+	close(next)
+	wg.Wait()
+	for i, err := range errs {
+		if err == nil {
+			continue
+		}
+		for _, res := range conns {
+			if res != nil {
+				h.Destroy(res)
+			}
+		}
+		return nil, fmt.Errorf("connecting to %s: %w", peers[i], err)
+	}
+	return conns, nil
+}
@@ -0,0 +1,275 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"bufio"
+	"fmt"
+	"io"
+	"sort"
+	"time"
+)
+
+// WithLatencySampling records the post-to-completion latency of every `every`th
+// signaled request in the connection's histogram (see Stats). Only sampled
+// requests read the clock, twice; the counters are always kept. A non-positive
+// value turns latency sampling off. By default every DEFAULT_LAT_SAMPLE'th
+// request is sampled.
+func WithLatencySampling(every int) Option {
+	return func(o *connOptions) {
+		if every > 0 {
+			o.latSample = every
+		} else {
+			o.latSample = -1
+		}
+	}
+}
+
+// OpStats counts the work requests of one kind.
+type OpStats struct {
+	// Posted is the number of work requests handed to the HCA.
+	Posted uint64
+	// Completed is the number of successful completions polled. Requests posted
+	// unsignaled have no completion of their own.
+	Completed uint64
+	// Bytes is the payload posted; for Recv it is the payload that arrived.
+	Bytes uint64
+}
+
+// ConnStats is a snapshot of a connection's data path counters.
+type ConnStats struct {
+	Write  OpStats
+	Read   OpStats
+	Send   OpStats
+	Atomic OpStats
+	Recv   OpStats
+	// CQPolls counts ibv_poll_cq calls that returned completions, CQEmptyPolls
+	// those that found the CQ empty.
+	CQPolls      uint64
+	CQEmptyPolls uint64
+	// Timeouts counts waits for a completion that gave up.
+	Timeouts uint64
+	// Errors counts failed completions by ibv_wc_status name.
+	Errors map[string]uint64
+	// Latency is the histogram of sampled post-to-completion latencies.
+	Latency LatencyHistogram
+}
+
+// LatencyHistogram is a log-linear histogram in the spirit of HDR histograms:
+// every power of two of nanoseconds is split into STATS_SUB_BUCKETS buckets, so
+// a quantile is accurate to 1/STATS_SUB_BUCKETS of its value.
+type LatencyHistogram struct {
+	// Count is the number of recorded latencies and Sum their total.
+	Count uint64
+	Sum   time.Duration
+
+	buckets [C.STATS_HIST_BUCKETS]uint64
+}
+
+// Stats returns the connection's counters. For a striped connection the counters
+// of all its QPs are added up; call Stats on a Lane for a single QP. It may be
+// called from any goroutine while the connection is in use.
+func (r *RDMAResources) Stats() ConnStats {
+	s := r.laneStats()
+	for _, lane := range r.lanes {
+		s.add(lane.laneStats())
+	}
+	return s
+}
+
+// laneStats converts the counters of this QP alone.
+func (r *RDMAResources) laneStats() ConnStats {
+	var cs C.struct_conn_stats
+	C.stats_snapshot(&r.res, &cs)
+	op := func(i C.int) OpStats {
+		return OpStats{Posted: uint64(cs.posted[i]), Completed: uint64(cs.completed[i]), Bytes: uint64(cs.bytes[i])}
+	}
+	s := ConnStats{
+		Write:        op(C.STATS_OP_WRITE),
+		Read:         op(C.STATS_OP_READ),
+		Send:         op(C.STATS_OP_SEND),
+		Atomic:       op(C.STATS_OP_ATOMIC),
+		Recv:         op(C.STATS_OP_RECV),
+		CQPolls:      uint64(cs.cq_polls),
+		CQEmptyPolls: uint64(cs.cq_empty_polls),
+		Timeouts:     uint64(cs.timeouts),
+		Errors:       make(map[string]uint64),
+	}
+	for i, n := range cs.errors {
+		if n != 0 {
+			s.Errors[C.GoString(C.ibv_wc_status_str(C.enum_ibv_wc_status(i)))] += uint64(n)
+		}
+	}
+	for i, n := range cs.lat_hist {
+		s.Latency.buckets[i] = uint64(n)
+		s.Latency.Count += uint64(n)
+	}
+	s.Latency.Sum = time.Duration(cs.lat_sum_ns)
+	return s
+}
+
+// add accumulates `o` into s.
+func (s *ConnStats) add(o ConnStats) {
+	for _, p := range []struct{ dst, src *OpStats }{
+		{&s.Write, &o.Write}, {&s.Read, &o.Read}, {&s.Send, &o.Send}, {&s.Atomic, &o.Atomic}, {&s.Recv, &o.Recv},
+	} {
+		p.dst.Posted += p.src.Posted
+		p.dst.Completed += p.src.Completed
+		p.dst.Bytes += p.src.Bytes
+	}
+	s.CQPolls += o.CQPolls
+	s.CQEmptyPolls += o.CQEmptyPolls
+	s.Timeouts += o.Timeouts
+	for k, n := range o.Errors {
+		s.Errors[k] += n
+	}
+	s.Latency.Merge(o.Latency)
+}
+
+// Merge adds the latencies recorded in `o`.
+func (h *LatencyHistogram) Merge(o LatencyHistogram) {
+	for i, n := range o.buckets {
+		h.buckets[i] += n
+	}
+	h.Count += o.Count
+	h.Sum += o.Sum
+}
+
+// Mean returns the average recorded latency.
+func (h LatencyHistogram) Mean() time.Duration {
+	if h.Count == 0 {
+		return 0
+	}
+	return h.Sum / time.Duration(h.Count)
+}
+
+// Quantile returns the latency below which the fraction `q` (0 to 1) of the
+// recorded latencies falls, rounded up to the end of its bucket.
+func (h LatencyHistogram) Quantile(q float64) time.Duration {
+	if h.Count == 0 {
+		return 0
+	}
+	rank := uint64(q*float64(h.Count) + 0.5)
+	if rank < 1 {
+		rank = 1
+	}
+	var seen uint64
+	for i, n := range h.buckets {
+		seen += n
+		if seen >= rank {
+			return time.Duration(bucketUpper(i))
+		}
+	}
+	return time.Duration(bucketUpper(len(h.buckets) - 1))
+}
+
+// bucketUpper returns the first latency in nanoseconds above bucket i, mirroring
+// stats_bucket on the C side.
+func bucketUpper(i int) uint64 {
+	if i < C.STATS_SUB_BUCKETS {
+		return uint64(i) + 1
+	}
+	shift := uint(i/C.STATS_SUB_BUCKETS - 1)
+	sub := uint64(i%C.STATS_SUB_BUCKETS) + C.STATS_SUB_BUCKETS
+	return (sub + 1) << shift
+}
+
+// countBelow returns how many latencies are below 2^shift nanoseconds; bucket
+// boundaries include every power of two.
+func (h LatencyHistogram) countBelow(shift int) uint64 {
+	end := C.STATS_SUB_BUCKETS
+	if shift > C.STATS_SUB_BITS {
+		end = (shift - C.STATS_SUB_BITS + 1) * C.STATS_SUB_BUCKETS
+	}
+	var n uint64
+	for _, c := range h.buckets[:end] {
+		n += c
+	}
+	return n
+}
+
+// WritePrometheus writes the counters of `conns`, keyed by the value of their
+// "conn" label, in the Prometheus text exposition format. The latency histogram
+// is exported with one bucket per power of two of nanoseconds from 1µs on; since
+// latencies are whole nanoseconds and Prometheus buckets include their bound, the
+// bucket of 2^n ns has le set to 2^n-1 ns, e.g. 1.023e-06 for 1µs.
+//
+// Example:
+//
+//	http.HandleFunc("/metrics", func(w http.ResponseWriter, _ *http.Request) {
+//	    rdmahandler.WritePrometheus(w, map[string]*rdmahandler.RDMAResources{"peer1": res})
+//	})
+func WritePrometheus(w io.Writer, conns map[string]*RDMAResources) error {
+	names := make([]string, 0, len(conns))
+	for name := range conns {
+		names = append(names, name)
+	}
+	sort.Strings(names)
+	stats := make([]ConnStats, len(names))
+	for i, name := range names {
+		stats[i] = conns[name].Stats()
+	}
+
+	bw := bufio.NewWriter(w)
+	family := func(name, kind, help string) {
+		fmt.Fprintf(bw, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, kind)
+	}
+	ops := func(s ConnStats) []struct {
+		name string
+		op   OpStats
+	} {
+		return []struct {
+			name string
+			op   OpStats
+		}{{"write", s.Write}, {"read", s.Read}, {"send", s.Send}, {"atomic", s.Atomic}, {"recv", s.Recv}}
+	}
+	perOp := func(metric, help string, value func(OpStats) uint64) {
+		family(metric, "counter", help)
+		for i, name := range names {
+			for _, o := range ops(stats[i]) {
+				fmt.Fprintf(bw, "%s{conn=%q,op=%q} %d\n", metric, name, o.name, value(o.op))
+			}
+		}
+	}
+	perConn := func(metric, help string, value func(ConnStats) uint64) {
+		family(metric, "counter", help)
+		for i, name := range names {
+			fmt.Fprintf(bw, "%s{conn=%q} %d\n", metric, name, value(stats[i]))
+		}
+	}
+
+	perOp("rdma_ops_posted_total", "Work requests posted.", func(o OpStats) uint64 { return o.Posted })
+	perOp("rdma_ops_completed_total", "Successful completions polled.", func(o OpStats) uint64 { return o.Completed })
+	perOp("rdma_bytes_total", "Payload bytes posted, or received for recv.", func(o OpStats) uint64 { return o.Bytes })
+	perConn("rdma_cq_polls_total", "CQ polls that returned completions.", func(s ConnStats) uint64 { return s.CQPolls })
+	perConn("rdma_cq_empty_polls_total", "CQ polls that found the CQ empty.", func(s ConnStats) uint64 { return s.CQEmptyPolls })
+	perConn("rdma_timeouts_total", "Waits for a completion that timed out.", func(s ConnStats) uint64 { return s.Timeouts })
+
+	family("rdma_completion_errors_total", "counter", "Failed completions by status.")
+	for i, name := range names {
+		statuses := make([]string, 0, len(stats[i].Errors))
+		for status := range stats[i].Errors {
+			statuses = append(statuses, status)
+		}
+		sort.Strings(statuses)
+		for _, status := range statuses {
+			fmt.Fprintf(bw, "rdma_completion_errors_total{conn=%q,status=%q} %d\n", name, status, stats[i].Errors[status])
+		}
+	}
+
+	family("rdma_latency_seconds", "histogram", "Sampled post-to-completion latency.")
+	for i, name := range names {
+		h := stats[i].Latency
+		// le 表示小于等于：延迟是整数纳秒，小于 2^shift 即不超过 2^shift-1
+		for shift := 10; shift <= C.STATS_MAX_SHIFT; shift++ {
+			fmt.Fprintf(bw, "rdma_latency_seconds_bucket{conn=%q,le=\"%g\"} %d\n", name,
+				float64(uint64(1)<<shift-1)/1e9, h.countBelow(shift))
+		}
+		fmt.Fprintf(bw, "rdma_latency_seconds_bucket{conn=%q,le=\"+Inf\"} %d\n", name, h.Count)
+		fmt.Fprintf(bw, "rdma_latency_seconds_sum{conn=%q} %g\n", name, h.Sum.Seconds())
+		fmt.Fprintf(bw, "rdma_latency_seconds_count{conn=%q} %d\n", name, h.Count)
+	}
+	return bw.Flush()
+}
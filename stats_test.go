@@ -0,0 +1,110 @@
+package rdmahandler
+
+import (
+	"testing"
+	"time"
+)
+
+// TestBucketUpper checks that bucketUpper mirrors stats_bucket: every latency lies
+// in [bucketUpper(i-1), bucketUpper(i)) of the bucket i it is recorded in.
+func TestBucketUpper(t *testing.T) {
+	for _, tc := range []struct {
+		ns     uint64
+		bucket int
+		upper  uint64
+	}{
+		{0, 0, 1},
+		{7, 7, 8},
+		{8, 8, 9},
+		{15, 15, 16},
+		{16, 16, 18},
+		{17, 16, 18},
+		{18, 17, 20},
+		{1023, 63, 1024},
+		{1024, 64, 1152},
+		{1151, 64, 1152},
+		{1152, 65, 1280},
+		{1 << statsMaxShift, statsHistBuckets - 8, (1<<statsMaxShift + 1<<(statsMaxShift-statsSubBits))},
+		{1 << 40, statsHistBuckets - 1, 1 << (statsMaxShift + 1)},
+	} {
+		i := cStatsBucket(tc.ns)
+		if i != tc.bucket {
+			t.Errorf("stats_bucket(%d) = %d, want %d", tc.ns, i, tc.bucket)
+			continue
+		}
+		if got := bucketUpper(i); got != tc.upper {
+			t.Errorf("bucketUpper(%d) = %d, want %d", i, got, tc.upper)
+		}
+	}
+	// 每个桶的下界是前一个桶的上界，覆盖所有精确可表示的延迟
+	for ns := uint64(0); ns < 1<<16; ns++ {
+		i := cStatsBucket(ns)
+		if ns >= bucketUpper(i) || (i > 0 && ns < bucketUpper(i-1)) {
+			t.Fatalf("%d ns is outside bucket %d [%d, %d)", ns, i, bucketUpper(i-1), bucketUpper(i))
+		}
+	}
+}
+
+// histogram records latencies of the given nanoseconds as the C side would.
+func histogram(ns ...uint64) LatencyHistogram {
+	var h LatencyHistogram
+	for _, v := range ns {
+		h.buckets[cStatsBucket(v)]++
+		h.Count++
+		h.Sum += time.Duration(v)
+	}
+	return h
+}
+
+func TestCountBelow(t *testing.T) {
+	h := histogram(1, 7, 8, 1023, 1024, 1025, 2047, 2048, 1<<20-1, 1<<20, 1<<40)
+	for _, tc := range []struct {
+		shift int
+		want  uint64
+	}{
+		{3, 2},
+		{4, 3},
+		{10, 4},
+		{11, 7},
+		{12, 8},
+		{20, 9},
+		{21, 10},
+		{statsMaxShift, 10},
+	} {
+		if got := h.countBelow(tc.shift); got != tc.want {
+			t.Errorf("countBelow(%d) = %d, want %d", tc.shift, got, tc.want)
+		}
+	}
+}
+
+func TestQuantile(t *testing.T) {
+	h := histogram(1, 2, 3, 4, 5, 6, 7, 8, 9, 10)
+	for _, tc := range []struct {
+		q    float64
+		want time.Duration
+	}{
+		// 名次 q*Count 四舍五入，至少为 1；结果向上取到所在桶的上界
+		{0, 2},
+		{0.04, 2},
+		{0.05, 2},
+		{0.15, 3},
+		{0.25, 4},
+		{0.5, 6},
+		{0.94, 10},
+		{0.95, 11},
+		{0.99, 11},
+		{1, 11},
+	} {
+		if got := h.Quantile(tc.q); got != tc.want {
+			t.Errorf("Quantile(%v) = %v, want %v", tc.q, got, tc.want)
+		}
+	}
+	if got := (LatencyHistogram{}).Quantile(0.5); got != 0 {
+		t.Errorf("Quantile of an empty histogram = %v, want 0", got)
+	}
+	// 精度：第 99 百分位不超过真实值的 1/2^STATS_SUB_BITS
+	h = histogram(1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000, 5000)
+	if got := h.Quantile(0.5); got < 1000 || got > 1000+1000>>statsSubBits {
+		t.Errorf("Quantile(0.5) = %v, want within one bucket of 1µs", got)
+	}
+}
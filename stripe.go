@@ -0,0 +1,154 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"time"
+	"unsafe"
+)
+
+// stripeMinBytes is the smallest synchronous transfer that is split across the
+// QPs of a striped connection; below it one QP is faster than the extra polls.
+const stripeMinBytes = 64 << 10
+
+// stripeAlign keeps the chunks of a striped transfer page aligned.
+const stripeAlign = 4 << 10
+
+// WithStripes opens `k` QPs to the peer instead of one, each with its own CQ, on the
+// same device and over the same registered buffer. Large WriteRegion, ReadRegion,
+// Write and Read transfers are split across all of them, so they are processed by
+// several HCA engines in parallel; Lane returns the individual QPs for callers that
+// drive them from separate goroutines with PostWrite/PostRead/Reap.
+//
+// The QPs are connected one after another over the connection's TCP socket. Both
+// peers announce their stripe count during the handshake and use the smaller of
+// the two, capped at MAX_STRIPES. Striping carries RDMA reads and writes only:
+// messaging, in-band completion and the memory pool stay on the first QP.
+func WithStripes(k int) Option {
+	return func(o *connOptions) {
+		if k > 0 {
+			o.stripes = k
+		}
+	}
+}
+
+// Stripes returns the number of QPs of the connection as negotiated with the peer.
+func (r *RDMAResources) Stripes() int {
+	return len(r.lanes) + 1
+}
+
+// Lane returns QP `i` of a striped connection, 0 being the connection itself. A lane
+// shares the connection's buffers and can run asynchronous operations concurrently
+// with the other lanes, one goroutine per lane. Lanes are destroyed together with
+// the connection and must not be passed to Destroy.
+func (r *RDMAResources) Lane(i int) *RDMAResources {
+	if i <= 0 {
+		return r
+	}
+	if i > len(r.lanes) {
+		return nil
+	}
+	return r.lanes[i-1]
+}
+
+// connectLanes creates and connects the additional QPs negotiated by connect_qp. All
+// lanes are created first, their connection data crosses the socket as one vector
+// in a single exchange, and each lane then runs its state transitions without
+// another round trip; one final sync covers them all. The peer runs the same
+// sequence, so entry i of either vector describes the same lane.
+func (r *RDMAResources) connectLanes() error {
+	n := int(r.res.stripes) - 1
+	if n <= 0 {
+		return nil
+	}
+	start := time.Now()
+	// cm_con_data_t 是紧凑结构体，cgo 给出的 Go 类型大小与 C 不同，按 C 的大小手工排列
+	local := make([]byte, n*C.sizeof_struct_cm_con_data_t)
+	remote := make([]byte, n*C.sizeof_struct_cm_con_data_t)
+	entry := func(v []byte, i int) *C.struct_cm_con_data_t {
+		return (*C.struct_cm_con_data_t)(unsafe.Pointer(&v[i*C.sizeof_struct_cm_con_data_t]))
+	}
+	for i := 0; i < n; i++ {
+		lane := &RDMAResources{spin: r.spin}
+		C.resources_init_lane(&lane.res, &r.res, C.int(i+1))
+		if C.resources_create(&lane.res) != 0 {
+			return fmt.Errorf("failed to create resources of QP %d", i+1)
+		}
+		r.lanes = append(r.lanes, lane)
+		if C.connect_qp_prepare(&lane.res, entry(local, i)) != 0 {
+			return fmt.Errorf("failed to prepare QP %d", i+1)
+		}
+	}
+	if C.sock_sync_data(r.res.sock, C.int(len(local)), (*C.char)(unsafe.Pointer(&local[0])), (*C.char)(unsafe.Pointer(&remote[0]))) < 0 {
+		return fmt.Errorf("failed to exchange connection data of %d QPs", n)
+	}
+	for i, lane := range r.lanes {
+		if C.connect_qp_finish(&lane.res, entry(remote, i)) != 0 {
+			return fmt.Errorf("failed to connect QP %d", i+1)
+		}
+		if err := lane.openEventFile(); err != nil {
+			return err
+		}
+	}
+	if C.sock_sync_ready(r.res.sock) != 0 {
+		return fmt.Errorf("sync error after %d QPs were moved to RTS", n)
+	}
+	r.laneSetup = time.Since(start)
+	return nil
+}
+
+// destroyLanes releases the additional QPs; it must run before the connection's own
+// resources are destroyed, since the lanes borrow its socket and buffer.
+func (r *RDMAResources) destroyLanes() error {
+	var err error
+	for _, lane := range r.lanes {
+		lane.closeEventFile()
+		if C.resources_destroy(&lane.res) != 0 && err == nil {
+			err = fmt.Errorf("failed to destroy striped QP %d", int(lane.res.lane))
+		}
+	}
+	r.lanes = nil
+	return err
+}
+
+// transfer moves [offset, offset+length) between the local and the remote buffer and
+// waits for it. Large transfers of a striped connection are cut into page-aligned
+// chunks, one per QP; all chunks are posted before any completion is polled.
+func (r *RDMAResources) transfer(opcode C.int, offset, length int, character string) error {
+	if len(r.lanes) == 0 || length < stripeMinBytes {
+		if C.post_send_range(&r.res, opcode, C.size_t(offset), C.size_t(offset), C.uint32_t(length)) != 0 {
+			return fmt.Errorf("%s: failed to post SR", character)
+		}
+		if C.poll_completion(&r.res) != 0 {
+			return fmt.Errorf("%s: poll completion failed", character)
+		}
+		return nil
+	}
+	n := len(r.lanes) + 1
+	chunk := (length + n - 1) / n
+	chunk = (chunk + stripeAlign - 1) &^ (stripeAlign - 1)
+	var err error
+	posted := 0
+	for start := 0; start < length; start += chunk {
+		size := chunk
+		if start+size > length {
+			size = length - start
+		}
+		lane := r.Lane(posted)
+		if C.post_send_range(&lane.res, opcode, C.size_t(offset+start), C.size_t(offset+start), C.uint32_t(size)) != 0 {
+			err = fmt.Errorf("%s: failed to post SR on QP %d", character, posted)
+			break
+		}
+		posted++
+	}
+	// 已经投递的分段都要等到完成，否则它们的完成事件会留在各自的 CQ 中
+	for i := 0; i < posted; i++ {
+		if C.poll_completion(&r.Lane(i).res) != 0 && err == nil {
+			err = fmt.Errorf("%s: poll completion on QP %d failed", character, i)
+		}
+	}
+	return err
+}
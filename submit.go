@@ -0,0 +1,164 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"time"
+	"unsafe"
+)
+
+// SubmissionQueue batches work requests of one connection on the Go side and hands
+// them to the C side in a single cgo call. Its request and completion arrays live
+// in C memory: Write and Read only store a descriptor, and Submit posts everything
+// queued and reaps the completions that are ready in one crossing. At millions of
+// small operations per second this removes the per-call cgo overhead that dominates
+// PostWrite/Reap.
+//
+// Requests are RDMA writes and reads between the local and remote registered
+// buffers; fill the local range through Slice or Buffer before queueing a write.
+// A SubmissionQueue is not safe for concurrent use, and like the other
+// asynchronous operations it must not be mixed with the synchronous ones.
+type SubmissionQueue struct {
+	res *RDMAResources
+	q   *C.struct_submit_queue
+	sqe []C.struct_batch_op_t
+	cqe []C.struct_completion_t
+}
+
+// NewSubmissionQueue creates a submission queue for `res` holding up to `entries`
+// requests between two Submit calls and returning up to `entries` completions per
+// call. Only every `signalEvery`th request of a doorbell batch, and always its
+// last one, produces a completion; a non-positive signalEvery signals every
+// request.
+func (h *RDMAHandler) NewSubmissionQueue(res *RDMAResources, entries int, signalEvery int) (*SubmissionQueue, error) {
+	if entries <= 0 {
+		return nil, fmt.Errorf("invalid submission queue of %d entries", entries)
+	}
+	q := C.submit_queue_create(C.int(entries), C.int(entries), C.int(signalEvery))
+	if q == nil {
+		return nil, fmt.Errorf("failed to create submission queue of %d entries", entries)
+	}
+	return &SubmissionQueue{
+		res: res,
+		q:   q,
+		sqe: unsafe.Slice(q.sqe, entries),
+		cqe: unsafe.Slice(q.cqe, entries),
+	}, nil
+}
+
+// Write queues an RDMA write of [localOffset, localOffset+length) of the local buffer
+// to remoteOffset of the remote buffer. Nothing is posted until Submit. ErrQueueFull
+// is returned when the queue already holds its capacity of requests.
+func (s *SubmissionQueue) Write(localOffset, remoteOffset, length int, wrID uint64) error {
+	return s.queue(C.IBV_WR_RDMA_WRITE, localOffset, remoteOffset, length, wrID)
+}
+
+// Read queues an RDMA read of [remoteOffset, remoteOffset+length) of the remote buffer
+// into localOffset of the local buffer. Nothing is posted until Submit.
+func (s *SubmissionQueue) Read(localOffset, remoteOffset, length int, wrID uint64) error {
+	return s.queue(C.IBV_WR_RDMA_READ, localOffset, remoteOffset, length, wrID)
+}
+
+// queue stores one descriptor in the C-side request array.
+func (s *SubmissionQueue) queue(opcode C.int, localOffset, remoteOffset, length int, wrID uint64) error {
+	n := int(s.q.sq_count)
+	if n == len(s.sqe) {
+		return ErrQueueFull
+	}
+	if err := checkWrID(wrID); err != nil {
+		return err
+	}
+	if localOffset < 0 || length < 0 || localOffset+length > s.res.BufferSize() ||
+		remoteOffset < 0 || remoteOffset+length > s.res.RemoteBufferSize() {
+		return fmt.Errorf("request [%d -> %d, +%d) is out of the %d/%d byte buffers",
+			localOffset, remoteOffset, length, s.res.BufferSize(), s.res.RemoteBufferSize())
+	}
+	s.sqe[n] = C.struct_batch_op_t{
+		wr_id:         C.uint64_t(wrID),
+		local_offset:  C.uint64_t(localOffset),
+		remote_offset: C.uint64_t(remoteOffset),
+		length:        C.uint32_t(length),
+		opcode:        opcode,
+	}
+	s.q.sq_count++
+	return nil
+}
+
+// Pending returns the number of queued requests that have not been posted yet.
+func (s *SubmissionQueue) Pending() int {
+	return int(s.q.sq_count)
+}
+
+// Submit posts every queued request and reaps completions into `out`, all in one cgo
+// call. It returns the number of requests posted and of completions stored, also
+// together with an error: requests posted before the failure are no longer queued,
+// and completions reaped before it are in `out`.
+//
+// When the send queue fills up, Submit reaps completions to make room, so more
+// requests than the queue depth can be submitted at once; if `out` fills up first,
+// the remaining requests stay queued for the next call. After posting, Submit waits
+// up to `timeout` until at least `minComplete` completions have been collected (a
+// negative timeout waits forever) and then returns everything else that is ready.
+// Waiting busy-polls, also with WithEventCompletion.
+//
+// Example:
+//
+//	sq, _ := h.NewSubmissionQueue(res, 1024, 32)
+//	done := make([]rdmahandler.Completion, 1024)
+//	for i := range records {
+//	    dst, err := res.Slice(i*64, 64)
+//	    if err != nil {
+//	        return err
+//	    }
+//	    copy(dst, records[i])
+//	    sq.Write(i*64, i*64, 64, uint64(i))
+//	}
+//	for sq.Pending() > 0 || res.Outstanding() > 0 {
+//	    _, n, err := sq.Submit(done, 1, time.Second)
+//	    ...
+//	}
+func (s *SubmissionQueue) Submit(out []Completion, minComplete int, timeout time.Duration) (int, int, error) {
+	limit := len(out)
+	if limit > len(s.cqe) {
+		limit = len(s.cqe)
+	}
+	if limit == 0 && s.q.sq_count == 0 {
+		return 0, 0, nil
+	}
+	// out 为空时只投递，不收割
+	s.q.cq_limit = C.int(limit)
+	if minComplete > limit {
+		minComplete = limit
+	}
+	queued := int(s.q.sq_count)
+	rc := C.submit_queue_run(&s.res.res, s.q, C.int(minComplete), timeoutMicros(timeout))
+	// 失败时已投出的请求和已收割的完成事件同样要交给调用方
+	posted := queued - int(s.q.sq_count)
+	n := int(s.q.cq_count)
+	for i := 0; i < n; i++ {
+		out[i] = Completion{
+			WrID:   uint64(s.cqe[i].wr_id),
+			Status: int(s.cqe[i].status),
+			Bytes:  int(s.cqe[i].byte_len),
+		}
+	}
+	if rc < 0 {
+		return posted, n, fmt.Errorf("failed to submit %d requests", int(s.q.sq_count))
+	}
+	return posted, n, nil
+}
+
+// Close frees the queue's arrays. Requests that are still queued are dropped;
+// posted ones keep running and are reaped by the next Reap.
+func (s *SubmissionQueue) Close() {
+	if s.q == nil {
+		return
+	}
+	C.submit_queue_destroy(s.q)
+	s.q = nil
+	s.sqe = nil
+	s.cqe = nil
+}
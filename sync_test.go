@@ -0,0 +1,60 @@
+package rdmahandler
+
+import (
+	"syscall"
+	"testing"
+)
+
+// setSock stores a descriptor in a C int field without importing "C" here.
+func setSock[T ~int32](field *T, fd int) {
+	*field = T(fd)
+}
+
+// socketPair returns a connection whose socket is one end of a socketpair, and
+// the other end, which plays the peer.
+func socketPair(t *testing.T) (*RDMAResources, int) {
+	t.Helper()
+	fds, err := syscall.Socketpair(syscall.AF_UNIX, syscall.SOCK_STREAM, 0)
+	if err != nil {
+		t.Fatalf("socketpair: %v", err)
+	}
+	t.Cleanup(func() {
+		syscall.Close(fds[0])
+		syscall.Close(fds[1])
+	})
+	res := &RDMAResources{}
+	setSock(&res.res.sock, fds[0])
+	return res, fds[1]
+}
+
+// TestSyncDataAllocs checks that a sync allocates nothing, so that millions of
+// synchronous operations do not grow the heap.
+func TestSyncDataAllocs(t *testing.T) {
+	res, peer := socketPair(t)
+	token := []byte{'R'}
+	got := make([]byte, 1)
+	allocs := testing.AllocsPerRun(100000, func() {
+		// 对端的令牌先写好，syncData 写出自己的令牌后可以立即读到
+		if _, err := syscall.Write(peer, token); err != nil {
+			t.Fatalf("peer write: %v", err)
+		}
+		if err := syncData(res); err != nil {
+			t.Fatalf("syncData: %v", err)
+		}
+		if _, err := syscall.Read(peer, got); err != nil || got[0] != 'R' {
+			t.Fatalf("peer read: %q, %v", got, err)
+		}
+	})
+	if allocs != 0 {
+		t.Fatalf("syncData allocates %v times per call, want 0", allocs)
+	}
+}
+
+// TestSyncDataPeerClosed checks that a peer that went away is reported.
+func TestSyncDataPeerClosed(t *testing.T) {
+	res, peer := socketPair(t)
+	syscall.Shutdown(peer, syscall.SHUT_RDWR)
+	if err := syncData(res); err == nil {
+		t.Fatal("syncData succeeded although the peer is gone")
+	}
+}
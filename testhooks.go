@@ -0,0 +1,86 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import "unsafe"
+
+// The package's tests cannot use cgo themselves; these wrappers give them the C
+// helpers whose arithmetic the tests check.
+
+// cStatsBucket returns the histogram bucket stats_bucket records `ns` in.
+func cStatsBucket(ns uint64) int {
+	return int(C.stats_bucket(C.uint64_t(ns)))
+}
+
+// cPoolSizeClass returns the pool's size class for `size`, -1 if it is too large.
+func cPoolSizeClass(size int) int {
+	return int(C.pool_size_class(C.size_t(size)))
+}
+
+// cCPUListParse parses a CPU list like the device's local_cpulist into at most
+// `max` CPUs.
+func cCPUListParse(list string, max int) []int {
+	cs := C.CString(list)
+	defer C.free(unsafe.Pointer(cs))
+	cpus := make([]C.int, max+1)
+	n := int(C.cpulist_parse(cs, &cpus[0], C.int(max)))
+	out := make([]int, n)
+	for i := range out {
+		out[i] = int(cpus[i])
+	}
+	return out
+}
+
+// cKVHash hashes `data` with kv_hash.
+func cKVHash(data []byte, seed uint64) uint64 {
+	var p unsafe.Pointer
+	if len(data) > 0 {
+		p = C.CBytes(data)
+		defer C.free(p)
+	}
+	return uint64(C.kv_hash(p, C.size_t(len(data)), C.uint64_t(seed)))
+}
+
+// cKVBuckets returns the candidate buckets of `key` in a table of `buckets` buckets.
+func cKVBuckets(buckets uint64, key []byte) []uint64 {
+	kv := C.struct_rdma_kv{buckets: C.uint64_t(buckets), slot_size: C.KV_DEFAULT_SLOT_SIZE, bucket_slots: C.KV_BUCKET_SLOTS}
+	var b [2]C.uint64_t
+	p := C.CBytes(key)
+	defer C.free(p)
+	n := int(C.kv_buckets(&kv, p, C.uint32_t(len(key)), &b[0]))
+	out := make([]uint64, n)
+	for i := range out {
+		out[i] = uint64(b[i])
+	}
+	return out
+}
+
+// cKVChecksum returns the checksum kv_checksum computes over `slot` holding
+// `length` bytes of key and value.
+func cKVChecksum(slot []byte, version uint64, length int) uint64 {
+	p := C.CBytes(slot)
+	defer C.free(p)
+	return uint64(C.kv_checksum((*C.char)(p), C.uint64_t(version), C.uint32_t(length)))
+}
+
+// kvChecksumOffset and kvSlotMeta locate the checksum and the key in a slot.
+const (
+	kvChecksumOffset = C.KV_CHECKSUM_OFFSET
+	kvSlotMeta       = C.KV_SLOT_META
+)
+
+// poolMinShift and poolNumClasses describe the pool's size classes.
+const (
+	poolMinShift   = C.POOL_MIN_SHIFT
+	poolNumClasses = C.POOL_NUM_CLASSES
+)
+
+// statsHistBuckets, statsSubBits and statsMaxShift describe the latency
+// histogram's layout.
+const (
+	statsHistBuckets = C.STATS_HIST_BUCKETS
+	statsSubBits     = C.STATS_SUB_BITS
+	statsMaxShift    = C.STATS_MAX_SHIFT
+)
@@ -0,0 +1,109 @@
+package rdmahandler
+
+/*
+#include "rdma_operations.h"
+*/
+import "C"
+import (
+	"fmt"
+	"unsafe"
+)
+
+// Segment names one local piece of a vectored transfer.
+type Segment struct {
+	// Block is the pool block holding the piece, or nil for the connection's own
+	// registered buffer. Blocks require a connection created with WithPool.
+	Block *Block
+	// Offset is the start of the piece within the block or buffer.
+	Offset int
+	// Length is the number of bytes of the piece.
+	Length int
+}
+
+// WriteV gathers the local segments, in order, into one contiguous range of the remote
+// buffer starting at `remoteOffset`. Nothing is copied: each segment becomes one
+// scatter/gather entry, so a header and a payload living in different registered
+// buffers go out in a single work request. Lists longer than the QP's SGE limit are
+// split across chained work requests automatically.
+//
+// Like WriteRegion, the transfer is bracketed by the TCP synchronization and waits
+// for its completion. It is not available with WithInbandCompletion, whose peer
+// expects exactly one WRITE_WITH_IMM per write.
+//
+// Example:
+//
+//	err := h.WriteV(res, []rdmahandler.Segment{
+//	    {Offset: 0, Length: headerLen},
+//	    {Block: payload, Length: payload.Size()},
+//	}, 0, "client")
+func (h *RDMAHandler) WriteV(res *RDMAResources, segs []Segment, remoteOffset int, character string) error {
+	return res.transferV(C.IBV_WR_RDMA_WRITE, segs, remoteOffset, character)
+}
+
+// ReadV scatters the contiguous remote range starting at `remoteOffset` into the local
+// segments, in order. It is the reverse of WriteV and has the same restrictions; once it
+// returns, the data is in the segments' memory (see Block.Bytes and Slice).
+func (h *RDMAHandler) ReadV(res *RDMAResources, segs []Segment, remoteOffset int, character string) error {
+	return res.transferV(C.IBV_WR_RDMA_READ, segs, remoteOffset, character)
+}
+
+// transferV validates the segments, builds their scatter/gather entries and runs the
+// synchronous transfer.
+func (r *RDMAResources) transferV(opcode C.int, segs []Segment, remoteOffset int, character string) error {
+	if err := r.checkIdle(character); err != nil {
+		return err
+	}
+	if r.inband() {
+		return fmt.Errorf("%s: vectored transfers are not supported with in-band completion", character)
+	}
+	if len(segs) == 0 {
+		return nil
+	}
+	sges := make([]C.struct_ibv_sge, len(segs))
+	total := 0
+	for i, s := range segs {
+		sge, err := r.segmentSGE(s)
+		if err != nil {
+			return fmt.Errorf("%s: segment %d: %w", character, i, err)
+		}
+		sges[i] = sge
+		total += s.Length
+	}
+	if remoteOffset < 0 || remoteOffset+total > r.RemoteBufferSize() {
+		return fmt.Errorf("%s: range [%d, +%d) is out of the %d byte remote buffer",
+			character, remoteOffset, total, r.RemoteBufferSize())
+	}
+	if err := syncData(r); err != nil {
+		return err
+	}
+	if C.post_sge_list(&r.res, opcode, &sges[0], C.int(len(sges)), C.size_t(remoteOffset)) != 0 {
+		return fmt.Errorf("%s: vectored transfer of %d segments failed", character, len(segs))
+	}
+	return syncData(r)
+}
+
+// segmentSGE checks one segment and returns its scatter/gather entry.
+func (r *RDMAResources) segmentSGE(s Segment) (C.struct_ibv_sge, error) {
+	var sge C.struct_ibv_sge
+	if s.Block == nil {
+		if s.Offset < 0 || s.Length < 0 || s.Offset+s.Length > r.BufferSize() {
+			return sge, fmt.Errorf("range [%d, +%d) is out of the %d byte buffer", s.Offset, s.Length, r.BufferSize())
+		}
+		sge.addr = C.uint64_t(uintptr(unsafe.Pointer(r.res.buf))) + C.uint64_t(s.Offset)
+		sge.lkey = r.res.mr.lkey
+	} else {
+		if r.res.pool == nil {
+			return sge, fmt.Errorf("connection was not created with a memory pool")
+		}
+		if s.Block.size == 0 {
+			return sge, fmt.Errorf("block is not leased")
+		}
+		if s.Offset < 0 || s.Length < 0 || s.Offset+s.Length > s.Block.Capacity() {
+			return sge, fmt.Errorf("range [%d, +%d) is out of the %d byte block", s.Offset, s.Length, s.Block.Capacity())
+		}
+		sge.addr = s.Block.blk.addr + C.uint64_t(s.Offset)
+		sge.lkey = s.Block.blk.lkey
+	}
+	sge.length = C.uint32_t(s.Length)
+	return sge, nil
+}